@@ -0,0 +1,32 @@
+// bench/bench.h
+// 各 benchmark 共用的結果輸出
+// 表格照常印到 stdout；設定環境變數 BENCH_JSON=<檔案> 時，每個量測值另外以一行 JSON
+// 附加到該檔案 (JSON Lines)，make bench 會寫到 bin/bench_results.json
+
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <stdio.h>
+#include <stdlib.h>
+
+// 一筆結果: 哪個 benchmark、量測項目、參數名稱與數值 (bytes / threads ...)、每次操作的 ns
+// 每行寫完就 flush: 之後 fork 的 child 不會把沒寫出的內容再寫一次
+static inline void bench_json(const char *bench, const char *name, const char *param, double value,
+                              double ns_per_op) {
+    static FILE *fp = NULL;
+    static int opened = 0;
+    if (!opened) {
+        const char *path = getenv("BENCH_JSON");
+        if (path && *path) {
+            fp = fopen(path, "a");
+            if (!fp) perror("BENCH_JSON: fopen failed");
+        }
+        opened = 1;
+    }
+    if (!fp) return;
+    fprintf(fp, "{\"bench\":\"%s\",\"name\":\"%s\",\"%s\":%g,\"ns_per_op\":%.3f}\n",
+            bench, name, param, value, ns_per_op);
+    fflush(fp);
+}
+
+#endif // BENCH_H
@@ -0,0 +1,234 @@
+// bench/bench_checksum.c
+// Checksum 引擎吞吐量測試: 各加總 / CRC32C 實作在不同封包大小下的 GB/s
+// 先確認所有實作的結果一致，再量測；CPU 不支援的實作會標示 (n/a)
+// 第二張表比較 "xor_cipher + checksum 兩遍" 與融合的單遍解密+驗證
+// 第三張表是一般程式呼叫的 calculate_checksum / xor_cipher 每次呼叫的 ns
+
+#include "common.h"
+#include "bench.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define BYTES_PER_RUN (256u * 1024 * 1024)  // 每個組合總共處理的資料量
+
+static double now_sec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+typedef uint32_t (*sum_fn)(const void *, size_t);
+typedef uint32_t (*crc_fn)(uint32_t, const void *, size_t);
+
+// 防止編譯器把沒用到的結果整段刪掉
+static volatile uint32_t sink;
+
+static double run_sum(sum_fn fn, const uint8_t *buf, size_t len) {
+    size_t iters = BYTES_PER_RUN / len;
+    uint32_t acc = 0;
+    double start = now_sec();
+    for (size_t i = 0; i < iters; i++) {
+        acc += fn(buf, len);
+    }
+    double elapsed = now_sec() - start;
+    sink = acc;
+    return (double)iters * len / elapsed / 1e9;
+}
+
+// 收封包的兩種做法: 兩遍 (xor_cipher 後再 checksum) vs 融合單遍。
+// 每輪都解密同一塊資料 (內容來回翻轉)，只量吞吐量
+static double run_open(int fused, int crc, uint8_t *buf, size_t len) {
+    size_t iters = BYTES_PER_RUN / len;
+    uint32_t acc = 0;
+    double start = now_sec();
+    for (size_t i = 0; i < iters; i++) {
+        if (fused) {
+            acc += crc ? decrypt_and_crc32c(0, buf, len) : decrypt_and_checksum(buf, len);
+        } else {
+            xor_cipher(buf, len);
+            acc += crc ? crc32c_update(0, buf, len) : calculate_checksum(buf, len);
+        }
+    }
+    double elapsed = now_sec() - start;
+    sink = acc;
+    return (double)iters * len / elapsed / 1e9;
+}
+
+// 公開 API 每次呼叫的 ns (calculate_checksum 或 xor_cipher，後者原地來回加解密)
+static double run_api_ns(int cipher, uint8_t *buf, size_t len) {
+    size_t iters = BYTES_PER_RUN / len;
+    uint32_t acc = 0;
+    double start = now_sec();
+    for (size_t i = 0; i < iters; i++) {
+        if (cipher) {
+            xor_cipher(buf, len);
+        } else {
+            acc += calculate_checksum(buf, len);
+        }
+    }
+    double elapsed = now_sec() - start;
+    sink = acc + buf[0];
+    return elapsed * 1e9 / iters;
+}
+
+// GB/s 換算成處理 len bytes 的 ns (JSON 一律以 ns/op 表示)
+static double gbps_to_ns(double gbps, size_t len) {
+    return len / gbps;
+}
+
+static double run_crc(crc_fn fn, const uint8_t *buf, size_t len) {
+    size_t iters = BYTES_PER_RUN / len;
+    uint32_t acc = 0;
+    double start = now_sec();
+    for (size_t i = 0; i < iters; i++) {
+        acc ^= fn(0, buf, len);
+    }
+    double elapsed = now_sec() - start;
+    sink = acc;
+    return (double)iters * len / elapsed / 1e9;
+}
+
+// 所有實作必須算出相同結果 (含各種奇數長度與未對齊起點)
+static int verify(const uint8_t *buf, size_t max_len) {
+    for (size_t off = 0; off < 8; off++) {
+        for (size_t len = 0; len + off <= max_len; len = len < 300 ? len + 1 : len * 2 + 7) {
+            const uint8_t *p = buf + off;
+            uint32_t sum = checksum_sum_portable(p, len);
+            if (checksum_sum_sse2(p, len) != sum || checksum_sum_avx2(p, len) != sum ||
+                calculate_checksum(p, len) != sum) {
+                fprintf(stderr, "Sum mismatch at off=%zu len=%zu\n", off, len);
+                return -1;
+            }
+            uint32_t crc = crc32c_update_portable(0, p, len);
+            if (crc32c_update_sse42(0, p, len) != crc || crc32c_update(0, p, len) != crc) {
+                fprintf(stderr, "CRC32C mismatch at off=%zu len=%zu\n", off, len);
+                return -1;
+            }
+            // 分兩段串接要等於一次算完
+            size_t half = len / 2;
+            if (crc32c_update(crc32c_update(0, p, half), p + half, len - half) != crc) {
+                fprintf(stderr, "CRC32C chaining mismatch at len=%zu\n", len);
+                return -1;
+            }
+        }
+    }
+    // 融合版本: 結果 (checksum 與加解密後的內容) 都要和兩遍的做法相同
+    uint8_t *plain = malloc(max_len), *work = malloc(max_len);
+    for (size_t len = 0; len <= max_len; len = len < 300 ? len + 1 : len * 2 + 7) {
+        // buf 當作密文，plain 是兩遍做法解出的明文
+        memcpy(plain, buf, len);
+        xor_cipher(plain, len);
+        uint32_t sum = calculate_checksum(plain, len);
+        uint32_t crc = crc32c_update(0, plain, len);
+        int bad = 0;
+
+        memcpy(work, buf, len);
+        bad |= decrypt_and_checksum(work, len) != sum || memcmp(work, plain, len) != 0;
+        memcpy(work, buf, len);
+        bad |= decrypt_and_crc32c(0, work, len) != crc || memcmp(work, plain, len) != 0;
+        memcpy(work, plain, len);
+        bad |= checksum_and_encrypt(work, len) != sum || memcmp(work, buf, len) != 0;
+        memcpy(work, plain, len);
+        bad |= crc32c_and_encrypt(0, work, len) != crc || memcmp(work, buf, len) != 0;
+        if (bad) {
+            fprintf(stderr, "Fused kernel mismatch at len=%zu\n", len);
+            return -1;
+        }
+    }
+    free(plain);
+    free(work);
+
+    // 標準測試向量
+    if (crc32c_update(0, "123456789", 9) != 0xE3069283u) {
+        fprintf(stderr, "CRC32C check value mismatch\n");
+        return -1;
+    }
+    return 0;
+}
+
+int main(void) {
+    static const size_t sizes[] = {16, 84, 256, 1024, 4096, 65536};
+    const size_t max_size = 65536;
+
+    uint8_t *buf = malloc(max_size + 64);
+    if (!buf) {
+        perror("malloc");
+        return 1;
+    }
+    srand(1234);
+    for (size_t i = 0; i < max_size + 64; i++) {
+        buf[i] = (uint8_t)rand();
+    }
+
+    if (verify(buf, 8192) != 0) {
+        return 1;
+    }
+
+    printf("Checksum throughput benchmark (GB/s, %u MB per cell)\n", BYTES_PER_RUN >> 20);
+    printf("CPU: sse2=%d avx2=%d sse4.2=%d; dispatch: sum=%s crc32c=%s\n",
+           checksum_cpu_has_sse2(), checksum_cpu_has_avx2(), checksum_cpu_has_sse42(),
+           checksum_sum_impl(), crc32c_impl());
+    printf("%8s %10s %10s %10s %12s %12s\n",
+           "bytes", "sum", "sum-sse2", "sum-avx2", "crc-table", "crc-sse4.2");
+
+    for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+        size_t len = sizes[s];
+        double gbps = run_sum(checksum_sum_portable, buf, len);
+        printf("%8zu %10.2f ", len, gbps);
+        bench_json("checksum", "sum", "bytes", len, gbps_to_ns(gbps, len));
+        if (checksum_cpu_has_sse2()) {
+            gbps = run_sum(checksum_sum_sse2, buf, len);
+            printf("%10.2f ", gbps);
+            bench_json("checksum", "sum-sse2", "bytes", len, gbps_to_ns(gbps, len));
+        } else {
+            printf("%10s ", "(n/a)");
+        }
+        if (checksum_cpu_has_avx2()) {
+            gbps = run_sum(checksum_sum_avx2, buf, len);
+            printf("%10.2f ", gbps);
+            bench_json("checksum", "sum-avx2", "bytes", len, gbps_to_ns(gbps, len));
+        } else {
+            printf("%10s ", "(n/a)");
+        }
+        gbps = run_crc(crc32c_update_portable, buf, len);
+        printf("%12.2f ", gbps);
+        bench_json("checksum", "crc-table", "bytes", len, gbps_to_ns(gbps, len));
+        if (checksum_cpu_has_sse42()) {
+            gbps = run_crc(crc32c_update_sse42, buf, len);
+            printf("%12.2f\n", gbps);
+            bench_json("checksum", "crc-sse4.2", "bytes", len, gbps_to_ns(gbps, len));
+        } else {
+            printf("%12s\n", "(n/a)");
+        }
+    }
+
+    printf("\nReceive path: decrypt + verify (GB/s)\n");
+    printf("%8s %12s %12s %12s %12s\n", "bytes", "sum 2-pass", "sum fused", "crc 2-pass", "crc fused");
+    static const char *open_names[] = { "sum 2-pass", "sum fused", "crc 2-pass", "crc fused" };
+    for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+        size_t len = sizes[s];
+        printf("%8zu", len);
+        for (int v = 0; v < 4; v++) {
+            double gbps = run_open(v & 1, v >> 1, buf, len);
+            printf(" %12.2f", gbps);
+            bench_json("checksum", open_names[v], "bytes", len, gbps_to_ns(gbps, len));
+        }
+        printf("\n");
+    }
+
+    printf("\nPublic API (ns per call, dispatch: sum=%s)\n", checksum_sum_impl());
+    printf("%8s %20s %12s\n", "bytes", "calculate_checksum", "xor_cipher");
+    for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+        size_t len = sizes[s];
+        double sum_ns = run_api_ns(0, buf, len);
+        double xor_ns = run_api_ns(1, buf, len);
+        printf("%8zu %20.1f %12.1f\n", len, sum_ns, xor_ns);
+        bench_json("checksum", "calculate_checksum", "bytes", len, sum_ns);
+        bench_json("checksum", "xor_cipher", "bytes", len, xor_ns);
+    }
+
+    free(buf);
+    return 0;
+}
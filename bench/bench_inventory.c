@@ -0,0 +1,181 @@
+// bench/bench_inventory.c
+// 票數扣除的競爭測試: SysV semaphore (原本的 sem_lock/sem_unlock) vs atomic CAS
+// 以 1 ~ 64 個 fork 出來的 child 同時訂票，量測每次操作的平均時間
+// 第二張表: 每個 child 訂不同活動時，票數擠在同一條 cache line (false sharing)
+// 與每個活動獨佔一條 cache line (InventorySlot) 的差別
+
+#include "common.h"
+#include "bench.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/sem.h>
+#include <sys/wait.h>
+
+#define OPS_PER_CHILD 10000
+
+static int sem_id;
+static atomic_int *tickets;   // 放在 MAP_SHARED 記憶體中，所有 child 共用
+static int *locked_tickets;   // semaphore 版本使用的一般 int
+static atomic_int *packed_events;   // 相鄰的 atomic_int: 16 個活動共用一條 cache line
+static InventorySlot *slot_events;  // 每個活動一條 cache line
+static int child_index;             // fork 前設定，child 用來選自己的活動
+
+#define MAX_CHILDREN 64
+#define SHARED_BYTES (4096 + MAX_CHILDREN * sizeof(InventorySlot))
+
+static void sem_lock(void) {
+    struct sembuf sb = {0, -1, 0};
+    semop(sem_id, &sb, 1);
+}
+
+static void sem_unlock(void) {
+    struct sembuf sb = {0, 1, 0};
+    semop(sem_id, &sb, 1);
+}
+
+// 原本 server.c 的做法: 每次 BOOK 都要兩次 semop
+static void book_with_semaphore(void) {
+    for (int i = 0; i < OPS_PER_CHILD; i++) {
+        sem_lock();
+        if (*locked_tickets >= 1) {
+            *locked_tickets -= 1;
+        }
+        sem_unlock();
+    }
+}
+
+static void book_with_atomic(void) {
+    int remaining;
+    for (int i = 0; i < OPS_PER_CHILD; i++) {
+        inventory_try_book(tickets, 1, &remaining);
+    }
+}
+
+// 所有 child 都訂同一個活動 (單一熱門活動)
+static void book_same_event(void) {
+    int remaining;
+    atomic_int *tickets = inventory_event(slot_events, MAX_CHILDREN, 0);
+    for (int i = 0; i < OPS_PER_CHILD; i++) {
+        inventory_try_book(tickets, 1, &remaining);
+    }
+}
+
+static void book_packed_event(void) {
+    int remaining;
+    for (int i = 0; i < OPS_PER_CHILD; i++) {
+        inventory_try_book(&packed_events[child_index], 1, &remaining);
+    }
+}
+
+static void book_slot_event(void) {
+    int remaining;
+    atomic_int *tickets = inventory_event(slot_events, MAX_CHILDREN, child_index);
+    for (int i = 0; i < OPS_PER_CHILD; i++) {
+        inventory_try_book(tickets, 1, &remaining);
+    }
+}
+
+static double now_sec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// fork num_children 個 process 執行 fn，回傳平均每次操作的 ns
+static double run_children(int num_children, void (*fn)(void)) {
+    double start = now_sec();
+    for (int i = 0; i < num_children; i++) {
+        child_index = i;
+        pid_t pid = fork();
+        if (pid < 0) {
+            perror("fork failed");
+            exit(EXIT_FAILURE);
+        }
+        if (pid == 0) {
+            fn();
+            _exit(0);
+        }
+    }
+    for (int i = 0; i < num_children; i++) {
+        wait(NULL);
+    }
+    double elapsed = now_sec() - start;
+    return elapsed * 1e9 / ((double)num_children * OPS_PER_CHILD);
+}
+
+int main(void) {
+    static const int child_counts[] = {1, 2, 4, 8, 16, 32, 64};
+
+    void *mem = mmap(NULL, SHARED_BYTES, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (mem == MAP_FAILED) {
+        perror("mmap failed");
+        return 1;
+    }
+    tickets = (atomic_int *)mem;
+    locked_tickets = (int *)((char *)mem + 64); // 不同 cache line
+    packed_events = (atomic_int *)((char *)mem + 128);
+    slot_events = (InventorySlot *)((char *)mem + 4096);
+
+    sem_id = semget(IPC_PRIVATE, 1, IPC_CREAT | 0600);
+    if (sem_id < 0) {
+        perror("semget failed");
+        return 1;
+    }
+    semctl(sem_id, 0, SETVAL, 1);
+
+    printf("Inventory contention benchmark (%d bookings per child)\n", OPS_PER_CHILD);
+    printf("%8s %16s %16s %10s\n", "children", "semaphore ns/op", "atomic ns/op", "speedup");
+
+    for (size_t i = 0; i < sizeof(child_counts) / sizeof(child_counts[0]); i++) {
+        int n = child_counts[i];
+        // 票數足夠讓每次訂票都成功，量測的是完整的扣票路徑
+        *locked_tickets = n * OPS_PER_CHILD;
+        inventory_set(tickets, n * OPS_PER_CHILD);
+
+        double sem_ns = run_children(n, book_with_semaphore);
+        double atomic_ns = run_children(n, book_with_atomic);
+
+        if (*locked_tickets != 0 || inventory_query(tickets) != 0) {
+            fprintf(stderr, "Lost update detected! semaphore=%d atomic=%d\n",
+                    *locked_tickets, inventory_query(tickets));
+            return 1;
+        }
+        printf("%8d %16.1f %16.1f %9.1fx\n", n, sem_ns, atomic_ns, sem_ns / atomic_ns);
+        bench_json("inventory", "semaphore", "children", n, sem_ns);
+        bench_json("inventory", "atomic", "children", n, atomic_ns);
+    }
+
+    printf("\nPer-event inventory (atomic ns/op, each child books its own event)\n");
+    printf("%8s %14s %16s %16s\n", "children", "one event", "packed events", "cache-line slots");
+    for (size_t i = 0; i < sizeof(child_counts) / sizeof(child_counts[0]); i++) {
+        int n = child_counts[i];
+        for (int e = 0; e < MAX_CHILDREN; e++) {
+            inventory_set(&slot_events[e].tickets, e == 0 ? n * OPS_PER_CHILD : OPS_PER_CHILD);
+            inventory_set(&packed_events[e], OPS_PER_CHILD);
+        }
+        double same_ns = run_children(n, book_same_event);
+        for (int e = 0; e < MAX_CHILDREN; e++) {
+            inventory_set(&slot_events[e].tickets, OPS_PER_CHILD);
+        }
+        double packed_ns = run_children(n, book_packed_event);
+        double slot_ns = run_children(n, book_slot_event);
+
+        for (int e = 0; e < n; e++) {
+            if (inventory_query(&packed_events[e]) != 0 || inventory_query(&slot_events[e].tickets) != 0) {
+                fprintf(stderr, "Lost update detected on event %d\n", e);
+                return 1;
+            }
+        }
+        printf("%8d %14.1f %16.1f %16.1f\n", n, same_ns, packed_ns, slot_ns);
+        bench_json("inventory", "one event", "children", n, same_ns);
+        bench_json("inventory", "packed events", "children", n, packed_ns);
+        bench_json("inventory", "cache-line slots", "children", n, slot_ns);
+    }
+
+    semctl(sem_id, 0, IPC_RMID);
+    munmap(mem, SHARED_BYTES);
+    return 0;
+}
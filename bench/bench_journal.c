@@ -0,0 +1,142 @@
+// bench/bench_journal.c
+// 訂票日誌的 group commit 測試: 每筆訂票都要等到 fdatasync 完成才算數
+// 以 MAX_CHILDREN 個 fork 出來的 child 同時訂票 (扣票 -> journal_append -> journal_wait)，
+// 比較不同批次大小下每秒能確認的訂票數，以及平均每次 fdatasync 帶走幾筆
+// 最後重播寫出的日誌，確認票數與實際扣掉的一致
+
+#include "common.h"
+#include "bench.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+#define MAX_CHILDREN    128
+#define OPS_PER_CHILD   100
+#define BATCH_US        2000   // 批次沒滿時最多等 2 ms
+#define NUM_EVENTS      MAX_CHILDREN
+#define JOURNAL_FILE    "bench_journal.wal"   // 放在目前目錄: /tmp 可能是 tmpfs，fdatasync 不用寫磁碟
+
+static InventorySlot *events;   // 放在 MAP_SHARED 記憶體中，所有 child 共用
+static double *wait_us;         // 每個 child 的平均等待時間 (us)
+static int child_index;
+
+static double now_sec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// server 的訂票路徑: 扣票成功後記日誌，等它寫入磁碟才回覆
+static void book_durably(void) {
+    int remaining;
+    atomic_int *tickets = inventory_event(events, NUM_EVENTS, child_index);
+    double waited = 0;
+    for (int i = 0; i < OPS_PER_CHILD; i++) {
+        if (!inventory_try_book(tickets, 1, &remaining)) _exit(EXIT_FAILURE);
+        uint64_t seq = journal_append(child_index, 1, child_index);
+        double start = now_sec();
+        if (journal_wait(seq) < 0) _exit(EXIT_FAILURE);
+        waited += now_sec() - start;
+    }
+    wait_us[child_index] = waited * 1e6 / OPS_PER_CHILD;
+}
+
+// 開一份新的日誌，跑完所有 child 後回傳每秒訂票數
+static double run_batch(uint32_t batch_records, int no_sync, double *records_per_commit, double *mean_wait_us) {
+    unlink(JOURNAL_FILE);
+    uint32_t num_events = NUM_EVENTS;
+    JournalConfig config = { batch_records, BATCH_US, no_sync, 0 };
+    if (journal_open(JOURNAL_FILE, &config, events, &num_events, OPS_PER_CHILD) < 0) {
+        exit(EXIT_FAILURE);
+    }
+
+    double start = now_sec();
+    for (int i = 0; i < MAX_CHILDREN; i++) {
+        child_index = i;
+        pid_t pid = fork();
+        if (pid < 0) {
+            perror("fork failed");
+            exit(EXIT_FAILURE);
+        }
+        if (pid == 0) {
+            book_durably();
+            _exit(0);
+        }
+    }
+    int failed = 0;
+    for (int i = 0; i < MAX_CHILDREN; i++) {
+        int status;
+        wait(&status);
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) failed = 1;
+    }
+    double elapsed = now_sec() - start;
+    if (failed) {
+        fprintf(stderr, "A child failed to book or commit\n");
+        exit(EXIT_FAILURE);
+    }
+
+    uint64_t records, commits;
+    journal_stats(&records, &commits);
+    *records_per_commit = commits ? (double)records / commits : 0;
+    double total_wait = 0;
+    for (int i = 0; i < MAX_CHILDREN; i++) total_wait += wait_us[i];
+    *mean_wait_us = total_wait / MAX_CHILDREN;
+    journal_close();
+    return (double)MAX_CHILDREN * OPS_PER_CHILD / elapsed;
+}
+
+// 重播: 每個活動的票都應該剛好被訂完
+static int verify_replay(void) {
+    uint32_t num_events = NUM_EVENTS;
+    for (int e = 0; e < NUM_EVENTS; e++) inventory_set(&events[e].tickets, -1);
+    long replayed = journal_open(JOURNAL_FILE, NULL, events, &num_events, 0);
+    journal_close();
+    if (replayed != MAX_CHILDREN * OPS_PER_CHILD) {
+        fprintf(stderr, "Replay found %ld bookings, expected %d\n", replayed, MAX_CHILDREN * OPS_PER_CHILD);
+        return -1;
+    }
+    for (int e = 0; e < NUM_EVENTS; e++) {
+        if (inventory_query(&events[e].tickets) != 0) {
+            fprintf(stderr, "Replay left %d tickets on event %d\n", inventory_query(&events[e].tickets), e);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+int main(void) {
+    static const uint32_t batch_sizes[] = {1, 8, 32, 128};
+
+    void *mem = mmap(NULL, NUM_EVENTS * sizeof(InventorySlot) + MAX_CHILDREN * sizeof(double),
+                     PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (mem == MAP_FAILED) {
+        perror("mmap failed");
+        return 1;
+    }
+    events = (InventorySlot *)mem;
+    wait_us = (double *)(events + NUM_EVENTS);
+
+    printf("Booking journal group commit (%d children x %d bookings, flush after N records or %d us)\n",
+           MAX_CHILDREN, OPS_PER_CHILD, BATCH_US);
+    printf("%10s %14s %16s %14s\n", "batch N", "bookings/s", "records/fsync", "mean wait us");
+    for (size_t i = 0; i < sizeof(batch_sizes) / sizeof(batch_sizes[0]); i++) {
+        double per_commit, mean_wait;
+        double rate = run_batch(batch_sizes[i], 0, &per_commit, &mean_wait);
+        printf("%10u %14.0f %16.1f %14.1f\n", batch_sizes[i], rate, per_commit, mean_wait);
+        bench_json("journal", "group commit", "batch", batch_sizes[i], 1e9 / rate);
+        if (verify_replay() < 0) return 1;
+    }
+
+    // 參考值: 不做 fdatasync (當機會遺失)，看出磁碟同步本身的成本
+    double per_commit, mean_wait;
+    double rate = run_batch(MAX_CHILDREN, 1, &per_commit, &mean_wait);
+    printf("%10s %14.0f %16.1f %14.1f\n", "no fsync", rate, per_commit, mean_wait);
+    bench_json("journal", "no fsync", "batch", MAX_CHILDREN, 1e9 / rate);
+
+    unlink(JOURNAL_FILE);
+    munmap(mem, NUM_EVENTS * sizeof(InventorySlot) + MAX_CHILDREN * sizeof(double));
+    return 0;
+}
@@ -0,0 +1,149 @@
+// bench/bench_logger.c
+// log_message 的吞吐量: 同步 (檔案鎖)、非同步 (背景 thread) 與共享記憶體 (collector process)
+// 三種模式下，以 1 ~ 8 個 thread 或 process 同時寫 log，量測平均每行的 ns
+// 時間從開始寫到最後一行確實寫進檔案為止，並確認行數沒有遺失
+
+#include "common.h"
+#include "bench.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+#define LINES_PER_WORKER 10000
+#define LOG_FILE         "bench_logger.log"   // 放在目前目錄，跑完刪除
+
+typedef enum { MODE_SYNC, MODE_ASYNC, MODE_SHM, NUM_MODES } LoggerMode;
+static const char *mode_names[NUM_MODES] = { "sync", "async", "shm" };
+
+static double *result_ns;   // runner 寫回結果 (MAP_SHARED)
+
+static double now_sec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static long count_lines(const char *filename) {
+    FILE *fp = fopen(filename, "r");
+    if (!fp) return -1;
+    long lines = 0;
+    int c;
+    while ((c = fgetc(fp)) != EOF) {
+        if (c == '\n') lines++;
+    }
+    fclose(fp);
+    return lines;
+}
+
+static void *write_lines(void *arg) {
+    int id = (int)(long)arg;
+    for (int i = 0; i < LINES_PER_WORKER; i++) {
+        log_message(LOG_INFO, "Worker %d booked %d tickets for user %d", id, i & 7, i);
+    }
+    return NULL;
+}
+
+// 在獨立的 runner process 中初始化 logger (每種模式只能初始化一次)，
+// 由它建立 num_workers 個 thread 或 process 寫 log，全部寫入檔案後回報 ns/行
+static void run_logger(LoggerMode mode, int use_processes, int num_workers) {
+    if (mode == MODE_ASYNC) {
+        init_logger_async(LOG_FILE, 0, LOG_FULL_BLOCK);   // 不丟行，量的才是真正寫完的速度
+    } else if (mode == MODE_SHM) {
+        init_logger_shm(LOG_FILE, num_workers, 0);
+    } else {
+        init_logger(LOG_FILE);
+    }
+
+    double start = now_sec();
+    if (use_processes) {
+        for (int i = 0; i < num_workers; i++) {
+            pid_t pid = fork();
+            if (pid < 0) {
+                perror("fork failed");
+                _exit(EXIT_FAILURE);
+            }
+            if (pid == 0) {
+                write_lines((void *)(long)i);
+                exit(0);   // exit: 讓 async 模式的 atexit 寫完
+            }
+        }
+        for (int i = 0; i < num_workers; i++) wait(NULL);
+    } else {
+        pthread_t threads[num_workers];
+        for (int i = 0; i < num_workers; i++) {
+            pthread_create(&threads[i], NULL, write_lines, (void *)(long)i);
+        }
+        for (int i = 0; i < num_workers; i++) pthread_join(threads[i], NULL);
+    }
+    logger_flush();
+    if (mode == MODE_SHM) shutdown_logger_shm();
+    double elapsed = now_sec() - start;
+
+    long expected = (long)num_workers * LINES_PER_WORKER;
+    long lines = count_lines(LOG_FILE);
+    *result_ns = lines == expected ? elapsed * 1e9 / expected : -1;
+    if (lines != expected) {
+        fprintf(stderr, "%s: expected %ld lines, found %ld\n", mode_names[mode], expected, lines);
+    }
+    _exit(0);
+}
+
+static double run_case(LoggerMode mode, int use_processes, int num_workers) {
+    remove(LOG_FILE);
+    fflush(stdout);
+    *result_ns = -1;
+    pid_t runner = fork();
+    if (runner < 0) {
+        perror("fork failed");
+        exit(EXIT_FAILURE);
+    }
+    if (runner == 0) run_logger(mode, use_processes, num_workers);
+    waitpid(runner, NULL, 0);
+    return *result_ns;
+}
+
+int main(void) {
+    static const int worker_counts[] = {1, 2, 4, 8};
+
+    result_ns = mmap(NULL, sizeof(double), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (result_ns == MAP_FAILED) {
+        perror("mmap failed");
+        return 1;
+    }
+
+    printf("log_message throughput (ns per line until written, %d lines per worker)\n", LINES_PER_WORKER);
+    printf("%10s %8s", "workers", "kind");
+    for (int m = 0; m < NUM_MODES; m++) printf(" %10s", mode_names[m]);
+    printf("\n");
+
+    int failed = 0;
+    for (int use_processes = 0; use_processes <= 1; use_processes++) {
+        const char *kind = use_processes ? "process" : "thread";
+        for (size_t i = 0; i < sizeof(worker_counts) / sizeof(worker_counts[0]); i++) {
+            int n = worker_counts[i];
+            printf("%10d %8s", n, kind);
+            for (int m = 0; m < NUM_MODES; m++) {
+                double ns = run_case((LoggerMode)m, use_processes, n);
+                if (ns < 0) {
+                    printf(" %10s", "(lost)");
+                    failed = 1;
+                    continue;
+                }
+                printf(" %10.1f", ns);
+                char name[32];
+                snprintf(name, sizeof(name), "%s/%s", mode_names[m], kind);
+                bench_json("logger", name, use_processes ? "processes" : "threads", n, ns);
+            }
+            printf("\n");
+        }
+    }
+
+    remove(LOG_FILE);
+    munmap(result_ns, sizeof(double));
+    return failed;
+}
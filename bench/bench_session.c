@@ -0,0 +1,196 @@
+// bench/bench_session.c
+// Session 表 (open addressing + CAS) 在大容量下的速度: LOGIN 的插入 (add_session)、
+// 每個 request 的查詢 (is_valid_session，命中會更新 last_seen) 與查不到的情況
+// 表從 1K 到 4M 個 slot，各填到 50% 與 90%；容量遠大於 cache 時量到的是 cache miss 的成本
+// 另外模擬登入持續換手 (累計登入數為容量的 16 倍)，確認 sweeper 會把 tombstone 清掉，探測長度不會一直變長
+
+#include "common.h"
+#include "bench.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define OPS_PER_CASE  (1u << 20)   // 查詢次數 (插入次數 = 容量 x 填充率)
+#define NOW           1000000u     // 固定的 "現在" 時間: 沒有 session 會過期
+
+#define CHURN_CAPACITY (1u << 14)  // 換手測試的表容量
+#define CHURN_TTL      16u         // 換手測試的 session 閒置期限 (秒)
+#define CHURN_SLICES   16u         // 和 server 一樣: sweeper 每秒掃 1/16 的表
+#define CHURN_PER_SEC  (CHURN_CAPACITY / 128)     // 每秒的新登入數
+#define CHURN_SECONDS  (16u * 128u)               // 累計登入 = 容量 x 16
+#define CHURN_MAX_RUN  256u        // 最長的連續非 EMPTY slot 超過這個就算失敗
+
+static volatile int sink;
+
+static double now_sec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// 固定種子的 xorshift: 每次執行產生相同的 session ID，跳過兩個保留值
+static uint32_t next_id(uint32_t *state) {
+    uint32_t x;
+    do {
+        x = *state;
+        x ^= x << 13;
+        x ^= x >> 17;
+        x ^= x << 5;
+        *state = x;
+    } while (x == SESSION_EMPTY || x == SESSION_TOMBSTONE);
+    return x;
+}
+
+// 回傳 0 成功；ns 依序為插入、查詢命中、查詢不到
+static int run_case(uint32_t capacity, int load_percent, double ns[3]) {
+    SessionTable *table = malloc(session_table_bytes(capacity));
+    uint32_t count = (uint32_t)((uint64_t)capacity * load_percent / 100);
+    uint32_t *ids = malloc(count * sizeof(uint32_t));
+    if (!table || !ids) {
+        perror("malloc failed");
+        return -1;
+    }
+    session_table_init(table, capacity, 1800);
+
+    // ID 先產生好，計時範圍內只有表的操作
+    uint32_t state = 2463534242u;
+    for (uint32_t i = 0; i < count; i++) ids[i] = next_id(&state);
+
+    uint32_t inserted = 0;
+    double start = now_sec();
+    for (uint32_t i = 0; i < count; i++) {
+        inserted += session_table_insert(table, ids[i], NOW) == 1;
+    }
+    ns[0] = (now_sec() - start) * 1e9 / count;
+
+    // 命中: 以跨步的順序查已插入的 ID，避免與插入順序相同而全在 cache 裡
+    int hits = 0;
+    uint32_t stride = 7919;
+    start = now_sec();
+    for (uint32_t i = 0, j = 0; i < OPS_PER_CASE; i++, j = (j + stride) % count) {
+        hits += session_table_touch(table, ids[j], NOW);
+    }
+    ns[1] = (now_sec() - start) * 1e9 / OPS_PER_CASE;
+
+    // 查不到: 另一個種子的 ID (偶爾撞到已存在的 ID 不影響量測)
+    uint32_t miss_state = 88675123u;
+    int misses = 0;
+    start = now_sec();
+    for (uint32_t i = 0; i < OPS_PER_CASE; i++) {
+        misses += !session_table_touch(table, next_id(&miss_state), NOW);
+    }
+    ns[2] = (now_sec() - start) * 1e9 / OPS_PER_CASE;
+    sink = misses;
+
+    int ok = hits == (int)OPS_PER_CASE && inserted + 16 >= count;   // 只容許極少數重複的 ID
+    if (!ok) {
+        fprintf(stderr, "capacity %u: inserted %u of %u, %d of %u lookups hit\n",
+                capacity, inserted, count, hits, OPS_PER_CASE);
+    }
+    free(ids);
+    free(table);
+    return ok ? 0 : -1;
+}
+
+// 查不到的 ID 平均要探測幾個 slot (從每個 slot 出發走到 EMPTY 的平均距離) 與最長的非 EMPTY 連續區段
+static void probe_lengths(SessionTable *table, double *mean, uint32_t *longest) {
+    uint32_t mask = table->capacity - 1;
+    uint32_t first_empty = 0;
+    while (first_empty < table->capacity && (uint32_t)table->slots[first_empty] != SESSION_EMPTY) first_empty++;
+    if (first_empty == table->capacity) {
+        *mean = table->capacity;
+        *longest = table->capacity;
+        return;
+    }
+
+    // 從第一個 EMPTY 往回繞一圈: run = 到下一個 EMPTY 前還有幾個非 EMPTY slot
+    uint64_t total = 0;
+    uint32_t run = 0;
+    *longest = 0;
+    for (uint32_t i = 1; i <= table->capacity; i++) {
+        uint32_t idx = (first_empty - i) & mask;
+        if ((uint32_t)table->slots[idx] == SESSION_EMPTY) {
+            run = 0;
+        } else {
+            run++;
+            if (run > *longest) *longest = run;
+        }
+        total += run + 1;
+    }
+    *mean = (double)total / table->capacity;
+}
+
+// 登入持續換手: 每秒固定數量的新 session，舊的閒置過期，sweeper 照 server 的節奏掃
+// 回傳 0 成功；ns 為最後查不到的 ID 的查詢時間
+static int run_churn(double *ns) {
+    uint32_t capacity = CHURN_CAPACITY;
+    SessionTable *table = malloc(session_table_bytes(capacity));
+    if (!table) {
+        perror("malloc failed");
+        return -1;
+    }
+    session_table_init(table, capacity, CHURN_TTL);
+
+    uint32_t state = 2463534242u;
+    uint32_t slice = capacity / CHURN_SLICES;
+    uint32_t cursor = 0;
+    uint32_t failed = 0;
+    uint32_t now = NOW;
+    for (uint32_t sec = 0; sec < CHURN_SECONDS; sec++, now++) {
+        for (uint32_t i = 0; i < CHURN_PER_SEC; i++) {
+            failed += session_table_insert(table, next_id(&state), now) < 0;
+        }
+        session_table_sweep(table, cursor, slice, now);
+        cursor = (cursor + slice) & (capacity - 1);
+    }
+
+    double mean;
+    uint32_t longest;
+    probe_lengths(table, &mean, &longest);
+
+    uint32_t miss_state = 88675123u;
+    int misses = 0;
+    double start = now_sec();
+    for (uint32_t i = 0; i < OPS_PER_CASE; i++) {
+        misses += !session_table_touch(table, next_id(&miss_state), now);
+    }
+    *ns = (now_sec() - start) * 1e9 / OPS_PER_CASE;
+    sink = misses;
+
+    printf("churn: %u logins into %u slots, %u live, mean miss probe %.1f slots, longest run %u\n",
+           CHURN_SECONDS * CHURN_PER_SEC, capacity, atomic_load(&table->count), mean, longest);
+
+    int ok = failed == 0 && longest <= CHURN_MAX_RUN;
+    if (!ok) {
+        fprintf(stderr, "churn: %u inserts failed, longest non-empty run %u (limit %u)\n",
+                failed, longest, CHURN_MAX_RUN);
+    }
+    free(table);
+    return ok ? 0 : -1;
+}
+
+int main(void) {
+    static const uint32_t capacities[] = {1u << 10, 1u << 14, 1u << 18, 1u << 22};
+    static const int loads[] = {50, 90};
+    static const char *names[3] = { "add_session", "is_valid_session hit", "is_valid_session miss" };
+
+    printf("Session table (ns/op, %u lookups per case)\n", OPS_PER_CASE);
+    printf("%10s %6s %12s %12s %12s\n", "capacity", "load", "insert", "lookup hit", "lookup miss");
+    for (size_t c = 0; c < sizeof(capacities) / sizeof(capacities[0]); c++) {
+        for (size_t l = 0; l < sizeof(loads) / sizeof(loads[0]); l++) {
+            double ns[3];
+            if (run_case(capacities[c], loads[l], ns) < 0) return 1;
+            printf("%10u %5d%% %12.1f %12.1f %12.1f\n", capacities[c], loads[l], ns[0], ns[1], ns[2]);
+            for (int k = 0; k < 3; k++) {
+                char name[64];
+                snprintf(name, sizeof(name), "%s @%d%%", names[k], loads[l]);
+                bench_json("session", name, "capacity", capacities[c], ns[k]);
+            }
+        }
+    }
+
+    double churn_ns;
+    if (run_churn(&churn_ns) < 0) return 1;
+    bench_json("session", "is_valid_session miss after churn", "capacity", CHURN_CAPACITY, churn_ns);
+    return 0;
+}
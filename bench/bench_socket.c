@@ -0,0 +1,100 @@
+// bench/bench_socket.c
+// read_n_bytes / write_n_bytes 經過 socketpair (AF_UNIX stream) 的成本
+// stream:    child 連續 write_n_bytes，parent 用 read_n_bytes 收，量每則訊息的 ns
+// ping-pong: 一問一答 (像沒有 pipeline 的 client)，量每個來回的 ns
+// 訊息大小與 bench_checksum 相同 (84 bytes = header + ServerResponse 的量級)
+
+#include "common.h"
+#include "bench.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+
+#define MAX_OPS        50000
+#define BYTES_PER_CASE (64u * 1024 * 1024)   // 大訊息時的總量上限
+
+static double now_sec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int ops_for(size_t len) {
+    size_t ops = BYTES_PER_CASE / len;
+    return ops < MAX_OPS ? (int)ops : MAX_OPS;
+}
+
+// child 端: stream 時只寫，ping-pong 時收到一則就回一則
+static void peer(int fd, int pingpong, char *buf, size_t len, int ops) {
+    for (int i = 0; i < ops; i++) {
+        if (pingpong && read_n_bytes(fd, buf, (int)len) <= 0) _exit(EXIT_FAILURE);
+        if (write_n_bytes(fd, buf, (int)len) <= 0) _exit(EXIT_FAILURE);
+    }
+    _exit(0);
+}
+
+// 回傳每則訊息 (stream) 或每個來回 (ping-pong) 的 ns，失敗時 -1
+static double run_case(int pingpong, size_t len) {
+    int sv[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) < 0) {
+        perror("socketpair failed");
+        return -1;
+    }
+    char *buf = malloc(len);
+    if (!buf) {
+        perror("malloc failed");
+        return -1;
+    }
+    memset(buf, 0x5A, len);
+    int ops = ops_for(len);
+
+    double start = now_sec();
+    pid_t pid = fork();
+    if (pid < 0) {
+        perror("fork failed");
+        return -1;
+    }
+    if (pid == 0) {
+        close(sv[0]);
+        peer(sv[1], pingpong, buf, len, ops);
+    }
+    close(sv[1]);
+
+    int ok = 1;
+    for (int i = 0; i < ops && ok; i++) {
+        if (pingpong && write_n_bytes(sv[0], buf, (int)len) <= 0) ok = 0;
+        if (ok && read_n_bytes(sv[0], buf, (int)len) <= 0) ok = 0;
+    }
+    double elapsed = now_sec() - start;
+
+    int status;
+    close(sv[0]);
+    waitpid(pid, &status, 0);
+    free(buf);
+    if (!ok || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        fprintf(stderr, "%s failed at %zu bytes\n", pingpong ? "ping-pong" : "stream", len);
+        return -1;
+    }
+    return elapsed * 1e9 / ops;
+}
+
+int main(void) {
+    static const size_t sizes[] = {16, 84, 256, 1024, 4096, 65536};
+
+    printf("read_n_bytes / write_n_bytes over a socketpair (ns/op)\n");
+    printf("%8s %12s %12s %14s\n", "bytes", "stream", "MB/s", "ping-pong rtt");
+    for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+        size_t len = sizes[s];
+        double stream_ns = run_case(0, len);
+        double rtt_ns = run_case(1, len);
+        if (stream_ns < 0 || rtt_ns < 0) return 1;
+        printf("%8zu %12.1f %12.1f %14.1f\n", len, stream_ns, len * 1e3 / stream_ns, rtt_ns);
+        bench_json("socket", "stream", "bytes", len, stream_ns);
+        bench_json("socket", "ping-pong", "bytes", len, rtt_ns);
+    }
+    return 0;
+}
@@ -1,323 +1,878 @@
-// client/client.c
-
-#include <stdio.h>
-#include <stdlib.h>
-#include <string.h>
-#include <unistd.h>
-#include <sys/socket.h>
-#include <arpa/inet.h>
-#include <time.h>
-#include <pthread.h>
-
-#include "common.h"
-
-#define SERVER_IP "127.0.0.1"
-#define PORT 8080
-
-// Thread argument structure
-struct thread_arg {
-    char action[10];
-    int num_tickets;
-    int user_id;
-};
-
-void *client_thread(void *arg);
-uint32_t perform_login(int sockfd);
-void query_availability(int sockfd, uint32_t session_id);
-void book_tickets(int sockfd, int num_tickets, int user_id, uint32_t session_id);
-
-int main(int argc, char *argv[]) {
-    if (argc < 3) {
-        fprintf(stderr, "Usage: %s <num_threads> <query|book> [num_tickets]\n", argv[0]);
-        exit(EXIT_FAILURE);
-    }
-
-    // Initialize logger
-    init_logger("client.log");
-    log_message(LOG_INFO, "Client starting with %s threads for %s operation", argv[1], argv[2]);
-
-    int num_threads = atoi(argv[1]);
-    if (num_threads <= 0) {
-        fprintf(stderr, "Number of threads must be a positive integer.\n");
-        exit(EXIT_FAILURE);
-    }
-
-    char action[10];
-    strcpy(action, argv[2]);
-
-    int num_tickets = 0;
-    if (strcmp(action, "book") == 0) {
-        if (argc < 4) {
-            fprintf(stderr, "Usage: %s <num_threads> book <num_tickets>\n", argv[0]);
-            exit(EXIT_FAILURE);
-        }
-        num_tickets = atoi(argv[3]);
-        if (num_tickets <= 0) {
-            fprintf(stderr, "Number of tickets must be a positive integer.\n");
-            exit(EXIT_FAILURE);
-        }
-    }
-
-    // Create threads
-    pthread_t threads[num_threads];
-    struct thread_arg args[num_threads];
-
-    srand(time(NULL));
-    for (int i = 0; i < num_threads; i++) {
-        strcpy(args[i].action, action);
-        args[i].num_tickets = num_tickets;
-        args[i].user_id = rand() % 10000 + i * 10000; // Unique user_id per thread
-
-        if (pthread_create(&threads[i], NULL, client_thread, &args[i]) != 0) {
-            perror("pthread_create failed");
-            exit(EXIT_FAILURE);
-        }
-    }
-
-    // Wait for all threads to finish
-    for (int i = 0; i < num_threads; i++) {
-        pthread_join(threads[i], NULL);
-    }
-
-    return 0;
-}
-
-void *client_thread(void *arg) {
-    struct thread_arg *targ = (struct thread_arg *)arg;
-    int sockfd;
-    uint32_t session_id = 0;
-
-    log_message(LOG_INFO, "Thread started for user %d, action: %s", targ->user_id, targ->action);
-
-    // Connect to server
-    if ((sockfd = connect_to_server(SERVER_IP, PORT)) < 0) {
-        perror("connect_to_server failed");
-        return NULL;
-    }
-    
-    // Set Timeouts (5 seconds)
-    struct timeval tv;
-    tv.tv_sec = 5;
-    tv.tv_usec = 0;
-    if (setsockopt(sockfd, SOL_SOCKET, SO_RCVTIMEO, (const char*)&tv, sizeof tv) < 0) {
-        perror("setsockopt failed (RCVTIMEO)");
-    }
-    if (setsockopt(sockfd, SOL_SOCKET, SO_SNDTIMEO, (const char*)&tv, sizeof tv) < 0) {
-        perror("setsockopt failed (SNDTIMEO)");
-    }
-
-    // Perform Login First
-    session_id = perform_login(sockfd);
-    log_message(LOG_INFO, "Login successful, session_id=%u for user %d", session_id, targ->user_id);
-
-    // Perform action
-    if (strcmp(targ->action, "query") == 0) {
-        query_availability(sockfd, session_id);
-    } else if (strcmp(targ->action, "book") == 0) {
-        book_tickets(sockfd, targ->num_tickets, targ->user_id, session_id);
-    }
-
-    close(sockfd);
-    return NULL;
-}
-
-uint32_t perform_login(int sockfd) {
-    static uint16_t req_id_counter = 0;
-
-    printf("Logging in...\n");
-    ProtocolHeader req_header = {
-        .packet_len = sizeof(ProtocolHeader),
-        .opcode = OP_LOGIN,
-        .req_id = req_id_counter++,
-        .session_id = 0,
-        .checksum = 0
-    };
-    
-    // Calculate Checksum & Encrypt
-    req_header.checksum = calculate_checksum(&req_header, sizeof(ProtocolHeader));
-    xor_cipher(&req_header, sizeof(ProtocolHeader));
-
-    if (write_n_bytes(sockfd, &req_header, sizeof(ProtocolHeader)) <= 0) {
-        perror("Failed to send login request");
-        exit(EXIT_FAILURE);
-    }
-
-    // Read Response
-    ProtocolHeader res_header;
-    if (read_n_bytes(sockfd, &res_header, sizeof(ProtocolHeader)) <= 0) {
-        perror("Failed to read login response header");
-        exit(EXIT_FAILURE);
-    }
-    // Decrypt Header
-    xor_cipher(&res_header, sizeof(ProtocolHeader));
-    
-    // Read Body
-    ServerResponse res_body;
-    if (read_n_bytes(sockfd, &res_body, sizeof(ServerResponse)) <= 0) {
-        perror("Failed to read login response body");
-        exit(EXIT_FAILURE);
-    }
-    // Decrypt Body
-    xor_cipher(&res_body, sizeof(ServerResponse));
-
-    // Verify Checksum
-    uint32_t received_checksum = res_header.checksum;
-    res_header.checksum = 0;
-    uint32_t calc_sum = calculate_checksum(&res_header, sizeof(ProtocolHeader));
-    calc_sum += calculate_checksum(&res_body, sizeof(ServerResponse));
-    
-    if (calc_sum != received_checksum) {
-        fprintf(stderr, "Login response checksum mismatch!\n");
-        exit(EXIT_FAILURE);
-    }
-
-    if (res_header.opcode == OP_RESPONSE_SUCCESS) {
-        uint32_t session_id = res_header.session_id;
-        printf("Login successful. Session ID: %u\n", session_id);
-        log_message(LOG_INFO, "Login response received, session_id=%u", session_id);
-        return session_id;
-    } else {
-        fprintf(stderr, "Login failed: %s\n", res_body.message);
-        log_message(LOG_ERROR, "Login failed: %s", res_body.message);
-        exit(EXIT_FAILURE);
-    }
-}
-
-void query_availability(int sockfd, uint32_t session_id) {
-    static uint16_t req_id_counter = 100;
-
-    log_message(LOG_INFO, "Sending QUERY_AVAILABILITY request, session_id=%u", session_id);
-
-    // 1. Prepare and send request header
-    ProtocolHeader req_header = {
-        .packet_len = sizeof(ProtocolHeader),
-        .opcode = OP_QUERY_AVAILABILITY,
-        .req_id = req_id_counter++,
-        .session_id = session_id,
-        .checksum = 0
-    };
-    
-    // Checksum & Encrypt
-    req_header.checksum = calculate_checksum(&req_header, sizeof(ProtocolHeader));
-    xor_cipher(&req_header, sizeof(ProtocolHeader));
-
-    if (write_n_bytes(sockfd, &req_header, sizeof(ProtocolHeader)) <= 0) {
-        perror("Failed to send query request");
-        return;
-    }
-
-    printf("Sent query request (req_id=%u).\n", req_id_counter-1);
-
-    // 2. Read response
-    ProtocolHeader res_header;
-    if (read_n_bytes(sockfd, &res_header, sizeof(ProtocolHeader)) <= 0) {
-        perror("Failed to read response header");
-        return;
-    }
-    xor_cipher(&res_header, sizeof(ProtocolHeader));
-
-    ServerResponse res_body;
-    if (read_n_bytes(sockfd, &res_body, sizeof(ServerResponse)) <= 0) {
-        perror("Failed to read response body");
-        return;
-    }
-    xor_cipher(&res_body, sizeof(ServerResponse));
-
-    // Verify Checksum
-    uint32_t received_checksum = res_header.checksum;
-    res_header.checksum = 0;
-    uint32_t calc_sum = calculate_checksum(&res_header, sizeof(ProtocolHeader));
-    calc_sum += calculate_checksum(&res_body, sizeof(ServerResponse));
-    if (calc_sum != received_checksum) {
-        fprintf(stderr, "Response checksum mismatch!\n");
-        return;
-    }
-
-    // 3. Print result
-    log_message(LOG_INFO, "Received QUERY response: remaining_tickets=%u, message=%s", res_body.remaining_tickets, res_body.message);
-    printf("----------------------------------------\n");
-    printf("Server Response (req_id=%u):\n", res_header.req_id);
-    printf("  OpCode: 0x%X\n", res_header.opcode);
-    printf("  Remaining Tickets: %u\n", res_body.remaining_tickets);
-    printf("  Message: %s\n", res_body.message);
-    printf("----------------------------------------\n");
-}
-
-void book_tickets(int sockfd, int num_tickets, int user_id, uint32_t session_id) {
-    static uint16_t req_id_counter = 200;
-
-    log_message(LOG_INFO, "Sending BOOK_TICKET request: num_tickets=%d, user_id=%d, session_id=%u", num_tickets, user_id, session_id);
-
-    // 1. Prepare request header and body
-    ProtocolHeader req_header = {
-        .packet_len = sizeof(ProtocolHeader) + sizeof(BookRequest),
-        .opcode = OP_BOOK_TICKET,
-        .req_id = req_id_counter++,
-        .session_id = session_id,
-        .checksum = 0
-    };
-    BookRequest req_body = {
-        .num_tickets = num_tickets,
-        .user_id = user_id
-    };
-
-    // Calculate Checksum (Header + Body)
-    // Note: To calc checksum correctly for header, header needs default 0 checksum field.
-    req_header.checksum = calculate_checksum(&req_header, sizeof(ProtocolHeader));
-    req_header.checksum += calculate_checksum(&req_body, sizeof(BookRequest));
-    
-    // Encrypt
-    xor_cipher(&req_header, sizeof(ProtocolHeader));
-    xor_cipher(&req_body, sizeof(BookRequest));
-
-    // 2. Send request
-    if (write_n_bytes(sockfd, &req_header, sizeof(ProtocolHeader)) <= 0) {
-        perror("Failed to send booking request header");
-        return;
-    }
-    if (write_n_bytes(sockfd, &req_body, sizeof(BookRequest)) <= 0) {
-        perror("Failed to send booking request body");
-        return;
-    }
-    printf("Sent book request for %d tickets (user_id=%d, req_id=%u).\n", num_tickets, user_id, req_header.req_id); // Note: req_header is encrypted now, printing it would show garbage if we accessed fields. Used counter-1 or similar. Actually here we might print unexpected values if we printed struct fields.
-    // Fixed: printing local vars or previous knowns. req_header.req_id is encrypted.
-    
-    // 3. Read response
-    ProtocolHeader res_header;
-    if (read_n_bytes(sockfd, &res_header, sizeof(ProtocolHeader)) <= 0) {
-        perror("Failed to read response header");
-        return;
-    }
-    xor_cipher(&res_header, sizeof(ProtocolHeader));
-
-    ServerResponse res_body;
-    if (read_n_bytes(sockfd, &res_body, sizeof(ServerResponse)) <= 0) {
-        perror("Failed to read response body");
-        return;
-    }
-    xor_cipher(&res_body, sizeof(ServerResponse));
-
-    // Verify Checksum
-    uint32_t received_checksum = res_header.checksum;
-    res_header.checksum = 0;
-    uint32_t calc_sum = calculate_checksum(&res_header, sizeof(ProtocolHeader));
-    calc_sum += calculate_checksum(&res_body, sizeof(ServerResponse));
-    if (calc_sum != received_checksum) {
-        fprintf(stderr, "Response checksum mismatch!\n");
-        return;
-    }
-
-    // 4. Print result
-    log_message(LOG_INFO, "Received BOOK response: status=%s, remaining_tickets=%u, message=%s", 
-                (res_header.opcode == OP_RESPONSE_SUCCESS) ? "SUCCESS" : "FAIL", res_body.remaining_tickets, res_body.message);
-    printf("----------------------------------------\n");
-    printf("Server Response (req_id=%u):\n", res_header.req_id);
-    if (res_header.opcode == OP_RESPONSE_SUCCESS) {
-        printf("  Status: SUCCESS\n");
-    } else {
-        printf("  Status: FAIL\n");
-    }
-    printf("  Remaining Tickets: %u\n", res_body.remaining_tickets);
-    printf("  Message: %s\n", res_body.message);
-    printf("----------------------------------------\n");
-}
+// client/client.c
+
+#define _GNU_SOURCE  // ppoll()
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#include <time.h>
+#include <pthread.h>
+#include <errno.h>
+#include <poll.h>
+
+#include "common.h"
+
+#define SERVER_IP "127.0.0.1"
+#define PORT 8080
+
+// OP_FLAG_CRC32C when CLIENT_CHECKSUM=crc32c, otherwise 0 (byte-sum checksum)
+static uint16_t checksum_flag = 0;
+
+// Protocol version requested at login (CLIENT_PROTOCOL=1 forces the fixed v1 replies)
+static uint32_t protocol_version = PROTOCOL_V2;
+
+// Event targeted by query/book/batch (CLIENT_EVENT); loadgen spreads its
+// requests over CLIENT_EVENTS consecutive events starting there
+static uint32_t event_id = DEFAULT_EVENT_ID;
+static uint32_t loadgen_events = 1;
+
+// CLIENT_SESSION: skip the login and reuse this session (e.g. across a server restart).
+// The pool demo instead swaps it into its logged-in connections before each
+// pooled phase, so a stale session forces the pool to log in again mid-run.
+static uint32_t resume_session = 0;
+
+// Operations mixed by the load generator
+enum { LG_QUERY, LG_BOOK, LG_OPS };
+static const char *lg_op_names[LG_OPS] = { "query", "book" };
+
+// Open-loop load generator settings, shared by all threads
+struct loadgen_config {
+    double rate;          // Target requests/second over all connections
+    double duration;      // Measured seconds (after the warmup)
+    double warmup;        // Seconds of load that are sent but not recorded
+    int query_pct;        // Share of QUERY requests in percent, the rest are BOOK
+    int connections;
+    uint64_t start_ns;    // Common CLOCK_MONOTONIC start, so connections do not bunch up
+};
+
+// What one connection measured
+struct loadgen_result {
+    HdrHistogram *hist[LG_OPS];   // Latency in ns, from the intended send time
+    uint64_t failed[LG_OPS];      // Replies with OP_RESPONSE_FAIL (e.g. sold out)
+    uint64_t shed[LG_OPS];        // Replies with OP_RESPONSE_BUSY: not executed, not in hist
+    uint64_t sent;
+    uint64_t completed;
+    uint64_t timeouts;            // Still unanswered when the drain period ended
+    uint64_t last_reply_ns;       // When the last reply arrived
+    int error;                    // Connection or protocol error
+};
+
+// Thread argument structure
+struct thread_arg {
+    char action[10];
+    int num_tickets;
+    int user_id;
+    int pipeline_depth;   // Only used by "pipeline"
+    int index;            // Only used by "loadgen": position of this connection
+    struct loadgen_config *lg;
+    struct loadgen_result result;
+};
+
+void *client_thread(void *arg);
+uint32_t perform_login(int sockfd);
+void query_availability(int sockfd, uint32_t session_id);
+void book_tickets(int sockfd, int num_tickets, int user_id, uint32_t session_id);
+void batch_book(int sockfd, int num_orders, int user_id, uint32_t session_id);
+void query_stats(int sockfd, uint32_t session_id);
+double run_pipeline(int sockfd, uint32_t session_id, int num_requests, int depth);
+void run_loadgen(int sockfd, uint32_t session_id, struct thread_arg *targ);
+int run_pool_demo(int connections, int num_requests, int depth);
+int report_loadgen(struct thread_arg *args, int num_threads, const char *json_path);
+
+int main(int argc, char *argv[]) {
+    if (argc < 3) {
+        fprintf(stderr, "Usage: %s <num_threads> <query|book|stats> [num_tickets]\n", argv[0]);
+        fprintf(stderr, "       %s <num_threads> pipeline <num_requests> [depth]\n", argv[0]);
+        fprintf(stderr, "       %s <num_threads> batch <num_orders>\n", argv[0]);
+        fprintf(stderr, "       %s <connections> pool <num_requests> [in_flight]\n", argv[0]);
+        fprintf(stderr, "       %s <connections> loadgen <rate> <duration_s> [warmup_s] [query_pct] [json_file]\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+
+    // Initialize logger (CLIENT_BINARY_LOG=<file> records fixed-template events in binary form)
+    init_logger("client.log");
+    if (getenv("CLIENT_BINARY_LOG")) {
+        init_binary_log(getenv("CLIENT_BINARY_LOG"));
+    }
+    // CLIENT_CHECKSUM=crc32c protects packets with CRC32C instead of the byte sum
+    if (getenv("CLIENT_CHECKSUM") && strcmp(getenv("CLIENT_CHECKSUM"), "crc32c") == 0) {
+        checksum_flag = OP_FLAG_CRC32C;
+    }
+    if (getenv("CLIENT_PROTOCOL") && atoi(getenv("CLIENT_PROTOCOL")) == PROTOCOL_V1) {
+        protocol_version = PROTOCOL_V1;
+    }
+    if (getenv("CLIENT_EVENT")) {
+        event_id = (uint32_t)strtoul(getenv("CLIENT_EVENT"), NULL, 10);
+    }
+    if (getenv("CLIENT_EVENTS") && atoi(getenv("CLIENT_EVENTS")) > 0) {
+        loadgen_events = (uint32_t)atoi(getenv("CLIENT_EVENTS"));
+    }
+    if (getenv("CLIENT_SESSION")) {
+        resume_session = (uint32_t)strtoul(getenv("CLIENT_SESSION"), NULL, 10);
+    }
+    log_message(LOG_INFO, "Client starting with %s threads for %s operation", argv[1], argv[2]);
+
+    int num_threads = atoi(argv[1]);
+    if (num_threads <= 0) {
+        fprintf(stderr, "Number of threads must be a positive integer.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    char action[10];
+    strcpy(action, argv[2]);
+
+    int num_tickets = 0;
+    int pipeline_depth = 64;
+    struct loadgen_config lg = { .warmup = 2, .query_pct = 90, .connections = num_threads };
+    const char *json_path = NULL;
+    if (strcmp(action, "loadgen") == 0) {
+        // Open loop: requests leave on a fixed schedule whether or not earlier replies arrived
+        if (argc < 5 || (lg.rate = atof(argv[3])) <= 0 || (lg.duration = atof(argv[4])) <= 0) {
+            fprintf(stderr, "Usage: %s <connections> loadgen <rate> <duration_s> [warmup_s] [query_pct] [json_file]\n", argv[0]);
+            exit(EXIT_FAILURE);
+        }
+        if (argc >= 6) lg.warmup = atof(argv[5]);
+        if (argc >= 7) lg.query_pct = atoi(argv[6]);
+        if (argc >= 8) json_path = argv[7];
+        if (lg.warmup < 0 || lg.query_pct < 0 || lg.query_pct > 100) {
+            fprintf(stderr, "Warmup must be >= 0 and query_pct between 0 and 100.\n");
+            exit(EXIT_FAILURE);
+        }
+        // Leave time for every connection to log in before the schedule starts
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        lg.start_ns = (uint64_t)now.tv_sec * 1000000000ull + now.tv_nsec + 500000000ull + num_threads * 1000000ull;
+    } else if (strcmp(action, "pipeline") == 0) {
+        // Benchmark: num_tickets is reused as the number of requests per thread
+        if (argc < 4 || (num_tickets = atoi(argv[3])) <= 0) {
+            fprintf(stderr, "Usage: %s <num_threads> pipeline <num_requests> [depth]\n", argv[0]);
+            exit(EXIT_FAILURE);
+        }
+        if (argc >= 5) pipeline_depth = atoi(argv[4]);
+        if (pipeline_depth <= 0 || pipeline_depth > 32768) {
+            fprintf(stderr, "Pipeline depth must be between 1 and 32768.\n");
+            exit(EXIT_FAILURE);
+        }
+    } else if (strcmp(action, "pool") == 0) {
+        // Single thread driving a ClientPool of num_threads connections
+        int depth = argc >= 5 ? atoi(argv[4]) : 64;
+        if (argc < 4 || (num_tickets = atoi(argv[3])) <= 0 || depth <= 0) {
+            fprintf(stderr, "Usage: %s <connections> pool <num_requests> [in_flight]\n", argv[0]);
+            exit(EXIT_FAILURE);
+        }
+        return run_pool_demo(num_threads, num_tickets, depth) == 0 ? 0 : EXIT_FAILURE;
+    } else if (strcmp(action, "batch") == 0) {
+        // num_tickets is reused as the number of one-ticket orders in the batch
+        if (argc < 4 || (num_tickets = atoi(argv[3])) <= 0 || num_tickets > BATCH_BOOK_MAX_ENTRIES) {
+            fprintf(stderr, "Usage: %s <num_threads> batch <num_orders (1-%d)>\n", argv[0], BATCH_BOOK_MAX_ENTRIES);
+            exit(EXIT_FAILURE);
+        }
+    } else if (strcmp(action, "book") == 0) {
+        if (argc < 4) {
+            fprintf(stderr, "Usage: %s <num_threads> book <num_tickets>\n", argv[0]);
+            exit(EXIT_FAILURE);
+        }
+        num_tickets = atoi(argv[3]);
+        if (num_tickets <= 0) {
+            fprintf(stderr, "Number of tickets must be a positive integer.\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    // Create threads
+    pthread_t threads[num_threads];
+    struct thread_arg args[num_threads];
+
+    srand(time(NULL));
+    for (int i = 0; i < num_threads; i++) {
+        strcpy(args[i].action, action);
+        args[i].num_tickets = num_tickets;
+        args[i].pipeline_depth = pipeline_depth;
+        args[i].user_id = rand() % 10000 + i * 10000; // Unique user_id per thread
+        args[i].index = i;
+        args[i].lg = &lg;
+        memset(&args[i].result, 0, sizeof(args[i].result));
+
+        if (pthread_create(&threads[i], NULL, client_thread, &args[i]) != 0) {
+            perror("pthread_create failed");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    // Wait for all threads to finish
+    for (int i = 0; i < num_threads; i++) {
+        pthread_join(threads[i], NULL);
+    }
+
+    if (strcmp(action, "loadgen") == 0) {
+        return report_loadgen(args, num_threads, json_path) == 0 ? 0 : EXIT_FAILURE;
+    }
+    return 0;
+}
+
+void *client_thread(void *arg) {
+    struct thread_arg *targ = (struct thread_arg *)arg;
+    int sockfd;
+    uint32_t session_id = 0;
+
+    log_message(LOG_INFO, "Thread started for user %d, action: %s", targ->user_id, targ->action);
+
+    // Connect to server
+    if ((sockfd = connect_to_server(SERVER_IP, PORT)) < 0) {
+        perror("connect_to_server failed");
+        targ->result.error = 1;
+        return NULL;
+    }
+    
+    // Set Timeouts (5 seconds)
+    struct timeval tv;
+    tv.tv_sec = 5;
+    tv.tv_usec = 0;
+    if (setsockopt(sockfd, SOL_SOCKET, SO_RCVTIMEO, (const char*)&tv, sizeof tv) < 0) {
+        perror("setsockopt failed (RCVTIMEO)");
+    }
+    if (setsockopt(sockfd, SOL_SOCKET, SO_SNDTIMEO, (const char*)&tv, sizeof tv) < 0) {
+        perror("setsockopt failed (SNDTIMEO)");
+    }
+
+    // Perform Login First, unless an existing session is reused
+    if (resume_session) {
+        session_id = resume_session;
+        printf("Reusing Session ID: %u\n", session_id);
+    } else {
+        session_id = perform_login(sockfd);
+    }
+    LOG_EVENT(LT_CLIENT_LOGIN_OK, session_id, targ->user_id);
+
+    // Perform action
+    if (strcmp(targ->action, "query") == 0) {
+        query_availability(sockfd, session_id);
+    } else if (strcmp(targ->action, "book") == 0) {
+        book_tickets(sockfd, targ->num_tickets, targ->user_id, session_id);
+    } else if (strcmp(targ->action, "batch") == 0) {
+        batch_book(sockfd, targ->num_tickets, targ->user_id, session_id);
+    } else if (strcmp(targ->action, "stats") == 0) {
+        query_stats(sockfd, session_id);
+    } else if (strcmp(targ->action, "pipeline") == 0) {
+        // Same connection, same number of queries: one at a time, then pipelined
+        double serial = run_pipeline(sockfd, session_id, targ->num_tickets, 1);
+        double piped = run_pipeline(sockfd, session_id, targ->num_tickets, targ->pipeline_depth);
+        if (serial > 0 && piped > 0) {
+            printf("[user %d] depth 1: %.0f req/s, depth %d: %.0f req/s (%.1fx)\n",
+                   targ->user_id, serial, targ->pipeline_depth, piped, piped / serial);
+            log_message(LOG_INFO, "Pipeline benchmark: depth 1 %.0f req/s, depth %d %.0f req/s",
+                        serial, targ->pipeline_depth, piped);
+        }
+    } else if (strcmp(targ->action, "loadgen") == 0) {
+        run_loadgen(sockfd, session_id, targ);
+    }
+
+    close(sockfd);
+    return NULL;
+}
+
+uint32_t perform_login(int sockfd) {
+    printf("Logging in...\n");
+    // v1 clients send no body; a LoginRequest asks for a newer protocol version
+    ClientReply reply;
+    uint32_t session_id = client_login(sockfd, checksum_flag, protocol_version, &reply);
+
+    if (session_id != 0) {
+        printf("Login successful. Session ID: %u\n", session_id);
+        LOG_EVENT(LT_CLIENT_LOGIN_REPLY, session_id);
+        return session_id;
+    } else {
+        const char *reason = reply.error ? "no valid response" : reply.body.message;
+        fprintf(stderr, "Login failed: %s\n", reason);
+        log_message(LOG_ERROR, "Login failed: %s", reason);
+        exit(EXIT_FAILURE);
+    }
+}
+
+void query_availability(int sockfd, uint32_t session_id) {
+    static uint16_t req_id_counter = 100;
+
+    LOG_EVENT(LT_CLIENT_SEND_QUERY, session_id);
+
+    // 1. Send the request and read the response
+    QueryRequest req_body = { .event_id = event_id };
+    uint16_t req_id = req_id_counter++;
+    ClientReply reply;
+    if (client_request(sockfd, OP_QUERY_AVAILABILITY | checksum_flag, req_id, session_id,
+                       &req_body, sizeof(QueryRequest), &reply) < 0) {
+        fprintf(stderr, "Query request (req_id=%u) failed\n", req_id);
+        return;
+    }
+    printf("Sent query request (req_id=%u).\n", req_id);
+
+    // 2. Print result
+    log_message(LOG_INFO, "Received QUERY response: remaining_tickets=%u, message=%s", reply.body.remaining_tickets, reply.body.message);
+    printf("----------------------------------------\n");
+    printf("Server Response (req_id=%u):\n", reply.req_id);
+    printf("  OpCode: 0x%X\n", reply.opcode);
+    printf("  Remaining Tickets: %u\n", reply.body.remaining_tickets);
+    printf("  Message: %s\n", reply.body.message);
+    printf("----------------------------------------\n");
+}
+
+void book_tickets(int sockfd, int num_tickets, int user_id, uint32_t session_id) {
+    static uint16_t req_id_counter = 200;
+
+    LOG_EVENT(LT_CLIENT_SEND_BOOK, num_tickets, user_id, session_id);
+
+    // 1. Send the request (header and body in one writev) and read the response
+    BookEventRequest req_body = {
+        .book = { .num_tickets = num_tickets, .user_id = user_id },
+        .event_id = event_id
+    };
+    uint16_t req_id = req_id_counter++;
+    ClientReply reply;
+    if (client_request(sockfd, OP_BOOK_TICKET | checksum_flag, req_id, session_id,
+                       &req_body, sizeof(BookEventRequest), &reply) < 0) {
+        fprintf(stderr, "Booking request (req_id=%u) failed\n", req_id);
+        return;
+    }
+    printf("Sent book request for %d tickets (user_id=%d, req_id=%u).\n", num_tickets, user_id, req_id);
+
+    // 2. Print result
+    log_message(LOG_INFO, "Received BOOK response: status=%s, remaining_tickets=%u, message=%s", 
+                (reply.opcode == OP_RESPONSE_SUCCESS) ? "SUCCESS" : "FAIL", reply.body.remaining_tickets, reply.body.message);
+    printf("----------------------------------------\n");
+    printf("Server Response (req_id=%u):\n", reply.req_id);
+    if (reply.opcode == OP_RESPONSE_SUCCESS) {
+        printf("  Status: SUCCESS\n");
+    } else {
+        printf("  Status: FAIL\n");
+    }
+    printf("  Remaining Tickets: %u\n", reply.body.remaining_tickets);
+    printf("  Message: %s\n", reply.body.message);
+    printf("----------------------------------------\n");
+}
+
+// Sends `num_orders` one-ticket orders (user_id, user_id+1, ...) in a single
+// OP_BATCH_BOOK packet and prints the per-order results.
+void batch_book(int sockfd, int num_orders, int user_id, uint32_t session_id) {
+    static uint16_t req_id_counter = 300;
+
+    // The event ID follows the last entry
+    size_t entries_len = sizeof(BatchBookRequest) + num_orders * sizeof(BookRequest);
+    size_t body_len = entries_len + sizeof(uint32_t);
+    BatchBookRequest *req_body = malloc(body_len);
+    if (!req_body) {
+        perror("malloc failed");
+        return;
+    }
+
+    // 1. Prepare request
+    req_body->count = num_orders;
+    for (int i = 0; i < num_orders; i++) {
+        req_body->entries[i].num_tickets = 1;
+        req_body->entries[i].user_id = user_id + i;
+    }
+    memcpy((char *)req_body + entries_len, &event_id, sizeof(uint32_t));
+
+    // 2. Send it and read the response: a BatchBookResponse on success, a ServerResponse otherwise
+    uint16_t req_id = req_id_counter++;
+    ClientReply reply;
+    int rc = client_request(sockfd, OP_BATCH_BOOK | checksum_flag, req_id, session_id, req_body, body_len, &reply);
+    free(req_body);
+    if (rc < 0) {
+        fprintf(stderr, "Batch request (req_id=%u) failed\n", req_id);
+        return;
+    }
+    printf("Sent batch of %d orders (user_id=%d..%d).\n", num_orders, user_id, user_id + num_orders - 1);
+
+    // 3. Print result
+    printf("----------------------------------------\n");
+    printf("Server Response (req_id=%u):\n", reply.req_id);
+    if (reply.opcode == OP_RESPONSE_SUCCESS && reply.raw_len >= sizeof(BatchBookResponse)) {
+        const BatchBookResponse *res = reply.raw;
+        uint32_t booked = 0;
+        for (uint32_t i = 0; i < res->count && sizeof(BatchBookResponse) + i < reply.raw_len; i++) {
+            if (res->results[i] == BATCH_RESULT_BOOKED) booked++;
+        }
+        printf("  Status: SUCCESS\n");
+        printf("  Orders Booked: %u of %u\n", booked, res->count);
+        printf("  Remaining Tickets: %u\n", res->remaining_tickets);
+        log_message(LOG_INFO, "Received BATCH response: %u of %u orders booked, remaining_tickets=%u",
+                    booked, res->count, res->remaining_tickets);
+    } else {
+        printf("  Status: FAIL\n");
+        printf("  Message: %s\n", reply.body.message);
+    }
+    printf("----------------------------------------\n");
+}
+
+// Asks the server for its counters (OP_STATS) and prints them
+void query_stats(int sockfd, uint32_t session_id) {
+    static const char *opcode_names[STATS_OPCODES] = { "login", "query", "book", "batch", "other" };
+
+    ClientReply reply;
+    if (client_request(sockfd, OP_STATS | checksum_flag, 400, session_id, NULL, 0, &reply) < 0) {
+        fprintf(stderr, "Stats request failed\n");
+        return;
+    }
+    if (reply.opcode != OP_RESPONSE_SUCCESS || reply.raw_len < sizeof(StatsResponse)) {
+        fprintf(stderr, "Stats request rejected: %s\n", reply.body.message);
+        return;
+    }
+    StatsResponse st;
+    memcpy(&st, reply.raw, sizeof(st));
+
+    printf("----------------------------------------\n");
+    printf("Server Stats (up %.1f s, %u workers):\n", st.uptime_ms / 1e3, st.workers);
+    for (int i = 0; i < STATS_OPCODES; i++) {
+        printf("  %-17s %lu\n", opcode_names[i], (unsigned long)st.requests[i]);
+    }
+    printf("  Successes         %lu\n", (unsigned long)st.successes);
+    printf("  Failures          %lu\n", (unsigned long)st.failures);
+    printf("  Checksum errors   %lu\n", (unsigned long)st.checksum_errors);
+    printf("  Invalid sessions  %lu\n", (unsigned long)st.invalid_sessions);
+    printf("  Shed (busy)       in-flight %lu, queue delay %lu, rate limit %lu\n",
+           (unsigned long)st.shed[BUSY_IN_FLIGHT], (unsigned long)st.shed[BUSY_QUEUE_DELAY],
+           (unsigned long)st.shed[BUSY_RATE_LIMIT]);
+    printf("  Bytes in / out    %lu / %lu\n", (unsigned long)st.bytes_in, (unsigned long)st.bytes_out);
+    printf("  CAS retries       inventory %lu, sessions %lu\n", (unsigned long)st.inventory_cas_retries,
+           (unsigned long)st.session_cas_retries);
+    printf("  Journal wait      %.3f ms\n", st.journal_wait_ns / 1e6);
+    printf("  Latency (us)      p50 %.1f, p99 %.1f, p99.9 %.1f, max %.1f\n", st.latency_p50_ns / 1e3,
+           st.latency_p99_ns / 1e3, st.latency_p999_ns / 1e3, st.latency_max_ns / 1e3);
+    printf("----------------------------------------\n");
+}
+
+// Pipelined QUERY benchmark: keeps up to `depth` requests in flight on one
+// connection. Requests are written in batches, replies are read in bulk and
+// matched back to their request by req_id. Returns requests/second, or -1.
+double run_pipeline(int sockfd, uint32_t session_id, int num_requests, int depth) {
+    static __thread uint16_t req_id_counter = 0;
+    static __thread uint8_t outstanding[65536];   // Indexed by req_id
+    static __thread uint8_t rx_storage[16384];
+
+    ProtocolHeader *batch = malloc(depth * sizeof(ProtocolHeader));
+    if (!batch) {
+        perror("malloc failed");
+        return -1;
+    }
+
+    // Replies differ in size between protocol versions; the FrameReader splits them by packet_len
+    FrameReader rx;
+    frame_reader_init(&rx, rx_storage, sizeof(rx_storage), sizeof(rx_storage));
+
+    int sent = 0, completed = 0, in_flight = 0;
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    while (completed < num_requests) {
+        // 1. Top the window up with one write
+        int n = 0;
+        while (in_flight + n < depth && sent + n < num_requests) {
+            ProtocolHeader *h = &batch[n++];
+            memset(h, 0, sizeof(*h));
+            h->packet_len = sizeof(ProtocolHeader);
+            h->opcode = OP_QUERY_AVAILABILITY | checksum_flag;
+            h->req_id = req_id_counter++;
+            h->session_id = session_id;
+            if (outstanding[h->req_id]) {
+                fprintf(stderr, "req_id %u reused while still outstanding\n", h->req_id);
+                goto fail;
+            }
+            outstanding[h->req_id] = 1;
+            packet_seal(h, NULL, 0);
+        }
+        if (n > 0) {
+            if (write_n_bytes(sockfd, batch, n * sizeof(ProtocolHeader)) <= 0) {
+                perror("Failed to send pipelined requests");
+                goto fail;
+            }
+            sent += n;
+            in_flight += n;
+        }
+
+        // 2. Read whatever replies have arrived (at least one)
+        ssize_t got = frame_reader_fill(&rx, sockfd);
+        if (got <= 0) {
+            perror("Failed to read pipelined replies");
+            goto fail;
+        }
+
+        // 3. Match every complete reply to its request
+        ProtocolHeader header;
+        void *body;
+        int rc;
+        while ((rc = frame_reader_next(&rx, &header, &body)) == 1) {
+            ClientReply res;
+            if (client_decode_reply(&header, body, header.packet_len - sizeof(ProtocolHeader), &res) < 0) {
+                fprintf(stderr, "Response checksum mismatch!\n");
+                goto fail;
+            }
+            if (!outstanding[header.req_id]) {
+                fprintf(stderr, "Unexpected reply for req_id %u\n", header.req_id);
+                goto fail;
+            }
+            outstanding[header.req_id] = 0;
+            in_flight--;
+            completed++;
+        }
+        if (rc < 0) {
+            fprintf(stderr, "Invalid reply length\n");
+            goto fail;
+        }
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    free(batch);
+    double elapsed = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    return num_requests / elapsed;
+
+fail:
+    free(batch);
+    return -1;
+}
+
+static uint64_t monotonic_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+// Open-loop load generator for one connection. Requests are sent at fixed
+// intervals (rate / connections) regardless of outstanding replies, and each
+// latency is measured from the time the request was *due*, not when it was
+// actually written, so a stalled server cannot hide its queueing delay
+// (no coordinated omission). Replies are matched by req_id.
+void run_loadgen(int sockfd, uint32_t session_id, struct thread_arg *targ) {
+    const struct loadgen_config *lg = targ->lg;
+    struct loadgen_result *res = &targ->result;
+
+    // Per in-flight req_id: the intended send time (0 = free) and the operation
+    uint64_t *due = calloc(65536, sizeof(uint64_t));
+    uint8_t *op_of = malloc(65536);
+    static __thread uint8_t rx_storage[65536];
+    char tx[256 * (sizeof(ProtocolHeader) + sizeof(BookEventRequest))];
+    for (int op = 0; op < LG_OPS; op++) {
+        res->hist[op] = malloc(sizeof(HdrHistogram));
+        if (res->hist[op]) hdr_init(res->hist[op]);
+    }
+    if (!due || !op_of || !res->hist[LG_QUERY] || !res->hist[LG_BOOK]) {
+        perror("malloc failed");
+        res->error = 1;
+        goto out;
+    }
+
+    FrameReader rx;
+    frame_reader_init(&rx, rx_storage, sizeof(rx_storage), sizeof(rx_storage));
+
+    uint64_t interval = (uint64_t)(1e9 * lg->connections / lg->rate);
+    if (interval == 0) interval = 1;
+    uint64_t measure_from = lg->start_ns + (uint64_t)(lg->warmup * 1e9);
+    uint64_t send_until = measure_from + (uint64_t)(lg->duration * 1e9);
+    uint64_t drain_until = send_until + 5000000000ull;
+    // Spread the connections' schedules evenly inside one interval
+    uint64_t next = lg->start_ns + interval * targ->index / lg->connections;
+    unsigned int seed = (unsigned int)targ->user_id;
+    uint16_t req_id = 0;
+    uint64_t in_flight = 0;
+
+    while (1) {
+        uint64_t now = monotonic_ns();
+
+        // 1. Send everything that is due, coalesced into as few writes as possible
+        size_t tx_len = 0;
+        while (next <= now && next < send_until) {
+            if (due[req_id]) {
+                // 65536 requests outstanding on one connection: the server has stalled
+                fprintf(stderr, "loadgen: req_id space exhausted on connection %d\n", targ->index);
+                res->error = 1;
+                goto out;
+            }
+            int op = (int)(rand_r(&seed) % 100) < lg->query_pct ? LG_QUERY : LG_BOOK;
+            uint32_t event = event_id + (loadgen_events > 1 ? (uint32_t)rand_r(&seed) % loadgen_events : 0);
+            ProtocolHeader *h = (ProtocolHeader *)(tx + tx_len);
+            memset(h, 0, sizeof(*h));
+            h->req_id = req_id;
+            h->session_id = session_id;
+            if (op == LG_QUERY) {
+                QueryRequest *body = (QueryRequest *)(h + 1);
+                body->event_id = event;
+                h->packet_len = sizeof(ProtocolHeader) + sizeof(QueryRequest);
+                h->opcode = OP_QUERY_AVAILABILITY | checksum_flag;
+                packet_seal(h, body, sizeof(QueryRequest));
+            } else {
+                BookEventRequest *body = (BookEventRequest *)(h + 1);
+                body->book.num_tickets = 1;
+                body->book.user_id = targ->user_id;
+                body->event_id = event;
+                h->packet_len = sizeof(ProtocolHeader) + sizeof(BookEventRequest);
+                h->opcode = OP_BOOK_TICKET | checksum_flag;
+                packet_seal(h, body, sizeof(BookEventRequest));
+            }
+            tx_len += sizeof(ProtocolHeader) +
+                      (op == LG_QUERY ? sizeof(QueryRequest) : sizeof(BookEventRequest));
+            due[req_id] = next;
+            op_of[req_id] = op;
+            req_id++;
+            in_flight++;
+            res->sent++;
+            next += interval;
+
+            if (tx_len + sizeof(ProtocolHeader) + sizeof(BookEventRequest) > sizeof(tx)) {
+                break;
+            }
+        }
+        if (tx_len > 0 && write_n_bytes(sockfd, tx, tx_len) <= 0) {
+            perror("loadgen: send failed");
+            res->error = 1;
+            goto out;
+        }
+
+        if (next >= send_until && in_flight == 0) break;
+        if (now >= drain_until) break;
+
+        // 2. Wait for replies until the next request is due
+        uint64_t wake = next < send_until ? next : drain_until;
+        if (wake <= now && tx_len > 0) continue;
+        uint64_t wait = wake > now ? wake - now : 0;
+        struct timespec timeout = { .tv_sec = wait / 1000000000ull, .tv_nsec = wait % 1000000000ull };
+        struct pollfd pfd = { .fd = sockfd, .events = POLLIN };
+        int ready = ppoll(&pfd, 1, &timeout, NULL);
+        if (ready < 0 && errno != EINTR) {
+            perror("loadgen: ppoll failed");
+            res->error = 1;
+            goto out;
+        }
+        if (ready <= 0) continue;
+
+        ssize_t got = frame_reader_fill(&rx, sockfd);
+        if (got <= 0) {
+            if (got < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) continue;
+            fprintf(stderr, "loadgen: connection %d closed by server\n", targ->index);
+            res->error = 1;
+            goto out;
+        }
+
+        // 3. Record every complete reply
+        uint64_t arrived = monotonic_ns();
+        ProtocolHeader header;
+        void *body;
+        int rc;
+        while ((rc = frame_reader_next(&rx, &header, &body)) == 1) {
+            ClientReply reply;
+            if (client_decode_reply(&header, body, header.packet_len - sizeof(ProtocolHeader), &reply) < 0 ||
+                !due[header.req_id]) {
+                fprintf(stderr, "loadgen: bad reply for req_id %u\n", header.req_id);
+                res->error = 1;
+                goto out;
+            }
+            int op = op_of[header.req_id];
+            if (due[header.req_id] >= measure_from) {
+                // Open loop: a shed request is not retried, it only lowers the goodput
+                if (header.opcode == OP_RESPONSE_BUSY) {
+                    res->shed[op]++;
+                } else {
+                    hdr_record(res->hist[op], arrived - due[header.req_id]);
+                    if (header.opcode != OP_RESPONSE_SUCCESS) res->failed[op]++;
+                }
+            }
+            due[header.req_id] = 0;
+            in_flight--;
+            res->completed++;
+        }
+        res->last_reply_ns = arrived;
+        if (rc < 0) {
+            fprintf(stderr, "loadgen: invalid reply length\n");
+            res->error = 1;
+            goto out;
+        }
+    }
+    res->timeouts = in_flight;
+
+out:
+    free(due);
+    free(op_of);
+}
+
+// Merges the per-connection histograms, prints a summary table and writes
+// the JSON report to `json_path` (stdout if NULL). Returns 0, or -1 if any
+// connection failed.
+int report_loadgen(struct thread_arg *args, int num_threads, const char *json_path) {
+    const struct loadgen_config *lg = args[0].lg;
+    HdrHistogram *total[LG_OPS];
+    uint64_t failed[LG_OPS] = {0}, shed[LG_OPS] = {0}, sent = 0, completed = 0, timeouts = 0, last_reply = 0;
+    int errors = 0;
+
+    for (int op = 0; op < LG_OPS; op++) {
+        total[op] = malloc(sizeof(HdrHistogram));
+        if (!total[op]) {
+            perror("malloc failed");
+            return -1;
+        }
+        hdr_init(total[op]);
+    }
+    for (int i = 0; i < num_threads; i++) {
+        struct loadgen_result *res = &args[i].result;
+        for (int op = 0; op < LG_OPS; op++) {
+            if (res->hist[op]) {
+                hdr_merge(total[op], res->hist[op]);
+                free(res->hist[op]);
+            }
+            failed[op] += res->failed[op];
+            shed[op] += res->shed[op];
+        }
+        sent += res->sent;
+        completed += res->completed;
+        timeouts += res->timeouts;
+        if (res->last_reply_ns > last_reply) last_reply = res->last_reply_ns;
+        errors += res->error;
+    }
+    uint64_t executed = total[LG_QUERY]->total + total[LG_BOOK]->total;
+    uint64_t measured = executed + shed[LG_QUERY] + shed[LG_BOOK];
+    // Throughput over the measured window, stretched if the server was still catching up after it
+    double window = (double)(last_reply - lg->start_ns) / 1e9 - lg->warmup;
+    if (window < lg->duration) window = lg->duration;
+    double achieved = measured / window;
+    double goodput = executed / window;   // Replies the server actually executed
+
+    printf("----------------------------------------\n");
+    printf("Open-loop load: target %.0f req/s over %d connections, %.1fs (+%.1fs warmup), %d%% query\n",
+           lg->rate, lg->connections, lg->duration, lg->warmup, lg->query_pct);
+    printf("Achieved: %.0f req/s measured (goodput %.0f req/s), sent %lu, completed %lu, timeouts %lu, "
+           "connection errors %d\n", achieved, goodput, (unsigned long)sent, (unsigned long)completed,
+           (unsigned long)timeouts, errors);
+    printf("%-6s %10s %8s %8s %10s %10s %10s %10s %10s\n",
+           "op", "count", "failed", "shed", "p50 us", "p99 us", "p99.9 us", "max us", "mean us");
+    for (int op = 0; op < LG_OPS; op++) {
+        const HdrHistogram *h = total[op];
+        printf("%-6s %10lu %8lu %8lu %10.1f %10.1f %10.1f %10.1f %10.1f\n", lg_op_names[op],
+               (unsigned long)h->total, (unsigned long)failed[op], (unsigned long)shed[op],
+               hdr_value_at_percentile(h, 50) / 1e3, hdr_value_at_percentile(h, 99) / 1e3,
+               hdr_value_at_percentile(h, 99.9) / 1e3, h->max / 1e3, hdr_mean(h) / 1e3);
+    }
+    printf("----------------------------------------\n");
+    log_message(LOG_INFO, "Loadgen: target %.0f req/s, achieved %.0f req/s, goodput %.0f req/s, timeouts %lu",
+                lg->rate, achieved, goodput, (unsigned long)timeouts);
+
+    FILE *out = stdout;
+    if (json_path && !(out = fopen(json_path, "w"))) {
+        perror("Failed to open JSON output");
+        out = stdout;
+    }
+    fprintf(out, "{\"target_rate\": %.1f, \"connections\": %d, \"duration_s\": %.3f, \"warmup_s\": %.3f, "
+                 "\"query_pct\": %d, \"protocol\": %u, \"achieved_rate\": %.1f, \"goodput\": %.1f, \"sent\": %lu, "
+                 "\"completed\": %lu, \"timeouts\": %lu, \"connection_errors\": %d, \"ops\": {",
+            lg->rate, lg->connections, lg->duration, lg->warmup, lg->query_pct, protocol_version,
+            achieved, goodput, (unsigned long)sent, (unsigned long)completed,
+            (unsigned long)timeouts, errors);
+    for (int op = 0; op < LG_OPS; op++) {
+        const HdrHistogram *h = total[op];
+        fprintf(out, "%s\"%s\": {\"count\": %lu, \"failed\": %lu, \"shed\": %lu, \"p50_us\": %.3f, "
+                     "\"p90_us\": %.3f, \"p99_us\": %.3f, \"p999_us\": %.3f, \"max_us\": %.3f, \"mean_us\": %.3f}",
+                op ? ", " : "", lg_op_names[op], (unsigned long)h->total, (unsigned long)failed[op],
+                (unsigned long)shed[op],
+                hdr_value_at_percentile(h, 50) / 1e3, hdr_value_at_percentile(h, 90) / 1e3,
+                hdr_value_at_percentile(h, 99) / 1e3, hdr_value_at_percentile(h, 99.9) / 1e3,
+                h->max / 1e3, hdr_mean(h) / 1e3);
+    }
+    fprintf(out, "}}\n");
+    if (out != stdout) fclose(out);
+
+    for (int op = 0; op < LG_OPS; op++) free(total[op]);
+    return errors ? -1 : 0;
+}
+
+// Completion counter shared by the asynchronous requests of run_pool_demo
+struct pool_progress {
+    int completed;
+    int failed;
+};
+
+static void pool_demo_done(void *ctx, const ClientReply *reply) {
+    struct pool_progress *progress = ctx;
+    progress->completed++;
+    if (reply->error || reply->opcode != OP_RESPONSE_SUCCESS) progress->failed++;
+}
+
+// Compares the cost of a QUERY on a fresh connection (connect + login + query)
+// with the same QUERY through a warm ClientPool, first one call at a time and
+// then with up to `depth` requests submitted asynchronously.
+int run_pool_demo(int connections, int num_requests, int depth) {
+    int fresh_requests = num_requests < 500 ? num_requests : 500;
+    struct timespec t0, t1;
+
+    // 1. A new connection and login for every request
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    for (int i = 0; i < fresh_requests; i++) {
+        int sockfd = connect_to_server(SERVER_IP, PORT);
+        ClientReply reply;
+        if (sockfd < 0) {
+            perror("connect_to_server failed");
+            return -1;
+        }
+        uint32_t session_id = client_login(sockfd, checksum_flag, protocol_version, &reply);
+        if (session_id == 0 ||
+            client_request(sockfd, OP_QUERY_AVAILABILITY | checksum_flag, 1, session_id, NULL, 0, &reply) < 0) {
+            fprintf(stderr, "Fresh-connection request failed\n");
+            close(sockfd);
+            return -1;
+        }
+        close(sockfd);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    double fresh_us = ((t1.tv_sec - t0.tv_sec) * 1e6 + (t1.tv_nsec - t0.tv_nsec) / 1e3) / fresh_requests;
+
+    ClientPoolConfig config = {
+        .ip = SERVER_IP,
+        .port = PORT,
+        .connections = connections,
+        .flags = checksum_flag,
+        .protocol_version = protocol_version,
+        .max_in_flight = depth,
+        .timeout_ms = 5000
+    };
+    ClientPool *pool = client_pool_create(&config);
+    if (!pool) {
+        fprintf(stderr, "Failed to create the connection pool\n");
+        return -1;
+    }
+
+    // 2. Warm pool, one synchronous call at a time
+    if (resume_session) client_pool_set_session(pool, resume_session);
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    for (int i = 0; i < num_requests; i++) {
+        ClientReply reply;
+        if (client_pool_call(pool, OP_QUERY_AVAILABILITY, NULL, 0, &reply) < 0) {
+            fprintf(stderr, "Pooled request failed\n");
+            client_pool_destroy(pool);
+            return -1;
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    double pooled_us = ((t1.tv_sec - t0.tv_sec) * 1e6 + (t1.tv_nsec - t0.tv_nsec) / 1e3) / num_requests;
+
+    // 3. Warm pool, asynchronous submit / complete
+    if (resume_session) client_pool_set_session(pool, resume_session);
+    struct pool_progress progress = { 0, 0 };
+    int submitted = 0;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    while (progress.completed < num_requests) {
+        while (submitted < num_requests && submitted - progress.completed < depth * connections &&
+               client_pool_submit(pool, OP_QUERY_AVAILABILITY, NULL, 0, pool_demo_done, &progress) == 0) {
+            submitted++;
+        }
+        // Nothing in flight and nothing could be submitted: every connection is gone
+        if (client_pool_in_flight(pool) == 0 || client_pool_poll(pool, 1000) < 0) break;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    double async_s = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+    client_pool_destroy(pool);
+
+    printf("fresh connection + login: %8.1f us/request (%d requests)\n", fresh_us, fresh_requests);
+    printf("pooled, synchronous:      %8.1f us/request (%.1fx)\n", pooled_us, fresh_us / pooled_us);
+    printf("pooled, asynchronous:     %8.0f req/s over %d connections (%d completed, %d failed)\n",
+           progress.completed / async_s, connections, progress.completed, progress.failed);
+    log_message(LOG_INFO, "Pool demo: fresh %.1f us, pooled %.1f us, async %.0f req/s",
+                fresh_us, pooled_us, progress.completed / async_s);
+    return progress.completed == num_requests && progress.failed == 0 ? 0 : -1;
+}
@@ -1,94 +1,1000 @@
-// include/common.h
-
-#ifndef COMMON_H  // 防止重複 include 的保護機制
-#define COMMON_H
-
-#include <stdint.h> // 用於 uint32_t, uint16_t 等固定長度型別
-#include <stddef.h>
-// ==========================================
-// 1. 操作碼定義 (OpCodes)
-// ==========================================
-// 用於告訴 Server 這次請求是要做什麼
-#define OP_LOGIN              0x0000 // 登入請求 (取得 Session ID)
-#define OP_QUERY_AVAILABILITY 0x0001 // 查詢剩餘票數
-#define OP_BOOK_TICKET        0x0002 // 訂票請求
-#define OP_RESPONSE_SUCCESS   0x1001 // 操作成功
-#define OP_RESPONSE_FAIL      0x1002 // 操作失敗
-
-#define XOR_KEY 0x42 // 簡單 XOR 金鑰
-
-// ==========================================
-// 2. 協定標頭 (Header) - 固定 16 bytes (原 8 bytes)
-// ==========================================
-// __attribute__((packed)) 告訴編譯器不要進行記憶體對齊 (Padding)
-typedef struct __attribute__((packed)) {
-    uint32_t packet_len;  // 封包總長度 (Header + Body 的 bytes 數)
-    uint16_t opcode;      // 操作類型
-    uint16_t req_id;      // 請求 ID
-    uint32_t checksum;    // 封包檢查碼 (Header + Body)
-    uint32_t session_id;  // Session ID (0 表示未登入/Login 請求)
-} ProtocolHeader;
-
-// ==========================================
-// 3. 資料內容 (Payload/Body) 結構
-// ==========================================
-
-// 訂票請求的 Body (當 OpCode = OP_BOOK_TICKET)
-typedef struct __attribute__((packed)) {
-    uint32_t num_tickets; // 想買幾張票
-    uint32_t user_id;     // 使用者 ID (模擬用)
-} BookRequest;
-
-// 伺服器回應的 Body (所有 Response 通用)
-typedef struct __attribute__((packed)) {
-    uint32_t remaining_tickets; // 剩餘票數
-    char message[64];           // 伺服器回傳的訊息 (如 "Booking Success")
-} ServerResponse;
-
-// ==========================================
-// 4. Logger 定義
-// ==========================================
-typedef enum {
-    LOG_INFO,
-    LOG_ERROR,
-    LOG_DEBUG
-} LogLevel;
-
-// 初始化 Logger (可選擇輸出到檔案或 stdout)
-void init_logger(const char *filename);
-
-// 寫入 Log
-void log_message(LogLevel level, const char *format, ...);
-
-
-// ==========================================
-// 5. 函數原型宣告 (Prototypes)
-// ==========================================
-// 這些函數實作在 src_lib/protocol.c 中
-
-// 計算 Checksum (簡單加總或 CRC)
-uint32_t calculate_checksum(const void *data, size_t len);
-
-// XOR 加解密 (In-place)
-void xor_cipher(void *data, size_t len);
-
-// 基礎網路讀寫 (處理 TCP 黏包/斷包問題)
-int read_n_bytes(int sockfd, void *buffer, int n);
-int write_n_bytes(int sockfd, void *buffer, int n);
-
-
-// ==========================================
-// 6. 網路交互原型宣告 (Prototypes)
-// ==========================================
-// 這些函數實作在 src_lib/network.c 中
-
-// 建立 Server Socket (socket -> bind -> listen)
-// 回傳: sockfd 或 -1 (失敗)
-int create_server_socket(int port);
-
-// 建立 Client Socket 並連線 (socket -> connect)
-// 回傳: sockfd 或 -1 (失敗)
-int connect_to_server(const char *ip, int port);
-
-
-#endif // COMMON_H
\ No newline at end of file
+// include/common.h
+
+#ifndef COMMON_H  // 防止重複 include 的保護機制
+#define COMMON_H
+
+#include <stdint.h> // 用於 uint32_t, uint16_t 等固定長度型別
+#include <stddef.h>
+#include <sys/types.h> // 用於 ssize_t
+#include <sys/uio.h>   // 用於 struct iovec (writev)
+#include <stdatomic.h> // 用於 shared memory 中的 lock-free 計數器
+// ==========================================
+// 1. 操作碼定義 (OpCodes)
+// ==========================================
+// 用於告訴 Server 這次請求是要做什麼
+#define OP_LOGIN              0x0000 // 登入請求 (取得 Session ID)
+#define OP_QUERY_AVAILABILITY 0x0001 // 查詢剩餘票數
+#define OP_BOOK_TICKET        0x0002 // 訂票請求
+#define OP_BATCH_BOOK         0x0003 // 批次訂票 (一個封包多筆訂單)
+#define OP_STATS              0x0004 // 取得 Server 的統計數據 (StatsResponse)
+#define OP_RESPONSE_SUCCESS   0x1001 // 操作成功
+#define OP_RESPONSE_FAIL      0x1002 // 操作失敗
+#define OP_RESPONSE_BUSY      0x1003 // Server 過載，request 沒有被處理 (Body 是 BusyResponse)
+
+// OpCode 的選項旗標 (最高 bit)，可與任何 OpCode 組合
+#define OP_FLAG_CRC32C        0x8000 // 本封包的 checksum 使用 CRC32C (而非加總)
+#define OP_FLAG_COMPACT       0x4000 // (只出現在回應) Body 是 v2 精簡格式 CompactResponse
+#define OP_FLAG_MASK          0xC000
+
+// 協定版本: 在 OP_LOGIN 的 Body (LoginRequest) 協商，之後同一條連線都使用該版本
+// 沒有 Body 的 OP_LOGIN (舊 Client) 一律視為 v1
+#define PROTOCOL_V1 1 // 回應 Body 固定是 68 bytes 的 ServerResponse
+#define PROTOCOL_V2 2 // 回應 Body 是 CompactResponse (狀態碼 + 剩餘票數，只有錯誤時附文字)
+
+#define XOR_KEY 0x42 // 簡單 XOR 金鑰
+
+// ==========================================
+// 2. 協定標頭 (Header) - 固定 16 bytes (原 8 bytes)
+// ==========================================
+// __attribute__((packed)) 告訴編譯器不要進行記憶體對齊 (Padding)
+typedef struct __attribute__((packed)) {
+    uint32_t packet_len;  // 封包總長度 (Header + Body 的 bytes 數)
+    uint16_t opcode;      // 操作類型
+    uint16_t req_id;      // 請求 ID
+    uint32_t checksum;    // 封包檢查碼 (Header + Body)
+    uint32_t session_id;  // Session ID (0 表示未登入/Login 請求)
+} ProtocolHeader;
+
+// ==========================================
+// 3. 資料內容 (Payload/Body) 結構
+// ==========================================
+
+// 訂票請求的 Body (當 OpCode = OP_BOOK_TICKET)
+typedef struct __attribute__((packed)) {
+    uint32_t num_tickets; // 想買幾張票
+    uint32_t user_id;     // 使用者 ID (模擬用)
+} BookRequest;
+
+// 批次訂票請求的 Body (當 OpCode = OP_BATCH_BOOK)
+// count 後面緊接 count 筆 BookRequest，依順序處理
+#define BATCH_BOOK_MAX_ENTRIES 4096
+typedef struct __attribute__((packed)) {
+    uint32_t count;         // 訂單筆數 (1 ~ BATCH_BOOK_MAX_ENTRIES)
+    BookRequest entries[];  // 每筆訂單 (num_tickets, user_id)
+} BatchBookRequest;
+
+// 批次訂票成功時的回應 Body (取代 ServerResponse)
+// results[i] 對應 entries[i]；失敗 (OP_RESPONSE_FAIL) 時回應仍是 ServerResponse
+#define BATCH_RESULT_REJECTED 0 // 票數不足，沒有扣票
+#define BATCH_RESULT_BOOKED   1 // 已訂到
+typedef struct __attribute__((packed)) {
+    uint32_t remaining_tickets; // 整批處理完後的剩餘票數
+    uint32_t count;             // results 的筆數
+    uint8_t results[];          // 每筆訂單一個 byte (BATCH_RESULT_*)
+} BatchBookResponse;
+
+// 活動編號 (event ID): 附加在 QUERY / BOOK / BATCH_BOOK body 的最後面。
+// 沒有附加的舊 Client 一律視為活動 0 (DEFAULT_EVENT_ID)。
+#define DEFAULT_EVENT_ID 0
+
+// QUERY 的 Body (可省略)
+typedef struct __attribute__((packed)) {
+    uint32_t event_id;
+} QueryRequest;
+
+// 指定活動的 BOOK Body；BATCH_BOOK 則是在所有 entries 之後再放一個 uint32_t event_id
+typedef struct __attribute__((packed)) {
+    BookRequest book;
+    uint32_t event_id;
+} BookEventRequest;
+
+// 登入請求的 Body (可省略，省略代表 v1)
+typedef struct __attribute__((packed)) {
+    uint32_t protocol_version; // 希望使用的協定版本 (PROTOCOL_V1 / PROTOCOL_V2)
+} LoginRequest;
+
+// v2 回應的狀態碼 (CompactResponse.status)
+typedef enum {
+    RESP_OK = 0,              // 成功
+    RESP_INVALID_SESSION = 1, // Session 不存在或已過期，請重新登入
+    RESP_SOLD_OUT = 2,        // 票數不足
+    RESP_BAD_REQUEST = 3,     // Body 缺少或格式錯誤
+    RESP_UNKNOWN_OPCODE = 4,  // 不支援的操作
+    RESP_SERVER_BUSY = 5,     // Server 資源不足 (例如 Session 表已滿)
+    RESP_UNKNOWN_EVENT = 6    // 活動編號超出範圍
+} RespStatus;
+
+// v2 回應的 Body (回應 OpCode 帶 OP_FLAG_COMPACT 時)
+// 成功時只有 6 bytes；session_id 放在 Header，不重複
+typedef struct __attribute__((packed)) {
+    uint8_t status;             // RespStatus
+    uint8_t text_len;           // text 的長度 (成功時為 0)
+    uint32_t remaining_tickets; // 剩餘票數
+    char text[];                // 錯誤說明 (不含結尾 '\0')
+} CompactResponse;
+
+// 過載時拒絕 request 的原因 (BusyResponse.reason)
+typedef enum {
+    BUSY_NONE = 0,          // (admission_admit 的回傳值: 允許處理)
+    BUSY_IN_FLIGHT = 1,     // 同時處理中的 request 超過上限
+    BUSY_QUEUE_DELAY = 2,   // request 的排隊時間持續超過目標
+    BUSY_RATE_LIMIT = 3,    // 這個 session 的 token bucket 用完了
+    BUSY_REASONS
+} BusyReason;
+
+// OP_RESPONSE_BUSY 的 Body (v1 / v2 相同)
+// Server 在解密 body 之前就拒絕，request 完全沒有執行，等 retry_after_ms 後可以原封不動重送
+typedef struct __attribute__((packed)) {
+    uint32_t retry_after_ms;  // 建議的重試等待時間
+    uint8_t reason;           // BusyReason
+} BusyResponse;
+
+// OP_STATS 成功時的回應 Body (v1 / v2 相同)；所有 worker 的累計值
+#define STATS_OPCODES 5 // requests[] 的索引: LOGIN / QUERY / BOOK / BATCH_BOOK / 其他
+typedef struct __attribute__((packed)) {
+    uint64_t uptime_ms;
+    uint32_t workers;             // 處理過 request 的 worker 數
+    uint64_t requests[STATS_OPCODES];
+    uint64_t successes;
+    uint64_t failures;
+    uint64_t checksum_errors;
+    uint64_t invalid_sessions;
+    uint64_t bytes_in;
+    uint64_t bytes_out;
+    uint64_t inventory_cas_retries; // 訂票的 CAS 因為競爭而重試的次數
+    uint64_t session_cas_retries;   // 新增 session 的 CAS 因為競爭而重試的次數
+    uint64_t journal_wait_ns;     // 累計等待時間
+    uint64_t latency_p50_ns;      // request 處理時間 (解密到回覆封好)
+    uint64_t latency_p99_ns;
+    uint64_t latency_p999_ns;
+    uint64_t latency_max_ns;
+    uint64_t shed[BUSY_REASONS];  // 過載時以 OP_RESPONSE_BUSY 拒絕的 request 數 (依 BusyReason，[0] 不用)
+} StatsResponse;
+
+// 伺服器回應的 Body (所有 Response 通用)
+typedef struct __attribute__((packed)) {
+    uint32_t remaining_tickets; // 剩餘票數
+    char message[64];           // 伺服器回傳的訊息 (如 "Booking Success")
+} ServerResponse;
+
+// ==========================================
+// 4. Logger 定義
+// ==========================================
+typedef enum {
+    LOG_INFO,
+    LOG_ERROR,
+    LOG_DEBUG
+} LogLevel;
+
+// 初始化 Logger (可選擇輸出到檔案或 stdout)
+void init_logger(const char *filename);
+
+// 寫入 Log
+void log_message(LogLevel level, const char *format, ...);
+
+// --- 非同步模式 (Async Logger) ---
+// 呼叫端只把格式化好的一行放進 lock-free ring buffer 就返回，
+// 由背景 thread 批次寫檔 (一次 flush 一個 write())。
+// 啟用後 log_message() 自動改走非同步路徑，API 不變。
+
+// ring buffer 滿了的處理方式
+typedef enum {
+    LOG_FULL_DROP,  // 丟棄這一行並累加計數 (預設，呼叫端永不等待)
+    LOG_FULL_BLOCK  // 等待背景 thread 騰出空間
+} LogFullPolicy;
+
+// 以非同步模式初始化 Logger
+// ring_slots: ring buffer 的行數 (會進位到 2 的次方，0 = 預設值)
+// 回傳: 0 成功，-1 失敗 (此時退回同步模式)
+int init_logger_async(const char *filename, size_t ring_slots, LogFullPolicy policy);
+
+// 等待目前已送出的 log 全部寫入檔案
+void logger_flush(void);
+
+// 因 ring buffer 已滿而被丟棄的行數
+unsigned long logger_dropped_count(void);
+
+// --- 共享記憶體模式 (Shared-Memory Log Channel) ---
+// 給 fork 出來的多個 process 使用: 每個 process 寫入 mmap 共享 ring 中
+// 屬於自己的區塊，由單一 collector process 依時間順序寫入檔案，
+// 請求路徑上不再有任何檔案鎖。必須在 fork 之前呼叫。
+// num_regions: 區塊數 (同時寫 log 的 process 上限，0 = 預設值)
+// region_bytes: 每個區塊的大小 (0 = 預設值)
+// 回傳: 0 成功，-1 失敗 (此時退回同步模式)
+int init_logger_shm(const char *filename, int num_regions, size_t region_bytes);
+
+// 停止 collector 並寫完所有剩下的 log (只有呼叫 init_logger_shm 的 process 有效)
+void shutdown_logger_shm(void);
+
+// --- 二進位結構化 Log (Binary Log) ---
+// 固定格式的 log 只記錄 template 編號、CLOCK_MONOTONIC 時間與原始整數參數，
+// 呼叫端不做任何 printf 格式化；文字由 bin/logdecode 事後還原。
+// 未啟用二進位模式時，LOG_EVENT 會自動格式化後交給 log_message()。
+//
+// 注意: template 編號就是它在表中的位置，寫進檔案後就不能改變，
+//       新的 template 只能加在最後面。參數只支援 32-bit 整數 (%d %u %x %X)。
+#define LOG_TEMPLATES(X) \
+    X(LT_REQUEST_RECEIVED,   LOG_INFO,  "Received request: opcode=0x%X, req_id=%u, session_id=%u") \
+    X(LT_LOGIN_PROCESSING,   LOG_INFO,  "Processing LOGIN request") \
+    X(LT_LOGIN_OK,           LOG_INFO,  "Login successful, session_id=%u") \
+    X(LT_LOGIN_TABLE_FULL,   LOG_ERROR, "Login rejected: session table full") \
+    X(LT_QUERY_PROCESSING,   LOG_INFO,  "Processing QUERY_AVAILABILITY request") \
+    X(LT_BOOK_PROCESSING,    LOG_INFO,  "Processing BOOK_TICKET request") \
+    X(LT_BOOK_OK,            LOG_INFO,  "Booking successful: %d tickets for user %u, remaining %d") \
+    X(LT_BOOK_FAIL,          LOG_ERROR, "Booking failed: not enough tickets, requested %d, available %d") \
+    X(LT_UNKNOWN_OPCODE,     LOG_ERROR, "Unknown opcode: 0x%X") \
+    X(LT_ACCEPTED,           LOG_INFO,  "Accepted connection from %u.%u.%u.%u:%d") \
+    X(LT_BAD_PACKET_LEN,     LOG_ERROR, "Invalid packet length %u, dropping connection") \
+    X(LT_IDLE_CLOSE,         LOG_INFO,  "Closing idle connection fd=%d") \
+    X(LT_CLIENT_LOGIN_OK,    LOG_INFO,  "Login successful, session_id=%u for user %d") \
+    X(LT_CLIENT_LOGIN_REPLY, LOG_INFO,  "Login response received, session_id=%u") \
+    X(LT_CLIENT_SEND_QUERY,  LOG_INFO,  "Sending QUERY_AVAILABILITY request, session_id=%u") \
+    X(LT_CLIENT_SEND_BOOK,   LOG_INFO,  "Sending BOOK_TICKET request: num_tickets=%d, user_id=%d, session_id=%u") \
+    X(LT_BATCH_PROCESSING,   LOG_INFO,  "Processing BATCH_BOOK request: %u entries") \
+    X(LT_BATCH_DONE,         LOG_INFO,  "Batch booking: %u of %u entries booked, remaining %d")
+
+#define LOG_TEMPLATE_ENUM(id, level, format) id,
+typedef enum {
+    LOG_TEMPLATES(LOG_TEMPLATE_ENUM)
+    LT_COUNT
+} LogTemplateId;
+
+typedef struct {
+    LogLevel level;
+    const char *format;
+} LogTemplate;
+
+extern const LogTemplate log_templates[LT_COUNT];
+
+// 檔案格式 (全部 little-endian，只會 append)
+#define BINLOG_MAGIC   "TKTBLOG1"  // 檔案開頭 8 bytes
+#define BINLOG_SYNC_ID 0xFFFF      // 時間同步紀錄: 每次 flush 的第一筆
+
+typedef struct __attribute__((packed)) {
+    uint16_t template_id;  // LogTemplateId 或 BINLOG_SYNC_ID
+    uint8_t nargs;         // 後面接著幾個 uint32_t 參數
+    uint8_t reserved;
+    uint64_t ts_ns;        // CLOCK_MONOTONIC
+} BinaryLogRecord;
+
+typedef struct __attribute__((packed)) {
+    BinaryLogRecord base;  // template_id = BINLOG_SYNC_ID, ts_ns = 當下的 monotonic 時間
+    uint64_t realtime_ns;  // 同一時刻的 CLOCK_REALTIME，用來換算牆上時間
+    uint32_t pid;          // 寫入這一批紀錄的 process
+} BinaryLogSync;
+
+// 開啟二進位 log 檔 (之後 LOG_EVENT 改寫入此檔)
+// 回傳: 0 成功，-1 失敗 (LOG_EVENT 繼續走文字 log)
+int init_binary_log(const char *filename);
+
+// 寫入一筆事件，請使用 LOG_EVENT 巨集
+void log_event(LogTemplateId id, const uint32_t *args, int nargs);
+
+#define LOG_EVENT(id, ...) \
+    log_event((id), (const uint32_t[]){ 0, ##__VA_ARGS__ } + 1, \
+              (int)(sizeof((const uint32_t[]){ 0, ##__VA_ARGS__ }) / sizeof(uint32_t)) - 1)
+
+// 依 template 把參數格式化成文字 (logdecode 與文字模式共用)
+// 回傳: 寫入的字元數
+int format_log_template(char *out, size_t out_size, const char *format, const uint32_t *args, int nargs);
+
+
+// ==========================================
+// 5. 函數原型宣告 (Prototypes)
+// ==========================================
+// 這些函數實作在 src_lib/protocol.c 中
+
+// 計算 Checksum (簡單加總)
+// 實作在 src_lib/checksum.c，載入時依 CPU 自動選擇 AVX2 / SSE2 / 一般版本
+uint32_t calculate_checksum(const void *data, size_t len);
+
+// XOR 加解密 (In-place)
+void xor_cipher(void *data, size_t len);
+
+// 融合版本: 加解密與 checksum 在同一次走訪完成 (checksum 一律針對明文)
+uint32_t decrypt_and_checksum(void *data, size_t len);
+uint32_t checksum_and_encrypt(void *data, size_t len);
+uint32_t decrypt_and_crc32c(uint32_t crc, void *data, size_t len);
+uint32_t crc32c_and_encrypt(uint32_t crc, void *data, size_t len);
+
+// 封包層級: 收到時 header 先用 xor_cipher 解密 (要先知道長度)，再用
+// packet_open_body 解密 body 並驗證 (0 = 正確, -1 = 不符)；
+// 送出前用 packet_seal 填 checksum 並加密 header + body
+int packet_open_body(const ProtocolHeader *header, void *body, size_t body_len);
+void packet_seal(ProtocolHeader *header, void *body, size_t body_len);
+
+// 基礎網路讀寫 (處理 TCP 黏包/斷包問題)
+int read_n_bytes(int sockfd, void *buffer, int n);
+int write_n_bytes(int sockfd, void *buffer, int n);
+
+// 狀態碼的文字說明 (例如 "sold out")
+const char *resp_status_name(uint8_t status);
+
+// Scatter-gather 寫入: 一次 writev() 送出多段資料 (例如 header + body，或多個 pipelined 封包)
+// 處理部分寫入 (partial write)，直到全部送出；iov 陣列內容會被修改
+// 回傳: 寫出的總 bytes 數，錯誤時 -1 (與 write_n_bytes 相同)
+int write_iov_n(int sockfd, struct iovec *iov, int iovcnt);
+
+
+// ==========================================
+// 6. 網路交互原型宣告 (Prototypes)
+// ==========================================
+// 這些函數實作在 src_lib/network.c 中
+
+// create_server_socket 的 flags
+#define SERVER_SOCKET_REUSEPORT 0x1 // 開啟 SO_REUSEPORT (每個 worker 一個 listener)
+
+// 建立 Server Socket (socket -> bind -> listen)
+// 回傳: sockfd 或 -1 (失敗)
+int create_server_socket(int port, int flags);
+
+// 建立 Client Socket 並連線 (socket -> connect)
+// 回傳: sockfd 或 -1 (失敗)
+int connect_to_server(const char *ip, int port);
+
+// 將 fd 設為非阻塞模式 (O_NONBLOCK)，供 event loop 使用
+// 回傳: 0 成功，-1 失敗
+int set_nonblocking(int fd);
+
+// 關閉 Nagle (TCP_NODELAY)，connect_to_server 已自動設定；Server 對 accept 到的 socket 呼叫
+int set_tcp_nodelay(int fd);
+
+
+// ==========================================
+// 7. 票券庫存 (Inventory) 原型宣告
+// ==========================================
+// 這些函數實作在 src_lib/inventory.c 中
+// 票數是一個放在 shared memory 的 atomic_int，所有 process 直接用
+// CPU 的 atomic 指令操作，不需要 semop 系統呼叫。
+// 每個活動的票數各佔一條 cache line (InventorySlot)，不同活動的訂票
+// 不會互相讓對方的 cache line 失效 (false sharing)，吞吐量隨熱門活動數增加。
+
+#define CACHE_LINE_SIZE 64
+#define INVENTORY_MAX_EVENTS 16384 // shared memory 中的活動數上限 (共 1 MB)
+
+typedef struct {
+    atomic_int tickets;
+    char pad[CACHE_LINE_SIZE - sizeof(atomic_int)];
+} __attribute__((aligned(CACHE_LINE_SIZE))) InventorySlot;
+
+_Static_assert(sizeof(InventorySlot) == CACHE_LINE_SIZE, "InventorySlot must fill one cache line");
+
+// 取得活動的票數；event_id 超出 num_events 時回傳 NULL
+atomic_int *inventory_event(InventorySlot *events, uint32_t num_events, uint32_t event_id);
+
+// 設定票數 (初始化 / 管理用途)
+void inventory_set(atomic_int *tickets, int count);
+
+// 查詢剩餘票數 (單純的 atomic load)
+int inventory_query(atomic_int *tickets);
+
+// 嘗試訂 num_tickets 張票 (compare-and-swap 迴圈)
+// 回傳: 1 成功，0 票數不足；*remaining 填入操作後 (或失敗當下) 的剩餘票數
+int inventory_try_book(atomic_int *tickets, uint32_t num_tickets, int *remaining);
+
+// 批次扣票: 依序處理每筆訂單，票數足夠就扣、不足就略過 (不影響後面的訂單)
+// 整批只做一次 CAS，其他 process 看到的是一次性的變化
+// results[i] 寫入 BATCH_RESULT_*；回傳訂到的筆數，*remaining 為處理後票數
+int inventory_try_book_batch(atomic_int *tickets, const BookRequest *entries, uint32_t count,
+                             uint8_t *results, int *remaining);
+
+
+// ==========================================
+// 8. Session 表 (Session Table) 原型宣告
+// ==========================================
+// 這些函數實作在 src_lib/session_table.c 中
+// 放在 shared memory 的 open-addressing hash table (linear probing)。
+// 每個 slot 是一個 64-bit atomic word: 高 32 bits = last_seen (秒)，
+// 低 32 bits = session_id。插入、查詢、過期都只用 CAS，不需要任何鎖。
+
+#define SESSION_EMPTY     0x00000000u // 從未使用過的 slot (探測到此即停止)
+#define SESSION_TOMBSTONE 0xFFFFFFFFu // 已過期的 slot (可重複使用)
+
+typedef struct {
+    uint32_t capacity;         // slot 數量 (2 的次方)
+    uint32_t ttl_sec;          // 閒置多久後過期
+    atomic_uint count;         // 目前有效的 session 數
+    atomic_uint expired_total; // 累計過期的 session 數
+    _Atomic uint64_t slots[];  // (last_seen << 32) | session_id
+} SessionTable;
+
+// 容量為 capacity 的表需要多少 bytes 的 shared memory
+size_t session_table_bytes(uint32_t capacity);
+
+// 初始化 (capacity 必須是 2 的次方)
+void session_table_init(SessionTable *table, uint32_t capacity, uint32_t ttl_sec);
+
+// 加入新的 session
+// 回傳: 1 成功，0 session_id 已存在，-1 表已滿
+int session_table_insert(SessionTable *table, uint32_t session_id, uint32_t now);
+
+// 檢查 session 是否有效，有效時順便更新 last_seen
+// 回傳: 1 有效，0 不存在或已過期
+int session_table_touch(SessionTable *table, uint32_t session_id, uint32_t now);
+
+// 掃描 [start, start + n) 範圍的 slot，把閒置超過 ttl 的標記為 tombstone，
+// 並把後面緊接 EMPTY 的舊 tombstone 清回 EMPTY (探測鏈不會無限變長)
+// 回傳: 這次過期的 session 數
+uint32_t session_table_sweep(SessionTable *table, uint32_t start, uint32_t n, uint32_t now);
+
+
+// ==========================================
+// 9. Checksum 引擎 原型宣告
+// ==========================================
+// 這些函數實作在 src_lib/checksum.c 中
+// 函式庫載入時 (constructor) 用 CPUID 選出最快的實作:
+//   加總:   AVX2 -> SSE2 -> 一般 C
+//   CRC32C: SSE4.2 crc32 指令 -> 查表 (slicing-by-8)
+// 所有加總版本的結果完全相同 (與原本逐 byte 加總相容)。
+
+// 各加總實作 (bench 與測試用；一般程式請呼叫 calculate_checksum)
+uint32_t checksum_sum_portable(const void *data, size_t len);
+uint32_t checksum_sum_sse2(const void *data, size_t len);
+uint32_t checksum_sum_avx2(const void *data, size_t len);
+
+// CRC32C (Castagnoli)。可串接: crc32c_update(crc32c_update(0, a), b) == CRC(a + b)
+uint32_t crc32c_update(uint32_t crc, const void *data, size_t len);
+uint32_t crc32c_update_portable(uint32_t crc, const void *data, size_t len);
+uint32_t crc32c_update_sse42(uint32_t crc, const void *data, size_t len);
+
+// CPU 是否支援各實作 (不支援時呼叫對應函數會退回一般版本)
+int checksum_cpu_has_sse2(void);
+int checksum_cpu_has_avx2(void);
+int checksum_cpu_has_sse42(void);
+
+// 目前選用的實作名稱 (例如 "avx2"、"sse4.2")
+const char *checksum_sum_impl(void);
+const char *crc32c_impl(void);
+
+// 依封包 OpCode 的 OP_FLAG_CRC32C 計算整個封包的 checksum
+// header 的 checksum 欄位必須先設為 0；body 可為 NULL
+uint32_t packet_checksum(const ProtocolHeader *header, const void *body, size_t body_len);
+
+
+// ==========================================
+// 10. 封包讀取器 (Frame Reader) 原型宣告
+// ==========================================
+// 這些函數實作在 src_lib/frame_reader.c 中
+// 每條連線一個接收緩衝區: 一次 read() 盡量讀多一點，再就地切出完整的封包，
+// 處理函數直接拿到指向緩衝區內的 body 指標 (每個 request 不需要 malloc)。
+// 緩衝區由呼叫端提供 (stack 或連線結構)，packet_len 超過 max_frame 視為錯誤。
+
+typedef struct {
+    char *buf;           // 呼叫端提供的緩衝區
+    size_t cap;          // 緩衝區大小
+    size_t start;        // 尚未處理的資料位於 buf[start, end)
+    size_t end;
+    uint32_t max_frame;  // 允許的最大 packet_len (不超過 cap)
+} FrameReader;
+
+void frame_reader_init(FrameReader *fr, void *storage, size_t capacity, uint32_t max_frame);
+
+// 一次 read()；回傳讀到的 bytes，0 = 對方關閉，-1 = 錯誤 (errno 保留)
+ssize_t frame_reader_fill(FrameReader *fr, int fd);
+
+// 取下一個完整封包: 1 = 成功，0 = 還不完整，-1 = 長度不合法
+// *header 為解密後的副本，*body 指向緩衝區內的密文 body (可直接交給 packet_open_body)
+int frame_reader_next(FrameReader *fr, ProtocolHeader *header, void **body);
+
+size_t frame_reader_pending(const FrameReader *fr);
+
+// 把已經收到的資料 (例如 io_uring 的 provided buffer) 複製進緩衝區，回傳放得下的 bytes 數
+size_t frame_reader_append(FrameReader *fr, const void *data, size_t len);
+
+
+// ==========================================
+// 11. 延遲直方圖 (HDR Histogram) 原型宣告
+// ==========================================
+// 這些函數實作在 src_lib/hdr_histogram.c 中
+// 對數-線性分桶: 小於 2048 的值每個值一桶，之後每個 2 的次方再切成 1024 桶，
+// 所以任何值的誤差都不超過 1/1024 (三位有效數字)，記錄一次只是一次加法。
+// 單位由呼叫端決定 (loadgen 使用奈秒)；可記錄到 2^40 (約 18 分鐘)，超過的值會被截斷。
+
+#define HDR_SUB_BUCKET_BITS 11
+#define HDR_MAX_MAGNITUDE   40
+#define HDR_BUCKET_COUNT    ((1 << HDR_SUB_BUCKET_BITS) + \
+                             (HDR_MAX_MAGNITUDE - HDR_SUB_BUCKET_BITS) * (1 << (HDR_SUB_BUCKET_BITS - 1)))
+
+typedef struct {
+    uint64_t total;                      // 記錄的筆數
+    uint64_t min;
+    uint64_t max;
+    double sum;                          // 用來算平均
+    uint64_t counts[HDR_BUCKET_COUNT];
+} HdrHistogram;
+
+void hdr_init(HdrHistogram *h);
+void hdr_record(HdrHistogram *h, uint64_t value);
+void hdr_merge(HdrHistogram *dst, const HdrHistogram *src);
+
+// 第 percentile (0 ~ 100) 百分位數；回傳該桶的上界 (不超過 max)，沒有資料時回傳 0
+uint64_t hdr_value_at_percentile(const HdrHistogram *h, double percentile);
+double hdr_mean(const HdrHistogram *h);
+
+
+// ==========================================
+// 12. Client 函式庫 (連線池) 原型宣告
+// ==========================================
+// 這些函數實作在 src_lib/client_pool.c 中
+// 讓其他服務直接嵌入的 Client API:
+//   - client_request / client_login: 在一條連線上同步送出一個 request 並等回覆
+//   - ClientPool: 事先建立並登入好的連線池。client_pool_submit 不會阻塞，
+//     回覆在 client_pool_poll 裡以 callback 通知 (或用 ClientFuture 等待)；
+//     收到 "Invalid Session" 會自動重新登入並重送一次；
+//     收到 OP_RESPONSE_BUSY 會等 Server 指定的時間後重送 (最多 CLIENT_BUSY_RETRIES 次)。
+// 一個 ClientPool 只能由一個 thread 使用 (不加鎖)；多個 thread 請各自建立自己的 pool。
+
+#define CLIENT_BUSY_RETRIES 3   // 同一個 request 收到 OP_RESPONSE_BUSY 後最多重送幾次
+
+// 一個 request 的結果
+typedef struct {
+    int error;                  // 0 = 收到回覆；-1 = 連線中斷 / 逾時 (其他欄位無效)
+    uint16_t opcode;            // OP_RESPONSE_SUCCESS / OP_RESPONSE_FAIL (已去掉旗標)
+    uint8_t status;             // RespStatus (v1 的回覆由訊息文字判斷)
+    uint16_t req_id;
+    uint32_t session_id;
+    ServerResponse body;        // 剩餘票數與訊息 (v2 沒有文字時填入狀態名稱)
+    const void *raw;            // 解密後的原始 body (例如 BatchBookResponse)，只在 callback 內有效
+    size_t raw_len;
+    uint32_t retry_after_ms;    // OP_RESPONSE_BUSY: Server 建議的重試等待時間 (status = RESP_SERVER_BUSY)
+} ClientReply;
+
+// 解密 / 驗證一個回覆的 body (v1 或 v2 皆可) 並填入 out；header->opcode 的旗標會被去掉
+// 回傳 0 = 成功，-1 = checksum 錯誤或格式不合法
+int client_decode_reply(ProtocolHeader *header, void *body, size_t body_len, ClientReply *out);
+
+// 同步送出一個 request 並讀取回覆 (opcode 可帶 OP_FLAG_CRC32C)；body 不會被修改
+// 回傳 0 = 收到回覆 (成功或失敗看 out->opcode)，-1 = 傳送 / 接收錯誤
+int client_request(int sockfd, uint16_t opcode, uint16_t req_id, uint32_t session_id,
+                   const void *body, size_t body_len, ClientReply *out);
+
+// 登入並協商協定版本 (PROTOCOL_V1 不帶 body)；回傳 session_id，失敗回傳 0
+uint32_t client_login(int sockfd, uint16_t flags, uint32_t protocol_version, ClientReply *out);
+
+typedef void (*client_callback)(void *ctx, const ClientReply *reply);
+
+typedef struct {
+    const char *ip;
+    int port;
+    int connections;            // 連線數 (全部在建立時就連線並登入)
+    uint16_t flags;             // 每個 request 附加的 OpCode 旗標 (例如 OP_FLAG_CRC32C)
+    uint32_t protocol_version;  // PROTOCOL_V1 / PROTOCOL_V2
+    int max_in_flight;          // 每條連線同時在途的 request 上限 (會放寬到 2 的次方 - 1，最多 32767)
+    int timeout_ms;             // 連線超過這麼久沒有任何回覆就視為中斷
+} ClientPoolConfig;
+
+typedef struct ClientPool ClientPool;
+
+// 建立連線池；所有連線都失敗時回傳 NULL
+ClientPool *client_pool_create(const ClientPoolConfig *config);
+
+// 關閉所有連線，尚未完成的 request 以 error = -1 通知
+void client_pool_destroy(ClientPool *pool);
+
+// 非阻塞送出 (只放進連線的傳送緩衝區)；body 會被複製
+// 回傳 0 = 已送出，-1 = 沒有可用的連線或每條連線都已達 max_in_flight
+int client_pool_submit(ClientPool *pool, uint16_t opcode, const void *body, size_t body_len,
+                       client_callback callback, void *ctx);
+
+// 送出緩衝區、等待最多 timeout_ms 並處理收到的回覆 (callback 在這裡被呼叫)
+// 回傳這次完成的 request 數，-1 = 錯誤
+int client_pool_poll(ClientPool *pool, int timeout_ms);
+
+size_t client_pool_in_flight(const ClientPool *pool);
+
+// 把所有連線的 session 換成 session_id (例如 server 重啟前的舊 session)，在沒有在途 request 時呼叫；
+// 之後被回 Invalid Session 的 request 會照常觸發重新登入並重送
+void client_pool_set_session(ClientPool *pool, uint32_t session_id);
+
+// Future: 把 client_future_complete 當作 callback、ClientFuture 當作 ctx 傳給 submit，
+// 再用 client_pool_wait 等它完成 (reply.raw 在完成後不再有效)
+typedef struct {
+    int done;
+    ClientReply reply;
+} ClientFuture;
+
+void client_future_complete(void *future, const ClientReply *reply);
+
+// 持續 poll 直到 future 完成；回傳 0 = 完成，-1 = 逾時
+int client_pool_wait(ClientPool *pool, ClientFuture *future, int timeout_ms);
+
+// submit + wait 的同步版本
+int client_pool_call(ClientPool *pool, uint16_t opcode, const void *body, size_t body_len,
+                     ClientReply *out);
+
+
+// ==========================================
+// 13. 訂票日誌 (Write-Ahead Journal) 原型宣告
+// ==========================================
+// 這些函數實作在 src_lib/journal.c 中
+// 每筆成功的訂票在回覆 client 之前先記進 append-only 的日誌檔:
+//   - worker 用 journal_append 把紀錄放進共享的 ring (只是一次 atomic fetch_add 加上複製)
+//   - committer process 做 group commit: 累積到 batch_records 筆，或第一筆已等了
+//     batch_us 微秒，就把整批一次 write + fdatasync，然後喚醒等待中的 worker
+//   - worker 用 journal_wait 等到自己那筆已寫入磁碟，才送出 SUCCESS
+// 重啟時 journal_open 重播日誌，還原各活動的票數。
+// 日誌是整個 server 共用的單一實例 (和 logger 一樣)，fork 出來的 process 直接沿用。
+
+#define JOURNAL_MAGIC "TKTWAL01"
+#define JOURNAL_DEFAULT_BATCH_RECORDS 64
+#define JOURNAL_DEFAULT_BATCH_US      200
+#define JOURNAL_RING_RECORDS          65536  // 尚未寫入的紀錄上限 (2 的次方)
+
+typedef struct {
+    uint32_t batch_records;  // 一次 commit 最多幾筆 (0 = 預設值)
+    uint32_t batch_us;       // 第一筆最多等多久就 commit (0 = 不等)
+    int no_sync;             // 1 = 只 write 不 fdatasync (比較用，當機時可能遺失)
+    int skip_replay;         // 1 = 票數已由狀態檔還原: 只接續序號，不重播也不動 events
+} JournalConfig;
+
+// 檔頭: 記錄建立日誌時的活動數與初始票數，重播從這裡開始
+typedef struct __attribute__((packed)) {
+    char magic[8];
+    uint32_t num_events;
+    uint32_t tickets_per_event;
+} JournalFileHeader;
+
+// 一筆訂票 (BOOK 或整個 BATCH 扣掉的票數)
+typedef struct __attribute__((packed)) {
+    uint64_t seq;            // 從 1 開始連續遞增，重啟後接續
+    uint32_t event_id;
+    uint32_t num_tickets;
+    uint32_t user_id;
+    uint32_t checksum;       // 前面 20 bytes 的 CRC32C，用來找出寫到一半的尾巴
+} JournalRecord;
+
+// 開啟 (或建立) 日誌並 fork 出 committer process
+// 檔案已存在: 依檔頭重設 events 的票數再重播所有完整的紀錄 (寫到一半的尾巴會被截掉)，
+//             *num_events 改成檔頭記錄的活動數
+// 新檔案:     寫入檔頭 (*num_events, tickets_per_event) 並照此初始化 events
+// config->skip_replay 時 events / *num_events 都不會被修改
+// 回傳重播的紀錄數，-1 = 失敗
+long journal_open(const char *path, const JournalConfig *config, InventorySlot *events,
+                  uint32_t *num_events, int tickets_per_event);
+
+// 記錄一筆訂票 (不等待)；回傳這筆的序號，日誌未啟用時回傳 0
+uint64_t journal_append(uint32_t event_id, uint32_t num_tickets, uint32_t user_id);
+
+// 等到序號 seq (含) 以前的紀錄都已寫入磁碟；seq = 0 立即返回
+// 回傳 0 = 已寫入，-1 = committer 寫入失敗或已結束
+int journal_wait(uint64_t seq);
+
+// 已確定寫入磁碟的最大序號
+uint64_t journal_durable_seq(void);
+
+// 累計寫入的紀錄數與 commit (fdatasync) 次數
+void journal_stats(uint64_t *records, uint64_t *commits);
+
+// 寫完 ring 中剩下的紀錄並結束 committer (只有呼叫 journal_open 的 process 有效)
+void journal_close(void);
+
+
+// ==========================================
+// 14. 狀態檔 (Memory-Mapped State File) 原型宣告
+// ==========================================
+// 這些函數實作在 src_lib/state_file.c 中
+// 把 server 的狀態 (票數、session 表) 放在一個 MAP_SHARED 映射的檔案裡，取代重開機就
+// 消失的 SysV shared memory。重啟時直接映射舊檔案即可使用: 不需要重建，也不需要重播日誌。
+// 檔案開頭一頁是 StateFileHeader (格式版本 + 呼叫端的資料版本 + 資料大小)，任何一項不符
+// 就視為新檔案重新初始化。快照 = msync 把髒頁寫回磁碟後再更新檔頭的快照編號。
+// 所有 process 共用同一份映射，fork 不會產生 copy-on-write 的副本，所以快照不用 fork。
+
+#define STATE_FILE_MAGIC          "TKTSTATE"
+#define STATE_FILE_FORMAT_VERSION 1
+#define STATE_FILE_HEADER_BYTES   4096   // 檔頭獨佔一頁，資料從頁邊界開始
+
+typedef struct {
+    char magic[8];
+    uint32_t format_version;   // STATE_FILE_FORMAT_VERSION (檔頭本身的格式)
+    uint32_t layout_version;   // 呼叫端資料的版本 (struct 改變時要遞增)
+    uint64_t data_bytes;
+    char boot_id[40];          // 最後一次開啟時的開機 ID (/proc/sys/kernel/random/boot_id)
+    uint32_t clean;            // 1 = 上次正常關閉，所有資料都已寫回
+    uint32_t reserved;
+    uint64_t snapshot_gen;     // 已完成的快照數
+    int64_t snapshot_time;     // 最後一次快照的時間 (epoch 秒)
+} StateFileHeader;
+
+typedef struct {
+    StateFileHeader *header;
+    void *data;                // STATE_FILE_HEADER_BYTES 之後的資料區
+    size_t data_bytes;
+    int created;               // 1 = 新檔案 (或版本不符被重設)，資料全為 0，需要初始化
+    int clean;                 // 上次是正常關閉
+    int same_boot;             // 上次開啟後沒有重開機: page cache 中的資料沒有遺失
+    pid_t owner_pid;           // 呼叫 state_file_open 的 process (只有它會在關閉時寫回)
+} StateFile;
+
+// 開啟 (或建立) 狀態檔並映射；回傳 0 成功，-1 失敗
+int state_file_open(StateFile *sf, const char *path, uint32_t layout_version, size_t data_bytes);
+
+// 快照: msync 資料區後更新並 msync 檔頭；回傳 0 成功，-1 失敗
+int state_file_snapshot(StateFile *sf);
+
+// 正常關閉: 最後一次快照、標記 clean 並解除映射 (fork 出來的 process 只解除映射)
+void state_file_close(StateFile *sf);
+
+
+// ==========================================
+// 15. 統計數據 (Shared-Memory Metrics) 原型宣告
+// ==========================================
+// 這些函數實作在 src_lib/metrics.c 中
+// 一塊獨立的 SysV shared memory (METRICS_SHM_KEY)，每個 worker 一個 WorkerMetrics，
+// 只用 relaxed 的 atomic 加法更新，不加鎖；worker 之間不共用 cache line。
+// OP_STATS 與 bin/stats 都是把所有 worker 加總後讀出，bin/stats 只以唯讀方式 attach，
+// 不會經過 request 的處理路徑。
+// 延遲直方圖: 每個 2 的次方再切 4 桶 (誤差 < 25%)，一次記錄只是一次 atomic 加法。
+
+#define METRICS_SHM_KEY          1235
+#define METRICS_MAGIC            "TKTMETR1"
+#define METRICS_VERSION          4
+#define METRICS_MAX_WORKERS      64
+#define METRICS_LATENCY_BUCKETS  256
+
+typedef enum {
+    METRICS_WAIT_JOURNAL = 0,    // 等訂票日誌寫入磁碟
+    METRICS_WAIT_KINDS
+} MetricsWait;
+
+// 沒有鎖可以等，競爭的程度改看 CAS 失敗重試了幾次
+typedef enum {
+    METRICS_CAS_INVENTORY = 0,   // inventory_try_book / inventory_try_book_batch
+    METRICS_CAS_SESSION,         // session_table_insert
+    METRICS_CAS_KINDS
+} MetricsCas;
+
+typedef struct {
+    _Atomic uint64_t requests[STATS_OPCODES];
+    _Atomic uint64_t successes;
+    _Atomic uint64_t failures;
+    _Atomic uint64_t checksum_errors;
+    _Atomic uint64_t invalid_sessions;
+    _Atomic uint64_t bytes_in;
+    _Atomic uint64_t bytes_out;
+    _Atomic uint64_t wait_ns[METRICS_WAIT_KINDS];
+    _Atomic uint64_t waits[METRICS_WAIT_KINDS];
+    _Atomic uint64_t cas_retries[METRICS_CAS_KINDS];
+    _Atomic uint64_t shed[BUSY_REASONS];                 // 被 admission control 拒絕的 request
+    _Atomic uint64_t latency[METRICS_LATENCY_BUCKETS];  // request 處理時間 (ns)
+    atomic_int pid;                                      // 使用這一格的 process (認領時以它判斷是否空著)
+} __attribute__((aligned(CACHE_LINE_SIZE))) WorkerMetrics;
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t max_workers;
+    int64_t start_ns;      // 建立時間 (CLOCK_REALTIME)
+    pid_t server_pid;
+    atomic_uint next_worker;   // metrics_claim_worker 從這一格開始找空的 slot
+    WorkerMetrics workers[METRICS_MAX_WORKERS];
+} MetricsBlock;
+
+// 建立 (或重設) 統計區塊；失敗時回傳 NULL，server 照常運作只是不記錄
+MetricsBlock *metrics_create(void);
+
+// 以唯讀方式 attach 到 server 的統計區塊；不存在或版本不符時回傳 NULL
+const MetricsBlock *metrics_attach(void);
+
+// 選擇呼叫的 thread 之後記錄到哪一格 (worker 編號，超過上限時取餘數)；
+// 沒有指定過的 thread 記錄到第 0 格。threads 模式每個 thread 用不同的編號
+void metrics_set_worker(int worker);
+
+// 認領一格沒有人使用 (或使用者已結束) 的 slot 給呼叫的 thread，fork 模式的 child 使用；
+// 同時存在的 process 不會分到同一格 (全部都有人用時才共用)。回傳 slot 編號，沒有統計區塊時回傳 -1
+int metrics_claim_worker(void);
+
+// 記錄一個處理完的 request (opcode 不含旗標)
+void metrics_request(uint16_t opcode, int success, uint64_t latency_ns, uint32_t bytes_in, uint32_t bytes_out);
+void metrics_checksum_error(uint32_t bytes_in);
+void metrics_invalid_session(void);
+void metrics_wait(MetricsWait kind, uint64_t ns);
+void metrics_cas_retry(MetricsCas kind, uint32_t retries);
+void metrics_shed(BusyReason reason, uint32_t bytes_in, uint32_t bytes_out);
+
+// 把所有 worker 加總到 total (一般記憶體，可用來相減求區間速率)
+void metrics_sum(const MetricsBlock *block, WorkerMetrics *total);
+
+// 直方圖的第 percentile (0 ~ 100) 百分位數 (該桶的上界)；沒有資料時回傳 0
+uint64_t metrics_latency_percentile(const _Atomic uint64_t *latency, double percentile);
+
+// 填入 OP_STATS 的回應
+void metrics_fill_stats(const MetricsBlock *block, StatsResponse *out);
+
+
+// ==========================================
+// 16. Request 階段追蹤 (Phase Tracing) 原型宣告
+// ==========================================
+// 這些函數實作在 src_lib/trace.c 中
+// 用 `make TRACE=1` 編譯 (定義 TRACE_ENABLED) 時，server 會在每個階段結束時讀一次
+// CLOCK_MONOTONIC，把 span 寫進這個 process 自己的 ring buffer (滿了覆蓋最舊的)；
+// 結束時輸出 Chrome trace JSON (chrome://tracing / Perfetto) 與 folded stacks (flamegraph.pl)。
+// 沒有 TRACE_ENABLED 時 TRACE_START / TRACE_PHASE 展開成空的，不會產生任何程式碼。
+
+#define TRACE_BUFFER_SPANS (1 << 20)  // 每個 process 保留最近的 span 數 (16 MB)
+
+typedef enum {
+    TRACE_READ = 0,           // read(): 一次讀進多個 request 的 header 與 body
+    TRACE_LOG,                // 每個 request 的 printf / LOG_EVENT
+    TRACE_DECRYPT_CHECKSUM,   // body 解密與 checksum (同一次掃描)
+    TRACE_SESSION,            // session 查詢
+    TRACE_HANDLE,             // opcode 處理 (含編碼回覆)
+    TRACE_SEAL,               // 回覆的 checksum 與加密
+    TRACE_JOURNAL_WAIT,       // 等訂票日誌寫入磁碟
+    TRACE_WRITE,              // write(): 送出累積的回覆
+    TRACE_PHASES
+} TracePhase;
+
+typedef struct {
+    uint64_t start_ns;
+    uint32_t duration_ns;
+    uint16_t req_id;          // 不屬於單一 request 的階段 (read / write) 為 0
+    uint8_t phase;            // TracePhase
+    uint8_t thread;           // 記錄的 thread，每個 process 從 0 開始依序編號
+} TraceSpan;
+
+#ifdef TRACE_ENABLED
+#include <time.h>
+static inline uint64_t trace_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000UL + ts.tv_nsec;
+}
+// TRACE_START(t) 宣告計時變數；TRACE_PHASE(t, ...) 記錄 [t, 現在) 並把 t 移到現在
+#define TRACE_START(t)             uint64_t t = trace_now_ns()
+#define TRACE_PHASE(t, phase, req) ((t) = trace_record((phase), (t), (req)))
+#else
+#define TRACE_START(t)             ((void)0)
+#define TRACE_PHASE(t, phase, req) ((void)(req))   // 只為了不產生 unused 警告
+#endif
+
+// 開始收集 (配置 buffer)；結束時寫出 <prefix>.<pid>.json 與 <prefix>.<pid>.folded
+// fork 出來的 process 從空的 buffer 開始，各自寫自己的檔案
+int trace_init(const char *prefix);
+
+// 記錄一個從 start_ns 到現在的 span，回傳現在的時間；trace_init 之前呼叫只回傳時間
+uint64_t trace_record(TracePhase phase, uint64_t start_ns, uint16_t req_id);
+
+const char *trace_phase_name(TracePhase phase);
+
+// 輸出目前 buffer 中的 span；回傳寫出的 span 數，-1 = 失敗
+long trace_export_chrome(const char *path);
+long trace_export_folded(const char *path);
+
+
+// ==========================================
+// 17. io_uring 原型宣告
+// ==========================================
+// 這些函數實作在 src_lib/uring.c 中
+// 直接以 io_uring_setup / io_uring_enter / io_uring_register syscall 操作 ring (不需要 liburing)。
+// 呼叫端只用 UringCompletion，不需要 include <linux/io_uring.h>。
+// 所有 uring_accept / uring_recv / uring_send ... 只是填好 SQE，
+// 直到 uring_submit_and_wait 才用一次 syscall 全部交給 kernel。
+
+typedef struct {
+    int fd;
+    unsigned sq_entries;
+    unsigned sq_mask;
+    unsigned cq_mask;
+    unsigned *sq_head;        // 以下指向與 kernel 共用的 ring
+    unsigned *sq_tail;
+    unsigned *sq_array;
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    void *sqes;               // struct io_uring_sqe[]
+    void *cqes;               // struct io_uring_cqe[]
+    unsigned sq_pending;      // 已填好、還沒交出去的 SQE 數
+    void *sq_ring;
+    void *cq_ring;
+    size_t sq_ring_bytes;
+    size_t cq_ring_bytes;
+    size_t sqes_bytes;
+    void *buf_ring;           // provided buffer ring (struct io_uring_buf_ring)
+    size_t buf_ring_bytes;
+    char *buf_base;           // buffer 本體，buf_count 塊各 buf_size bytes
+    unsigned buf_count;
+    unsigned buf_size;
+    uint16_t buf_group;
+    uint16_t buf_tail;
+    uint64_t enter_calls;     // io_uring_enter 的呼叫次數 (統計 syscall 用)
+} Uring;
+
+typedef struct {
+    uint64_t user_data;
+    int32_t res;              // 結果: bytes 數 / 新的 fd / -errno
+    int more;                 // multishot 請求之後還會有完成事件
+    int buffer_id;            // recv 使用的 provided buffer，-1 = 無
+} UringCompletion;
+
+// 建立 ring；核心不支援或被停用時回傳 -1 (errno 保留)
+int uring_init(Uring *ring, unsigned entries);
+
+// 註冊 count 塊 (2 的次方) 各 size bytes 的 provided buffer
+int uring_setup_buffers(Uring *ring, uint16_t group, unsigned count, unsigned size);
+void *uring_buffer(Uring *ring, int buffer_id);
+void uring_recycle_buffer(Uring *ring, int buffer_id);
+
+// 填入 SQE (尚未交出)；回傳 0 成功，-1 = SQ 滿且無法交出
+int uring_accept(Uring *ring, int fd, uint64_t user_data, int multishot);
+int uring_recv(Uring *ring, int fd, uint64_t user_data, int multishot);
+int uring_send(Uring *ring, int fd, const void *buf, size_t len, uint64_t user_data);
+int uring_timeout(Uring *ring, unsigned msec, uint64_t user_data);
+int uring_cancel(Uring *ring, uint64_t target, uint64_t user_data);
+
+// 交出累積的 SQE 並等待至少 wait_nr 個完成事件；-1 = 失敗 (errno，EINTR = signal)
+int uring_submit_and_wait(Uring *ring, unsigned wait_nr);
+
+// 取出下一個完成事件: 1 = 取得，0 = 沒有
+int uring_next_completion(Uring *ring, UringCompletion *out);
+
+void uring_close(Uring *ring);
+
+// ==========================================
+// 18. Work-Stealing Thread Pool 原型宣告
+// ==========================================
+// 這些函數實作在 src_lib/work_pool.c 中
+// 每個 worker thread 有自己的佇列；submit 輪流放進各佇列，自己的佇列空了的 worker
+// 會從其他 worker 的佇列偷工作，所以一個很慢的工作不會卡住排在它後面的工作。
+// 工作是呼叫端的結構中內嵌的 WorkItem (intrusive)，submit 不配置記憶體。
+
+typedef struct WorkItem {
+    struct WorkItem *next;              // 佇列內部使用
+    void (*run)(struct WorkItem *item); // 在某個 worker thread 上執行
+} WorkItem;
+
+typedef struct WorkPool WorkPool;
+
+// 建立 num_threads 個 worker；thread_init 不是 NULL 時，每個 worker 開始取工作前
+// 先在自己的 thread 上呼叫 thread_init(編號 0 ~ num_threads-1)。失敗回傳 NULL
+WorkPool *work_pool_create(int num_threads, void (*thread_init)(int id));
+
+// 放入一個工作 (任何 thread 都可以呼叫)
+void work_pool_submit(WorkPool *pool, WorkItem *item);
+
+// 執行完已放入的工作後結束所有 worker 並釋放 pool
+void work_pool_destroy(WorkPool *pool);
+
+// 執行過的工作數，以及其中從其他 worker 的佇列偷來的數量
+void work_pool_stats(const WorkPool *pool, uint64_t *executed, uint64_t *stolen);
+
+
+// ==========================================
+// 19. 過載保護 (Admission Control) 原型宣告
+// ==========================================
+// 這些函數實作在 src_lib/admission.c 中
+// 狀態放在 MAP_SHARED 的匿名記憶體，在 fork 之前建立，所有 worker process / thread 共用，只用 atomic。
+// 每個 request 在解密 body 之前先經過 admission_admit，超過限制就回 OP_RESPONSE_BUSY:
+//   - 處理中的 request 數 (in flight) 超過 max_in_flight；
+//   - 排隊時間 (讀進來到開始處理) 連續 interval_ms 都高於 target_delay_us
+//     (CoDel 的判斷方式: 只看持續的排隊，不理會短暫的突波)；
+//   - 每個 session 一個 token bucket (session_rate 個/秒，最多累積 session_burst 個)。
+//     bucket 以 session ID 雜湊到固定大小的表，碰撞的 session 共用一個 bucket。
+// 拒絕的 request 不解密、不執行，Server 很快就能把佇列清空，處理中的 request 仍在目標延遲內完成。
+
+#define ADMISSION_BUCKETS        (1u << 16)  // token bucket 表的大小 (2 的次方)
+#define ADMISSION_MIN_RETRY_MS   5
+#define ADMISSION_MAX_RETRY_MS   1000
+
+typedef struct {
+    uint32_t max_in_flight;     // 0 = 不限制
+    uint32_t target_delay_us;   // 0 = 不檢查排隊時間
+    uint32_t interval_ms;       // 排隊時間要持續超過目標多久才開始拒絕
+    uint32_t session_rate;      // 每個 session 每秒的 request 數；0 = 不限制
+    uint32_t session_burst;     // token bucket 的容量 (0 = 與 session_rate 相同)
+} AdmissionConfig;
+
+typedef struct Admission Admission;
+
+// 建立共用狀態 (在 fork 任何 worker 之前呼叫)；失敗回傳 NULL
+Admission *admission_create(const AdmissionConfig *config);
+
+// 記錄一個 request 開始處理時已經排隊了多久
+void admission_observe(Admission *adm, uint64_t queued_ns, uint64_t now_ns);
+
+// 決定是否處理一個 request (session_id 0 = LOGIN，不受 token bucket 限制)
+// 回傳 BUSY_NONE = 處理，處理完必須呼叫 admission_done；其他 = 拒絕的原因，*retry_after_ms 是建議的等待時間
+BusyReason admission_admit(Admission *adm, uint32_t session_id, uint64_t now_ns, uint32_t *retry_after_ms);
+void admission_done(Admission *adm);
+
+int admission_in_flight(const Admission *adm);
+
+#endif // COMMON_H
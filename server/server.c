@@ -1,328 +1,2197 @@
-// server/server.c
-
-#include <stdio.h>
-#include <stdlib.h>
-#include <string.h>
-#include <unistd.h>
-#include <time.h>
-#include <sys/socket.h>
-#include <netinet/in.h>
-#include <arpa/inet.h>
-#include <sys/shm.h>
-#include <sys/sem.h>
-#include <sys/wait.h>
-
-#include "common.h"
-
-#define PORT 8080
-#define MAX_PENDING_CONNECTIONS 5
-#define MAX_SESSIONS 100
-
-// Shared data structure
-struct shared_data {
-    int total_tickets;
-    uint32_t active_sessions[MAX_SESSIONS];
-    int session_count;
-};
-
-// Shared memory and semaphore keys
-#define SHM_KEY 1234
-#define SEM_KEY 5678
-
-// Global pointers to shared memory
-struct shared_data *shared;
-int sem_id;
-
-
-// Semaphore operations
-void sem_lock() {
-    struct sembuf sb = {0, -1, 0};
-    semop(sem_id, &sb, 1);
-}
-
-void sem_unlock() {
-    struct sembuf sb = {0, 1, 0};
-    semop(sem_id, &sb, 1);
-}
-
-void add_session(uint32_t session_id) {
-    sem_lock();
-    for (int i = 0; i < MAX_SESSIONS; i++) {
-        if (shared->active_sessions[i] == 0) {
-            shared->active_sessions[i] = session_id;
-            shared->session_count++;
-            break;
-        }
-    }
-    sem_unlock();
-}
-
-int is_valid_session(uint32_t session_id) {
-    if (session_id == 0) return 0;
-    int found = 0;
-    sem_lock();
-    for (int i = 0; i < MAX_SESSIONS; i++) {
-        if (shared->active_sessions[i] == session_id) {
-            found = 1;
-            break;
-        }
-    }
-    sem_unlock();
-    return found;
-}
-
-void handle_connection(int client_socket);
-
-int main() {
-    int server_fd, client_socket;
-    struct sockaddr_in client_addr;
-    socklen_t client_addr_len = sizeof(client_addr);
-    int shm_id;
-
-    // Initialize logger
-    init_logger("server.log");
-    log_message(LOG_INFO, "Server starting up");
-
-    // Create shared memory
-    shm_id = shmget(SHM_KEY, sizeof(struct shared_data), IPC_CREAT | 0666);
-    if (shm_id < 0) {
-        perror("shmget failed");
-        exit(EXIT_FAILURE);
-    }
-    shared = (struct shared_data *)shmat(shm_id, NULL, 0);
-    if (shared == (struct shared_data *)-1) {
-        perror("shmat failed");
-        exit(EXIT_FAILURE);
-    }
-
-    // Initialize shared data
-    shared->total_tickets = 100;
-    memset(shared->active_sessions, 0, sizeof(shared->active_sessions));
-    shared->session_count = 0;
-
-    // Create semaphore
-    sem_id = semget(SEM_KEY, 1, IPC_CREAT | 0666);
-    if (sem_id < 0) {
-        perror("semget failed");
-        exit(EXIT_FAILURE);
-    }
-    // Initialize semaphore to 1
-    semctl(sem_id, 0, SETVAL, 1);
-
-    // Create server socket
-    if ((server_fd = create_server_socket(PORT)) < 0) {
-        perror("create_server_socket failed");
-        exit(EXIT_FAILURE);
-    }
-
-
-
-    printf("Server listening on port %d\n", PORT);
-    printf("Initial tickets: %d\n", shared->total_tickets);
-
-    // 4. Accept connections in a loop
-    while (1) {
-        if ((client_socket = accept(server_fd, (struct sockaddr *)&client_addr, &client_addr_len)) < 0) {
-            perror("accept failed");
-            continue; // Continue to next iteration
-        }
-
-        char client_ip[INET_ADDRSTRLEN];
-        inet_ntop(AF_INET, &client_addr.sin_addr, client_ip, INET_ADDRSTRLEN);
-        printf("Connection accepted from %s:%d\n", client_ip, ntohs(client_addr.sin_port));
-        log_message(LOG_INFO, "Accepted connection from %s:%d", client_ip, ntohs(client_addr.sin_port));
-
-        // Fork a child process to handle the connection
-        pid_t pid = fork();
-        if (pid < 0) {
-            perror("fork failed");
-            close(client_socket);
-            continue;
-        } else if (pid == 0) {
-            // Child process
-            close(server_fd); // Child doesn't need the listening socket
-
-            // Seed the random number generator
-            srand(time(NULL) ^ getpid());
-
-            // Set Timeout (10 seconds)
-            struct timeval tv;
-            tv.tv_sec = 10;
-            tv.tv_usec = 0;
-            if (setsockopt(client_socket, SOL_SOCKET, SO_RCVTIMEO, (const char*)&tv, sizeof tv) < 0) {
-                perror("setsockopt failed (RCVTIMEO)");
-            }
-
-            // Handle the connection
-            handle_connection(client_socket);
-            close(client_socket);
-            exit(0);
-        } else {
-            // Parent process
-            close(client_socket); // Parent doesn't need the client socket
-            // Continue to accept next connection
-        }
-    }
-
-    close(server_fd);
-    return 0;
-}
-
-void handle_connection(int client_socket) {
-    ProtocolHeader header;
-    int read_ret;
-
-    // Loop to handle multiple requests from the same client
-    while ((read_ret = read_n_bytes(client_socket, &header, sizeof(ProtocolHeader))) > 0) {
-        
-        // 1. Decrypt Header
-        xor_cipher(&header, sizeof(ProtocolHeader));
-
-        // 2. Verify Checksum (Header part)
-        // Note: For simplicity, we assume checksum was calculated on cleartext. 
-        // We need to re-calculate it. 
-        // But since we need the body to fully verify, we'll verify after reading body if needed.
-        // Or we can assume Checksum covers Header+Body.
-        
-        // Let's read the body first if there is one
-        void *body_buffer = NULL;
-        int body_len = header.packet_len - sizeof(ProtocolHeader);
-        if (body_len > 0) {
-            body_buffer = malloc(body_len);
-            if (read_n_bytes(client_socket, body_buffer, body_len) <= 0) {
-                perror("Failed to read body");
-                free(body_buffer);
-                return;
-            }
-            // Decrypt Body
-            xor_cipher(body_buffer, body_len);
-        }
-
-        // 3. Verify Checksum (Full Packet)
-        uint32_t received_checksum = header.checksum;
-        header.checksum = 0; // Zero out to calculate
-        uint32_t calc_sum = calculate_checksum(&header, sizeof(ProtocolHeader));
-        if (body_buffer) {
-            calc_sum += calculate_checksum(body_buffer, body_len);
-        }
-        
-        if (calc_sum != received_checksum) {
-            printf("Checksum mismatch! Expected %u, got %u\n", received_checksum, calc_sum);
-            if (body_buffer) free(body_buffer);
-            close(client_socket);
-            return;
-        }
-        // Restore checksum (optional, but good for debugging if we print it)
-        header.checksum = received_checksum; 
-
-        printf("Received request: packet_len=%u, opcode=0x%X, req_id=%u, session_id=%u\n",
-               header.packet_len, header.opcode, header.req_id, header.session_id);
-        log_message(LOG_INFO, "Received request: opcode=0x%X, req_id=%u, session_id=%u", header.opcode, header.req_id, header.session_id);
-
-        ServerResponse response;
-        memset(&response, 0, sizeof(ServerResponse)); // Clear response buffer
-
-        // 4. Validate Session (unless Login)
-        if (header.opcode != OP_LOGIN && !is_valid_session(header.session_id)) {
-            printf("Invalid Session ID: %u\n", header.session_id);
-            header.opcode = OP_RESPONSE_FAIL;
-            strcpy(response.message, "Invalid Session ID. Please Login.");
-            // Proceed to send response
-        } else {
-            switch (header.opcode) {
-                case OP_LOGIN: {
-                    log_message(LOG_INFO, "Processing LOGIN request");
-                    // Generate new Session ID
-                    uint32_t new_session_id = (rand() % 900000) + 100000;
-                    add_session(new_session_id);
-                    
-                    // We reuse ServerResponse to send back session_id in remaining_tickets field? 
-                    // Or define a new LoginResponse? 
-                    // For simplicity, let's use the 'message' or 'remaining_tickets' field hacks, 
-                    // or just assume the client looks at the `session_id` field in the RESPONSE HEADER?
-                    // YES! The response header should carry the session_id back.
-                    
-                    header.session_id = new_session_id; // Set for response
-                    header.opcode = OP_RESPONSE_SUCCESS;
-                    strcpy(response.message, "Login Successful");
-                    response.remaining_tickets = 0;
-                    log_message(LOG_INFO, "Login successful, session_id=%u", new_session_id);
-                    break;
-                }
-
-                case OP_QUERY_AVAILABILITY: {
-                    log_message(LOG_INFO, "Processing QUERY_AVAILABILITY request");
-                    sem_lock();
-                    response.remaining_tickets = shared->total_tickets;
-                    sem_unlock();
-
-                    strcpy(response.message, "Query successful.");
-                    header.opcode = OP_RESPONSE_SUCCESS;
-                    break;
-                }
-
-                case OP_BOOK_TICKET: {
-                    log_message(LOG_INFO, "Processing BOOK_TICKET request");
-                    if (!body_buffer) {
-                        header.opcode = OP_RESPONSE_FAIL;
-                        strcpy(response.message, "Missing body.");
-                        break;
-                    }
-                    BookRequest *req_body = (BookRequest *)body_buffer;
-                    
-                    sem_lock();
-                    if ((unsigned int)shared->total_tickets >= req_body->num_tickets) {
-                        shared->total_tickets -= req_body->num_tickets;
-                        response.remaining_tickets = shared->total_tickets;
-                        sprintf(response.message, "Booking successful for user %u.", req_body->user_id);
-                        header.opcode = OP_RESPONSE_SUCCESS;
-                        log_message(LOG_INFO, "Booking successful: %d tickets for user %u, remaining %d", req_body->num_tickets, req_body->user_id, shared->total_tickets);
-                    } else {
-                        response.remaining_tickets = shared->total_tickets;
-                        sprintf(response.message, "Booking failed: not enough tickets.");
-                        header.opcode = OP_RESPONSE_FAIL;
-                        log_message(LOG_ERROR, "Booking failed: not enough tickets, requested %d, available %d", req_body->num_tickets, shared->total_tickets);
-                    }
-                    sem_unlock();
-                    break;
-                }
-
-                default: {
-                    printf("Unknown opcode: 0x%X\n", header.opcode);
-                    log_message(LOG_ERROR, "Unknown opcode: 0x%X", header.opcode);
-                    header.opcode = OP_RESPONSE_FAIL;
-                    strcpy(response.message, "Unknown operation.");
-                    break;
-                }
-            }
-        }
-
-        if (body_buffer) free(body_buffer);
-
-        // 5. Send Response
-        header.packet_len = sizeof(ProtocolHeader) + sizeof(ServerResponse);
-        header.checksum = 0;
-        
-        // Calculate Checksum for Response
-        uint32_t res_sum = calculate_checksum(&header, sizeof(ProtocolHeader));
-        res_sum += calculate_checksum(&response, sizeof(ServerResponse));
-        header.checksum = res_sum;
-
-        // Encrypt Response
-        xor_cipher(&header, sizeof(ProtocolHeader));
-        xor_cipher(&response, sizeof(ServerResponse));
-
-
-
-        write_n_bytes(client_socket, &header, sizeof(ProtocolHeader));
-        write_n_bytes(client_socket, &response, sizeof(ServerResponse));
-    }
-
-    if (read_ret == 0) {
-        printf("Client disconnected.\n");
-    } else {
-        perror("read_n_bytes failed");
-    }
-
-    close(client_socket);
-}
+// server/server.c
+
+#define _GNU_SOURCE  // accept4()
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <sys/shm.h>
+#include <sys/wait.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <pthread.h>
+#include <errno.h>
+#include <signal.h>
+#include <sys/prctl.h>
+
+#include "common.h"
+
+#define PORT 8080
+#define MAX_PENDING_CONNECTIONS 5
+#define SESSION_CAPACITY (1u << 22)  // Session table slots (power of two, ~3M live sessions)
+#define SESSION_TTL_SEC 1800          // Sessions idle this long expire
+#define SESSION_SWEEP_SLICES 16       // Sweeper covers 1/16 of the table per second
+#define CLIENT_TIMEOUT_SEC 10      // Idle connections are dropped after this
+#define MAX_PACKET_LEN 65536       // Upper bound on packet_len; longer frames drop the connection
+#define RX_BUFFER_SIZE MAX_PACKET_LEN  // Per-connection receive buffer, always fits one full frame
+#define TX_FLUSH_BYTES 65536           // Flush queued replies early once this much is pending
+#define EPOLL_MAX_EVENTS 256
+#define CORES_PER_IO_THREAD 4          // Threads mode default: the rest of the cores run workers
+#define DEFAULT_ADMIT_DELAY_US 5000    // -A: shed once queueing stays above this ...
+#define DEFAULT_ADMIT_INTERVAL_MS 100  // ... for this long (CoDel's defaults)
+#define DEFAULT_NUM_EVENTS 1024        // Events served unless -e says otherwise
+#define DEFAULT_TICKETS_PER_EVENT 100
+#define DEFAULT_SNAPSHOT_SEC 5         // State file snapshot interval unless -S says otherwise
+#define STATE_LAYOUT_VERSION 1         // Bump when struct shared_data or the session table layout changes
+
+// Shared data structure
+// The session table (session_table_* in libcommon) follows it in the same
+// segment, starting at SESSIONS_OFFSET.
+// Each event's ticket count sits on its own cache line, so bookings for
+// different events never contend (see inventory_* in libcommon).
+struct shared_data {
+    uint32_t num_events;                         // Events in use (-e)
+    InventorySlot events[INVENTORY_MAX_EVENTS];  // Lock-free, indexed by event ID
+};
+
+#define SESSIONS_OFFSET ((sizeof(struct shared_data) + 63) & ~(size_t)63)
+#define SHM_SIZE (SESSIONS_OFFSET + session_table_bytes(SESSION_CAPACITY))
+
+// Shared memory key
+#define SHM_KEY 1234
+
+// Global pointers to shared memory
+struct shared_data *shared;
+SessionTable *sessions;
+StateFile state_file;  // Backs `shared` when the server runs with -s
+MetricsBlock *metrics; // Per-worker counters read by OP_STATS and bin/stats (NULL if unavailable)
+Admission *admission;  // Load shedding shared by every worker (NULL unless -A or -R)
+
+static uint64_t monotonic_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000UL + ts.tv_nsec;
+}
+
+// The tickets the server starts with: -e/-t on a fresh start, otherwise the
+// counts the state file or the journal replay left in `shared`
+static void print_inventory(int fresh, int tickets_per_event) {
+    if (fresh) {
+        printf("Initial tickets: %d per event, %u events\n", tickets_per_event, shared->num_events);
+        return;
+    }
+    uint64_t total = 0;
+    for (uint32_t i = 0; i < shared->num_events; i++) total += inventory_query(&shared->events[i].tickets);
+    printf("Resumed tickets: %lu remaining over %u events (event %d: %d)\n", (unsigned long)total,
+           shared->num_events, DEFAULT_EVENT_ID, inventory_query(&shared->events[DEFAULT_EVENT_ID].tickets));
+}
+
+// Returns 1 if added, 0 if the ID is already taken, -1 if the table is full
+int add_session(uint32_t session_id) {
+    return session_table_insert(sessions, session_id, (uint32_t)time(NULL));
+}
+
+int is_valid_session(uint32_t session_id) {
+    return session_table_touch(sessions, session_id, (uint32_t)time(NULL));
+}
+
+// Background process that expires idle sessions. It only uses CAS on the
+// table, so requests are never blocked by it.
+void start_session_sweeper(void) {
+    pid_t pid = fork();
+    if (pid < 0) {
+        perror("fork failed (session sweeper)");
+        exit(EXIT_FAILURE);
+    }
+    if (pid > 0) return;
+
+    prctl(PR_SET_PDEATHSIG, SIGTERM);
+    if (getppid() == 1) exit(0);
+
+    uint32_t slice = SESSION_CAPACITY / SESSION_SWEEP_SLICES;
+    uint32_t cursor = 0;
+    while (1) {
+        sleep(1);
+        uint32_t expired = session_table_sweep(sessions, cursor, slice, (uint32_t)time(NULL));
+        if (expired > 0) {
+            log_message(LOG_INFO, "Session sweeper expired %u sessions, %u active",
+                        expired, atomic_load(&sessions->count));
+        }
+        cursor = (cursor + slice) & (SESSION_CAPACITY - 1);
+    }
+}
+
+// Background process that snapshots the state file. msync only writes the
+// pages dirtied since the last snapshot, and requests keep running meanwhile.
+void start_state_snapshotter(int interval_sec) {
+    pid_t pid = fork();
+    if (pid < 0) {
+        perror("fork failed (state snapshotter)");
+        exit(EXIT_FAILURE);
+    }
+    if (pid > 0) return;
+
+    prctl(PR_SET_PDEATHSIG, SIGTERM);
+    if (getppid() == 1) exit(0);
+
+    while (1) {
+        sleep(interval_sec);
+        if (state_file_snapshot(&state_file) < 0) {
+            log_message(LOG_ERROR, "State file snapshot failed");
+        }
+    }
+}
+
+static void close_state_file(void) {
+    state_file_close(&state_file);
+}
+
+// Set by SIGTERM/SIGINT: the accept/event loops return so main() can exit
+// normally and the loggers flush what they have buffered.
+static volatile sig_atomic_t server_stopping = 0;
+
+static void on_shutdown_signal(int sig) {
+    (void)sig;
+    server_stopping = 1;
+}
+
+static void install_shutdown_handlers(void) {
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = on_shutdown_signal;
+    sigemptyset(&sa.sa_mask);
+    sa.sa_flags = 0; // No SA_RESTART: blocking accept/wait/epoll_wait must return EINTR
+    sigaction(SIGTERM, &sa, NULL);
+    sigaction(SIGINT, &sa, NULL);
+}
+
+static void log_accepted(const struct sockaddr_in *addr) {
+    uint32_t ip = ntohl(addr->sin_addr.s_addr);
+    LOG_EVENT(LT_ACCEPTED, ip >> 24, (ip >> 16) & 0xFF, (ip >> 8) & 0xFF, ip & 0xFF, ntohs(addr->sin_port));
+}
+
+// Server modes
+typedef enum {
+    MODE_FORK,    // One child process per accepted connection
+    MODE_EPOLL,   // Single process, non-blocking epoll event loop
+    MODE_PREFORK, // N long-lived workers, each with its own SO_REUSEPORT listener
+    MODE_URING,   // Single process, io_uring completion loop (epoll if unavailable)
+    MODE_THREADS  // Single process: I/O threads feeding a work-stealing worker pool
+} ServerMode;
+
+static const char *mode_names[] = { "fork", "epoll", "prefork", "uring", "threads" };
+
+// Largest reply body: a BatchBookResponse with a result byte per entry
+#define MAX_REPLY_BODY (sizeof(BatchBookResponse) + BATCH_BOOK_MAX_ENTRIES)
+
+// A reply as it goes on the wire: header immediately followed by the body.
+// Only packet_len bytes of it are sent.
+typedef struct __attribute__((packed)) {
+    ProtocolHeader header;
+    union {
+        ServerResponse response;      // Every opcode except a successful batch or OP_STATS
+        BatchBookResponse batch;
+        StatsResponse stats;
+        uint8_t raw[MAX_REPLY_BODY];
+    } body;
+} SealedReply;
+
+void handle_connection(int client_socket);
+int process_request(ProtocolHeader *header, void *body_buffer, int body_len, void *reply_body, int *proto_version,
+                    uint64_t *journal_seq, uint64_t arrival_ns);
+void seal_response(ProtocolHeader *header, void *reply_body, int reply_len);
+void run_fork_server(int server_fd);
+void run_epoll_server(int server_fd);
+void run_prefork_server(int num_workers);
+void run_uring_server(int server_fd);
+void run_threads_server(int server_fd, int num_io, int num_workers);
+
+static void usage(const char *prog) {
+    fprintf(stderr, "Usage: %s [-m epoll|fork|prefork|uring|threads] [-w workers] [-i io-threads]\n"
+                    "          [-l sync|async|async-block|shm] [-b file]\n"
+                    "          [-e events] [-t tickets] [-j journal] [-g records[,us]] [-s state] [-S sec]\n"
+                    "          [-T prefix] [-A in-flight[,us[,ms]]] [-R rate[,burst]]\n", prog);
+    fprintf(stderr, "  -m epoll    single-process event loop (default)\n");
+    fprintf(stderr, "  -m fork     fork one child per connection\n");
+    fprintf(stderr, "  -m prefork  long-lived workers with SO_REUSEPORT listeners\n");
+    fprintf(stderr, "  -m uring    io_uring event loop: multishot accept/recv, batched sends\n"
+                    "              (falls back to epoll on kernels without io_uring)\n");
+    fprintf(stderr, "  -m threads  I/O threads (read, decrypt, write) feeding a work-stealing pool\n"
+                    "              of worker threads that run the requests\n");
+    fprintf(stderr, "  -w N        number of prefork workers or worker threads (default: one per core)\n");
+    fprintf(stderr, "  -i N        number of I/O threads in threads mode (default: one per %d cores)\n",
+            CORES_PER_IO_THREAD);
+    fprintf(stderr, "  -l sync     write each log line under a file lock (default)\n");
+    fprintf(stderr, "  -l async    queue log lines to a background flusher, drop when full\n");
+    fprintf(stderr, "  -l async-block  same, but wait for space instead of dropping\n");
+    fprintf(stderr, "  -l shm      per-process shared-memory rings drained by a collector process\n");
+    fprintf(stderr, "  -b file     write fixed-template events as binary records (decode with bin/logdecode)\n");
+    fprintf(stderr, "  -e N        number of events on sale (default %d, at most %d)\n",
+            DEFAULT_NUM_EVENTS, INVENTORY_MAX_EVENTS);
+    fprintf(stderr, "  -t N        initial tickets per event (default %d)\n", DEFAULT_TICKETS_PER_EVENT);
+    fprintf(stderr, "  -j file     write-ahead booking journal: SUCCESS only once the booking is on disk,\n"
+                    "              and a restart replays it (the file's events/tickets override -e/-t)\n");
+    fprintf(stderr, "  -g N[,US]   journal group commit: sync every N bookings or after US microseconds\n"
+                    "              (default %d,%d)\n", JOURNAL_DEFAULT_BATCH_RECORDS, JOURNAL_DEFAULT_BATCH_US);
+    fprintf(stderr, "  -s file     keep inventory and sessions in a memory-mapped state file instead of\n"
+                    "              SysV shared memory; a restart maps it and resumes (-e/-t only for a new file)\n");
+    fprintf(stderr, "  -S N        snapshot the state file every N seconds (default %d)\n", DEFAULT_SNAPSHOT_SEC);
+    fprintf(stderr, "  -T prefix   trace the phases of every request; each process writes prefix.<pid>.json\n"
+                    "              (Chrome trace) and prefix.<pid>.folded on exit (needs make TRACE=1)\n");
+    fprintf(stderr, "  -A N[,US[,MS]]  admission control: answer OP_RESPONSE_BUSY instead of executing once more\n"
+                    "              than N requests are in flight (0 = no limit), or once queueing delay has\n"
+                    "              stayed above US microseconds for MS ms (default %d,%d; US 0 = off)\n",
+            DEFAULT_ADMIT_DELAY_US, DEFAULT_ADMIT_INTERVAL_MS);
+    fprintf(stderr, "  -R N[,B]    shed requests beyond N/second per session, bursts of B (default N)\n");
+}
+
+int main(int argc, char *argv[]) {
+    int server_fd;
+    int shm_id;
+    ServerMode mode = MODE_EPOLL;
+    int num_workers = 0;
+    int num_io = 0;
+    const char *log_mode = "sync";
+    const char *binary_log = NULL;
+    int num_events = DEFAULT_NUM_EVENTS;
+    int tickets_per_event = DEFAULT_TICKETS_PER_EVENT;
+    const char *journal_path = NULL;
+    JournalConfig journal_config = { JOURNAL_DEFAULT_BATCH_RECORDS, JOURNAL_DEFAULT_BATCH_US, 0, 0 };
+    const char *state_path = NULL;
+    int snapshot_sec = DEFAULT_SNAPSHOT_SEC;
+    const char *trace_prefix = NULL;
+    AdmissionConfig admission_config = { 0, DEFAULT_ADMIT_DELAY_US, DEFAULT_ADMIT_INTERVAL_MS, 0, 0 };
+    int use_admission = 0;             // bit 0: -A given, bit 1: -R given
+    int opt;
+
+    while ((opt = getopt(argc, argv, "m:w:i:l:b:e:t:j:g:s:S:T:A:R:h")) != -1) {
+        switch (opt) {
+            case 'm': {
+                int found = 0;
+                for (size_t i = 0; i < sizeof(mode_names) / sizeof(mode_names[0]); i++) {
+                    if (strcmp(optarg, mode_names[i]) == 0) {
+                        mode = (ServerMode)i;
+                        found = 1;
+                    }
+                }
+                if (!found) {
+                    usage(argv[0]);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            }
+            case 'w':
+                num_workers = atoi(optarg);
+                if (num_workers <= 0) {
+                    fprintf(stderr, "Number of workers must be a positive integer.\n");
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'i':
+                num_io = atoi(optarg);
+                if (num_io <= 0) {
+                    fprintf(stderr, "Number of I/O threads must be a positive integer.\n");
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'l':
+                if (strcmp(optarg, "sync") != 0 && strcmp(optarg, "async") != 0 &&
+                    strcmp(optarg, "async-block") != 0 && strcmp(optarg, "shm") != 0) {
+                    usage(argv[0]);
+                    exit(EXIT_FAILURE);
+                }
+                log_mode = optarg;
+                break;
+            case 'b':
+                binary_log = optarg;
+                break;
+            case 'e':
+                num_events = atoi(optarg);
+                if (num_events <= 0 || num_events > INVENTORY_MAX_EVENTS) {
+                    fprintf(stderr, "Number of events must be between 1 and %d.\n", INVENTORY_MAX_EVENTS);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 't':
+                tickets_per_event = atoi(optarg);
+                if (tickets_per_event < 0) {
+                    fprintf(stderr, "Tickets per event must not be negative.\n");
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'j':
+                journal_path = optarg;
+                break;
+            case 'g': {
+                char *end;
+                long records = strtol(optarg, &end, 10);
+                long batch_us = journal_config.batch_us;
+                if (*end == ',') batch_us = strtol(end + 1, &end, 10);
+                if (*end != '\0' || records <= 0 || records > JOURNAL_RING_RECORDS || batch_us < 0) {
+                    fprintf(stderr, "Group commit must be N[,US] with 1 <= N <= %d.\n", JOURNAL_RING_RECORDS);
+                    exit(EXIT_FAILURE);
+                }
+                journal_config.batch_records = records;
+                journal_config.batch_us = batch_us;
+                break;
+            }
+            case 's':
+                state_path = optarg;
+                break;
+            case 'S':
+                snapshot_sec = atoi(optarg);
+                if (snapshot_sec <= 0) {
+                    fprintf(stderr, "Snapshot interval must be a positive number of seconds.\n");
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'T':
+                trace_prefix = optarg;
+                break;
+            case 'A': {
+                char *end;
+                long in_flight = strtol(optarg, &end, 10);
+                long delay_us = admission_config.target_delay_us;
+                long interval_ms = admission_config.interval_ms;
+                if (*end == ',') delay_us = strtol(end + 1, &end, 10);
+                if (*end == ',') interval_ms = strtol(end + 1, &end, 10);
+                if (*end != '\0' || in_flight < 0 || in_flight > INT32_MAX || delay_us < 0 || delay_us > INT32_MAX ||
+                    interval_ms <= 0 || interval_ms > INT32_MAX) {
+                    fprintf(stderr, "Admission control must be N[,US[,MS]] with N, US >= 0 and MS > 0.\n");
+                    exit(EXIT_FAILURE);
+                }
+                admission_config.max_in_flight = in_flight;
+                admission_config.target_delay_us = delay_us;
+                admission_config.interval_ms = interval_ms;
+                use_admission |= 1;
+                break;
+            }
+            case 'R': {
+                char *end;
+                long rate = strtol(optarg, &end, 10);
+                long burst = 0;
+                if (*end == ',') burst = strtol(end + 1, &end, 10);
+                if (*end != '\0' || rate <= 0 || rate > 1000000 || burst < 0 || burst > 1000000) {
+                    fprintf(stderr, "Session rate limit must be N[,B] with 1 <= N <= 1000000.\n");
+                    exit(EXIT_FAILURE);
+                }
+                admission_config.session_rate = rate;
+                admission_config.session_burst = burst;
+                use_admission |= 2;
+                break;
+            }
+            default:
+                usage(argv[0]);
+                exit(EXIT_FAILURE);
+        }
+    }
+
+    // A client that disconnects mid-write must not kill the server
+    signal(SIGPIPE, SIG_IGN);
+
+    // Initialize logger
+    if (strcmp(log_mode, "async") == 0) {
+        init_logger_async("server.log", 0, LOG_FULL_DROP);
+    } else if (strcmp(log_mode, "async-block") == 0) {
+        init_logger_async("server.log", 0, LOG_FULL_BLOCK);
+    } else if (strcmp(log_mode, "shm") == 0) {
+        init_logger_shm("server.log", 0, 0);
+    } else {
+        init_logger("server.log");
+    }
+    if (binary_log) {
+        init_binary_log(binary_log);
+    }
+    log_message(LOG_INFO, "Server starting up (%s mode, %s logging%s%s)", mode_names[mode], log_mode,
+                binary_log ? ", binary events to " : "", binary_log ? binary_log : "");
+
+    // Before any fork: every worker records into the same segment
+    metrics = metrics_create();
+    if (use_admission) {
+        // -R alone only rate-limits sessions
+        if (!(use_admission & 1)) admission_config.target_delay_us = 0;
+        admission = admission_create(&admission_config);
+        if (!admission) exit(EXIT_FAILURE);
+    }
+    if (trace_prefix) {
+#ifdef TRACE_ENABLED
+        trace_init(trace_prefix);
+#else
+        fprintf(stderr, "Tracing is not compiled in; rebuild with make TRACE=1 to use -T\n");
+#endif
+    }
+
+    // Shared state: a memory-mapped file that survives restarts, or a SysV segment
+    struct timespec map_start, map_end;
+    clock_gettime(CLOCK_MONOTONIC, &map_start);
+    if (state_path) {
+        if (state_file_open(&state_file, state_path, STATE_LAYOUT_VERSION, SHM_SIZE) < 0) {
+            fprintf(stderr, "Cannot open state file %s\n", state_path);
+            exit(EXIT_FAILURE);
+        }
+        atexit(close_state_file);
+        shared = (struct shared_data *)state_file.data;
+    } else {
+        shm_id = shmget(SHM_KEY, SHM_SIZE, IPC_CREAT | 0666);
+        if (shm_id < 0 && errno == EINVAL) {
+            // A segment left over from an older build is too small: replace it
+            int stale_id = shmget(SHM_KEY, 0, 0);
+            if (stale_id >= 0) shmctl(stale_id, IPC_RMID, NULL);
+            shm_id = shmget(SHM_KEY, SHM_SIZE, IPC_CREAT | 0666);
+        }
+        if (shm_id < 0) {
+            perror("shmget failed");
+            exit(EXIT_FAILURE);
+        }
+        shared = (struct shared_data *)shmat(shm_id, NULL, 0);
+        if (shared == (struct shared_data *)-1) {
+            perror("shmat failed");
+            exit(EXIT_FAILURE);
+        }
+    }
+    sessions = (SessionTable *)((char *)shared + SESSIONS_OFFSET);
+
+    // An existing state file already holds inventory and sessions: use them as they are
+    int restored = state_path && !state_file.created;
+    if (restored) {
+        clock_gettime(CLOCK_MONOTONIC, &map_end);
+        num_events = shared->num_events;
+        printf("State file %s: resumed %s shutdown, snapshot %lu, in %.2f ms\n", state_path,
+               state_file.clean ? "after a clean" : "after an unclean",
+               (unsigned long)state_file.header->snapshot_gen,
+               (map_end.tv_sec - map_start.tv_sec) * 1e3 + (map_end.tv_nsec - map_start.tv_nsec) / 1e6);
+        log_message(LOG_INFO, "State file %s resumed (%u events, %u sessions)", state_path,
+                    shared->num_events, atomic_load(&sessions->count));
+    } else {
+        shared->num_events = num_events;
+        session_table_init(sessions, SESSION_CAPACITY, SESSION_TTL_SEC);
+    }
+
+    // Inventory: from the journal when there is one, unless the state file is
+    // known to be current. After a reboot without a clean shutdown pages that
+    // were never snapshotted may be lost, so the journal is replayed instead.
+    int journal_existed = journal_path && access(journal_path, F_OK) == 0;
+    if (journal_path) {
+        journal_config.skip_replay = restored && (state_file.clean || state_file.same_boot);
+        long replayed = journal_open(journal_path, &journal_config, shared->events,
+                                     &shared->num_events, tickets_per_event);
+        if (replayed < 0) {
+            fprintf(stderr, "Cannot open booking journal %s\n", journal_path);
+            exit(EXIT_FAILURE);
+        }
+        num_events = shared->num_events;
+        printf("Booking journal %s: replayed %ld bookings (group commit %u records / %u us)\n",
+               journal_path, replayed, journal_config.batch_records, journal_config.batch_us);
+        log_message(LOG_INFO, "Booking journal %s: replayed %ld bookings", journal_path, replayed);
+    } else if (!restored) {
+        for (int i = 0; i < num_events; i++) {
+            inventory_set(&shared->events[i].tickets, tickets_per_event);
+        }
+    }
+
+    start_session_sweeper();
+    if (state_path) start_state_snapshotter(snapshot_sec);
+    install_shutdown_handlers();
+
+    if (mode == MODE_PREFORK) {
+        // Workers open their own listeners; the parent only supervises
+        if (num_workers == 0) {
+            num_workers = (int)sysconf(_SC_NPROCESSORS_ONLN);
+            if (num_workers <= 0) num_workers = 1;
+        }
+        printf("Server listening on port %d (%d workers)\n", PORT, num_workers);
+        print_inventory(!restored && !journal_existed, tickets_per_event);
+        fflush(stdout);
+        run_prefork_server(num_workers);
+        return 0;
+    }
+
+    // Create server socket
+    if ((server_fd = create_server_socket(PORT, 0)) < 0) {
+        perror("create_server_socket failed");
+        exit(EXIT_FAILURE);
+    }
+
+    printf("Server listening on port %d\n", PORT);
+    print_inventory(!restored && !journal_existed, tickets_per_event);
+
+    if (mode == MODE_FORK) {
+        run_fork_server(server_fd);
+    } else if (mode == MODE_URING) {
+        run_uring_server(server_fd);
+    } else if (mode == MODE_THREADS) {
+        int cores = (int)sysconf(_SC_NPROCESSORS_ONLN);
+        if (cores <= 0) cores = 1;
+        if (num_io == 0) num_io = cores / CORES_PER_IO_THREAD > 0 ? cores / CORES_PER_IO_THREAD : 1;
+        if (num_workers == 0) num_workers = cores;
+        run_threads_server(server_fd, num_io, num_workers);
+    } else {
+        run_epoll_server(server_fd);
+    }
+
+    close(server_fd);
+    return 0;
+}
+
+// ==========================================
+// Prefork mode: long-lived workers with SO_REUSEPORT listeners
+// ==========================================
+// Each worker binds its own listener on PORT with SO_REUSEPORT and runs the
+// event loop on it, so the kernel spreads incoming connections across
+// workers instead of one parent serializing every accept(). All workers
+// attach to the same shared_data segment.
+
+static pid_t spawn_worker(int worker_id) {
+    pid_t pid = fork();
+    if (pid != 0) return pid;
+
+    // Worker process: exit together with the supervisor
+    prctl(PR_SET_PDEATHSIG, SIGTERM);
+    if (getppid() == 1) exit(0);
+
+    metrics_set_worker(worker_id);
+    int listen_fd = create_server_socket(PORT, SERVER_SOCKET_REUSEPORT);
+    if (listen_fd < 0) {
+        log_message(LOG_ERROR, "Worker %d could not open its listener", worker_id);
+        exit(EXIT_FAILURE);
+    }
+    log_message(LOG_INFO, "Worker %d (pid %d) ready", worker_id, getpid());
+    run_epoll_server(listen_fd);
+    exit(0);
+}
+
+void run_prefork_server(int num_workers) {
+    // Probe the port once so a bind error is reported here instead of
+    // from every worker.
+    int probe_fd = create_server_socket(PORT, SERVER_SOCKET_REUSEPORT);
+    if (probe_fd < 0) {
+        perror("create_server_socket failed");
+        exit(EXIT_FAILURE);
+    }
+    // Closed before forking: a listener nobody accepts on would still be
+    // handed its share of connections by the kernel.
+    close(probe_fd);
+
+    pid_t *workers = calloc(num_workers, sizeof(pid_t));
+    if (!workers) {
+        perror("calloc failed");
+        exit(EXIT_FAILURE);
+    }
+
+    for (int i = 0; i < num_workers; i++) {
+        workers[i] = spawn_worker(i);
+        if (workers[i] < 0) {
+            perror("fork failed");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    // Supervise: restart workers that crash, give up on ones that fail to start
+    int alive = num_workers;
+    int forwarded = 0;
+    while (alive > 0) {
+        // Checked before every wait(): the signal may have landed while we were
+        // restarting a worker, not only while blocked in wait()
+        if (server_stopping && !forwarded) {
+            // Forward the shutdown to every worker, then keep reaping
+            for (int i = 0; i < num_workers; i++) {
+                if (workers[i] > 0) kill(workers[i], SIGTERM);
+            }
+            forwarded = 1;
+        }
+
+        int status;
+        pid_t pid = wait(&status);
+        if (pid < 0) {
+            if (errno == EINTR) continue;
+            perror("wait failed");
+            break;
+        }
+
+        for (int i = 0; i < num_workers; i++) {
+            if (workers[i] != pid) continue;
+
+            if (WIFSIGNALED(status) && !server_stopping) {
+                log_message(LOG_ERROR, "Worker %d (pid %d) killed by signal %d, restarting", i, pid, WTERMSIG(status));
+                workers[i] = spawn_worker(i);
+                if (workers[i] > 0) break;
+            } else if (WIFSIGNALED(status)) {
+                log_message(LOG_ERROR, "Worker %d (pid %d) killed by signal %d", i, pid, WTERMSIG(status));
+            } else {
+                log_message(LOG_ERROR, "Worker %d (pid %d) exited with status %d", i, pid, WEXITSTATUS(status));
+            }
+            workers[i] = 0;
+            alive--;
+            break;
+        }
+    }
+
+    free(workers);
+}
+
+// ==========================================
+// Fork mode: one child process per connection
+// ==========================================
+void run_fork_server(int server_fd) {
+    int client_socket;
+    struct sockaddr_in client_addr;
+    socklen_t client_addr_len = sizeof(client_addr);
+
+    // Let the kernel reap finished children so they do not pile up as zombies
+    signal(SIGCHLD, SIG_IGN);
+
+    // 4. Accept connections in a loop
+    while (!server_stopping) {
+        if ((client_socket = accept(server_fd, (struct sockaddr *)&client_addr, &client_addr_len)) < 0) {
+            if (errno == EINTR) continue;
+            perror("accept failed");
+            continue; // Continue to next iteration
+        }
+        set_tcp_nodelay(client_socket); // Replies are small: send them without waiting on Nagle
+
+        char client_ip[INET_ADDRSTRLEN];
+        inet_ntop(AF_INET, &client_addr.sin_addr, client_ip, INET_ADDRSTRLEN);
+        printf("Connection accepted from %s:%d\n", client_ip, ntohs(client_addr.sin_port));
+        log_accepted(&client_addr);
+
+        // Fork a child process to handle the connection
+        pid_t pid = fork();
+        if (pid < 0) {
+            perror("fork failed");
+            close(client_socket);
+            continue;
+        } else if (pid == 0) {
+            // Child process
+            close(server_fd); // Child doesn't need the listening socket
+            signal(SIGTERM, SIG_DFL);
+            signal(SIGINT, SIG_DFL);
+
+            // Seed the random number generator
+            srand(time(NULL) ^ getpid());
+            metrics_claim_worker();
+
+            // Set Timeout (10 seconds)
+            struct timeval tv;
+            tv.tv_sec = CLIENT_TIMEOUT_SEC;
+            tv.tv_usec = 0;
+            if (setsockopt(client_socket, SOL_SOCKET, SO_RCVTIMEO, (const char*)&tv, sizeof tv) < 0) {
+                perror("setsockopt failed (RCVTIMEO)");
+            }
+
+            // Handle the connection
+            handle_connection(client_socket);
+            close(client_socket);
+            exit(0);
+        } else {
+            // Parent process
+            close(client_socket); // Parent doesn't need the client socket
+            // Continue to accept next connection
+        }
+    }
+}
+
+// Replies that confirm bookings may only leave once the journal has them on disk.
+// If the journal cannot commit, the connection is dropped instead: the client
+// never sees a SUCCESS that a restart could take back.
+static int wait_durable(uint64_t journal_seq) {
+    if (journal_seq == 0) return 0;
+    uint64_t start = monotonic_ns();
+    TRACE_START(trace_t);
+    int ret = journal_wait(journal_seq);
+    TRACE_PHASE(trace_t, TRACE_JOURNAL_WAIT, 0);
+    metrics_wait(METRICS_WAIT_JOURNAL, monotonic_ns() - start);
+    if (ret == 0) return 0;
+    log_message(LOG_ERROR, "Booking journal unavailable, dropping connection");
+    return -1;
+}
+
+void handle_connection(int client_socket) {
+    // Receive and reply buffers live on the child's stack: no heap use per request
+    char rx_storage[RX_BUFFER_SIZE];
+    char tx[TX_FLUSH_BYTES + sizeof(SealedReply)];
+    FrameReader reader;
+    frame_reader_init(&reader, rx_storage, sizeof(rx_storage), MAX_PACKET_LEN);
+    int proto_version = PROTOCOL_V1; // Until the client negotiates v2 at login
+
+    // Loop to handle multiple requests from the same client.
+    // Each read may bring in several pipelined requests; all are answered with one write.
+    ssize_t read_ret;
+    while ((read_ret = frame_reader_fill(&reader, client_socket)) > 0) {
+        ProtocolHeader header;
+        void *body_buffer;
+        size_t tx_len = 0;
+        uint64_t journal_seq = 0;  // Bookings among the queued replies must be durable before they go out
+        uint64_t arrival_ns = monotonic_ns();
+        int ret;
+
+        while ((ret = frame_reader_next(&reader, &header, &body_buffer)) > 0) {
+            // 1. Decrypt body, verify checksum, check session and dispatch
+            SealedReply *reply = (SealedReply *)(tx + tx_len);
+            int body_len = header.packet_len - sizeof(ProtocolHeader);
+            int reply_len = process_request(&header, body_buffer, body_len, &reply->body, &proto_version,
+                                            &journal_seq, arrival_ns);
+            if (reply_len < 0) {
+                close(client_socket);
+                return;
+            }
+
+            // 2. Queue the sealed response
+            reply->header = header;
+            seal_response(&reply->header, &reply->body, reply_len);
+            tx_len += sizeof(ProtocolHeader) + reply_len;
+            if (tx_len >= TX_FLUSH_BYTES) {
+                // A failed or partial write leaves the stream in an unknown state: never resend
+                if (wait_durable(journal_seq) < 0 || write_n_bytes(client_socket, tx, tx_len) <= 0) {
+                    close(client_socket);
+                    return;
+                }
+                tx_len = 0;
+            }
+        }
+        if (ret < 0) {
+            printf("Invalid packet length: %u\n", header.packet_len);
+            LOG_EVENT(LT_BAD_PACKET_LEN, header.packet_len);
+            break;
+        }
+
+        // 3. Send the responses
+        if (tx_len > 0 && (wait_durable(journal_seq) < 0 || write_n_bytes(client_socket, tx, tx_len) <= 0)) break;
+    }
+
+    if (read_ret == 0) {
+        printf("Client disconnected.\n");
+    } else if (read_ret < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+        fprintf(stderr, "Request Timed Out (read)\n");
+    } else if (read_ret < 0) {
+        perror("read failed");
+    }
+
+    close(client_socket);
+}
+
+// ==========================================
+// Protocol logic shared by every server mode
+// ==========================================
+
+// Outcome of a request, before it is encoded for the connection's protocol version
+typedef struct {
+    uint8_t status;              // RespStatus
+    uint32_t remaining_tickets;
+    uint32_t user_id;            // BOOK: quoted in the v1 success message
+    uint64_t journal_seq;        // Booking journal record; the reply waits until it is durable
+} RequestResult;
+
+// Takes a request whose header is already decrypted and whose body (if any)
+// is still encrypted. Decrypts the body while verifying the checksum, validates the
+// session and runs the opcode handler. On return `header` and `reply_body` hold
+// the (cleartext) reply; `reply_body` must have room for MAX_REPLY_BODY bytes.
+// `proto_version` is the connection's negotiated protocol version (LOGIN may change it).
+// A booking raises `*journal_seq` to its journal record: the caller must not
+// send the reply before journal_wait() on it succeeds.
+// `arrival_ns` is when the request was read; with admission control (-A / -R)
+// an overloaded server answers OP_RESPONSE_BUSY without decrypting the body.
+// Returns the reply body length, or -1 if the connection must be dropped.
+static int handle_opcode(ProtocolHeader *header, void *body_buffer, int body_len,
+                         int *proto_version, void *reply_body, RequestResult *result);
+static int encode_reply(uint16_t opcode, const RequestResult *result, int proto_version, void *reply_body);
+static int open_request(ProtocolHeader *header, void *body_buffer, int body_len);
+static int run_request(ProtocolHeader *header, void *body_buffer, int body_len, void *reply_body,
+                       int *proto_version, uint64_t *journal_seq, uint64_t start_ns);
+static int encode_busy(ProtocolHeader *header, BusyReason reason, uint32_t retry_after_ms, void *reply_body);
+
+int process_request(ProtocolHeader *header, void *body_buffer, int body_len, void *reply_body, int *proto_version,
+                    uint64_t *journal_seq, uint64_t arrival_ns) {
+    uint64_t start = monotonic_ns();
+    if (admission) {
+        uint32_t retry_after_ms;
+        admission_observe(admission, start - arrival_ns, start);
+        BusyReason reason = admission_admit(admission, header->session_id, start, &retry_after_ms);
+        if (reason != BUSY_NONE) return encode_busy(header, reason, retry_after_ms, reply_body);
+    }
+
+    int reply_len = -1;
+    if (open_request(header, body_buffer, body_len) == 0) {
+        reply_len = run_request(header, body_buffer, body_len, reply_body, proto_version, journal_seq, start);
+    }
+    if (admission) admission_done(admission);
+    return reply_len;
+}
+
+// The reply to a request shed by admission control. Only the header has been
+// decrypted; the reply keeps its req_id, session and checksum algorithm.
+static int encode_busy(ProtocolHeader *header, BusyReason reason, uint32_t retry_after_ms, void *reply_body) {
+    BusyResponse *busy = reply_body;
+    busy->retry_after_ms = retry_after_ms;
+    busy->reason = reason;
+    metrics_shed(reason, header->packet_len, sizeof(ProtocolHeader) + sizeof(BusyResponse));
+    header->opcode = OP_RESPONSE_BUSY | (header->opcode & OP_FLAG_CRC32C);
+    return sizeof(BusyResponse);
+}
+
+// Decrypt the body and verify the full-packet checksum in a single pass.
+// OP_FLAG_CRC32C selects CRC32C instead of the byte sum.
+// Returns -1 on a checksum mismatch: the connection must be dropped.
+static int open_request(ProtocolHeader *header, void *body_buffer, int body_len) {
+    TRACE_START(trace_t);
+    if (packet_open_body(header, body_buffer, body_len > 0 ? (size_t)body_len : 0) < 0) {
+        printf("Checksum mismatch! (received %u)\n", header->checksum);
+        metrics_checksum_error(header->packet_len);
+        return -1;
+    }
+    TRACE_PHASE(trace_t, TRACE_DECRYPT_CHECKSUM, header->req_id);
+    return 0;
+}
+
+// The rest of process_request() for a request open_request() has accepted.
+// `start_ns` is when the request was picked up, for the latency metrics.
+static int run_request(ProtocolHeader *header, void *body_buffer, int body_len, void *reply_body,
+                       int *proto_version, uint64_t *journal_seq, uint64_t start_ns) {
+    uint32_t bytes_in = header->packet_len;
+    TRACE_START(trace_t);
+
+    // Option flags are not part of the opcode proper; the checksum choice is echoed on the reply
+    uint16_t flags = header->opcode & OP_FLAG_CRC32C;
+    uint16_t opcode = header->opcode & ~OP_FLAG_MASK;
+    header->opcode = opcode;
+
+    printf("Received request: packet_len=%u, opcode=0x%X, req_id=%u, session_id=%u\n",
+           header->packet_len, header->opcode, header->req_id, header->session_id);
+    LOG_EVENT(LT_REQUEST_RECEIVED, header->opcode, header->req_id, header->session_id);
+    TRACE_PHASE(trace_t, TRACE_LOG, header->req_id);
+
+    // Validate Session (unless Login)
+    RequestResult result = { .status = RESP_OK };
+    int reply_len = 0;
+    int session_ok = opcode == OP_LOGIN || is_valid_session(header->session_id);
+    TRACE_PHASE(trace_t, TRACE_SESSION, header->req_id);
+    if (!session_ok) {
+        printf("Invalid Session ID: %u\n", header->session_id);
+        metrics_invalid_session();
+        result.status = RESP_INVALID_SESSION;
+    } else {
+        reply_len = handle_opcode(header, body_buffer, body_len, proto_version, reply_body, &result);
+    }
+    int encoded = reply_len == 0;
+    if (encoded) {
+        reply_len = encode_reply(opcode, &result, *proto_version, reply_body);
+    }
+    TRACE_PHASE(trace_t, TRACE_HANDLE, header->req_id);
+
+    header->opcode = (result.status == RESP_OK ? OP_RESPONSE_SUCCESS : OP_RESPONSE_FAIL) | flags;
+    // OP_FLAG_COMPACT marks a CompactResponse body; a batch reply keeps its own format
+    if (encoded && *proto_version >= PROTOCOL_V2) header->opcode |= OP_FLAG_COMPACT;
+    if (result.journal_seq > *journal_seq) *journal_seq = result.journal_seq;
+    metrics_request(opcode, result.status == RESP_OK, monotonic_ns() - start_ns, bytes_in,
+                    sizeof(ProtocolHeader) + reply_len);
+    return reply_len;
+}
+
+// Text of a v1 message (and of a v2 error)
+static const char *reply_text(uint16_t opcode, uint8_t status) {
+    switch (status) {
+        case RESP_OK:
+            return opcode == OP_LOGIN ? "Login Successful" : "Query successful.";
+        case RESP_INVALID_SESSION:
+            return "Invalid Session ID. Please Login.";
+        case RESP_SOLD_OUT:
+            return "Booking failed: not enough tickets.";
+        case RESP_BAD_REQUEST:
+            return opcode == OP_BATCH_BOOK ? "Malformed batch." : "Missing body.";
+        case RESP_SERVER_BUSY:
+            return "Server busy: session table full.";
+        case RESP_UNKNOWN_EVENT:
+            return "Unknown event.";
+        default:
+            return "Unknown operation.";
+    }
+}
+
+// v1: the fixed ServerResponse with a formatted message.
+// v2: a CompactResponse; text is only attached to errors.
+static int encode_reply(uint16_t opcode, const RequestResult *result, int proto_version, void *reply_body) {
+    if (proto_version >= PROTOCOL_V2) {
+        CompactResponse *out = reply_body;
+        out->status = result->status;
+        out->remaining_tickets = result->remaining_tickets;
+        out->text_len = 0;
+        if (result->status != RESP_OK) {
+            const char *text = reply_text(opcode, result->status);
+            out->text_len = strlen(text);
+            memcpy(out->text, text, out->text_len);
+        }
+        return sizeof(CompactResponse) + out->text_len;
+    }
+
+    ServerResponse *response = reply_body;
+    memset(response, 0, sizeof(ServerResponse)); // Clear response buffer
+    response->remaining_tickets = result->remaining_tickets;
+    if (result->status == RESP_OK && opcode == OP_BOOK_TICKET) {
+        sprintf(response->message, "Booking successful for user %u.", result->user_id);
+    } else {
+        strcpy(response->message, reply_text(opcode, result->status));
+    }
+    return sizeof(ServerResponse);
+}
+
+// Finds the inventory of the event named by the optional uint32_t that
+// follows the first `base_len` bytes of the body (event 0 when absent).
+// Returns NULL for an event ID that is out of range.
+static atomic_int *request_event(const void *body, int body_len, size_t base_len, uint32_t *event_id) {
+    *event_id = DEFAULT_EVENT_ID;
+    if (body_len >= (int)(base_len + sizeof(uint32_t))) {
+        memcpy(event_id, (const char *)body + base_len, sizeof(uint32_t));
+    }
+    return inventory_event(shared->events, shared->num_events, *event_id);
+}
+
+// Runs the handler for a verified request whose session has been checked:
+// fills `result`, and sets the session ID in `header` for LOGIN. Returns 0 when
+// the reply still has to be encoded from `result`, or the length of a body it
+// wrote itself (batch).
+static int handle_opcode(ProtocolHeader *header, void *body_buffer, int body_len,
+                         int *proto_version, void *reply_body, RequestResult *result) {
+    switch (header->opcode) {
+        case OP_LOGIN: {
+            LOG_EVENT(LT_LOGIN_PROCESSING);
+            // Optional body: the protocol version the client wants for this connection
+            if (body_len >= (int)sizeof(LoginRequest)) {
+                LoginRequest *login = (LoginRequest *)body_buffer;
+                *proto_version = login->protocol_version >= PROTOCOL_V2 ? PROTOCOL_V2 : PROTOCOL_V1;
+            } else {
+                *proto_version = PROTOCOL_V1;
+            }
+
+            // Generate new Session ID (retry on the rare collision)
+            uint32_t new_session_id;
+            int added;
+            do {
+                new_session_id = ((uint32_t)rand() << 16) ^ (uint32_t)rand();
+                added = add_session(new_session_id);
+            } while (added == 0);
+
+            if (added < 0) {
+                result->status = RESP_SERVER_BUSY;
+                LOG_EVENT(LT_LOGIN_TABLE_FULL);
+                break;
+            }
+            
+            // The response header carries the session_id back to the client.
+            header->session_id = new_session_id; // Set for response
+            LOG_EVENT(LT_LOGIN_OK, new_session_id);
+            break;
+        }
+
+        case OP_QUERY_AVAILABILITY: {
+            LOG_EVENT(LT_QUERY_PROCESSING);
+            uint32_t event_id;
+            atomic_int *tickets = request_event(body_buffer, body_len, 0, &event_id);
+            if (!tickets) {
+                result->status = RESP_UNKNOWN_EVENT;
+                break;
+            }
+            result->remaining_tickets = inventory_query(tickets);
+            break;
+        }
+
+        case OP_BOOK_TICKET: {
+            LOG_EVENT(LT_BOOK_PROCESSING);
+            if (body_len < (int)sizeof(BookRequest)) {
+                result->status = RESP_BAD_REQUEST;
+                break;
+            }
+            BookRequest *req_body = (BookRequest *)body_buffer;
+            uint32_t event_id;
+            atomic_int *tickets = request_event(body_buffer, body_len, sizeof(BookRequest), &event_id);
+            if (!tickets) {
+                result->status = RESP_UNKNOWN_EVENT;
+                break;
+            }
+            
+            int remaining;
+            if (inventory_try_book(tickets, req_body->num_tickets, &remaining)) {
+                result->user_id = req_body->user_id;
+                result->journal_seq = journal_append(event_id, req_body->num_tickets, req_body->user_id);
+                LOG_EVENT(LT_BOOK_OK, req_body->num_tickets, req_body->user_id, remaining);
+            } else {
+                result->status = RESP_SOLD_OUT;
+                LOG_EVENT(LT_BOOK_FAIL, req_body->num_tickets, remaining);
+            }
+            result->remaining_tickets = remaining;
+            break;
+        }
+
+        case OP_BATCH_BOOK: {
+            BatchBookRequest *batch = (BatchBookRequest *)body_buffer;
+            if (body_len < (int)sizeof(BatchBookRequest) || batch->count == 0 ||
+                batch->count > BATCH_BOOK_MAX_ENTRIES ||
+                (size_t)body_len < sizeof(BatchBookRequest) + batch->count * sizeof(BookRequest)) {
+                result->status = RESP_BAD_REQUEST;
+                break;
+            }
+            uint32_t count = batch->count;
+            uint32_t event_id;
+            atomic_int *tickets = request_event(body_buffer, body_len,
+                                                sizeof(BatchBookRequest) + count * sizeof(BookRequest), &event_id);
+            if (!tickets) {
+                result->status = RESP_UNKNOWN_EVENT;
+                break;
+            }
+            LOG_EVENT(LT_BATCH_PROCESSING, count);
+
+            // The whole batch is applied with a single CAS on the event's inventory.
+            // Its reply is already compact and is the same in v1 and v2.
+            BatchBookResponse *out = reply_body;
+            int remaining;
+            int booked = inventory_try_book_batch(tickets, batch->entries, count,
+                                                  out->results, &remaining);
+            out->remaining_tickets = remaining;
+            out->count = count;
+            // One journal record per booked entry so each user's tickets are
+            // attributed to them; the reply waits for the last of them
+            for (uint32_t i = 0; booked > 0 && i < count; i++) {
+                if (out->results[i] != BATCH_RESULT_BOOKED) continue;
+                uint64_t seq = journal_append(event_id, batch->entries[i].num_tickets, batch->entries[i].user_id);
+                if (seq > result->journal_seq) result->journal_seq = seq;
+            }
+            LOG_EVENT(LT_BATCH_DONE, booked, count, remaining);
+            return sizeof(BatchBookResponse) + count;
+        }
+
+        case OP_STATS: {
+            // Totals over every worker; the same format in v1 and v2
+            metrics_fill_stats(metrics, reply_body);
+            return sizeof(StatsResponse);
+        }
+
+        default: {
+            printf("Unknown opcode: 0x%X\n", header->opcode);
+            LOG_EVENT(LT_UNKNOWN_OPCODE, header->opcode);
+            result->status = RESP_UNKNOWN_OPCODE;
+            break;
+        }
+    }
+
+    return 0;
+}
+
+// Fill in length and checksum of a reply, then encrypt it in place
+void seal_response(ProtocolHeader *header, void *reply_body, int reply_len) {
+    header->packet_len = sizeof(ProtocolHeader) + reply_len;
+    TRACE_START(trace_t);
+
+    // Checksum (same algorithm the request used) and encrypt in one pass
+    uint16_t req_id = header->req_id;
+    packet_seal(header, reply_body, reply_len);
+    TRACE_PHASE(trace_t, TRACE_SEAL, req_id);
+}
+
+// ==========================================
+// Epoll mode: single-process event loop
+// ==========================================
+// Every connection owns a FrameReader and an output buffer. Each read pulls
+// in as much as the socket has; every complete frame in the input buffer is
+// processed (clients may pipeline many requests) and the sealed replies are
+// appended to the output buffer, which goes out in one write.
+// The protocol work itself is the same process_request() used by fork mode.
+
+typedef enum {
+    CONN_READING,   // Waiting for requests
+    CONN_WRITING    // Output buffer blocked on a full socket; not reading meanwhile
+} ConnState;
+
+struct connection {
+    int fd;
+    ConnState state;
+    FrameReader rx;              // Received bytes not yet consumed
+    int proto_version;           // PROTOCOL_V1 until negotiated at login
+    char *tx;                    // Sealed replies waiting to be written
+    size_t tx_len;
+    size_t tx_off;               // Bytes of tx already written
+    size_t tx_cap;
+    uint64_t journal_seq;        // Latest booking among the replies; they wait until it is durable
+    time_t last_active;
+};
+
+// Connections indexed by fd
+static struct connection **conn_table = NULL;
+static int conn_table_size = 0;
+
+static struct connection *conn_open(int epoll_fd, int fd) {
+    if (fd >= conn_table_size) {
+        int new_size = conn_table_size ? conn_table_size : 1024;
+        while (new_size <= fd) new_size *= 2;
+        struct connection **grown = realloc(conn_table, new_size * sizeof(*grown));
+        if (!grown) return NULL;
+        memset(grown + conn_table_size, 0, (new_size - conn_table_size) * sizeof(*grown));
+        conn_table = grown;
+        conn_table_size = new_size;
+    }
+
+    struct connection *conn = calloc(1, sizeof(struct connection));
+    if (!conn) return NULL;
+    conn->fd = fd;
+    conn->state = CONN_READING;
+    conn->proto_version = PROTOCOL_V1;
+    conn->last_active = time(NULL);
+    void *rx_storage = malloc(RX_BUFFER_SIZE);
+    if (!rx_storage) {
+        free(conn);
+        return NULL;
+    }
+    frame_reader_init(&conn->rx, rx_storage, RX_BUFFER_SIZE, MAX_PACKET_LEN);
+
+    struct epoll_event ev = { .events = EPOLLIN, .data.ptr = conn };
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+        perror("epoll_ctl ADD failed");
+        free(conn->rx.buf);
+        free(conn);
+        return NULL;
+    }
+    conn_table[fd] = conn;
+    return conn;
+}
+
+static void conn_close(int epoll_fd, struct connection *conn) {
+    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, conn->fd, NULL);
+    close(conn->fd);
+    conn_table[conn->fd] = NULL;
+    free(conn->rx.buf);
+    free(conn->tx);
+    free(conn);
+}
+
+static void conn_set_events(int epoll_fd, struct connection *conn, uint32_t events) {
+    struct epoll_event ev = { .events = events, .data.ptr = conn };
+    epoll_ctl(epoll_fd, EPOLL_CTL_MOD, conn->fd, &ev);
+}
+
+// Write as much of the queued replies as the socket accepts.
+// Returns 1 when the queue is empty, 0 if the socket is full, -1 on error.
+static int conn_flush(struct connection *conn) {
+    while (conn->tx_off < conn->tx_len) {
+        TRACE_START(trace_t);
+        ssize_t n = write(conn->fd, conn->tx + conn->tx_off, conn->tx_len - conn->tx_off);
+        TRACE_PHASE(trace_t, TRACE_WRITE, 0);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) return 0;
+            perror("write failed");
+            return -1;
+        }
+        conn->tx_off += n;
+    }
+    conn->tx_off = conn->tx_len = 0;
+    return 1;
+}
+
+// Reserve room for one more (largest possible) reply at the end of the output buffer
+static SealedReply *conn_reply_slot(struct connection *conn) {
+    if (conn->tx_len + sizeof(SealedReply) > conn->tx_cap) {
+        size_t new_cap = conn->tx_cap ? conn->tx_cap * 2 : TX_FLUSH_BYTES + sizeof(SealedReply);
+        char *grown = realloc(conn->tx, new_cap);
+        if (!grown) return NULL;
+        conn->tx = grown;
+        conn->tx_cap = new_cap;
+    }
+    return (SealedReply *)(conn->tx + conn->tx_len);
+}
+
+// Run every complete frame in the input buffer and queue the replies.
+// Returns the number of requests run, or -1 to drop the connection.
+static int conn_process_frames(struct connection *conn) {
+    ProtocolHeader header;
+    void *body;
+    int ret;
+    int frames = 0;
+    uint64_t arrival_ns = monotonic_ns(); // Every frame here came in with the last read
+    while ((ret = frame_reader_next(&conn->rx, &header, &body)) > 0) {
+        SealedReply *reply = conn_reply_slot(conn);
+        if (!reply) return -1;
+
+        // The body is decrypted in place inside the receive buffer
+        int body_len = header.packet_len - sizeof(ProtocolHeader);
+        int reply_len = process_request(&header, body, body_len, &reply->body, &conn->proto_version,
+                                        &conn->journal_seq, arrival_ns);
+        if (reply_len < 0) return -1;
+
+        reply->header = header;
+        seal_response(&reply->header, &reply->body, reply_len);
+        conn->tx_len += sizeof(ProtocolHeader) + reply_len;
+        frames++;
+    }
+    if (ret < 0) {
+        printf("Invalid packet length: %u\n", header.packet_len);
+        LOG_EVENT(LT_BAD_PACKET_LEN, header.packet_len);
+        return -1;
+    }
+    return frames;
+}
+
+// Connections whose replies wait for the booking journal (at most one entry per epoll event)
+static struct connection *pending_flush[EPOLL_MAX_EVENTS];
+static int num_pending_flush = 0;
+
+// Write the queued replies; if the socket fills up, wait for EPOLLOUT and
+// stop reading until then. Returns -1 to drop the connection.
+static int conn_send_replies(int epoll_fd, struct connection *conn) {
+    int ret = conn_flush(conn);
+    if (ret < 0) return -1;
+    if (ret == 0) {
+        conn->state = CONN_WRITING;
+        conn_set_events(epoll_fd, conn, EPOLLOUT);
+    }
+    return 0;
+}
+
+// Consume everything currently readable and send the replies together.
+// Returns -1 to drop the connection.
+static int conn_on_readable(int epoll_fd, struct connection *conn) {
+    int peer_closed = 0;
+    while (!peer_closed) {
+        ssize_t n = frame_reader_fill(&conn->rx, conn->fd);
+        if (n == 0) {
+            // Still answer whatever arrived before the FIN
+            printf("Client disconnected.\n");
+            peer_closed = 1;
+        } else if (n < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+            perror("read failed");
+            return -1;
+        }
+
+        if (conn_process_frames(conn) < 0) return -1;
+
+        // A long pipeline: push out what is queued before reading further
+        if (conn->tx_len >= TX_FLUSH_BYTES) {
+            if (wait_durable(conn->journal_seq) < 0) return -1;
+            int ret = conn_flush(conn);
+            if (ret < 0) return -1;
+            if (ret == 0) break;
+        }
+    }
+
+    if (!peer_closed && conn->journal_seq > journal_durable_seq()) {
+        // Bookings not on disk yet: the event loop sends these after a single
+        // journal_wait() covering every connection it served this round.
+        pending_flush[num_pending_flush++] = conn;
+        return 0;
+    }
+    if (wait_durable(conn->journal_seq) < 0) return -1;
+    if (conn_send_replies(epoll_fd, conn) < 0 || peer_closed) return -1;
+    return 0;
+}
+
+// Send the replies held back for the booking journal, all after one group commit
+static void flush_pending(int epoll_fd) {
+    uint64_t journal_seq = 0;
+    for (int i = 0; i < num_pending_flush; i++) {
+        if (pending_flush[i]->journal_seq > journal_seq) journal_seq = pending_flush[i]->journal_seq;
+    }
+    int durable = wait_durable(journal_seq) == 0;
+    for (int i = 0; i < num_pending_flush; i++) {
+        if (!durable || conn_send_replies(epoll_fd, pending_flush[i]) < 0) {
+            conn_close(epoll_fd, pending_flush[i]);
+        }
+    }
+    num_pending_flush = 0;
+}
+
+static void accept_pending(int epoll_fd, int server_fd) {
+    while (1) {
+        struct sockaddr_in client_addr;
+        socklen_t client_addr_len = sizeof(client_addr);
+        int client_socket = accept4(server_fd, (struct sockaddr *)&client_addr, &client_addr_len, SOCK_NONBLOCK);
+        if (client_socket < 0) {
+            if (errno == EINTR) continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK) perror("accept failed");
+            return;
+        }
+        set_tcp_nodelay(client_socket); // Replies are small: send them without waiting on Nagle
+
+        char client_ip[INET_ADDRSTRLEN];
+        inet_ntop(AF_INET, &client_addr.sin_addr, client_ip, INET_ADDRSTRLEN);
+        printf("Connection accepted from %s:%d\n", client_ip, ntohs(client_addr.sin_port));
+        log_accepted(&client_addr);
+
+        if (!conn_open(epoll_fd, client_socket)) {
+            close(client_socket);
+        }
+    }
+}
+
+// Drop connections that have been silent for CLIENT_TIMEOUT_SEC, like the
+// SO_RCVTIMEO the fork mode sets on each child socket.
+static void close_idle_connections(int epoll_fd, time_t now) {
+    for (int fd = 0; fd < conn_table_size; fd++) {
+        struct connection *conn = conn_table[fd];
+        if (conn && now - conn->last_active >= CLIENT_TIMEOUT_SEC) {
+            printf("Request Timed Out (fd=%d)\n", fd);
+            LOG_EVENT(LT_IDLE_CLOSE, fd);
+            conn_close(epoll_fd, conn);
+        }
+    }
+}
+
+void run_epoll_server(int server_fd) {
+    struct epoll_event events[EPOLL_MAX_EVENTS];
+
+    srand(time(NULL) ^ getpid());
+
+    if (set_nonblocking(server_fd) < 0) {
+        perror("set_nonblocking failed");
+        exit(EXIT_FAILURE);
+    }
+
+    int epoll_fd = epoll_create1(0);
+    if (epoll_fd < 0) {
+        perror("epoll_create1 failed");
+        exit(EXIT_FAILURE);
+    }
+
+    // The listening socket is tagged with a NULL pointer
+    struct epoll_event ev = { .events = EPOLLIN, .data.ptr = NULL };
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, server_fd, &ev) < 0) {
+        perror("epoll_ctl ADD listener failed");
+        exit(EXIT_FAILURE);
+    }
+
+    time_t last_sweep = time(NULL);
+    while (!server_stopping) {
+        int n = epoll_wait(epoll_fd, events, EPOLL_MAX_EVENTS, 1000);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            perror("epoll_wait failed");
+            break;
+        }
+
+        time_t now = time(NULL);
+        for (int i = 0; i < n; i++) {
+            struct connection *conn = events[i].data.ptr;
+            if (!conn) {
+                accept_pending(epoll_fd, server_fd);
+                continue;
+            }
+
+            conn->last_active = now;
+            int ret = 0;
+            if (events[i].events & (EPOLLERR | EPOLLHUP) && !(events[i].events & EPOLLIN)) {
+                ret = -1;
+            } else if (conn->state == CONN_WRITING) {
+                ret = conn_flush(conn);
+                if (ret > 0) {
+                    // Replies drained: go back to reading requests
+                    conn->state = CONN_READING;
+                    conn_set_events(epoll_fd, conn, EPOLLIN);
+                    ret = conn_on_readable(epoll_fd, conn);
+                }
+            } else {
+                ret = conn_on_readable(epoll_fd, conn);
+            }
+
+            if (ret < 0) conn_close(epoll_fd, conn);
+        }
+        if (num_pending_flush > 0) flush_pending(epoll_fd);
+
+        if (now != last_sweep) {
+            close_idle_connections(epoll_fd, now);
+            last_sweep = now;
+        }
+    }
+
+    close(epoll_fd);
+}
+
+// ==========================================
+// io_uring mode: completion-based event loop
+// ==========================================
+// Same connection state and protocol code as epoll mode, without readiness
+// notifications or per-connection read/write syscalls:
+// - one multishot accept delivers every new connection;
+// - one multishot recv per connection fills buffers the kernel picks from a
+//   shared provided-buffer ring; the data is copied into the connection's
+//   FrameReader and the buffer goes straight back to the ring;
+// - the replies of every connection served in a round are queued as sends and
+//   submitted together with the wait for the next round, in one io_uring_enter.
+// Under load one syscall covers many requests. Without io_uring, provided-buffer
+// rings or multishot accept (kernels before 5.19) the server runs the epoll loop;
+// a kernel without multishot recv (before 6.0) gets single-shot recvs instead.
+
+#define URING_ENTRIES 1024                     // SQ size (the CQ is four times larger)
+#define URING_BUF_GROUP 0
+#define URING_BUF_COUNT 1024                   // Receive buffers shared by every connection
+#define URING_BUF_SIZE 4096
+#define URING_TX_BACKLOG (4 * TX_FLUSH_BYTES)  // Stop receiving while this much waits behind a send
+
+// user_data is a connection pointer with the operation in its low bits,
+// or one of the small tags below.
+enum { URING_OP_RECV = 0, URING_OP_SEND = 1 };
+#define URING_OP_MASK 3
+#define URING_TAG_ACCEPT 1
+#define URING_TAG_TIMER  2
+#define URING_TAG_IGNORE 3  // Completions of cancel requests
+#define URING_TAG_LIMIT  4096
+
+struct uring_conn {
+    struct connection c;         // Receive buffer, reply queue, protocol version, journal sequence
+    char *out;                   // Replies handed to the kernel; c.tx keeps collecting meanwhile
+    size_t out_len;
+    size_t out_off;
+    size_t out_cap;
+    int recv_armed;              // A recv is outstanding
+    int sending;                 // A send is outstanding
+    int recv_paused;             // Recv cancelled: too many replies are waiting behind the send
+    int peer_closed;             // Client sent FIN: answer what arrived, then close
+    int closing;                 // Shut down; freed once nothing is outstanding
+    struct uring_conn *next_ready;  // Served this round, replies not yet handed to the kernel
+    int ready;
+};
+
+static Uring uring;
+static int uring_multishot_accept = 1;
+static int uring_multishot_recv = 1;
+static struct uring_conn **uring_conns = NULL;  // Indexed by fd
+static int uring_conns_size = 0;
+static struct uring_conn *uring_ready = NULL;
+static uint64_t uring_requests = 0;
+
+static uint64_t uring_tag(struct uring_conn *uc, int op) {
+    return (uint64_t)(uintptr_t)uc | op;
+}
+
+static struct uring_conn *uring_conn_open(int fd) {
+    if (fd >= uring_conns_size) {
+        int new_size = uring_conns_size ? uring_conns_size : 1024;
+        while (new_size <= fd) new_size *= 2;
+        struct uring_conn **grown = realloc(uring_conns, new_size * sizeof(*grown));
+        if (!grown) return NULL;
+        memset(grown + uring_conns_size, 0, (new_size - uring_conns_size) * sizeof(*grown));
+        uring_conns = grown;
+        uring_conns_size = new_size;
+    }
+
+    struct uring_conn *uc = calloc(1, sizeof(struct uring_conn));
+    if (!uc) return NULL;
+    uc->c.fd = fd;
+    uc->c.state = CONN_READING;
+    uc->c.proto_version = PROTOCOL_V1;
+    uc->c.last_active = time(NULL);
+    void *rx_storage = malloc(RX_BUFFER_SIZE);
+    if (!rx_storage) {
+        free(uc);
+        return NULL;
+    }
+    frame_reader_init(&uc->c.rx, rx_storage, RX_BUFFER_SIZE, MAX_PACKET_LEN);
+    uring_conns[fd] = uc;
+    return uc;
+}
+
+// Free a connection once it is shut down and the kernel holds no request of it.
+// Every handler calls this as its last use of the connection.
+static void uring_conn_release(struct uring_conn *uc) {
+    if (!uc->closing || uc->recv_armed || uc->sending || uc->ready) return;
+    close(uc->c.fd);
+    uring_conns[uc->c.fd] = NULL;
+    free(uc->c.rx.buf);
+    free(uc->c.tx);
+    free(uc->out);
+    free(uc);
+}
+
+// Stop serving a connection. shutdown() ends its outstanding recv and send;
+// it is freed by uring_conn_release once their completions are in.
+static void uring_conn_close(struct uring_conn *uc) {
+    if (uc->closing) return;
+    uc->closing = 1;
+    shutdown(uc->c.fd, SHUT_RDWR);
+}
+
+static void uring_arm_recv(struct uring_conn *uc) {
+    if (uring_recv(&uring, uc->c.fd, uring_tag(uc, URING_OP_RECV), uring_multishot_recv) < 0) {
+        uring_conn_close(uc);
+        return;
+    }
+    uc->recv_armed = 1;
+}
+
+static void uring_mark_ready(struct uring_conn *uc) {
+    if (uc->ready) return;
+    uc->ready = 1;
+    uc->next_ready = uring_ready;
+    uring_ready = uc;
+}
+
+// Hand the queued replies to the kernel; later replies collect in c.tx until it completes
+static void uring_start_send(struct uring_conn *uc) {
+    if (uc->sending || uc->closing || uc->c.tx_len == 0) return;
+
+    char *buf = uc->out;
+    size_t cap = uc->out_cap;
+    uc->out = uc->c.tx;
+    uc->out_cap = uc->c.tx_cap;
+    uc->out_len = uc->c.tx_len;
+    uc->out_off = 0;
+    uc->c.tx = buf;
+    uc->c.tx_cap = cap;
+    uc->c.tx_len = 0;
+
+    if (uring_send(&uring, uc->c.fd, uc->out, uc->out_len, uring_tag(uc, URING_OP_SEND)) < 0) {
+        uring_conn_close(uc);
+        return;
+    }
+    uc->sending = 1;
+}
+
+static void uring_on_accept(int listen_fd, const UringCompletion *cqe) {
+    if (cqe->res >= 0) {
+        int client_socket = cqe->res;
+        set_tcp_nodelay(client_socket); // Replies are small: send them without waiting on Nagle
+
+        struct sockaddr_in client_addr;
+        socklen_t client_addr_len = sizeof(client_addr);
+        if (getpeername(client_socket, (struct sockaddr *)&client_addr, &client_addr_len) == 0) {
+            char client_ip[INET_ADDRSTRLEN];
+            inet_ntop(AF_INET, &client_addr.sin_addr, client_ip, INET_ADDRSTRLEN);
+            printf("Connection accepted from %s:%d\n", client_ip, ntohs(client_addr.sin_port));
+            log_accepted(&client_addr);
+        }
+
+        struct uring_conn *uc = uring_conn_open(client_socket);
+        if (uc) {
+            uring_arm_recv(uc);
+            uring_conn_release(uc);
+        } else {
+            close(client_socket);
+        }
+    } else if (cqe->res == -EINVAL && uring_multishot_accept) {
+        log_message(LOG_INFO, "io_uring: no multishot accept, using one accept per connection");
+        uring_multishot_accept = 0;
+    } else {
+        fprintf(stderr, "accept failed: %s\n", strerror(-cqe->res));
+    }
+
+    if (!cqe->more && !server_stopping) {
+        if (uring_accept(&uring, listen_fd, URING_TAG_ACCEPT, uring_multishot_accept) < 0) {
+            log_message(LOG_ERROR, "io_uring: cannot re-arm accept");
+        }
+    }
+}
+
+static void uring_on_recv(struct uring_conn *uc, const UringCompletion *cqe, time_t now) {
+    if (!cqe->more) uc->recv_armed = 0;
+
+    if (cqe->res > 0 && !uc->closing) {
+        uc->c.last_active = now;
+        const char *data = uring_buffer(&uring, cqe->buffer_id);
+        size_t len = cqe->res;
+        // The receive buffer always has room for the rest of a frame:
+        // append, run the complete frames, repeat with what did not fit
+        while (len > 0) {
+            size_t n = frame_reader_append(&uc->c.rx, data, len);
+            data += n;
+            len -= n;
+            int frames = conn_process_frames(&uc->c);
+            if (frames < 0) {
+                uring_conn_close(uc);
+                break;
+            }
+            uring_requests += frames;
+        }
+        if (!uc->closing) {
+            uring_mark_ready(uc);
+            // Backpressure: the client does not read its replies fast enough
+            if (uc->recv_armed && !uc->recv_paused && uc->c.tx_len >= URING_TX_BACKLOG) {
+                uc->recv_paused = 1;
+                uring_cancel(&uring, uring_tag(uc, URING_OP_RECV), URING_TAG_IGNORE);
+            }
+        }
+    } else if (cqe->res == 0 && !uc->closing) {
+        // Still answer whatever arrived before the FIN
+        printf("Client disconnected.\n");
+        uc->peer_closed = 1;
+        uring_mark_ready(uc);
+    } else if (cqe->res == -EINVAL && uring_multishot_recv) {
+        log_message(LOG_INFO, "io_uring: no multishot recv, using one recv per read");
+        uring_multishot_recv = 0;
+    } else if (cqe->res < 0 && cqe->res != -ENOBUFS && cqe->res != -ECANCELED && !uc->closing) {
+        // ENOBUFS: every receive buffer was in use; simply receive again
+        fprintf(stderr, "recv failed: %s\n", strerror(-cqe->res));
+        uring_conn_close(uc);
+    }
+    if (cqe->buffer_id >= 0) uring_recycle_buffer(&uring, cqe->buffer_id);
+
+    // The backlog drained before the cancelled recv completed: uring_on_send
+    // saw the recv still armed and left it to us
+    if (!cqe->more && uc->recv_paused && !uc->sending && uc->c.tx_len < URING_TX_BACKLOG) {
+        uc->recv_paused = 0;
+    }
+    if (!uc->recv_armed && !uc->closing && !uc->peer_closed && !uc->recv_paused) {
+        uring_arm_recv(uc);
+    }
+    uring_conn_release(uc);
+}
+
+static void uring_on_send(struct uring_conn *uc, const UringCompletion *cqe) {
+    uc->sending = 0;
+    if (cqe->res < 0) {
+        if (!uc->closing) fprintf(stderr, "send failed: %s\n", strerror(-cqe->res));
+        uring_conn_close(uc);
+    } else if (!uc->closing) {
+        uc->out_off += cqe->res;
+        if (uc->out_off < uc->out_len) {
+            // Short send: the socket buffer is full, send the rest
+            if (uring_send(&uring, uc->c.fd, uc->out + uc->out_off, uc->out_len - uc->out_off,
+                           uring_tag(uc, URING_OP_SEND)) < 0) {
+                uring_conn_close(uc);
+            } else {
+                uc->sending = 1;
+            }
+        } else {
+            uc->out_len = uc->out_off = 0;
+            if (uc->recv_paused && uc->c.tx_len < URING_TX_BACKLOG && !uc->recv_armed) {
+                uc->recv_paused = 0;
+                if (!uc->peer_closed) uring_arm_recv(uc);
+            }
+            // Replies queued while this send was in flight
+            uring_mark_ready(uc);
+        }
+    }
+    uring_conn_release(uc);
+}
+
+// Queue the sends of every connection served this round, after one group
+// commit covering all the bookings among their replies.
+static void uring_flush_ready(void) {
+    uint64_t journal_seq = 0;
+    for (struct uring_conn *uc = uring_ready; uc; uc = uc->next_ready) {
+        if (uc->c.tx_len > 0 && uc->c.journal_seq > journal_seq) journal_seq = uc->c.journal_seq;
+    }
+    int durable = wait_durable(journal_seq) == 0;
+
+    struct uring_conn *uc = uring_ready;
+    uring_ready = NULL;
+    while (uc) {
+        struct uring_conn *next = uc->next_ready;
+        uc->ready = 0;
+        if (!durable) {
+            uring_conn_close(uc);
+        } else {
+            uring_start_send(uc);
+            if (uc->peer_closed && !uc->sending) uring_conn_close(uc);
+        }
+        uring_conn_release(uc);
+        uc = next;
+    }
+}
+
+// Drop connections that have been silent for CLIENT_TIMEOUT_SEC, as in epoll mode
+static void uring_close_idle(time_t now) {
+    for (int fd = 0; fd < uring_conns_size; fd++) {
+        struct uring_conn *uc = uring_conns[fd];
+        if (uc && !uc->closing && now - uc->c.last_active >= CLIENT_TIMEOUT_SEC) {
+            printf("Request Timed Out (fd=%d)\n", fd);
+            LOG_EVENT(LT_IDLE_CLOSE, fd);
+            uring_conn_close(uc);
+            uring_conn_release(uc);
+        }
+    }
+}
+
+// The pending accept holds a reference to the listener, and closing the ring
+// only cancels it later from a kernel worker: without waiting for its final
+// completion here, port 8080 can stay bound for a moment after exit.
+static void uring_stop_accept(void) {
+    if (uring_cancel(&uring, URING_TAG_ACCEPT, URING_TAG_IGNORE) < 0) return;
+    for (int rounds = 0; rounds < 100; rounds++) {
+        if (uring_submit_and_wait(&uring, 1) < 0 && errno != EINTR) return;
+        UringCompletion cqe;
+        while (uring_next_completion(&uring, &cqe)) {
+            if (cqe.user_data == URING_TAG_ACCEPT && !cqe.more) return;
+            if (cqe.user_data == URING_TAG_ACCEPT && cqe.res >= 0) close(cqe.res);
+        }
+    }
+}
+
+void run_uring_server(int server_fd) {
+    if (uring_init(&uring, URING_ENTRIES) < 0 ||
+        uring_setup_buffers(&uring, URING_BUF_GROUP, URING_BUF_COUNT, URING_BUF_SIZE) < 0) {
+        fprintf(stderr, "io_uring unavailable (%s), using epoll\n", strerror(errno));
+        log_message(LOG_INFO, "io_uring unavailable (%s), using epoll", strerror(errno));
+        uring_close(&uring);
+        run_epoll_server(server_fd);
+        return;
+    }
+
+    srand(time(NULL) ^ getpid());
+
+    // The timer wakes the loop once a second for the idle sweep
+    if (uring_accept(&uring, server_fd, URING_TAG_ACCEPT, uring_multishot_accept) < 0 ||
+        uring_timeout(&uring, 1000, URING_TAG_TIMER) < 0) {
+        perror("io_uring: initial submit failed");
+        uring_close(&uring);
+        run_epoll_server(server_fd);
+        return;
+    }
+
+    time_t last_sweep = time(NULL);
+    while (!server_stopping) {
+        if (uring_submit_and_wait(&uring, 1) < 0) {
+            if (errno == EINTR) continue;
+            perror("io_uring_enter failed");
+            break;
+        }
+
+        time_t now = time(NULL);
+        UringCompletion cqe;
+        while (uring_next_completion(&uring, &cqe)) {
+            if (cqe.user_data < URING_TAG_LIMIT) {
+                if (cqe.user_data == URING_TAG_ACCEPT) {
+                    uring_on_accept(server_fd, &cqe);
+                } else if (cqe.user_data == URING_TAG_TIMER && !server_stopping) {
+                    uring_timeout(&uring, 1000, URING_TAG_TIMER);
+                }
+                continue;
+            }
+            struct uring_conn *uc = (struct uring_conn *)(uintptr_t)(cqe.user_data & ~(uint64_t)URING_OP_MASK);
+            if ((cqe.user_data & URING_OP_MASK) == URING_OP_SEND) {
+                uring_on_send(uc, &cqe);
+            } else {
+                uring_on_recv(uc, &cqe, now);
+            }
+        }
+        if (uring_ready) uring_flush_ready();
+
+        if (now != last_sweep) {
+            uring_close_idle(now);
+            last_sweep = now;
+        }
+    }
+
+    uring_stop_accept();
+
+    printf("io_uring: %lu requests, %lu io_uring_enter calls (%.3f per request)\n",
+           (unsigned long)uring_requests, (unsigned long)uring.enter_calls,
+           uring_requests ? (double)uring.enter_calls / uring_requests : 0.0);
+    log_message(LOG_INFO, "io_uring: %lu requests, %lu io_uring_enter calls",
+                (unsigned long)uring_requests, (unsigned long)uring.enter_calls);
+    uring_close(&uring);
+}
+
+// ==========================================
+// Threads mode: I/O threads in front of a work-stealing booking pool
+// ==========================================
+// One process, two sets of threads sharing the in-process state:
+// - I/O threads each run an epoll loop over the connections they accepted
+//   (all of them wait on the listener with EPOLLEXCLUSIVE). They read, cut
+//   frames, decrypt and verify checksums, and seal and write the replies.
+// - Worker threads (a WorkPool from libcommon) check sessions and run the
+//   opcode handlers. An idle worker steals from the others' queues, so one
+//   long pipeline does not hold up the requests queued behind it.
+// A connection has at most one job in the pool: its I/O thread stops reading
+// it (EPOLLONESHOT) until that job's replies are written, so the requests of
+// one connection still run in order. Connections and cores scale apart:
+// -i sets the I/O threads, -w the workers.
+
+struct tp_frame {
+    ProtocolHeader header;       // Decrypted and verified by the I/O thread
+    void *body;                  // Decrypted in place in the connection's FrameReader
+    int body_len;
+    uint64_t start_ns;           // When the request was read, for the latency metrics
+    BusyReason shed;             // Rejected by admission control: the body was never decrypted
+    uint32_t retry_after_ms;
+};
+
+struct tp_io;
+
+struct tp_conn {
+    struct connection c;
+    struct tp_io *io;            // The I/O thread that owns the socket
+    WorkItem job;                // Runs `frames` on a worker
+    struct tp_frame *frames;
+    int num_frames;
+    int frames_cap;
+    int busy;                    // Job in the pool: the I/O thread leaves the connection alone
+    int failed;                  // Set by the worker: drop the connection instead of replying
+    int peer_closed;             // FIN seen: close once the replies are out
+    struct tp_conn *prev;        // The I/O thread's connections, for the idle sweep
+    struct tp_conn *next;
+    struct tp_conn *next_done;
+};
+
+struct tp_io {
+    pthread_t thread;
+    int index;                   // Metrics slot: I/O threads take 0..num_io-1
+    int server_fd;
+    int epoll_fd;
+    int wake_fd;                 // eventfd: a worker handed back a connection
+    pthread_mutex_t done_lock;
+    struct tp_conn *done;        // Connections whose job has finished
+    struct tp_conn *conns;
+};
+
+static WorkPool *tp_pool;
+static int tp_num_io;            // Worker threads take the metrics slots after the I/O threads
+
+// Each worker thread records into its own metrics slot, not the main thread's
+static void tp_worker_init(int id) {
+    metrics_set_worker(tp_num_io + id);
+}
+
+static int tp_arm(struct tp_conn *tc, uint32_t events) {
+    struct epoll_event ev = { .events = events | EPOLLONESHOT, .data.ptr = tc };
+    return epoll_ctl(tc->io->epoll_fd, EPOLL_CTL_MOD, tc->c.fd, &ev);
+}
+
+static void tp_conn_close(struct tp_conn *tc) {
+    struct tp_io *io = tc->io;
+    epoll_ctl(io->epoll_fd, EPOLL_CTL_DEL, tc->c.fd, NULL);
+    close(tc->c.fd);
+    if (tc->prev) {
+        tc->prev->next = tc->next;
+    } else {
+        io->conns = tc->next;
+    }
+    if (tc->next) tc->next->prev = tc->prev;
+    free(tc->c.rx.buf);
+    free(tc->c.tx);
+    free(tc->frames);
+    free(tc);
+}
+
+// Worker side: run the frames and queue the cleartext replies, then hand the
+// connection back to its I/O thread
+static void tp_run_job(WorkItem *item) {
+    struct tp_conn *tc = (struct tp_conn *)((char *)item - offsetof(struct tp_conn, job));
+    for (int i = 0; i < tc->num_frames; i++) {
+        struct tp_frame *f = &tc->frames[i];
+        SealedReply *reply = conn_reply_slot(&tc->c);
+        if (!reply) {
+            // The connection is dropped: the frames not run give back their admission
+            for (int j = i; j < tc->num_frames; j++) {
+                if (admission && tc->frames[j].shed == BUSY_NONE) admission_done(admission);
+            }
+            tc->failed = 1;
+            break;
+        }
+        int reply_len;
+        if (f->shed != BUSY_NONE) {
+            reply_len = encode_busy(&f->header, f->shed, f->retry_after_ms, &reply->body);
+        } else {
+            if (admission) {
+                uint64_t now = monotonic_ns();
+                admission_observe(admission, now - f->start_ns, now); // Time spent in the pool's queues
+            }
+            reply_len = run_request(&f->header, f->body, f->body_len, &reply->body, &tc->c.proto_version,
+                                    &tc->c.journal_seq, f->start_ns);
+            if (admission) admission_done(admission);
+        }
+        reply->header = f->header;
+        reply->header.packet_len = sizeof(ProtocolHeader) + reply_len; // Sealed by the I/O thread
+        tc->c.tx_len += reply->header.packet_len;
+    }
+    tc->num_frames = 0;
+
+    struct tp_io *io = tc->io;
+    pthread_mutex_lock(&io->done_lock);
+    int wake = io->done == NULL; // Otherwise the I/O thread has a wakeup pending already
+    tc->next_done = io->done;
+    io->done = tc;
+    pthread_mutex_unlock(&io->done_lock);
+    uint64_t one = 1;
+    if (wake && write(io->wake_fd, &one, sizeof(one)) < 0) perror("eventfd write failed");
+}
+
+static struct tp_conn *tp_conn_open(struct tp_io *io, int fd) {
+    struct tp_conn *tc = calloc(1, sizeof(struct tp_conn));
+    if (!tc) return NULL;
+    tc->io = io;
+    tc->job.run = tp_run_job;
+    tc->c.fd = fd;
+    tc->c.state = CONN_READING;
+    tc->c.proto_version = PROTOCOL_V1;
+    tc->c.last_active = time(NULL);
+    void *rx_storage = malloc(RX_BUFFER_SIZE);
+    if (!rx_storage) {
+        free(tc);
+        return NULL;
+    }
+    frame_reader_init(&tc->c.rx, rx_storage, RX_BUFFER_SIZE, MAX_PACKET_LEN);
+
+    struct epoll_event ev = { .events = EPOLLIN | EPOLLONESHOT, .data.ptr = tc };
+    if (epoll_ctl(io->epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+        perror("epoll_ctl ADD failed");
+        free(rx_storage);
+        free(tc);
+        return NULL;
+    }
+    tc->next = io->conns;
+    if (io->conns) io->conns->prev = tc;
+    io->conns = tc;
+    return tc;
+}
+
+// The connection is dropped before its frames reach the pool: give back
+// their admission. Returns -1.
+static int tp_drop_frames(struct tp_conn *tc) {
+    for (int i = 0; i < tc->num_frames; i++) {
+        if (admission && tc->frames[i].shed == BUSY_NONE) admission_done(admission);
+    }
+    tc->num_frames = 0;
+    return -1;
+}
+
+// Read once, decrypt every complete frame and queue them as one job.
+// Returns -1 to drop the connection.
+static int tp_on_readable(struct tp_conn *tc) {
+    ssize_t n = frame_reader_fill(&tc->c.rx, tc->c.fd);
+    if (n == 0) {
+        // Still answer whatever arrived before the FIN
+        printf("Client disconnected.\n");
+        tc->peer_closed = 1;
+    } else if (n < 0) {
+        if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) return tp_arm(tc, EPOLLIN);
+        perror("read failed");
+        return -1;
+    }
+
+    ProtocolHeader header;
+    void *body;
+    int ret;
+    while ((ret = frame_reader_next(&tc->c.rx, &header, &body)) > 0) {
+        if (tc->num_frames == tc->frames_cap) {
+            int new_cap = tc->frames_cap ? tc->frames_cap * 2 : 16;
+            struct tp_frame *grown = realloc(tc->frames, new_cap * sizeof(*grown));
+            if (!grown) return tp_drop_frames(tc);
+            tc->frames = grown;
+            tc->frames_cap = new_cap;
+        }
+        struct tp_frame *f = &tc->frames[tc->num_frames];
+        f->start_ns = monotonic_ns();
+        f->body_len = header.packet_len - sizeof(ProtocolHeader);
+        // Admitted here, before the request waits in the pool: in flight counts
+        // the queued requests too, and a shed one is never decrypted
+        f->shed = admission ? admission_admit(admission, header.session_id, f->start_ns, &f->retry_after_ms)
+                            : BUSY_NONE;
+        if (f->shed == BUSY_NONE && open_request(&header, body, f->body_len) < 0) {
+            if (admission) admission_done(admission);
+            return tp_drop_frames(tc);
+        }
+        f->header = header;
+        f->body = body;
+        tc->num_frames++;
+    }
+    if (ret < 0) {
+        printf("Invalid packet length: %u\n", header.packet_len);
+        LOG_EVENT(LT_BAD_PACKET_LEN, header.packet_len);
+        return tp_drop_frames(tc);
+    }
+
+    if (tc->num_frames == 0) return tc->peer_closed ? -1 : tp_arm(tc, EPOLLIN);
+    tc->busy = 1;
+    work_pool_submit(tp_pool, &tc->job);
+    return 0;
+}
+
+// Write the queued replies, then go back to reading (or wait for EPOLLOUT).
+// Returns -1 to drop the connection.
+static int tp_send_replies(struct tp_conn *tc) {
+    int ret = conn_flush(&tc->c);
+    if (ret < 0) return -1;
+    if (ret == 0) {
+        tc->c.state = CONN_WRITING;
+        return tp_arm(tc, EPOLLOUT);
+    }
+    tc->c.state = CONN_READING;
+    if (tc->peer_closed) return -1;
+    return tp_arm(tc, EPOLLIN);
+}
+
+// Take back the connections the workers are done with: seal their replies
+// and send them all after a single journal wait
+static void tp_on_done(struct tp_io *io) {
+    uint64_t count;
+    if (read(io->wake_fd, &count, sizeof(count)) < 0 && errno != EAGAIN) perror("eventfd read failed");
+    pthread_mutex_lock(&io->done_lock);
+    struct tp_conn *done = io->done;
+    io->done = NULL;
+    pthread_mutex_unlock(&io->done_lock);
+
+    uint64_t journal_seq = 0;
+    for (struct tp_conn *tc = done; tc; tc = tc->next_done) {
+        tc->busy = 0;
+        if (tc->failed) continue;
+        for (size_t off = 0; off < tc->c.tx_len;) {
+            SealedReply *reply = (SealedReply *)(tc->c.tx + off);
+            int reply_len = reply->header.packet_len - sizeof(ProtocolHeader);
+            seal_response(&reply->header, &reply->body, reply_len);
+            off += sizeof(ProtocolHeader) + reply_len;
+        }
+        if (tc->c.journal_seq > journal_seq) journal_seq = tc->c.journal_seq;
+    }
+
+    int durable = wait_durable(journal_seq) == 0;
+    struct tp_conn *next;
+    for (struct tp_conn *tc = done; tc; tc = next) {
+        next = tc->next_done;
+        if (tc->failed || !durable || tp_send_replies(tc) < 0) tp_conn_close(tc);
+    }
+}
+
+static void tp_accept(struct tp_io *io) {
+    while (1) {
+        struct sockaddr_in client_addr;
+        socklen_t client_addr_len = sizeof(client_addr);
+        int client_socket = accept4(io->server_fd, (struct sockaddr *)&client_addr, &client_addr_len,
+                                    SOCK_NONBLOCK);
+        if (client_socket < 0) {
+            if (errno == EINTR) continue;
+            // Another I/O thread may have taken it
+            if (errno != EAGAIN && errno != EWOULDBLOCK) perror("accept failed");
+            return;
+        }
+        set_tcp_nodelay(client_socket); // Replies are small: send them without waiting on Nagle
+
+        char client_ip[INET_ADDRSTRLEN];
+        inet_ntop(AF_INET, &client_addr.sin_addr, client_ip, INET_ADDRSTRLEN);
+        printf("Connection accepted from %s:%d\n", client_ip, ntohs(client_addr.sin_port));
+        log_accepted(&client_addr);
+
+        if (!tp_conn_open(io, client_socket)) {
+            close(client_socket);
+        }
+    }
+}
+
+// Drop connections that have been silent for CLIENT_TIMEOUT_SEC, as in epoll mode
+static void tp_close_idle(struct tp_io *io, time_t now) {
+    struct tp_conn *next;
+    for (struct tp_conn *tc = io->conns; tc; tc = next) {
+        next = tc->next;
+        if (!tc->busy && now - tc->c.last_active >= CLIENT_TIMEOUT_SEC) {
+            printf("Request Timed Out (fd=%d)\n", tc->c.fd);
+            LOG_EVENT(LT_IDLE_CLOSE, tc->c.fd);
+            tp_conn_close(tc);
+        }
+    }
+}
+
+static void *tp_io_main(void *arg) {
+    struct tp_io *io = arg;
+    struct epoll_event events[EPOLL_MAX_EVENTS];
+    metrics_set_worker(io->index);
+
+    time_t last_sweep = time(NULL);
+    while (!server_stopping) {
+        int n = epoll_wait(io->epoll_fd, events, EPOLL_MAX_EVENTS, 1000);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            perror("epoll_wait failed");
+            break;
+        }
+
+        time_t now = time(NULL);
+        for (int i = 0; i < n; i++) {
+            void *ptr = events[i].data.ptr;
+            if (!ptr) {
+                tp_accept(io);
+                continue;
+            }
+            if (ptr == io) {
+                tp_on_done(io);
+                continue;
+            }
+
+            struct tp_conn *tc = ptr;
+            tc->c.last_active = now;
+            int ret;
+            if (events[i].events & (EPOLLERR | EPOLLHUP) && !(events[i].events & EPOLLIN)) {
+                ret = -1;
+            } else if (tc->c.state == CONN_WRITING) {
+                ret = tp_send_replies(tc);
+            } else {
+                ret = tp_on_readable(tc);
+            }
+            if (ret < 0) tp_conn_close(tc);
+        }
+
+        if (now != last_sweep) {
+            tp_close_idle(io, now);
+            last_sweep = now;
+        }
+    }
+    return NULL;
+}
+
+static int tp_io_init(struct tp_io *io, int index, int server_fd) {
+    memset(io, 0, sizeof(*io));
+    io->index = index;
+    io->server_fd = server_fd;
+    pthread_mutex_init(&io->done_lock, NULL);
+    io->epoll_fd = epoll_create1(0);
+    io->wake_fd = eventfd(0, EFD_NONBLOCK);
+    if (io->epoll_fd < 0 || io->wake_fd < 0) {
+        perror("epoll_create1 / eventfd failed");
+        return -1;
+    }
+    // The listener is tagged with NULL, the eventfd with the thread itself.
+    // EPOLLEXCLUSIVE: a new connection wakes one I/O thread, not all of them.
+    struct epoll_event ev = { .events = EPOLLIN | EPOLLEXCLUSIVE, .data.ptr = NULL };
+    struct epoll_event wake = { .events = EPOLLIN, .data.ptr = io };
+    if (epoll_ctl(io->epoll_fd, EPOLL_CTL_ADD, server_fd, &ev) < 0 ||
+        epoll_ctl(io->epoll_fd, EPOLL_CTL_ADD, io->wake_fd, &wake) < 0) {
+        perror("epoll_ctl ADD failed");
+        return -1;
+    }
+    return 0;
+}
+
+void run_threads_server(int server_fd, int num_io, int num_workers) {
+    srand(time(NULL) ^ getpid());
+
+    if (set_nonblocking(server_fd) < 0) {
+        perror("set_nonblocking failed");
+        exit(EXIT_FAILURE);
+    }
+
+    struct tp_io *ios = calloc(num_io, sizeof(struct tp_io));
+    if (!ios) {
+        perror("calloc failed");
+        exit(EXIT_FAILURE);
+    }
+    for (int i = 0; i < num_io; i++) {
+        if (tp_io_init(&ios[i], i, server_fd) < 0) exit(EXIT_FAILURE);
+    }
+
+    // SIGTERM/SIGINT go to this thread only: the others inherit a blocked mask
+    sigset_t block, old_mask;
+    sigemptyset(&block);
+    sigaddset(&block, SIGTERM);
+    sigaddset(&block, SIGINT);
+    pthread_sigmask(SIG_BLOCK, &block, &old_mask);
+    tp_num_io = num_io;
+    tp_pool = work_pool_create(num_workers, tp_worker_init);
+    if (!tp_pool) {
+        fprintf(stderr, "Cannot start %d worker threads\n", num_workers);
+        exit(EXIT_FAILURE);
+    }
+    int started = 1;
+    for (; started < num_io; started++) {
+        if (pthread_create(&ios[started].thread, NULL, tp_io_main, &ios[started]) != 0) {
+            perror("pthread_create failed (I/O thread)");
+            break;
+        }
+    }
+    pthread_sigmask(SIG_SETMASK, &old_mask, NULL);
+    printf("Threads: %d I/O, %d workers\n", started, num_workers);
+    log_message(LOG_INFO, "Threads mode: %d I/O threads, %d worker threads", started, num_workers);
+
+    tp_io_main(&ios[0]);
+
+    // Wake the other I/O threads so they see server_stopping now
+    uint64_t one = 1;
+    for (int i = 1; i < started; i++) {
+        if (write(ios[i].wake_fd, &one, sizeof(one)) < 0) perror("eventfd write failed");
+        pthread_join(ios[i].thread, NULL);
+    }
+
+    uint64_t executed, stolen;
+    work_pool_stats(tp_pool, &executed, &stolen);
+    work_pool_destroy(tp_pool);
+    printf("Threads: %lu jobs, %lu stolen from another worker's queue\n",
+           (unsigned long)executed, (unsigned long)stolen);
+    log_message(LOG_INFO, "Threads mode: %lu jobs, %lu stolen", (unsigned long)executed, (unsigned long)stolen);
+}
@@ -0,0 +1,144 @@
+// src_lib/admission.c
+
+#include "common.h"
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+
+struct Admission {
+    AdmissionConfig config;
+    // 每個 request 都會寫的欄位各自一條 cache line
+    atomic_int in_flight __attribute__((aligned(CACHE_LINE_SIZE)));
+    _Atomic uint64_t first_above_ns __attribute__((aligned(CACHE_LINE_SIZE)));  // 0 = 目前排隊時間低於目標
+    _Atomic uint64_t last_delay_ns;     // 最近一次量到的排隊時間
+    _Atomic uint64_t last_observe_ns;
+    // token bucket: 高 32 bits = 上次補充的時間 (ms)，低 32 bits = 剩餘的 milli-token；0 = 從未使用 (全滿)
+    _Atomic uint64_t buckets[ADMISSION_BUCKETS] __attribute__((aligned(CACHE_LINE_SIZE)));
+};
+
+static uint32_t clamp_retry_ms(uint64_t ms) {
+    if (ms < ADMISSION_MIN_RETRY_MS) return ADMISSION_MIN_RETRY_MS;
+    if (ms > ADMISSION_MAX_RETRY_MS) return ADMISSION_MAX_RETRY_MS;
+    return (uint32_t)ms;
+}
+
+// 過載時的建議等待時間: 目前的排隊時間，也就是清空佇列大約需要多久
+static uint32_t overload_retry_ms(Admission *adm) {
+    uint64_t delay_ns = atomic_load_explicit(&adm->last_delay_ns, memory_order_relaxed);
+    return clamp_retry_ms((delay_ns + 999999) / 1000000);
+}
+
+// ==========================================
+// 函數: admission_create
+// 功能: 建立所有 worker 共用的 admission 狀態
+// 說明: 匿名的 MAP_SHARED 記憶體，fork 出來的 process 繼承同一份。
+// ==========================================
+Admission *admission_create(const AdmissionConfig *config) {
+    Admission *adm = mmap(NULL, sizeof(Admission), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (adm == MAP_FAILED) {
+        perror("admission: mmap failed");
+        return NULL;
+    }
+    memset(adm, 0, sizeof(Admission));
+    adm->config = *config;
+    if (adm->config.session_rate > 0 && adm->config.session_burst == 0) {
+        adm->config.session_burst = adm->config.session_rate;
+    }
+    if (adm->config.interval_ms == 0) adm->config.interval_ms = 100;
+    return adm;
+}
+
+// ==========================================
+// 函數: admission_observe
+// 功能: 記錄一個 request 開始處理時的排隊時間
+// 說明: 低於目標就清除 "超過目標的起始時間"；高於目標而且還沒有起始時間就記下現在。
+// ==========================================
+void admission_observe(Admission *adm, uint64_t queued_ns, uint64_t now_ns) {
+    if (adm->config.target_delay_us == 0) return;
+    atomic_store_explicit(&adm->last_delay_ns, queued_ns, memory_order_relaxed);
+    atomic_store_explicit(&adm->last_observe_ns, now_ns, memory_order_relaxed);
+    uint64_t since = atomic_load_explicit(&adm->first_above_ns, memory_order_relaxed);
+    if (queued_ns <= (uint64_t)adm->config.target_delay_us * 1000) {
+        if (since != 0) atomic_store_explicit(&adm->first_above_ns, 0, memory_order_relaxed);
+    } else if (since == 0) {
+        // 多個 worker 同時發現時只留第一個
+        atomic_compare_exchange_strong(&adm->first_above_ns, &since, now_ns);
+    }
+}
+
+// 從 session 的 token bucket 拿一個 token；不夠時回傳 0 並算出下一個 token 何時補上
+static int bucket_take(Admission *adm, uint32_t session_id, uint64_t now_ns, uint32_t *retry_after_ms) {
+    _Atomic uint64_t *bucket = &adm->buckets[(session_id * 2654435761u) & (ADMISSION_BUCKETS - 1)];
+    uint64_t rate = adm->config.session_rate;       // token/s = milli-token/ms
+    uint64_t capacity = (uint64_t)adm->config.session_burst * 1000;
+    uint32_t now_ms = (uint32_t)(now_ns / 1000000);
+
+    uint64_t old = atomic_load_explicit(bucket, memory_order_relaxed);
+    while (1) {
+        uint64_t tokens = capacity;
+        if (old != 0) {
+            uint32_t elapsed_ms = now_ms - (uint32_t)(old >> 32);
+            tokens = (old & 0xFFFFFFFFu) + elapsed_ms * rate;
+            if (tokens > capacity) tokens = capacity;
+        }
+        if (tokens < 1000) {
+            // 不寫回: 被拒絕的 request 不會讓 bucket 的 cache line 在 worker 之間搬來搬去
+            *retry_after_ms = clamp_retry_ms((1000 - tokens + rate - 1) / rate);
+            return 0;
+        }
+        uint64_t next = ((uint64_t)now_ms << 32) | (tokens - 1000);
+        if (atomic_compare_exchange_weak_explicit(bucket, &old, next, memory_order_relaxed,
+                                                  memory_order_relaxed)) {
+            return 1;
+        }
+    }
+}
+
+// ==========================================
+// 函數: admission_admit
+// 功能: 決定是否處理一個 request
+// 說明: 依序檢查排隊時間、處理中的數量、session 的 token bucket。
+//       排隊時間超過目標已經 interval_ms，但這段時間內都沒有新的量測時
+//       (例如所有 request 都被拒絕，佇列已經空了)，視為恢復正常。
+// ==========================================
+BusyReason admission_admit(Admission *adm, uint32_t session_id, uint64_t now_ns, uint32_t *retry_after_ms) {
+    const AdmissionConfig *config = &adm->config;
+
+    if (config->target_delay_us > 0) {
+        uint64_t since = atomic_load_explicit(&adm->first_above_ns, memory_order_relaxed);
+        uint64_t interval_ns = (uint64_t)config->interval_ms * 1000000;
+        if (since != 0 && now_ns > since && now_ns - since >= interval_ns) {
+            uint64_t observed = atomic_load_explicit(&adm->last_observe_ns, memory_order_relaxed);
+            if (now_ns < observed || now_ns - observed < interval_ns) {
+                *retry_after_ms = overload_retry_ms(adm);
+                return BUSY_QUEUE_DELAY;
+            }
+            atomic_store_explicit(&adm->first_above_ns, 0, memory_order_relaxed);
+        }
+    }
+
+    int in_flight = atomic_fetch_add_explicit(&adm->in_flight, 1, memory_order_relaxed) + 1;
+    if (config->max_in_flight > 0 && in_flight > (int)config->max_in_flight) {
+        atomic_fetch_sub_explicit(&adm->in_flight, 1, memory_order_relaxed);
+        *retry_after_ms = overload_retry_ms(adm);
+        return BUSY_IN_FLIGHT;
+    }
+
+    if (config->session_rate > 0 && session_id != 0 && !bucket_take(adm, session_id, now_ns, retry_after_ms)) {
+        atomic_fetch_sub_explicit(&adm->in_flight, 1, memory_order_relaxed);
+        return BUSY_RATE_LIMIT;
+    }
+    return BUSY_NONE;
+}
+
+// ==========================================
+// 函數: admission_done
+// 功能: 一個允許處理的 request 已經完成 (回覆已產生)
+// ==========================================
+void admission_done(Admission *adm) {
+    atomic_fetch_sub_explicit(&adm->in_flight, 1, memory_order_relaxed);
+}
+
+int admission_in_flight(const Admission *adm) {
+    return atomic_load_explicit(&adm->in_flight, memory_order_relaxed);
+}
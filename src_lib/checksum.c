@@ -0,0 +1,272 @@
+// src_lib/checksum.c
+
+#include "common.h"
+#include <string.h>  // 用於 memcpy
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define CHECKSUM_X86 1
+#endif
+
+// ==========================================
+// 加總 Checksum
+// 所有版本結果與「逐 byte 相加，溢位自動 mod 2^32」完全一致。
+// ==========================================
+
+uint32_t checksum_sum_portable(const void *data, size_t len) {
+    const uint8_t *ptr = (const uint8_t *)data;
+    uint32_t sum = 0;
+    for (size_t i = 0; i < len; i++) {
+        sum += ptr[i];
+    }
+    return sum;
+}
+
+#ifdef CHECKSUM_X86
+
+// SSE2: _mm_sad_epu8 對 0 做 "絕對差加總"，一次把 16 個 byte 加成兩個 64-bit 值
+__attribute__((target("sse2")))
+static uint32_t sum_sse2_impl(const void *data, size_t len) {
+    const uint8_t *ptr = (const uint8_t *)data;
+    const __m128i zero = _mm_setzero_si128();
+    __m128i acc0 = _mm_setzero_si128();
+    __m128i acc1 = _mm_setzero_si128();
+    size_t i = 0;
+
+    // 一次處理 32 bytes，兩個累加器讓相鄰迴圈沒有相依
+    for (; i + 32 <= len; i += 32) {
+        __m128i a = _mm_loadu_si128((const __m128i *)(ptr + i));
+        __m128i b = _mm_loadu_si128((const __m128i *)(ptr + i + 16));
+        acc0 = _mm_add_epi64(acc0, _mm_sad_epu8(a, zero));
+        acc1 = _mm_add_epi64(acc1, _mm_sad_epu8(b, zero));
+    }
+    for (; i + 16 <= len; i += 16) {
+        __m128i a = _mm_loadu_si128((const __m128i *)(ptr + i));
+        acc0 = _mm_add_epi64(acc0, _mm_sad_epu8(a, zero));
+    }
+
+    acc0 = _mm_add_epi64(acc0, acc1);
+    acc0 = _mm_add_epi64(acc0, _mm_unpackhi_epi64(acc0, acc0));
+    uint32_t sum = (uint32_t)_mm_cvtsi128_si32(acc0);
+
+    // 剩下不足 16 bytes 的尾巴
+    for (; i < len; i++) {
+        sum += ptr[i];
+    }
+    return sum;
+}
+
+// AVX2: 同樣的做法，一次 32 bytes (每個 64-bit lane 累加 8 個 byte)
+__attribute__((target("avx2")))
+static uint32_t sum_avx2_impl(const void *data, size_t len) {
+    const uint8_t *ptr = (const uint8_t *)data;
+    const __m256i zero = _mm256_setzero_si256();
+    __m256i acc0 = _mm256_setzero_si256();
+    __m256i acc1 = _mm256_setzero_si256();
+    size_t i = 0;
+
+    for (; i + 64 <= len; i += 64) {
+        __m256i a = _mm256_loadu_si256((const __m256i *)(ptr + i));
+        __m256i b = _mm256_loadu_si256((const __m256i *)(ptr + i + 32));
+        acc0 = _mm256_add_epi64(acc0, _mm256_sad_epu8(a, zero));
+        acc1 = _mm256_add_epi64(acc1, _mm256_sad_epu8(b, zero));
+    }
+    for (; i + 32 <= len; i += 32) {
+        __m256i a = _mm256_loadu_si256((const __m256i *)(ptr + i));
+        acc0 = _mm256_add_epi64(acc0, _mm256_sad_epu8(a, zero));
+    }
+
+    acc0 = _mm256_add_epi64(acc0, acc1);
+    __m128i lo = _mm256_castsi256_si128(acc0);
+    __m128i hi = _mm256_extracti128_si256(acc0, 1);
+    lo = _mm_add_epi64(lo, hi);
+    lo = _mm_add_epi64(lo, _mm_unpackhi_epi64(lo, lo));
+    uint32_t sum = (uint32_t)_mm_cvtsi128_si32(lo);
+
+    for (; i < len; i++) {
+        sum += ptr[i];
+    }
+    return sum;
+}
+
+#endif // CHECKSUM_X86
+
+// ==========================================
+// CRC32C (Castagnoli, 反射多項式 0x82F63B78)
+// ==========================================
+
+#define CRC32C_POLY 0x82F63B78u
+
+// slicing-by-8 查表: crc32c_table[k][b] = 把 byte b 後面再接 k 個 0 byte 的 CRC
+static uint32_t crc32c_table[8][256];
+
+static void crc32c_init_table(void) {
+    for (uint32_t b = 0; b < 256; b++) {
+        uint32_t crc = b;
+        for (int k = 0; k < 8; k++) {
+            crc = (crc >> 1) ^ (CRC32C_POLY & (0u - (crc & 1)));
+        }
+        crc32c_table[0][b] = crc;
+    }
+    for (uint32_t b = 0; b < 256; b++) {
+        uint32_t crc = crc32c_table[0][b];
+        for (int k = 1; k < 8; k++) {
+            crc = crc32c_table[0][crc & 0xFF] ^ (crc >> 8);
+            crc32c_table[k][b] = crc;
+        }
+    }
+}
+
+uint32_t crc32c_update_portable(uint32_t crc, const void *data, size_t len) {
+    const uint8_t *ptr = (const uint8_t *)data;
+    crc = ~crc;
+
+    // 一次吃 8 bytes (little-endian 讀法)
+    while (len >= 8) {
+        uint32_t lo = crc ^ ((uint32_t)ptr[0] | (uint32_t)ptr[1] << 8 |
+                             (uint32_t)ptr[2] << 16 | (uint32_t)ptr[3] << 24);
+        crc = crc32c_table[7][lo & 0xFF] ^ crc32c_table[6][(lo >> 8) & 0xFF] ^
+              crc32c_table[5][(lo >> 16) & 0xFF] ^ crc32c_table[4][lo >> 24] ^
+              crc32c_table[3][ptr[4]] ^ crc32c_table[2][ptr[5]] ^
+              crc32c_table[1][ptr[6]] ^ crc32c_table[0][ptr[7]];
+        ptr += 8;
+        len -= 8;
+    }
+    while (len--) {
+        crc = crc32c_table[0][(crc ^ *ptr++) & 0xFF] ^ (crc >> 8);
+    }
+    return ~crc;
+}
+
+#ifdef CHECKSUM_X86
+
+// SSE4.2 crc32 指令 (硬體 CRC32C)
+__attribute__((target("sse4.2")))
+static uint32_t crc32c_sse42_impl(uint32_t crc, const void *data, size_t len) {
+    const uint8_t *ptr = (const uint8_t *)data;
+    crc = ~crc;
+#ifdef __x86_64__
+    uint64_t crc64 = crc;
+    while (len >= 8) {
+        uint64_t word;
+        memcpy(&word, ptr, sizeof(word));
+        crc64 = _mm_crc32_u64(crc64, word);
+        ptr += 8;
+        len -= 8;
+    }
+    crc = (uint32_t)crc64;
+#endif
+    while (len >= 4) {
+        uint32_t word;
+        memcpy(&word, ptr, sizeof(word));
+        crc = _mm_crc32_u32(crc, word);
+        ptr += 4;
+        len -= 4;
+    }
+    while (len--) {
+        crc = _mm_crc32_u8(crc, *ptr++);
+    }
+    return ~crc;
+}
+
+#endif // CHECKSUM_X86
+
+// ==========================================
+// CPU 偵測與執行期分派 (Runtime Dispatch)
+// ==========================================
+
+typedef uint32_t (*sum_fn)(const void *, size_t);
+typedef uint32_t (*crc_fn)(uint32_t, const void *, size_t);
+
+static sum_fn      sum_impl      = checksum_sum_portable;
+static crc_fn      crc_impl      = crc32c_update_portable;
+static const char *sum_impl_name = "portable";
+static const char *crc_impl_name = "portable";
+
+static int has_sse2, has_avx2, has_sse42;
+
+// 函式庫載入時執行一次 (在 main 之前)，之後只讀不寫，多 thread / process 都安全
+__attribute__((constructor))
+static void checksum_dispatch_init(void) {
+    crc32c_init_table();
+
+#ifdef CHECKSUM_X86
+    __builtin_cpu_init();
+    has_sse2  = __builtin_cpu_supports("sse2");
+    has_avx2  = __builtin_cpu_supports("avx2");
+    has_sse42 = __builtin_cpu_supports("sse4.2");
+
+    if (has_avx2) {
+        sum_impl = sum_avx2_impl;
+        sum_impl_name = "avx2";
+    } else if (has_sse2) {
+        sum_impl = sum_sse2_impl;
+        sum_impl_name = "sse2";
+    }
+    if (has_sse42) {
+        crc_impl = crc32c_sse42_impl;
+        crc_impl_name = "sse4.2";
+    }
+#endif
+}
+
+int checksum_cpu_has_sse2(void)  { return has_sse2; }
+int checksum_cpu_has_avx2(void)  { return has_avx2; }
+int checksum_cpu_has_sse42(void) { return has_sse42; }
+
+const char *checksum_sum_impl(void) { return sum_impl_name; }
+const char *crc32c_impl(void)       { return crc_impl_name; }
+
+// 各實作的公開入口: CPU 不支援時退回一般版本 (bench 可以放心呼叫)
+uint32_t checksum_sum_sse2(const void *data, size_t len) {
+#ifdef CHECKSUM_X86
+    if (has_sse2) return sum_sse2_impl(data, len);
+#endif
+    return checksum_sum_portable(data, len);
+}
+
+uint32_t checksum_sum_avx2(const void *data, size_t len) {
+#ifdef CHECKSUM_X86
+    if (has_avx2) return sum_avx2_impl(data, len);
+#endif
+    return checksum_sum_portable(data, len);
+}
+
+uint32_t crc32c_update_sse42(uint32_t crc, const void *data, size_t len) {
+#ifdef CHECKSUM_X86
+    if (has_sse42) return crc32c_sse42_impl(crc, data, len);
+#endif
+    return crc32c_update_portable(crc, data, len);
+}
+
+// ==========================================
+// 函數: calculate_checksum
+// 功能: 計算資料的簡易 Checksum (加總)，自動使用最快的實作
+// ==========================================
+uint32_t calculate_checksum(const void *data, size_t len) {
+    return sum_impl(data, len);
+}
+
+uint32_t crc32c_update(uint32_t crc, const void *data, size_t len) {
+    return crc_impl(crc, data, len);
+}
+
+// ==========================================
+// 函數: packet_checksum
+// 功能: 依 OpCode 的旗標選擇加總或 CRC32C，計算 header + body 的 checksum
+// ==========================================
+uint32_t packet_checksum(const ProtocolHeader *header, const void *body, size_t body_len) {
+    if (header->opcode & OP_FLAG_CRC32C) {
+        uint32_t crc = crc_impl(0, header, sizeof(ProtocolHeader));
+        if (body && body_len > 0) {
+            crc = crc_impl(crc, body, body_len);
+        }
+        return crc;
+    }
+
+    uint32_t sum = sum_impl(header, sizeof(ProtocolHeader));
+    if (body && body_len > 0) {
+        sum += sum_impl(body, body_len);
+    }
+    return sum;
+}
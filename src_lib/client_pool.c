@@ -0,0 +1,693 @@
+// src_lib/client_pool.c
+
+#include "common.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>   // 用於 memcpy, memset, strncmp
+#include <unistd.h>   // 用於 close
+#include <errno.h>
+#include <poll.h>
+#include <time.h>
+#include <sys/socket.h>
+
+#define CLIENT_MAX_REQUEST_BODY (sizeof(BatchBookRequest) + BATCH_BOOK_MAX_ENTRIES * sizeof(BookRequest))
+#define CLIENT_MAX_REPLY_BODY   (sizeof(BatchBookResponse) + BATCH_BOOK_MAX_ENTRIES)
+#define CLIENT_RX_BUFFER        (64 * 1024)
+#define CLIENT_MAX_IN_FLIGHT    32768
+
+static uint64_t now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+// v1 的失敗回覆只有文字，依 Server 固定的訊息開頭推回狀態碼
+static uint8_t status_from_message(uint16_t opcode, const char *message) {
+    if (opcode == OP_RESPONSE_SUCCESS) return RESP_OK;
+    if (strncmp(message, "Invalid Session", 15) == 0) return RESP_INVALID_SESSION;
+    if (strncmp(message, "Booking failed", 14) == 0) return RESP_SOLD_OUT;
+    if (strncmp(message, "Server busy", 11) == 0) return RESP_SERVER_BUSY;
+    if (strncmp(message, "Unknown event", 13) == 0) return RESP_UNKNOWN_EVENT;
+    if (strncmp(message, "Unknown", 7) == 0) return RESP_UNKNOWN_OPCODE;
+    return RESP_BAD_REQUEST;
+}
+
+// ==========================================
+// 函數: client_decode_reply
+// 功能: 解密並驗證回覆的 body，把 v1 (ServerResponse) 或 v2 (CompactResponse)
+//       統一轉成 ClientReply。批次訂票成功的回覆 (BatchBookResponse) 只取剩餘票數，
+//       其餘內容由呼叫端從 raw 讀取。OP_RESPONSE_BUSY 轉成 RESP_SERVER_BUSY 並填入 retry_after_ms。
+// ==========================================
+int client_decode_reply(ProtocolHeader *header, void *body, size_t body_len, ClientReply *out) {
+    if (packet_open_body(header, body, body_len) < 0) {
+        return -1;
+    }
+    int compact = (header->opcode & OP_FLAG_COMPACT) != 0;
+    header->opcode &= ~OP_FLAG_MASK;
+
+    memset(out, 0, sizeof(ClientReply));
+    out->opcode = header->opcode;
+    out->req_id = header->req_id;
+    out->session_id = header->session_id;
+    out->raw = body;
+    out->raw_len = body_len;
+
+    if (out->opcode == OP_RESPONSE_BUSY) {
+        const BusyResponse *busy = body;
+        if (body_len < sizeof(BusyResponse)) {
+            return -1;
+        }
+        out->status = RESP_SERVER_BUSY;
+        out->retry_after_ms = busy->retry_after_ms;
+        snprintf(out->body.message, sizeof(out->body.message), "Server busy, retry after %u ms",
+                 busy->retry_after_ms);
+        return 0;
+    }
+
+    if (compact) {
+        const CompactResponse *res = body;
+        if (body_len < sizeof(CompactResponse) || body_len < sizeof(CompactResponse) + res->text_len) {
+            return -1;
+        }
+        out->status = res->status;
+        out->body.remaining_tickets = res->remaining_tickets;
+        if (res->text_len > 0) {
+            size_t n = res->text_len < sizeof(out->body.message) - 1 ? res->text_len : sizeof(out->body.message) - 1;
+            memcpy(out->body.message, res->text, n);
+        } else {
+            snprintf(out->body.message, sizeof(out->body.message), "%s", resp_status_name(res->status));
+        }
+        return 0;
+    }
+
+    if (body_len == sizeof(ServerResponse)) {
+        memcpy(&out->body, body, sizeof(ServerResponse));
+        out->body.message[sizeof(out->body.message) - 1] = '\0';
+        out->status = status_from_message(out->opcode, out->body.message);
+        return 0;
+    }
+
+    // 其他長度是 BatchBookResponse (第一個欄位同樣是剩餘票數) 或 StatsResponse，內容在 raw
+    if (body_len < sizeof(BatchBookResponse)) {
+        return -1;
+    }
+    memcpy(&out->body.remaining_tickets, body, sizeof(uint32_t));
+    out->status = out->opcode == OP_RESPONSE_SUCCESS ? RESP_OK : RESP_BAD_REQUEST;
+    return 0;
+}
+
+// ==========================================
+// 函數: client_request
+// 功能: 同步送出一個 request (header + body 一次 writev) 並讀取、驗證回覆
+// 說明: body 先複製到 thread-local 緩衝區再加密，呼叫端的資料不會被改動；
+//       out->raw 指向 thread-local 緩衝區，在同一個 thread 下一次呼叫前有效。
+// ==========================================
+int client_request(int sockfd, uint16_t opcode, uint16_t req_id, uint32_t session_id,
+                   const void *body, size_t body_len, ClientReply *out) {
+    static __thread uint8_t tx_body[CLIENT_MAX_REQUEST_BODY];
+    static __thread uint8_t rx_body[CLIENT_MAX_REPLY_BODY];
+
+    if (body_len > sizeof(tx_body)) {
+        return -1;
+    }
+    if (body_len > 0) memcpy(tx_body, body, body_len);
+
+    ProtocolHeader header = {
+        .packet_len = sizeof(ProtocolHeader) + body_len,
+        .opcode = opcode,
+        .req_id = req_id,
+        .session_id = session_id,
+        .checksum = 0
+    };
+    packet_seal(&header, tx_body, body_len);
+
+    struct iovec iov[2] = {
+        { .iov_base = &header, .iov_len = sizeof(ProtocolHeader) },
+        { .iov_base = tx_body, .iov_len = body_len }
+    };
+    if (write_iov_n(sockfd, iov, body_len > 0 ? 2 : 1) <= 0) {
+        return -1;
+    }
+
+    if (read_n_bytes(sockfd, &header, sizeof(ProtocolHeader)) <= 0) {
+        return -1;
+    }
+    xor_cipher(&header, sizeof(ProtocolHeader));
+    if (header.packet_len < sizeof(ProtocolHeader) ||
+        header.packet_len - sizeof(ProtocolHeader) > sizeof(rx_body)) {
+        return -1;
+    }
+    size_t reply_len = header.packet_len - sizeof(ProtocolHeader);
+    if (reply_len > 0 && read_n_bytes(sockfd, rx_body, reply_len) <= 0) {
+        return -1;
+    }
+    return client_decode_reply(&header, rx_body, reply_len, out);
+}
+
+// ==========================================
+// 函數: client_login
+// 功能: 送出 OP_LOGIN (v2 以上附 LoginRequest)，回傳新的 session_id (失敗回傳 0)
+// 說明: 收到 OP_RESPONSE_BUSY 時睡 retry_after_ms 後重送，最多 CLIENT_BUSY_RETRIES 次。
+// ==========================================
+uint32_t client_login(int sockfd, uint16_t flags, uint32_t protocol_version, ClientReply *out) {
+    LoginRequest login = { .protocol_version = protocol_version };
+    size_t body_len = protocol_version >= PROTOCOL_V2 ? sizeof(LoginRequest) : 0;
+
+    for (int attempt = 0; ; attempt++) {
+        if (client_request(sockfd, OP_LOGIN | flags, 0, 0, &login, body_len, out) < 0) {
+            return 0;
+        }
+        if (out->opcode != OP_RESPONSE_BUSY || attempt == CLIENT_BUSY_RETRIES) break;
+        struct timespec delay = { out->retry_after_ms / 1000, (out->retry_after_ms % 1000) * 1000000L };
+        nanosleep(&delay, NULL);
+    }
+    return out->opcode == OP_RESPONSE_SUCCESS ? out->session_id : 0;
+}
+
+// ==========================================
+// 連線池 (ClientPool)
+// ==========================================
+
+// 一個在途的 request；以 req_id & slot_mask 為索引
+typedef struct {
+    client_callback callback;  // NULL = 連線池自己送出的重新登入
+    void *ctx;
+    uint8_t *body;             // request body 的副本 (重送時使用)
+    uint32_t body_len;
+    uint32_t session_id;       // 最後一次送出時使用的 session
+    uint16_t req_id;
+    uint16_t opcode;           // 不含旗標
+    uint8_t in_use;
+    uint8_t retried;           // 已經因為 Invalid Session 重送過一次
+    uint8_t parked;            // 等待重新登入完成後再送
+    uint8_t busy_retries;      // 已經因為 OP_RESPONSE_BUSY 重送的次數
+    uint64_t retry_at_ms;      // 非 0 = 收到 OP_RESPONSE_BUSY，到這個時間再重送
+} PendingRequest;
+
+typedef struct {
+    int fd;                    // -1 = 尚未連線 / 已中斷
+    int closing;               // conn_fail 正在通知 callback，不可重新連線
+    int logging_in;            // 重新登入的 request 在途中
+    uint32_t session_id;
+    uint16_t next_req_id;
+    size_t in_flight;
+    size_t waiting;            // 在途的 request 中有多少個在等 retry_at_ms
+    uint64_t last_progress_ms; // 最後一次收到回覆 (或開始等待) 的時間
+    PendingRequest *slots;
+    FrameReader rx;
+    uint8_t *rx_storage;
+    uint8_t *tx;               // 尚未寫出的封包 (已加密)
+    size_t tx_len;
+    size_t tx_cap;
+} PoolConnection;
+
+struct ClientPool {
+    ClientPoolConfig config;
+    char ip[64];
+    uint32_t slot_mask;
+    int next_conn;             // round-robin 起點
+    PoolConnection *conns;
+};
+
+// 把封包 (header + body) 加密後附加到傳送緩衝區
+static int conn_queue_packet(ClientPool *pool, PoolConnection *conn, const PendingRequest *req) {
+    size_t len = sizeof(ProtocolHeader) + req->body_len;
+    if (conn->tx_len + len > conn->tx_cap) {
+        size_t cap = conn->tx_cap ? conn->tx_cap : 4096;
+        while (cap < conn->tx_len + len) cap *= 2;
+        uint8_t *tx = realloc(conn->tx, cap);
+        if (!tx) return -1;
+        conn->tx = tx;
+        conn->tx_cap = cap;
+    }
+
+    ProtocolHeader *header = (ProtocolHeader *)(conn->tx + conn->tx_len);
+    uint8_t *body = (uint8_t *)(header + 1);
+    header->packet_len = len;
+    header->opcode = req->opcode | pool->config.flags;
+    header->req_id = req->req_id;
+    header->session_id = req->session_id;
+    header->checksum = 0;
+    if (req->body_len > 0) memcpy(body, req->body, req->body_len);
+    packet_seal(header, body, req->body_len);
+    conn->tx_len += len;
+    return 0;
+}
+
+static void conn_free_slot(PoolConnection *conn, PendingRequest *req) {
+    free(req->body);
+    memset(req, 0, sizeof(PendingRequest));
+    conn->in_flight--;
+}
+
+// 連線中斷: 關閉 socket，所有在途的 request 以 error = -1 通知
+static void conn_fail(PoolConnection *conn, uint32_t slot_count) {
+    if (conn->fd >= 0) {
+        close(conn->fd);
+        conn->fd = -1;
+    }
+    conn->closing = 1;
+    conn->logging_in = 0;
+    conn->waiting = 0;
+    conn->tx_len = 0;
+    for (uint32_t i = 0; i < slot_count && conn->in_flight > 0; i++) {
+        PendingRequest *req = &conn->slots[i];
+        if (!req->in_use) continue;
+        client_callback callback = req->callback;
+        void *ctx = req->ctx;
+        ClientReply reply = { .error = -1, .req_id = req->req_id };
+        conn_free_slot(conn, req);
+        if (callback) callback(ctx, &reply);
+    }
+    conn->closing = 0;
+}
+
+// 連線並登入 (同步，最多等 timeout_ms)，成功後改為非阻塞
+static int conn_establish(ClientPool *pool, PoolConnection *conn) {
+    int fd = connect_to_server(pool->ip, pool->config.port);
+    if (fd < 0) return -1;
+
+    struct timeval tv = {
+        .tv_sec = pool->config.timeout_ms / 1000,
+        .tv_usec = (pool->config.timeout_ms % 1000) * 1000
+    };
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+
+    ClientReply reply;
+    uint32_t session_id = client_login(fd, pool->config.flags, pool->config.protocol_version, &reply);
+    if (session_id == 0 || set_nonblocking(fd) < 0) {
+        close(fd);
+        return -1;
+    }
+
+    conn->fd = fd;
+    conn->session_id = session_id;
+    conn->logging_in = 0;
+    conn->tx_len = 0;
+    frame_reader_init(&conn->rx, conn->rx_storage, CLIENT_RX_BUFFER, CLIENT_RX_BUFFER);
+    log_message(LOG_INFO, "Client pool: connection %d logged in (session %u)", fd, session_id);
+    return 0;
+}
+
+// 從 next_req_id 開始找一個空 slot (回覆的順序不一定，空出來的 slot 不一定連續)；
+// 呼叫端的 request 最多用到 slot_mask 格，留一格給重新登入。沒有空 slot 時回傳 NULL
+static PendingRequest *conn_take_slot(ClientPool *pool, PoolConnection *conn, int for_relogin) {
+    if (conn->in_flight >= pool->slot_mask + (for_relogin ? 1 : 0)) return NULL;
+
+    PendingRequest *req = &conn->slots[conn->next_req_id & pool->slot_mask];
+    while (req->in_use) {
+        conn->next_req_id++;
+        req = &conn->slots[conn->next_req_id & pool->slot_mask];
+    }
+
+    req->in_use = 1;
+    req->req_id = conn->next_req_id++;
+    req->session_id = conn->session_id;
+    if (conn->in_flight++ == 0) {
+        conn->last_progress_ms = now_ms();
+    }
+    return req;
+}
+
+// Session 失效: 在同一條連線上重新登入，完成前收到的失效回覆都先暫停
+static int conn_start_relogin(ClientPool *pool, PoolConnection *conn) {
+    PendingRequest *req = conn_take_slot(pool, conn, 1);
+    if (!req) return -1;
+
+    LoginRequest login = { .protocol_version = pool->config.protocol_version };
+    req->opcode = OP_LOGIN;
+    req->session_id = 0;
+    if (pool->config.protocol_version >= PROTOCOL_V2) {
+        req->body = malloc(sizeof(LoginRequest));
+        if (!req->body) {
+            conn_free_slot(conn, req);
+            return -1;
+        }
+        memcpy(req->body, &login, sizeof(LoginRequest));
+        req->body_len = sizeof(LoginRequest);
+    }
+    if (conn_queue_packet(pool, conn, req) < 0) {
+        conn_free_slot(conn, req);
+        return -1;
+    }
+    conn->logging_in = 1;
+    log_message(LOG_INFO, "Client pool: session %u rejected, logging in again", conn->session_id);
+    return 0;
+}
+
+// 重新登入的回覆: 成功就用新 session 重送暫停的 request，失敗就把登入的回覆交給它們
+static void conn_finish_relogin(ClientPool *pool, PoolConnection *conn, const ClientReply *login) {
+    conn->logging_in = 0;
+    if (login->opcode == OP_RESPONSE_SUCCESS) {
+        conn->session_id = login->session_id;
+    }
+    for (uint32_t i = 0; i <= pool->slot_mask; i++) {
+        PendingRequest *req = &conn->slots[i];
+        if (!req->in_use || !req->parked) continue;
+        req->parked = 0;
+        if (login->opcode == OP_RESPONSE_SUCCESS) {
+            req->session_id = conn->session_id;
+            if (conn_queue_packet(pool, conn, req) == 0) continue;
+        }
+        client_callback callback = req->callback;
+        void *ctx = req->ctx;
+        ClientReply reply = *login;
+        reply.req_id = req->req_id;
+        reply.raw = NULL;
+        reply.raw_len = 0;
+        conn_free_slot(conn, req);
+        if (callback) callback(ctx, &reply);
+    }
+}
+
+// 處理一個回覆；回傳 1 = 一個 request 完成，0 = 已安排重送，-1 = 協定錯誤
+static int conn_handle_reply(ClientPool *pool, PoolConnection *conn, ProtocolHeader *header, void *body) {
+    PendingRequest *req = &conn->slots[header->req_id & pool->slot_mask];
+    if (!req->in_use || req->req_id != header->req_id) {
+        return -1;
+    }
+    ClientReply reply;
+    if (client_decode_reply(header, body, header->packet_len - sizeof(ProtocolHeader), &reply) < 0) {
+        return -1;
+    }
+    conn->last_progress_ms = now_ms();
+
+    // Server 沒有執行這個 request: 依它建議的時間之後原封不動重送 (在 client_pool_poll 裡)
+    if (reply.opcode == OP_RESPONSE_BUSY && req->busy_retries < CLIENT_BUSY_RETRIES) {
+        req->busy_retries++;
+        req->retry_at_ms = conn->last_progress_ms + reply.retry_after_ms;
+        conn->waiting++;
+        return 0;
+    }
+
+    if (req->opcode == OP_LOGIN && req->callback == NULL) {
+        conn_free_slot(conn, req);
+        conn_finish_relogin(pool, conn, &reply);
+        return 0;
+    }
+
+    if (reply.status == RESP_INVALID_SESSION && !req->retried) {
+        req->retried = 1;
+        if (req->session_id != conn->session_id && !conn->logging_in) {
+            // 已經換過 session (前面的 request 觸發了重新登入)，直接重送
+            req->session_id = conn->session_id;
+            if (conn_queue_packet(pool, conn, req) == 0) return 0;
+        } else {
+            req->parked = 1;
+            if (conn->logging_in || conn_start_relogin(pool, conn) == 0) return 0;
+            req->parked = 0;
+        }
+    }
+
+    client_callback callback = req->callback;
+    void *ctx = req->ctx;
+    conn_free_slot(conn, req);
+    if (callback) callback(ctx, &reply);
+    return 1;
+}
+
+// 盡量把傳送緩衝區寫出 (非阻塞)
+static int conn_flush(PoolConnection *conn) {
+    size_t off = 0;
+    while (off < conn->tx_len) {
+        // MSG_NOSIGNAL: 對方已關閉時回傳 EPIPE，不要讓 SIGPIPE 殺掉嵌入的程式
+        ssize_t n = send(conn->fd, conn->tx + off, conn->tx_len - off, MSG_NOSIGNAL);
+        if (n > 0) {
+            off += n;
+        } else if (n < 0 && errno == EINTR) {
+            continue;
+        } else if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            break;
+        } else {
+            return -1;
+        }
+    }
+    if (off > 0) {
+        memmove(conn->tx, conn->tx + off, conn->tx_len - off);
+        conn->tx_len -= off;
+    }
+    return 0;
+}
+
+// 重送到期的 OP_RESPONSE_BUSY request；回傳最近一個還沒到期的時間 (沒有時為 0)，-1 = 失敗
+static int64_t conn_resend_due(ClientPool *pool, PoolConnection *conn, uint64_t now) {
+    uint64_t next_due = 0;
+    for (uint32_t i = 0; i <= pool->slot_mask && conn->waiting > 0; i++) {
+        PendingRequest *req = &conn->slots[i];
+        if (!req->in_use || req->retry_at_ms == 0) continue;
+        if (req->retry_at_ms > now) {
+            if (next_due == 0 || req->retry_at_ms < next_due) next_due = req->retry_at_ms;
+            continue;
+        }
+        req->retry_at_ms = 0;
+        conn->waiting--;
+        // 等待期間可能已經重新登入過
+        if (req->opcode != OP_LOGIN) req->session_id = conn->session_id;
+        if (conn_queue_packet(pool, conn, req) < 0) return -1;
+        conn->last_progress_ms = now;
+    }
+    return (int64_t)next_due;
+}
+
+// ==========================================
+// 函數: client_pool_create
+// 功能: 建立連線池，並把所有連線都連好、登入好 (保持 session 溫熱)
+// ==========================================
+ClientPool *client_pool_create(const ClientPoolConfig *config) {
+    if (config->connections <= 0) return NULL;
+
+    ClientPool *pool = calloc(1, sizeof(ClientPool));
+    if (!pool) return NULL;
+    pool->config = *config;
+    snprintf(pool->ip, sizeof(pool->ip), "%s", config->ip ? config->ip : "127.0.0.1");
+    pool->config.ip = pool->ip;
+    if (pool->config.protocol_version == 0) pool->config.protocol_version = PROTOCOL_V2;
+    if (pool->config.timeout_ms <= 0) pool->config.timeout_ms = 5000;
+
+    // slot 數進位成 2 的次方，req_id (16 bits) 才能直接用 mask 對應；
+    // 多留一格: 在途的 request 全部被回 Invalid Session 時，重新登入仍有 slot 可用
+    uint32_t slots = 1;
+    int want = config->max_in_flight > 0 ? config->max_in_flight : 1024;
+    if (want > CLIENT_MAX_IN_FLIGHT - 1) want = CLIENT_MAX_IN_FLIGHT - 1;
+    while ((int)slots < want + 1) slots <<= 1;
+    pool->slot_mask = slots - 1;
+
+    pool->conns = calloc(config->connections, sizeof(PoolConnection));
+    if (!pool->conns) {
+        free(pool);
+        return NULL;
+    }
+
+    int connected = 0;
+    for (int i = 0; i < config->connections; i++) {
+        PoolConnection *conn = &pool->conns[i];
+        conn->fd = -1;
+        conn->slots = calloc(slots, sizeof(PendingRequest));
+        conn->rx_storage = malloc(CLIENT_RX_BUFFER);
+        if (!conn->slots || !conn->rx_storage) {
+            pool->config.connections = i + 1;
+            client_pool_destroy(pool);
+            return NULL;
+        }
+        if (conn_establish(pool, conn) == 0) connected++;
+    }
+
+    if (connected == 0) {
+        log_message(LOG_ERROR, "Client pool: no connection to %s:%d", pool->ip, config->port);
+        client_pool_destroy(pool);
+        return NULL;
+    }
+    return pool;
+}
+
+void client_pool_destroy(ClientPool *pool) {
+    if (!pool) return;
+    for (int i = 0; i < pool->config.connections; i++) {
+        PoolConnection *conn = &pool->conns[i];
+        if (conn->slots) conn_fail(conn, pool->slot_mask + 1);
+        free(conn->slots);
+        free(conn->rx_storage);
+        free(conn->tx);
+    }
+    free(pool->conns);
+    free(pool);
+}
+
+// ==========================================
+// 函數: client_pool_submit
+// 功能: 選一條連線 (round-robin，必要時重新連線) 並把 request 放進它的傳送緩衝區
+// ==========================================
+int client_pool_submit(ClientPool *pool, uint16_t opcode, const void *body, size_t body_len,
+                       client_callback callback, void *ctx) {
+    if (body_len > CLIENT_MAX_REQUEST_BODY) return -1;
+
+    for (int i = 0; i < pool->config.connections; i++) {
+        int index = (pool->next_conn + i) % pool->config.connections;
+        PoolConnection *conn = &pool->conns[index];
+        if (conn->fd < 0) {
+            if (conn->closing || conn->in_flight > 0 || conn_establish(pool, conn) < 0) continue;
+        }
+
+        PendingRequest *req = conn_take_slot(pool, conn, 0);
+        if (!req) continue;
+
+        req->callback = callback;
+        req->ctx = ctx;
+        req->opcode = opcode & ~OP_FLAG_MASK;
+        if (body_len > 0) {
+            req->body = malloc(body_len);
+            if (!req->body) {
+                conn_free_slot(conn, req);
+                return -1;
+            }
+            memcpy(req->body, body, body_len);
+            req->body_len = body_len;
+        }
+        if (conn_queue_packet(pool, conn, req) < 0) {
+            conn_free_slot(conn, req);
+            return -1;
+        }
+        pool->next_conn = (index + 1) % pool->config.connections;
+        return 0;
+    }
+    return -1;
+}
+
+// ==========================================
+// 函數: client_pool_poll
+// 功能: 寫出所有傳送緩衝區、等待回覆 (最多 timeout_ms)、逐一觸發 callback
+// 說明: 有 request 在等 OP_RESPONSE_BUSY 的重試時間時，最多只等到最早的那一個到期。
+// ==========================================
+int client_pool_poll(ClientPool *pool, int timeout_ms) {
+    int n = pool->config.connections;
+    struct pollfd fds[n];
+    int index[n];
+    int nfds = 0, completed = 0;
+    uint64_t now = now_ms();
+
+    for (int i = 0; i < n; i++) {
+        PoolConnection *conn = &pool->conns[i];
+        if (conn->fd < 0) continue;
+        if (conn->waiting > 0) {
+            int64_t due = conn_resend_due(pool, conn, now);
+            if (due < 0) {
+                conn_fail(conn, pool->slot_mask + 1);
+                continue;
+            }
+            if (due > 0 && (timeout_ms < 0 || (uint64_t)due - now < (uint64_t)timeout_ms)) {
+                timeout_ms = (int)((uint64_t)due - now);
+            }
+        }
+        if (conn->tx_len > 0 && conn_flush(conn) < 0) {
+            conn_fail(conn, pool->slot_mask + 1);
+            continue;
+        }
+        if (conn->in_flight > 0 && now - conn->last_progress_ms > (uint64_t)pool->config.timeout_ms) {
+            log_message(LOG_ERROR, "Client pool: connection %d timed out", conn->fd);
+            conn_fail(conn, pool->slot_mask + 1);
+            continue;
+        }
+        if (conn->in_flight == 0 && conn->tx_len == 0) continue;
+
+        fds[nfds].fd = conn->fd;
+        fds[nfds].events = POLLIN | (conn->tx_len > 0 ? POLLOUT : 0);
+        fds[nfds].revents = 0;
+        index[nfds++] = i;
+    }
+    if (nfds == 0) return 0;
+
+    int ready = poll(fds, nfds, timeout_ms);
+    if (ready < 0) return errno == EINTR ? 0 : -1;
+
+    for (int k = 0; k < nfds && ready > 0; k++) {
+        if (!fds[k].revents) continue;
+        PoolConnection *conn = &pool->conns[index[k]];
+
+        if ((fds[k].revents & POLLOUT) && conn_flush(conn) < 0) {
+            conn_fail(conn, pool->slot_mask + 1);
+            continue;
+        }
+        if (!(fds[k].revents & (POLLIN | POLLHUP | POLLERR))) continue;
+
+        ssize_t got = frame_reader_fill(&conn->rx, conn->fd);
+        if (got < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) continue;
+        if (got <= 0) {
+            conn_fail(conn, pool->slot_mask + 1);
+            continue;
+        }
+
+        ProtocolHeader header;
+        void *body;
+        int rc = 0;
+        while (conn->fd >= 0 && (rc = frame_reader_next(&conn->rx, &header, &body)) == 1) {
+            int done = conn_handle_reply(pool, conn, &header, body);
+            if (done < 0) {
+                rc = -1;
+                break;
+            }
+            completed += done;
+        }
+        if (rc < 0 && conn->fd >= 0) {
+            log_message(LOG_ERROR, "Client pool: bad reply on connection %d", conn->fd);
+            conn_fail(conn, pool->slot_mask + 1);
+        }
+    }
+
+    // callback 裡送出的 request 與重送的封包盡快寫出
+    for (int i = 0; i < n; i++) {
+        PoolConnection *conn = &pool->conns[i];
+        if (conn->fd >= 0 && conn->tx_len > 0 && conn_flush(conn) < 0) {
+            conn_fail(conn, pool->slot_mask + 1);
+        }
+    }
+    return completed;
+}
+
+size_t client_pool_in_flight(const ClientPool *pool) {
+    size_t total = 0;
+    for (int i = 0; i < pool->config.connections; i++) {
+        total += pool->conns[i].in_flight;
+    }
+    return total;
+}
+
+// ==========================================
+// 函數: client_pool_set_session
+// 功能: 讓已連線的連線改用指定的 session (測試重新登入、或沿用舊的 session)
+// ==========================================
+void client_pool_set_session(ClientPool *pool, uint32_t session_id) {
+    for (int i = 0; i < pool->config.connections; i++) {
+        PoolConnection *conn = &pool->conns[i];
+        if (conn->fd >= 0 && !conn->logging_in) conn->session_id = session_id;
+    }
+}
+
+void client_future_complete(void *future, const ClientReply *reply) {
+    ClientFuture *f = future;
+    f->reply = *reply;
+    f->reply.raw = NULL;
+    f->reply.raw_len = 0;
+    f->done = 1;
+}
+
+int client_pool_wait(ClientPool *pool, ClientFuture *future, int timeout_ms) {
+    uint64_t deadline = now_ms() + timeout_ms;
+    while (!future->done) {
+        uint64_t now = now_ms();
+        if (now >= deadline || client_pool_in_flight(pool) == 0) return -1;
+        if (client_pool_poll(pool, (int)(deadline - now)) < 0) return -1;
+    }
+    return 0;
+}
+
+int client_pool_call(ClientPool *pool, uint16_t opcode, const void *body, size_t body_len,
+                     ClientReply *out) {
+    ClientFuture future = { 0 };
+    if (client_pool_submit(pool, opcode, body, body_len, client_future_complete, &future) < 0 ||
+        client_pool_wait(pool, &future, pool->config.timeout_ms) < 0) {
+        return -1;
+    }
+    *out = future.reply;
+    return out->error;
+}
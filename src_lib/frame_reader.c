@@ -0,0 +1,94 @@
+// src_lib/frame_reader.c
+
+#include "common.h"
+#include <string.h>  // 用於 memcpy, memmove
+#include <unistd.h>  // 用於 read
+#include <errno.h>   // 用於 errno
+
+// ==========================================
+// 函數: frame_reader_init
+// 功能: 綁定呼叫端提供的緩衝區 (reader 本身不做任何 malloc)
+// ==========================================
+void frame_reader_init(FrameReader *fr, void *storage, size_t capacity, uint32_t max_frame) {
+    fr->buf = (char *)storage;
+    fr->cap = capacity;
+    fr->start = 0;
+    fr->end = 0;
+    // 一個完整的 frame 必須放得進緩衝區
+    fr->max_frame = max_frame <= capacity ? max_frame : (uint32_t)capacity;
+}
+
+// ==========================================
+// 函數: frame_reader_fill
+// 功能: 用一次 read() 盡量把緩衝區填滿
+// 說明: 讀之前先把還沒處理完的半個 frame 搬到最前面，
+//       所以剩餘空間一定放得下一個最大的 frame。
+// 回傳: 讀到的 bytes 數；0 = 對方關閉連線；-1 = 錯誤 (errno 保留，EAGAIN 代表暫時沒資料)
+// ==========================================
+ssize_t frame_reader_fill(FrameReader *fr, int fd) {
+    if (fr->start > 0) {
+        memmove(fr->buf, fr->buf + fr->start, fr->end - fr->start);
+        fr->end -= fr->start;
+        fr->start = 0;
+    }
+
+    ssize_t n;
+    TRACE_START(trace_t);
+    do {
+        n = read(fd, fr->buf + fr->end, fr->cap - fr->end);
+    } while (n < 0 && errno == EINTR);
+    TRACE_PHASE(trace_t, TRACE_READ, 0);
+
+    if (n > 0) fr->end += n;
+    return n;
+}
+
+// ==========================================
+// 函數: frame_reader_next
+// 功能: 從緩衝區取出下一個完整的 frame (就地解析，不複製 body)
+// 說明: *header 得到解密後的 header 副本；*body 指向緩衝區內仍是密文的 body
+//       (沒有 body 時為 NULL)。指標在下一次 frame_reader_fill 之前都有效。
+// 回傳: 1 = 取得一個 frame；0 = 資料還不完整；-1 = packet_len 不合法
+// ==========================================
+int frame_reader_next(FrameReader *fr, ProtocolHeader *header, void **body) {
+    size_t avail = fr->end - fr->start;
+    if (avail < sizeof(ProtocolHeader)) return 0;
+
+    // header 先解密一份副本: frame 可能還沒收完，緩衝區內容不能動
+    memcpy(header, fr->buf + fr->start, sizeof(ProtocolHeader));
+    xor_cipher(header, sizeof(ProtocolHeader));
+    if (header->packet_len < sizeof(ProtocolHeader) || header->packet_len > fr->max_frame) {
+        return -1;
+    }
+    if (avail < header->packet_len) return 0;
+
+    *body = header->packet_len > sizeof(ProtocolHeader) ? fr->buf + fr->start + sizeof(ProtocolHeader) : NULL;
+    fr->start += header->packet_len;
+    return 1;
+}
+
+// ==========================================
+// 函數: frame_reader_pending
+// 功能: 緩衝區內還沒被取走的 bytes 數
+// ==========================================
+size_t frame_reader_pending(const FrameReader *fr) {
+    return fr->end - fr->start;
+}
+
+// ==========================================
+// 函數: frame_reader_append
+// 功能: 把別處收到的資料接在緩衝區後面 (取代 frame_reader_fill 的 read())
+// 說明: 空間不夠時只放一部分；緩衝區滿了一定含有一個完整的 frame，
+//       呼叫端取出 frame 後再放剩下的部分。
+// ==========================================
+size_t frame_reader_append(FrameReader *fr, const void *data, size_t len) {
+    if (fr->start > 0) {
+        memmove(fr->buf, fr->buf + fr->start, fr->end - fr->start);
+        fr->end -= fr->start;
+        fr->start = 0;
+    }
+    size_t n = fr->cap - fr->end < len ? fr->cap - fr->end : len;
+    memcpy(fr->buf + fr->end, data, n);
+    fr->end += n;
+    return n;
+}
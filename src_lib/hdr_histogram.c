@@ -0,0 +1,93 @@
+// src_lib/hdr_histogram.c
+
+#include "common.h"
+#include <string.h>  // 用於 memset
+
+#define HDR_SUB_BUCKET_COUNT (1u << HDR_SUB_BUCKET_BITS)       // 2048
+#define HDR_SUB_BUCKET_HALF  (1u << (HDR_SUB_BUCKET_BITS - 1)) // 1024
+#define HDR_MAX_VALUE        ((1ull << HDR_MAX_MAGNITUDE) - 1)
+
+// 值 -> 桶的編號
+static inline uint32_t bucket_index(uint64_t value) {
+    if (value < HDR_SUB_BUCKET_COUNT) {
+        return (uint32_t)value;
+    }
+    // 最高位元在 msb，保留最高的 11 個位元: value >> shift 落在 [1024, 2048)
+    uint32_t msb = 63 - __builtin_clzll(value);
+    uint32_t shift = msb - (HDR_SUB_BUCKET_BITS - 1);
+    return HDR_SUB_BUCKET_COUNT + (shift - 1) * HDR_SUB_BUCKET_HALF +
+           (uint32_t)((value >> shift) - HDR_SUB_BUCKET_HALF);
+}
+
+// 桶的編號 -> 這個桶能代表的最大值
+static uint64_t bucket_upper(uint32_t index) {
+    if (index < HDR_SUB_BUCKET_COUNT) {
+        return index;
+    }
+    uint32_t shift = (index - HDR_SUB_BUCKET_COUNT) / HDR_SUB_BUCKET_HALF + 1;
+    uint64_t sub = (index - HDR_SUB_BUCKET_COUNT) % HDR_SUB_BUCKET_HALF + HDR_SUB_BUCKET_HALF;
+    return ((sub + 1) << shift) - 1;
+}
+
+// ==========================================
+// 函數: hdr_init
+// 功能: 清空直方圖 (結構約 250 KB，建議放在 heap 上)
+// ==========================================
+void hdr_init(HdrHistogram *h) {
+    memset(h, 0, sizeof(HdrHistogram));
+    h->min = UINT64_MAX;
+}
+
+// ==========================================
+// 函數: hdr_record
+// 功能: 記錄一個值，超過可記錄範圍的值以最大值計
+// ==========================================
+void hdr_record(HdrHistogram *h, uint64_t value) {
+    if (value > HDR_MAX_VALUE) value = HDR_MAX_VALUE;
+    h->counts[bucket_index(value)]++;
+    h->total++;
+    h->sum += (double)value;
+    if (value < h->min) h->min = value;
+    if (value > h->max) h->max = value;
+}
+
+// ==========================================
+// 函數: hdr_merge
+// 功能: 把 src 的內容加進 dst (例如合併各 thread 的直方圖)
+// ==========================================
+void hdr_merge(HdrHistogram *dst, const HdrHistogram *src) {
+    if (src->total == 0) return;
+    for (uint32_t i = 0; i < HDR_BUCKET_COUNT; i++) {
+        dst->counts[i] += src->counts[i];
+    }
+    dst->total += src->total;
+    dst->sum += src->sum;
+    if (src->min < dst->min) dst->min = src->min;
+    if (src->max > dst->max) dst->max = src->max;
+}
+
+// ==========================================
+// 函數: hdr_value_at_percentile
+// 功能: 找出至少 percentile% 的紀錄落在其中 (含) 以下的桶
+// ==========================================
+uint64_t hdr_value_at_percentile(const HdrHistogram *h, double percentile) {
+    if (h->total == 0) return 0;
+    if (percentile > 100.0) percentile = 100.0;
+
+    uint64_t target = (uint64_t)(percentile / 100.0 * (double)h->total + 0.5);
+    if (target < 1) target = 1;
+
+    uint64_t seen = 0;
+    for (uint32_t i = 0; i < HDR_BUCKET_COUNT; i++) {
+        seen += h->counts[i];
+        if (seen >= target) {
+            uint64_t value = bucket_upper(i);
+            return value < h->max ? value : h->max;
+        }
+    }
+    return h->max;
+}
+
+double hdr_mean(const HdrHistogram *h) {
+    return h->total ? h->sum / (double)h->total : 0.0;
+}
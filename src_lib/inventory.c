@@ -0,0 +1,100 @@
+// src_lib/inventory.c
+
+#include "common.h"
+
+// ==========================================
+// 函數: inventory_event
+// 功能: 依活動編號取得該活動的票數 (只會碰到該活動自己的 cache line)
+// ==========================================
+atomic_int *inventory_event(InventorySlot *events, uint32_t num_events, uint32_t event_id) {
+    if (event_id >= num_events) {
+        return NULL;
+    }
+    return &events[event_id].tickets;
+}
+
+// ==========================================
+// 函數: inventory_set
+// 功能: 直接設定票數 (只在初始化或管理操作時使用)
+// ==========================================
+void inventory_set(atomic_int *tickets, int count) {
+    atomic_store_explicit(tickets, count, memory_order_release);
+}
+
+// ==========================================
+// 函數: inventory_query
+// 功能: 讀取剩餘票數
+// 說明: 單一 atomic load，不需要任何鎖
+// ==========================================
+int inventory_query(atomic_int *tickets) {
+    return atomic_load_explicit(tickets, memory_order_acquire);
+}
+
+// ==========================================
+// 函數: inventory_try_book
+// 功能: 以 compare-and-swap 扣除票數
+// 說明: 讀取目前票數 -> 檢查是否足夠 -> CAS 寫回新值。
+//       若其他 process 在這之間改過票數，CAS 會失敗並拿到最新值，重試即可。
+//       票數永遠不會被扣成負數。重試的次數記進統計數據 (競爭程度)。
+// ==========================================
+int inventory_try_book(atomic_int *tickets, uint32_t num_tickets, int *remaining) {
+    int current = atomic_load_explicit(tickets, memory_order_relaxed);
+    uint32_t retries = 0;
+    int booked = 1;
+
+    while (1) {
+        if ((unsigned int)current < num_tickets) {
+            // 票數不足，不做任何修改
+            booked = 0;
+            break;
+        }
+        if (atomic_compare_exchange_weak_explicit(tickets, &current, current - (int)num_tickets,
+                                                  memory_order_acq_rel, memory_order_relaxed)) {
+            current -= (int)num_tickets;
+            break;
+        }
+        retries++;
+    }
+
+    if (retries) metrics_cas_retry(METRICS_CAS_INVENTORY, retries);
+    *remaining = current;
+    return booked;
+}
+
+// ==========================================
+// 函數: inventory_try_book_batch
+// 功能: 一次 CAS 完成整批訂單
+// 說明: 以讀到的票數在本地依序模擬每筆訂單，算出最終票數後一次 CAS 寫回。
+//       CAS 失敗代表有人在中間訂過票，用新的票數重新模擬即可。
+// ==========================================
+int inventory_try_book_batch(atomic_int *tickets, const BookRequest *entries, uint32_t count,
+                             uint8_t *results, int *remaining) {
+    int current = atomic_load_explicit(tickets, memory_order_relaxed);
+    int left, booked;
+    uint32_t retries = 0;
+
+    do {
+        left = current;
+        booked = 0;
+        for (uint32_t i = 0; i < count; i++) {
+            if ((unsigned int)left >= entries[i].num_tickets) {
+                left -= (int)entries[i].num_tickets;
+                results[i] = BATCH_RESULT_BOOKED;
+                booked++;
+            } else {
+                results[i] = BATCH_RESULT_REJECTED;
+            }
+        }
+        // 全部都沒訂到就不用寫回
+        if (left == current) break;
+        if (atomic_compare_exchange_weak_explicit(tickets, &current, left,
+                                                  memory_order_acq_rel, memory_order_relaxed)) {
+            break;
+        }
+        retries++;
+    } while (1);
+
+    if (retries) metrics_cas_retry(METRICS_CAS_INVENTORY, retries);
+    *remaining = left;
+    return booked;
+}
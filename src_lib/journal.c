@@ -0,0 +1,451 @@
+// src_lib/journal.c
+
+#include "common.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <limits.h>
+#include <signal.h>
+#include <time.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <sys/prctl.h>
+
+// ==========================================
+// 共享狀態 (Shared Journal State)
+// ==========================================
+// 一塊 MAP_SHARED 的記憶體，在 fork 之前建立，server 的所有 process 共用:
+//   - ring: 多個 producer (worker) 用 fetch_add 取得序號，序號決定格子；
+//     紀錄寫好後才把序號存進 ready，committer 依序號順序取走
+//   - published / durable_gen: 兩個 futex 字，分別用來叫醒 committer 與等待的 worker
+// committer 只在閒置 (IDLE) 或湊批次 (FILLING) 且批次已滿時才需要被叫醒，
+// 其餘時候 producer 不做任何系統呼叫。
+
+#define JOURNAL_RING_MASK      (JOURNAL_RING_RECORDS - 1)
+#define JOURNAL_IDLE_WAIT_NS   100000000L  // 100 ms: 閒置時也定期醒來檢查是否要結束
+#define JOURNAL_REPLAY_CHUNK   4096         // 重播時一次讀入的紀錄數
+
+enum { COMMITTER_BUSY, COMMITTER_IDLE, COMMITTER_FILLING };
+
+typedef struct {
+    _Atomic uint64_t ready;      // 格子裡目前放的紀錄序號 (寫完才發布)
+    JournalRecord rec;
+} JournalSlot;
+
+typedef struct {
+    // producer 端
+    _Atomic uint64_t next_seq;       // 下一個要配發的序號
+    atomic_uint published;           // futex: 每發布一筆遞增
+    atomic_int committer_state;      // COMMITTER_*
+    _Atomic uint64_t fill_target;    // FILLING 時，發布到這個序號的 producer 負責叫醒 committer
+    char pad0[CACHE_LINE_SIZE - 2 * sizeof(uint64_t) - 2 * sizeof(int)];
+    // committer 端
+    _Atomic uint64_t durable_seq;    // 已 fdatasync 的最大序號
+    atomic_uint durable_gen;         // futex: 每次 commit 後遞增
+    atomic_int waiters;              // 正在 futex 上等待的 worker 數
+    atomic_int failed;               // committer 寫入失敗或已結束
+    atomic_int stopping;
+    _Atomic uint64_t records;
+    _Atomic uint64_t commits;
+    pid_t committer_pid;
+    uint32_t batch_records;
+    uint32_t batch_us;
+    int no_sync;
+    JournalSlot ring[JOURNAL_RING_RECORDS];
+} JournalShared;
+
+static JournalShared *journal = NULL;
+static pid_t journal_creator_pid = 0;
+
+static long futex_wait(atomic_uint *word, uint32_t expected, long timeout_ns) {
+    struct timespec ts = { timeout_ns / 1000000000L, timeout_ns % 1000000000L };
+    return syscall(SYS_futex, word, FUTEX_WAIT, expected, timeout_ns > 0 ? &ts : NULL, NULL, 0);
+}
+
+static void futex_wake(atomic_uint *word, int count) {
+    syscall(SYS_futex, word, FUTEX_WAKE, count, NULL, NULL, 0);
+}
+
+static uint64_t journal_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000UL + ts.tv_nsec;
+}
+
+static uint32_t journal_record_checksum(const JournalRecord *rec) {
+    return crc32c_update(0, rec, offsetof(JournalRecord, checksum));
+}
+
+// ==========================================
+// 重播 (Recovery)
+// ==========================================
+
+// 新檔案 (或連檔頭都沒寫完的檔案): 寫入檔頭並照參數初始化票數 (events 為 NULL 時不初始化)
+static int journal_create(int fd, InventorySlot *events, uint32_t num_events, int tickets_per_event) {
+    JournalFileHeader header;
+    memcpy(header.magic, JOURNAL_MAGIC, sizeof(header.magic));
+    header.num_events = num_events;
+    header.tickets_per_event = tickets_per_event;
+    if (ftruncate(fd, 0) < 0 || pwrite(fd, &header, sizeof(header), 0) != sizeof(header) || fsync(fd) < 0) {
+        perror("journal: failed to write header");
+        return -1;
+    }
+    for (uint32_t i = 0; events && i < num_events; i++) {
+        inventory_set(&events[i].tickets, tickets_per_event);
+    }
+    return 0;
+}
+
+// 票數已經由別處還原時，只需要最後一筆的序號: 尾巴完整就只讀最後一筆
+static int journal_tail_seq(int fd, off_t file_size, uint64_t *last_seq) {
+    off_t body = file_size - (off_t)sizeof(JournalFileHeader);
+    if (body == 0) return 1;
+    if (body % sizeof(JournalRecord) != 0) return 0;
+    JournalRecord rec;
+    if (pread(fd, &rec, sizeof(rec), file_size - sizeof(rec)) != sizeof(rec) ||
+        rec.checksum != journal_record_checksum(&rec)) {
+        return 0;
+    }
+    *last_seq = rec.seq;
+    return 1;
+}
+
+// 依檔頭重設票數並套用每一筆完整的紀錄；第一筆不完整 / checksum 不符的紀錄
+// (當機時寫到一半) 及其後的內容都會被截掉。events 為 NULL 時只找出最後的序號。
+// 回傳重播的筆數，-1 = 檔案不是日誌
+static long journal_replay(int fd, off_t file_size, InventorySlot *events, uint32_t *num_events,
+                           uint64_t *last_seq) {
+    JournalFileHeader header;
+    if (pread(fd, &header, sizeof(header), 0) != sizeof(header) ||
+        memcmp(header.magic, JOURNAL_MAGIC, sizeof(header.magic)) != 0 ||
+        header.num_events == 0 || header.num_events > INVENTORY_MAX_EVENTS) {
+        fprintf(stderr, "journal: not a booking journal (bad header)\n");
+        return -1;
+    }
+    if (!events) {
+        if (journal_tail_seq(fd, file_size, last_seq)) return 0;
+    } else {
+        for (uint32_t i = 0; i < header.num_events; i++) {
+            inventory_set(&events[i].tickets, header.tickets_per_event);
+        }
+        *num_events = header.num_events;
+    }
+
+    JournalRecord *chunk = malloc(JOURNAL_REPLAY_CHUNK * sizeof(JournalRecord));
+    if (!chunk) return -1;
+
+    long replayed = 0;
+    off_t offset = sizeof(header);
+    int torn = 0;
+    while (!torn && offset < file_size) {
+        ssize_t n = pread(fd, chunk, JOURNAL_REPLAY_CHUNK * sizeof(JournalRecord), offset);
+        if (n <= 0) break;
+        size_t whole = n / sizeof(JournalRecord);
+        if (whole == 0) break;   // 只剩半筆
+        for (size_t i = 0; i < whole; i++) {
+            JournalRecord *rec = &chunk[i];
+            if (rec->checksum != journal_record_checksum(rec) ||
+                (*last_seq != 0 && rec->seq != *last_seq + 1)) {
+                torn = 1;
+                break;
+            }
+            int remaining;
+            atomic_int *tickets = events ? inventory_event(events, *num_events, rec->event_id) : NULL;
+            if (events && (!tickets || !inventory_try_book(tickets, rec->num_tickets, &remaining))) {
+                fprintf(stderr, "journal: record %lu does not apply (event %u, %u tickets), skipped\n",
+                        (unsigned long)rec->seq, rec->event_id, rec->num_tickets);
+            }
+            *last_seq = rec->seq;
+            offset += sizeof(JournalRecord);
+            if (events) replayed++;
+        }
+    }
+    free(chunk);
+
+    if (offset < file_size) {
+        fprintf(stderr, "journal: dropping %ld bytes of incomplete records at offset %ld\n",
+                (long)(file_size - offset), (long)offset);
+        if (ftruncate(fd, offset) < 0 || fsync(fd) < 0) {
+            perror("journal: failed to truncate");
+            return -1;
+        }
+    }
+    return replayed;
+}
+
+// ==========================================
+// Committer process
+// ==========================================
+
+static volatile sig_atomic_t committer_stop_signal = 0;
+
+static void committer_on_term(int sig) {
+    (void)sig;
+    committer_stop_signal = 1;
+}
+
+// 從序號 next 開始，連續已發布的紀錄數 (最多 max 筆)
+static uint32_t journal_ready_count(uint64_t next, uint32_t max) {
+    uint32_t n = 0;
+    while (n < max) {
+        JournalSlot *slot = &journal->ring[(next + n) & JOURNAL_RING_MASK];
+        if (atomic_load_explicit(&slot->ready, memory_order_acquire) != next + n) break;
+        n++;
+    }
+    return n;
+}
+
+// 把 ring 中已發布的紀錄寫進檔案；n 筆一起 write + fdatasync。
+// 批次未滿時最多等 batch_us，等待期間只有補滿批次的 producer 會叫醒它。
+static void journal_committer_main(int fd) {
+    prctl(PR_SET_PDEATHSIG, SIGTERM);
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = committer_on_term;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGTERM, &sa, NULL);   // 不設 SA_RESTART: futex 等待要被打斷
+    signal(SIGINT, SIG_IGN);
+
+    uint32_t batch_max = journal->batch_records;
+    JournalRecord *batch = malloc(batch_max * sizeof(JournalRecord));
+    if (!batch) _exit(EXIT_FAILURE);
+
+    uint64_t next = atomic_load(&journal->durable_seq) + 1;
+    uint64_t fill_start = 0;
+    while (1) {
+        int stopping = committer_stop_signal || atomic_load(&journal->stopping);
+        uint32_t n = journal_ready_count(next, batch_max);
+
+        if (n == 0) {
+            if (stopping) break;
+            atomic_store(&journal->committer_state, COMMITTER_IDLE);
+            uint32_t gen = atomic_load(&journal->published);
+            if (journal_ready_count(next, 1) == 0) {
+                futex_wait(&journal->published, gen, JOURNAL_IDLE_WAIT_NS);
+            }
+            atomic_store(&journal->committer_state, COMMITTER_BUSY);
+            continue;
+        }
+
+        if (n < batch_max && journal->batch_us > 0 && !stopping) {
+            uint64_t now = journal_now_ns();
+            if (fill_start == 0) fill_start = now;
+            uint64_t deadline = fill_start + (uint64_t)journal->batch_us * 1000;
+            if (now < deadline) {
+                atomic_store(&journal->fill_target, next + batch_max - 1);
+                atomic_store(&journal->committer_state, COMMITTER_FILLING);
+                uint32_t gen = atomic_load(&journal->published);
+                if (journal_ready_count(next, batch_max) == n) {
+                    futex_wait(&journal->published, gen, deadline - now);
+                }
+                atomic_store(&journal->committer_state, COMMITTER_BUSY);
+                continue;
+            }
+        }
+        fill_start = 0;
+
+        for (uint32_t i = 0; i < n; i++) {
+            batch[i] = journal->ring[(next + i) & JOURNAL_RING_MASK].rec;
+        }
+        size_t len = n * sizeof(JournalRecord);
+        const char *p = (const char *)batch;
+        int error = 0;
+        while (len > 0) {
+            ssize_t w = write(fd, p, len);
+            if (w < 0) {
+                if (errno == EINTR) continue;
+                error = 1;
+                break;
+            }
+            p += w;
+            len -= w;
+        }
+        if (!error && !journal->no_sync && fdatasync(fd) < 0) error = 1;
+        if (error) {
+            // 無法保證寫入: 不能再回覆任何 SUCCESS
+            perror("journal: commit failed");
+            break;
+        }
+
+        next += n;
+        atomic_store(&journal->durable_seq, next - 1);
+        atomic_fetch_add_explicit(&journal->records, n, memory_order_relaxed);
+        atomic_fetch_add_explicit(&journal->commits, 1, memory_order_relaxed);
+        atomic_fetch_add(&journal->durable_gen, 1);
+        if (atomic_load(&journal->waiters) > 0) futex_wake(&journal->durable_gen, INT_MAX);
+    }
+
+    // 之後的 journal_wait 一律失敗，不讓任何人等下去
+    atomic_store(&journal->failed, 1);
+    atomic_fetch_add(&journal->durable_gen, 1);
+    futex_wake(&journal->durable_gen, INT_MAX);
+    free(batch);
+    _exit(0);
+}
+
+static void journal_atexit(void) {
+    journal_close();
+}
+
+// ==========================================
+// 函數: journal_open
+// 功能: 重播 (或建立) 日誌檔，建立共享 ring 並 fork 出 committer process
+// ==========================================
+long journal_open(const char *path, const JournalConfig *config, InventorySlot *events,
+                  uint32_t *num_events, int tickets_per_event) {
+    static int atexit_registered = 0;
+
+    if (journal) return -1;
+    int fd = open(path, O_RDWR | O_CREAT, 0644);
+    if (fd < 0) {
+        perror("journal: open failed");
+        return -1;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) < 0) {
+        perror("journal: fstat failed");
+        close(fd);
+        return -1;
+    }
+    long replayed = 0;
+    uint64_t last_seq = 0;
+    if (config && config->skip_replay) events = NULL;
+    if (st.st_size < (off_t)sizeof(JournalFileHeader)) {
+        if (journal_create(fd, events, *num_events, tickets_per_event) < 0) replayed = -1;
+    } else {
+        replayed = journal_replay(fd, st.st_size, events, num_events, &last_seq);
+    }
+    if (replayed < 0 || lseek(fd, 0, SEEK_END) < 0) {
+        close(fd);
+        return -1;
+    }
+
+    void *mem = mmap(NULL, sizeof(JournalShared), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (mem == MAP_FAILED) {
+        perror("journal: mmap failed");
+        close(fd);
+        return -1;
+    }
+    journal = (JournalShared *)mem;   // MAP_ANONYMOUS: 已經全部是 0
+    journal->batch_records = config && config->batch_records ? config->batch_records : JOURNAL_DEFAULT_BATCH_RECORDS;
+    if (journal->batch_records > JOURNAL_RING_RECORDS) journal->batch_records = JOURNAL_RING_RECORDS;
+    journal->batch_us = config ? config->batch_us : JOURNAL_DEFAULT_BATCH_US;
+    journal->no_sync = config ? config->no_sync : 0;
+    atomic_store(&journal->next_seq, last_seq + 1);
+    atomic_store(&journal->durable_seq, last_seq);
+
+    // stdio buffer 不能被 committer 複製一份
+    fflush(NULL);
+    pid_t pid = fork();
+    if (pid < 0) {
+        perror("journal: fork failed");
+        munmap(mem, sizeof(JournalShared));
+        journal = NULL;
+        close(fd);
+        return -1;
+    }
+    if (pid == 0) {
+        journal_committer_main(fd);
+    }
+    close(fd);   // 只有 committer 寫檔
+
+    journal->committer_pid = pid;
+    journal_creator_pid = getpid();
+    if (!atexit_registered) {
+        atexit(journal_atexit);
+        atexit_registered = 1;
+    }
+    return replayed;
+}
+
+// ==========================================
+// 函數: journal_append
+// 功能: 把一筆訂票放進 ring，必要時叫醒 committer
+// ==========================================
+uint64_t journal_append(uint32_t event_id, uint32_t num_tickets, uint32_t user_id) {
+    if (!journal) return 0;
+
+    uint64_t seq = atomic_fetch_add(&journal->next_seq, 1);
+    // ring 滿了: 等 committer 寫出這一格上一輪的紀錄
+    if (seq > JOURNAL_RING_RECORDS && journal_wait(seq - JOURNAL_RING_RECORDS) < 0) return seq;
+
+    JournalSlot *slot = &journal->ring[seq & JOURNAL_RING_MASK];
+    slot->rec.seq = seq;
+    slot->rec.event_id = event_id;
+    slot->rec.num_tickets = num_tickets;
+    slot->rec.user_id = user_id;
+    slot->rec.checksum = journal_record_checksum(&slot->rec);
+    atomic_store_explicit(&slot->ready, seq, memory_order_release);
+
+    atomic_fetch_add(&journal->published, 1);
+    int state = atomic_load(&journal->committer_state);
+    if (state == COMMITTER_IDLE ||
+        (state == COMMITTER_FILLING && seq >= atomic_load(&journal->fill_target))) {
+        futex_wake(&journal->published, 1);
+    }
+    return seq;
+}
+
+// ==========================================
+// 函數: journal_wait
+// 功能: 等到 seq 已寫入磁碟 (futex，不忙等)
+// ==========================================
+int journal_wait(uint64_t seq) {
+    if (!journal || seq == 0) return 0;
+
+    while (1) {
+        uint32_t gen = atomic_load(&journal->durable_gen);
+        if (atomic_load(&journal->durable_seq) >= seq) return 0;
+        if (atomic_load(&journal->failed)) return -1;
+
+        atomic_fetch_add(&journal->waiters, 1);
+        long ret = futex_wait(&journal->durable_gen, gen, JOURNAL_IDLE_WAIT_NS);
+        atomic_fetch_sub(&journal->waiters, 1);
+        // committer 被 SIGKILL 時不會設 failed
+        if (ret < 0 && errno == ETIMEDOUT && kill(journal->committer_pid, 0) < 0 && errno == ESRCH) {
+            return -1;
+        }
+    }
+}
+
+// ==========================================
+// 函數: journal_durable_seq
+// 功能: 回傳已寫入磁碟的最大序號
+// ==========================================
+uint64_t journal_durable_seq(void) {
+    return journal ? atomic_load(&journal->durable_seq) : 0;
+}
+
+// ==========================================
+// 函數: journal_stats
+// 功能: 回傳累計寫入的紀錄數與 commit 次數
+// ==========================================
+void journal_stats(uint64_t *records, uint64_t *commits) {
+    *records = journal ? atomic_load(&journal->records) : 0;
+    *commits = journal ? atomic_load(&journal->commits) : 0;
+}
+
+// ==========================================
+// 函數: journal_close
+// 功能: 通知 committer 寫完剩下的紀錄並等待它結束
+// ==========================================
+void journal_close(void) {
+    if (!journal) return;
+    if (getpid() != journal_creator_pid) {
+        // fork 出來的 process 只是放掉對應
+        journal = NULL;
+        return;
+    }
+    atomic_store(&journal->stopping, 1);
+    futex_wake(&journal->published, 1);
+    waitpid(journal->committer_pid, NULL, 0);
+    munmap(journal, sizeof(JournalShared));
+    journal = NULL;
+}
@@ -1,99 +1,1034 @@
-// src_lib/logger.c
-
-#include "common.h"
-#include <stdio.h>
-#include <stdlib.h>
-#include <stdarg.h>
-#include <time.h>
-#include <string.h>
-#include <pthread.h>
-#include <unistd.h>
-#include <fcntl.h>   // 用於 fcntl 檔案鎖
-#include <sys/file.h>
-#include <errno.h>
-
-static FILE *log_file = NULL;
-static pthread_mutex_t log_mutex = PTHREAD_MUTEX_INITIALIZER;
-
-// 初始化
-void init_logger(const char *filename) {
-    if (filename) {
-        log_file = fopen(filename, "a"); // Append mode
-        if (!log_file) {
-            perror("Failed to open log file, using stdout");
-            log_file = stdout;
-        }
-    } else {
-        log_file = stdout;
-    }
-}
-
-// 內部 helper: 檔案鎖定
-static int lock_file(FILE *fp) {
-    int fd = fileno(fp);
-    struct flock fl;
-    fl.l_type = F_WRLCK;    // 寫入鎖 (獨佔鎖)
-    fl.l_whence = SEEK_SET;
-    fl.l_start = 0;
-    fl.l_len = 0;           // 鎖定整個檔案
-    
-    // F_SETLKW: 若有鎖則等待 (Wait)
-    return fcntl(fd, F_SETLKW, &fl);
-}
-
-// 內部 helper: 解除鎖定
-static int unlock_file(FILE *fp) {
-    int fd = fileno(fp);
-    struct flock fl;
-    fl.l_type = F_UNLCK;    // 解鎖
-    fl.l_whence = SEEK_SET;
-    fl.l_start = 0;
-    fl.l_len = 0;
-    
-    return fcntl(fd, F_SETLKW, &fl);
-}
-
-void log_message(LogLevel level, const char *format, ...) {
-    if (!log_file) return;
-
-    // 1. 準備時間與層級字串
-    time_t now;
-    time(&now);
-    struct tm *local = localtime(&now);
-    char time_str[20];
-    strftime(time_str, sizeof(time_str), "%Y-%m-%d %H:%M:%S", local);
-
-    const char *level_str = "INFO";
-    if (level == LOG_ERROR) level_str = "ERROR";
-    else if (level == LOG_DEBUG) level_str = "DEBUG";
-
-    // 2. 格式化訊息內容 (先寫入 buffer 避免多次 I/O)
-    char buffer[1024];
-    char message_buffer[800]; // 用於存放變數參數處理後的結果
-
-    va_list args;
-    va_start(args, format);
-    vsnprintf(message_buffer, sizeof(message_buffer), format, args);
-    va_end(args);
-
-    // 組合最終字串: [時間] [層級] 訊息\n
-    snprintf(buffer, sizeof(buffer), "[%s] [%s] %s\n", time_str, level_str, message_buffer);
-
-    // ==========================================
-    // 關鍵區域 (Critical Section)
-    // ==========================================
-    
-    // 第一層保護: 針對同 Process 內的多 Thread
-    pthread_mutex_lock(&log_mutex);
-
-    // 第二層保護: 針對不同 Process (使用 OS 檔案鎖)
-    lock_file(log_file);
-
-    // 執行寫入
-    fputs(buffer, log_file);
-    fflush(log_file); // 確保立刻寫入磁碟
-
-    // 解鎖
-    unlock_file(log_file);
-    pthread_mutex_unlock(&log_mutex);
-}
\ No newline at end of file
+// src_lib/logger.c
+
+#include "common.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <time.h>
+#include <string.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <fcntl.h>   // 用於 fcntl 檔案鎖
+#include <sys/file.h>
+#include <errno.h>
+#include <stdatomic.h>
+#include <sched.h>   // sched_yield
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <sys/prctl.h>
+
+static FILE *log_file = NULL;
+static pthread_mutex_t log_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static void log_message_async(LogLevel level, const char *format, va_list args);
+static int log_message_shm(LogLevel level, const char *format, va_list args);
+static atomic_int async_enabled = 0;
+static int shm_enabled = 0;
+static int binlog_fd = -1;
+static void binlog_atexit(void);
+
+// 初始化
+void init_logger(const char *filename) {
+    if (filename) {
+        log_file = fopen(filename, "a"); // Append mode
+        if (!log_file) {
+            perror("Failed to open log file, using stdout");
+            log_file = stdout;
+        }
+    } else {
+        log_file = stdout;
+    }
+}
+
+// 內部 helper: 檔案鎖定
+static int lock_file(FILE *fp) {
+    int fd = fileno(fp);
+    struct flock fl;
+    fl.l_type = F_WRLCK;    // 寫入鎖 (獨佔鎖)
+    fl.l_whence = SEEK_SET;
+    fl.l_start = 0;
+    fl.l_len = 0;           // 鎖定整個檔案
+    
+    // F_SETLKW: 若有鎖則等待 (Wait)
+    return fcntl(fd, F_SETLKW, &fl);
+}
+
+// 內部 helper: 解除鎖定
+static int unlock_file(FILE *fp) {
+    int fd = fileno(fp);
+    struct flock fl;
+    fl.l_type = F_UNLCK;    // 解鎖
+    fl.l_whence = SEEK_SET;
+    fl.l_start = 0;
+    fl.l_len = 0;
+    
+    return fcntl(fd, F_SETLKW, &fl);
+}
+
+void log_message(LogLevel level, const char *format, ...) {
+    if (atomic_load_explicit(&async_enabled, memory_order_relaxed)) {
+        va_list args;
+        va_start(args, format);
+        log_message_async(level, format, args);
+        va_end(args);
+        return;
+    }
+
+    if (shm_enabled) {
+        va_list args;
+        va_start(args, format);
+        int ret = log_message_shm(level, format, args);
+        va_end(args);
+        if (ret == 0) return;
+        // 沒有空的區塊可用，或 collector 跟不上: 退回下面的檔案鎖路徑
+    }
+
+    if (!log_file) return;
+
+    // 1. 準備時間與層級字串 (localtime_r: 多個 thread 同時呼叫時不共用 static 的 struct tm)
+    time_t now;
+    time(&now);
+    struct tm local;
+    localtime_r(&now, &local);
+    char time_str[20];
+    strftime(time_str, sizeof(time_str), "%Y-%m-%d %H:%M:%S", &local);
+
+    const char *level_str = "INFO";
+    if (level == LOG_ERROR) level_str = "ERROR";
+    else if (level == LOG_DEBUG) level_str = "DEBUG";
+
+    // 2. 格式化訊息內容 (先寫入 buffer 避免多次 I/O)
+    char buffer[1024];
+    char message_buffer[800]; // 用於存放變數參數處理後的結果
+
+    va_list args;
+    va_start(args, format);
+    vsnprintf(message_buffer, sizeof(message_buffer), format, args);
+    va_end(args);
+
+    // 組合最終字串: [時間] [層級] 訊息\n
+    snprintf(buffer, sizeof(buffer), "[%s] [%s] %s\n", time_str, level_str, message_buffer);
+
+    // ==========================================
+    // 關鍵區域 (Critical Section)
+    // ==========================================
+    
+    // 第一層保護: 針對同 Process 內的多 Thread
+    pthread_mutex_lock(&log_mutex);
+
+    // 第二層保護: 針對不同 Process (使用 OS 檔案鎖)
+    lock_file(log_file);
+
+    // 執行寫入
+    fputs(buffer, log_file);
+    fflush(log_file); // 確保立刻寫入磁碟
+
+    // 解鎖
+    unlock_file(log_file);
+    pthread_mutex_unlock(&log_mutex);
+}
+
+// ==========================================
+// 非同步模式 (Async Logger)
+// ==========================================
+// 多個 producer (任何呼叫 log_message 的 thread) / 單一 consumer (背景 flusher)
+// 的 bounded ring buffer。每個 slot 帶一個 sequence number:
+//   seq == pos           -> slot 空著，producer 可以搶
+//   seq == pos + 1       -> slot 已寫好，consumer 可以讀
+//   seq == pos + 容量    -> consumer 讀完，下一輪的 producer 可以用
+// producer 只需要一次 CAS 搶位置，完全不進入 kernel。
+
+#define ASYNC_DEFAULT_SLOTS 4096
+#define ASYNC_LINE_MAX      512          // 每行最大長度 (超過會截斷)
+#define ASYNC_BATCH_BYTES   (64 * 1024)  // flusher 每次 write() 的最大量
+#define ASYNC_IDLE_WAIT_MS  5            // ring 空的時候 flusher 的休息時間
+
+typedef struct {
+    atomic_size_t seq;
+    uint16_t len;
+    char text[ASYNC_LINE_MAX];
+} LogSlot;
+
+static struct {
+    LogSlot *slots;
+    size_t mask;
+    LogFullPolicy policy;
+    int fd;
+    atomic_size_t tail;          // producer 下一個要搶的位置
+    size_t head;                 // consumer 下一個要讀的位置 (只有 flusher 使用)
+    atomic_size_t flushed;       // 已寫入檔案的位置
+    atomic_ulong dropped;
+    unsigned long dropped_reported;
+
+    // 時間字串快取: flusher 每秒更新一次，producer 只做 memcpy
+    char time_cache[2][20];
+    atomic_int time_index;
+    time_t time_cached_sec;
+
+    pthread_t thread;
+    pthread_mutex_t wake_mutex;
+    pthread_cond_t wake_cond;
+    int stopping;
+} async_log;
+
+static void async_refresh_time(void) {
+    time_t now = time(NULL);
+    if (now == async_log.time_cached_sec) return;
+
+    struct tm local;
+    localtime_r(&now, &local);
+    int next = 1 - atomic_load_explicit(&async_log.time_index, memory_order_relaxed);
+    strftime(async_log.time_cache[next], sizeof(async_log.time_cache[next]), "%Y-%m-%d %H:%M:%S", &local);
+    atomic_store_explicit(&async_log.time_index, next, memory_order_release);
+    async_log.time_cached_sec = now;
+}
+
+static void async_wake_flusher(void) {
+    pthread_mutex_lock(&async_log.wake_mutex);
+    pthread_cond_signal(&async_log.wake_cond);
+    pthread_mutex_unlock(&async_log.wake_mutex);
+}
+
+// 呼叫端路徑: 搶 slot -> 直接格式化進 slot -> 發布
+static void log_message_async(LogLevel level, const char *format, va_list args) {
+    size_t pos = atomic_load_explicit(&async_log.tail, memory_order_relaxed);
+    LogSlot *slot;
+
+    while (1) {
+        slot = &async_log.slots[pos & async_log.mask];
+        size_t seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+        intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+
+        if (diff == 0) {
+            if (atomic_compare_exchange_weak_explicit(&async_log.tail, &pos, pos + 1,
+                                                      memory_order_relaxed, memory_order_relaxed)) {
+                break;
+            }
+        } else if (diff < 0) {
+            // ring 已滿
+            if (async_log.policy == LOG_FULL_DROP) {
+                atomic_fetch_add_explicit(&async_log.dropped, 1, memory_order_relaxed);
+                return;
+            }
+            async_wake_flusher();
+            sched_yield();
+            pos = atomic_load_explicit(&async_log.tail, memory_order_relaxed);
+        } else {
+            pos = atomic_load_explicit(&async_log.tail, memory_order_relaxed);
+        }
+    }
+
+    const char *level_str = "INFO";
+    if (level == LOG_ERROR) level_str = "ERROR";
+    else if (level == LOG_DEBUG) level_str = "DEBUG";
+
+    int idx = atomic_load_explicit(&async_log.time_index, memory_order_acquire);
+    int len = snprintf(slot->text, ASYNC_LINE_MAX, "[%s] [%s] ", async_log.time_cache[idx], level_str);
+    int msg_len = vsnprintf(slot->text + len, ASYNC_LINE_MAX - len, format, args);
+    if (msg_len < 0) msg_len = 0;
+    len += msg_len;
+    if (len > ASYNC_LINE_MAX - 1) len = ASYNC_LINE_MAX - 1; // 截斷，保留換行的位置
+    slot->text[len++] = '\n';
+    slot->len = (uint16_t)len;
+
+    atomic_store_explicit(&slot->seq, pos + 1, memory_order_release);
+
+    // 每寫滿半個 ring 才主動叫醒 flusher 一次，其餘時間不做任何系統呼叫
+    if (((pos + 1) & (async_log.mask >> 1)) == 0) {
+        async_wake_flusher();
+    }
+}
+
+static void write_all(int fd, const char *buf, size_t len) {
+    while (len > 0) {
+        ssize_t n = write(fd, buf, len);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return;
+        }
+        buf += n;
+        len -= n;
+    }
+}
+
+// 把 ring 中已就緒的行搬進 batch，每滿一批就一次 write()
+// 回傳: 這次寫出的行數
+static size_t async_drain(char *batch) {
+    size_t batch_len = 0;
+    size_t lines = 0;
+
+    while (1) {
+        LogSlot *slot = &async_log.slots[async_log.head & async_log.mask];
+        size_t seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+        if (seq != async_log.head + 1) break; // 尚未寫好
+
+        if (batch_len + slot->len > ASYNC_BATCH_BYTES) {
+            write_all(async_log.fd, batch, batch_len);
+            batch_len = 0;
+        }
+        memcpy(batch + batch_len, slot->text, slot->len);
+        batch_len += slot->len;
+
+        atomic_store_explicit(&slot->seq, async_log.head + async_log.mask + 1, memory_order_release);
+        async_log.head++;
+        lines++;
+    }
+
+    // 回報丟棄的行數 (放在同一批寫出)
+    unsigned long dropped = atomic_load_explicit(&async_log.dropped, memory_order_relaxed);
+    if (dropped != async_log.dropped_reported) {
+        char note[128];
+        int n = snprintf(note, sizeof(note), "[%s] [ERROR] Logger ring full: %lu messages dropped\n",
+                         async_log.time_cache[atomic_load(&async_log.time_index)],
+                         dropped - async_log.dropped_reported);
+        if (batch_len + n > ASYNC_BATCH_BYTES) {
+            write_all(async_log.fd, batch, batch_len);
+            batch_len = 0;
+        }
+        memcpy(batch + batch_len, note, n);
+        batch_len += n;
+        async_log.dropped_reported = dropped;
+    }
+
+    if (batch_len > 0) {
+        write_all(async_log.fd, batch, batch_len);
+    }
+    atomic_store_explicit(&async_log.flushed, async_log.head, memory_order_release);
+    return lines;
+}
+
+static void *async_flusher(void *arg) {
+    (void)arg;
+    char *batch = malloc(ASYNC_BATCH_BYTES);
+    if (!batch) return NULL;
+
+    while (1) {
+        async_refresh_time();
+        size_t lines = async_drain(batch);
+
+        pthread_mutex_lock(&async_log.wake_mutex);
+        if (async_log.stopping) {
+            pthread_mutex_unlock(&async_log.wake_mutex);
+            break;
+        }
+        if (lines == 0) {
+            struct timespec deadline;
+            clock_gettime(CLOCK_REALTIME, &deadline);
+            deadline.tv_nsec += ASYNC_IDLE_WAIT_MS * 1000000L;
+            if (deadline.tv_nsec >= 1000000000L) {
+                deadline.tv_sec++;
+                deadline.tv_nsec -= 1000000000L;
+            }
+            pthread_cond_timedwait(&async_log.wake_cond, &async_log.wake_mutex, &deadline);
+        }
+        pthread_mutex_unlock(&async_log.wake_mutex);
+    }
+
+    async_drain(batch); // 結束前把剩下的寫完
+    free(batch);
+    return NULL;
+}
+
+static void async_reset_ring(void) {
+    for (size_t i = 0; i <= async_log.mask; i++) {
+        atomic_init(&async_log.slots[i].seq, i);
+    }
+    atomic_init(&async_log.tail, 0);
+    async_log.head = 0;
+    atomic_init(&async_log.flushed, 0);
+}
+
+static int async_start_thread(void) {
+    pthread_mutex_init(&async_log.wake_mutex, NULL);
+    pthread_cond_init(&async_log.wake_cond, NULL);
+    async_log.stopping = 0;
+    return pthread_create(&async_log.thread, NULL, async_flusher, NULL);
+}
+
+// fork 之後 child 只有呼叫 fork 的那個 thread: 丟掉從 parent 複製來的
+// 未寫出內容 (parent 自己會寫)，並為 child 啟動新的 flusher。
+static void async_atfork_child(void) {
+    if (!atomic_load(&async_enabled)) return;
+    async_reset_ring();
+    atomic_store(&async_log.dropped, 0);
+    async_log.dropped_reported = 0;
+    if (async_start_thread() != 0) {
+        atomic_store(&async_enabled, 0);
+    }
+}
+
+// 程式結束 (exit) 時確保所有 log 都已寫入
+static void async_atexit(void) {
+    if (!atomic_load(&async_enabled)) return;
+    pthread_mutex_lock(&async_log.wake_mutex);
+    async_log.stopping = 1;
+    pthread_cond_signal(&async_log.wake_cond);
+    pthread_mutex_unlock(&async_log.wake_mutex);
+    pthread_join(async_log.thread, NULL);
+    atomic_store(&async_enabled, 0);
+}
+
+// ==========================================
+// 函數: init_logger_async
+// 功能: 開啟檔案並啟動背景 flusher thread
+// 說明: 檔案以 O_APPEND 開啟，每批一次 write()，多個 process
+//       同時 append 也不會互相覆蓋，因此不需要 fcntl 檔案鎖。
+// ==========================================
+int init_logger_async(const char *filename, size_t ring_slots, LogFullPolicy policy) {
+    static int atfork_registered = 0;
+
+    if (atomic_load(&async_enabled)) return 0;
+
+    size_t slots = ASYNC_DEFAULT_SLOTS;
+    if (ring_slots > 0) {
+        slots = 2;
+        while (slots < ring_slots) slots <<= 1;
+    }
+
+    async_log.fd = filename ? open(filename, O_WRONLY | O_CREAT | O_APPEND, 0644) : dup(STDOUT_FILENO);
+    if (async_log.fd < 0) {
+        perror("Failed to open log file, using synchronous logger");
+        init_logger(filename);
+        return -1;
+    }
+
+    async_log.slots = malloc(slots * sizeof(LogSlot));
+    if (!async_log.slots) {
+        close(async_log.fd);
+        init_logger(filename);
+        return -1;
+    }
+    async_log.mask = slots - 1;
+    async_log.policy = policy;
+    async_reset_ring();
+    atomic_init(&async_log.dropped, 0);
+    async_log.dropped_reported = 0;
+    async_log.time_cached_sec = 0;
+    atomic_init(&async_log.time_index, 0);
+    async_refresh_time();
+
+    if (async_start_thread() != 0) {
+        free(async_log.slots);
+        close(async_log.fd);
+        init_logger(filename);
+        return -1;
+    }
+
+    if (!atfork_registered) {
+        pthread_atfork(NULL, NULL, async_atfork_child);
+        atexit(async_atexit);
+        atfork_registered = 1;
+    }
+
+    atomic_store(&async_enabled, 1);
+    return 0;
+}
+
+// ==========================================
+// 函數: logger_flush
+// 功能: 等待呼叫當下已送出的 log 都寫入檔案
+// ==========================================
+void logger_flush(void) {
+    if (binlog_fd >= 0) {
+        binlog_atexit();
+    }
+    if (atomic_load(&async_enabled)) {
+        size_t target = atomic_load_explicit(&async_log.tail, memory_order_acquire);
+        while (atomic_load_explicit(&async_log.flushed, memory_order_acquire) < target) {
+            async_wake_flusher();
+            sched_yield();
+        }
+        return;
+    }
+    if (log_file) {
+        pthread_mutex_lock(&log_mutex);
+        fflush(log_file);
+        pthread_mutex_unlock(&log_mutex);
+    }
+}
+
+// ==========================================
+// 函數: logger_dropped_count
+// 功能: 回傳因 ring buffer 滿而被丟棄的行數
+// ==========================================
+unsigned long logger_dropped_count(void) {
+    return atomic_load_explicit(&async_log.dropped, memory_order_relaxed);
+}
+
+// ==========================================
+// 共享記憶體模式 (Shared-Memory Log Channel)
+// ==========================================
+// 一塊 MAP_SHARED 的記憶體切成 num_regions 個區塊，每個區塊是一個
+// single-producer / single-consumer 的 byte ring:
+//   - producer: 第一次寫 log 時用 CAS 認領區塊的 process (同 process 的
+//     thread 之間用 process 內的 mutex 排隊)
+//   - consumer: collector process
+// collector 把各區塊依 timestamp 合併 (k-way merge) 後寫入檔案。
+// 為了讓不同區塊的紀錄能正確排序，collector 只輸出比現在早
+// SHM_REORDER_NS 以上的紀錄，給還在寫的 producer 一點時間發布。
+
+#define SHM_DEFAULT_REGIONS      128
+#define SHM_DEFAULT_REGION_BYTES (64 * 1024)
+#define SHM_REORDER_NS           2000000L   // 2 ms
+#define SHM_POLL_US              1000
+#define SHM_FULL_WAIT_US         100000     // 區塊滿了最多等 collector 這麼久，之後改走檔案鎖路徑
+#define SHM_RECORD_WRAP          0xFFFF     // len 為此值代表 "跳回區塊開頭"
+
+typedef struct {
+    uint16_t len;        // text 長度 (不含 header)，放在最前面讓 WRAP 標記只需 8 bytes
+    uint8_t level;
+    uint8_t reserved[5];
+    int64_t ts_ns;       // CLOCK_REALTIME (ns)
+    char text[];
+} ShmLogRecord;
+
+typedef struct {
+    atomic_int owner;     // 擁有者 pid，0 = 空閒，負值 = 擁有者已結束 (寫完後釋放)
+    atomic_size_t head;   // collector 已讀到的位置 (單調遞增)
+    atomic_size_t tail;   // producer 已寫到的位置 (單調遞增)
+    char pad[64 - sizeof(atomic_int) - 2 * sizeof(atomic_size_t)];
+} ShmLogRegion;
+
+typedef struct {
+    atomic_int stopping;
+    int num_regions;
+    size_t region_bytes;
+    char pad[64 - sizeof(atomic_int) - sizeof(int) - sizeof(size_t)];
+    // 接著是 ShmLogRegion[num_regions]，再接著是各區塊的資料
+} ShmLogHeader;
+
+static ShmLogHeader *shm_log = NULL;
+static size_t shm_log_bytes = 0;
+static pid_t shm_collector_pid = 0;
+static pid_t shm_creator_pid = 0;
+static ShmLogRegion *shm_my_region = NULL;   // 本 process 認領的區塊
+static int shm_no_region = 0;                // 已確認沒有空區塊
+static int shm_stalled = 0;                  // 上次等區塊空出來時逾時 (collector 卡住或已結束)
+static pthread_mutex_t shm_region_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static ShmLogRegion *shm_region(int i) {
+    return (ShmLogRegion *)((char *)shm_log + sizeof(ShmLogHeader)) + i;
+}
+
+static char *shm_region_data(int i) {
+    return (char *)shm_region(shm_log->num_regions) + (size_t)i * shm_log->region_bytes;
+}
+
+static size_t shm_record_size(size_t text_len) {
+    return (sizeof(ShmLogRecord) + text_len + 7) & ~(size_t)7;
+}
+
+static int64_t realtime_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (int64_t)ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
+
+// fork 之後的 child 要認領自己的區塊
+static void shm_atfork_child(void) {
+    shm_my_region = NULL;
+    shm_no_region = 0;
+    shm_stalled = 0;
+    pthread_mutex_init(&shm_region_mutex, NULL);
+}
+
+static ShmLogRegion *shm_claim_region(void) {
+    int pid = getpid();
+    for (int i = 0; i < shm_log->num_regions; i++) {
+        ShmLogRegion *r = shm_region(i);
+        int expected = 0;
+        if (atomic_load_explicit(&r->owner, memory_order_relaxed) == 0 &&
+            atomic_compare_exchange_strong(&r->owner, &expected, pid)) {
+            return r;
+        }
+    }
+    return NULL;
+}
+
+// 呼叫端路徑: 寫入自己區塊的 ring，不碰任何檔案鎖
+// 區塊滿了就等 collector 讀走，但最多等 SHM_FULL_WAIT_US: collector 死掉時不能讓所有 process 卡住。
+// (collector 是 server 的 child，死掉後在被 wait 之前仍是 zombie，kill(pid, 0) 查不出來，所以用逾時判斷)
+// 逾時後在區塊重新有空間之前都不再等待，直接退回檔案鎖路徑。
+// 回傳: 0 成功，-1 沒有可用的區塊或區塊一直是滿的
+static int log_message_shm(LogLevel level, const char *format, va_list args) {
+    char text[800];
+    int len = vsnprintf(text, sizeof(text), format, args);
+    if (len < 0) len = 0;
+    if (len >= (int)sizeof(text)) len = sizeof(text) - 1;
+
+    pthread_mutex_lock(&shm_region_mutex);
+    // 拿到鎖之後才取時間: 同一區塊內的 timestamp 才會跟寫入順序一致，collector 的 merge 依賴這點
+    int64_t ts = realtime_ns();
+    if (!shm_my_region) {
+        if (!shm_no_region) shm_my_region = shm_claim_region();
+        if (!shm_my_region) {
+            shm_no_region = 1;
+            pthread_mutex_unlock(&shm_region_mutex);
+            return -1;
+        }
+    }
+
+    ShmLogRegion *r = shm_my_region;
+    int idx = (int)(r - shm_region(0));
+    char *data = shm_region_data(idx);
+    size_t cap = shm_log->region_bytes;
+    size_t need = shm_record_size(len);
+    size_t tail = atomic_load_explicit(&r->tail, memory_order_relaxed);
+    int waited_us = 0;
+
+    while (1) {
+        size_t head = atomic_load_explicit(&r->head, memory_order_acquire);
+        size_t offset = tail % cap;
+        size_t to_end = cap - offset;
+        // 紀錄不能跨越區塊結尾: 不夠放就先填一個 WRAP 標記
+        size_t total = (to_end < need) ? to_end + need : need;
+        if (cap - (tail - head) >= total) {
+            if (to_end < need) {
+                ShmLogRecord *wrap = (ShmLogRecord *)(data + offset);
+                wrap->len = SHM_RECORD_WRAP;
+                tail += to_end;
+                offset = 0;
+            }
+            break;
+        }
+        // 區塊已滿: 等 collector 讀走 (不丟 log)
+        if (shm_stalled || waited_us >= SHM_FULL_WAIT_US) {
+            shm_stalled = 1;
+            pthread_mutex_unlock(&shm_region_mutex);
+            return -1;
+        }
+        usleep(100);
+        waited_us += 100;
+    }
+    shm_stalled = 0;
+
+    ShmLogRecord *rec = (ShmLogRecord *)(data + tail % cap);
+    rec->ts_ns = ts;
+    rec->len = (uint16_t)len;
+    rec->level = (uint8_t)level;
+    memcpy(rec->text, text, len);
+    atomic_store_explicit(&r->tail, tail + need, memory_order_release);
+
+    pthread_mutex_unlock(&shm_region_mutex);
+    return 0;
+}
+
+// 取得區塊 i 下一筆紀錄 (跳過 WRAP 標記)，沒有則回傳 NULL
+static ShmLogRecord *shm_peek(int i) {
+    ShmLogRegion *r = shm_region(i);
+    size_t cap = shm_log->region_bytes;
+    size_t head = atomic_load_explicit(&r->head, memory_order_relaxed);
+    size_t tail = atomic_load_explicit(&r->tail, memory_order_acquire);
+
+    while (head != tail) {
+        ShmLogRecord *rec = (ShmLogRecord *)(shm_region_data(i) + head % cap);
+        if (rec->len != SHM_RECORD_WRAP) return rec;
+        head += cap - head % cap;
+        atomic_store_explicit(&r->head, head, memory_order_release);
+    }
+    return NULL;
+}
+
+static void shm_consume(int i, ShmLogRecord *rec) {
+    ShmLogRegion *r = shm_region(i);
+    size_t head = atomic_load_explicit(&r->head, memory_order_relaxed);
+    atomic_store_explicit(&r->head, head + shm_record_size(rec->len), memory_order_release);
+}
+
+// 把已結束的 process 留下的空區塊還回去
+// 正常 exit 的 process 會自己把 owner 設成負值；被 signal 殺掉的則用 kill(pid, 0) 檢查
+static void shm_reclaim_regions(void) {
+    for (int i = 0; i < shm_log->num_regions; i++) {
+        ShmLogRegion *r = shm_region(i);
+        int owner = atomic_load(&r->owner);
+        if (owner == 0) continue;
+        if (atomic_load(&r->head) != atomic_load(&r->tail)) continue;
+        if (owner > 0 && (kill(owner, 0) == 0 || errno != ESRCH)) continue;
+        atomic_store(&r->head, 0);
+        atomic_store(&r->tail, 0);
+        atomic_store(&r->owner, 0);
+    }
+}
+
+// collector 的 min-heap 節點: 每個有資料的區塊一個
+typedef struct {
+    int64_t ts_ns;
+    int region;
+} ShmHeapNode;
+
+static void heap_push(ShmHeapNode *heap, int *size, ShmHeapNode node) {
+    int i = (*size)++;
+    while (i > 0 && heap[(i - 1) / 2].ts_ns > node.ts_ns) {
+        heap[i] = heap[(i - 1) / 2];
+        i = (i - 1) / 2;
+    }
+    heap[i] = node;
+}
+
+static ShmHeapNode heap_pop(ShmHeapNode *heap, int *size) {
+    ShmHeapNode top = heap[0];
+    ShmHeapNode last = heap[--(*size)];
+    int i = 0;
+    while (1) {
+        int child = 2 * i + 1;
+        if (child >= *size) break;
+        if (child + 1 < *size && heap[child + 1].ts_ns < heap[child].ts_ns) child++;
+        if (last.ts_ns <= heap[child].ts_ns) break;
+        heap[i] = heap[child];
+        i = child;
+    }
+    if (*size > 0) heap[i] = last;
+    return top;
+}
+
+// k-way merge: 以 min-heap 依 timestamp 輸出各區塊的紀錄，直到超過 watermark
+static void shm_collect(int fd, char *batch, size_t batch_cap, ShmHeapNode *heap, int64_t watermark) {
+    static time_t cached_sec = 0;
+    static char time_str[20];
+    size_t batch_len = 0;
+    int heap_size = 0;
+
+    for (int i = 0; i < shm_log->num_regions; i++) {
+        if (atomic_load_explicit(&shm_region(i)->owner, memory_order_relaxed) == 0) continue;
+        ShmLogRecord *rec = shm_peek(i);
+        if (rec) heap_push(heap, &heap_size, (ShmHeapNode){ rec->ts_ns, i });
+    }
+
+    while (heap_size > 0 && heap[0].ts_ns <= watermark) {
+        ShmHeapNode node = heap_pop(heap, &heap_size);
+        ShmLogRecord *rec = shm_peek(node.region);
+
+        // 時間字串在 collector 這邊才格式化，每秒只做一次 strftime
+        time_t sec = rec->ts_ns / 1000000000L;
+        if (sec != cached_sec) {
+            struct tm local;
+            localtime_r(&sec, &local);
+            strftime(time_str, sizeof(time_str), "%Y-%m-%d %H:%M:%S", &local);
+            cached_sec = sec;
+        }
+        const char *level_str = "INFO";
+        if (rec->level == LOG_ERROR) level_str = "ERROR";
+        else if (rec->level == LOG_DEBUG) level_str = "DEBUG";
+
+        if (batch_len + rec->len + 64 > batch_cap) {
+            write_all(fd, batch, batch_len);
+            batch_len = 0;
+        }
+        batch_len += snprintf(batch + batch_len, batch_cap - batch_len, "[%s] [%s] %.*s\n",
+                              time_str, level_str, (int)rec->len, rec->text);
+        shm_consume(node.region, rec);
+
+        rec = shm_peek(node.region);
+        if (rec) heap_push(heap, &heap_size, (ShmHeapNode){ rec->ts_ns, node.region });
+    }
+
+    if (batch_len > 0) write_all(fd, batch, batch_len);
+}
+
+static volatile sig_atomic_t collector_stop_signal = 0;
+
+static void collector_on_term(int sig) {
+    (void)sig;
+    collector_stop_signal = 1;
+}
+
+static void shm_collector_main(const char *filename) {
+    prctl(PR_SET_PDEATHSIG, SIGTERM);
+    signal(SIGTERM, collector_on_term);
+    signal(SIGINT, SIG_IGN);
+
+    int fd = filename ? open(filename, O_WRONLY | O_CREAT | O_APPEND, 0644) : STDOUT_FILENO;
+    if (fd < 0) {
+        perror("collector: failed to open log file");
+        _exit(EXIT_FAILURE);
+    }
+
+    char *batch = malloc(ASYNC_BATCH_BYTES);
+    ShmHeapNode *heap = malloc(shm_log->num_regions * sizeof(ShmHeapNode));
+    if (!batch || !heap) _exit(EXIT_FAILURE);
+
+    int ticks = 0;
+    while (!atomic_load(&shm_log->stopping) && !collector_stop_signal) {
+        shm_collect(fd, batch, ASYNC_BATCH_BYTES, heap, realtime_ns() - SHM_REORDER_NS);
+        if (++ticks % 10 == 0) shm_reclaim_regions();
+        usleep(SHM_POLL_US);
+    }
+
+    // 結束: 等 producer 發布完最後的紀錄，再全部寫出
+    usleep(SHM_REORDER_NS / 1000);
+    shm_collect(fd, batch, ASYNC_BATCH_BYTES, heap, INT64_MAX);
+    free(heap);
+    free(batch);
+    _exit(0);
+}
+
+static void shm_atexit(void) {
+    if (getpid() == shm_creator_pid) {
+        shutdown_logger_shm();
+    } else if (shm_enabled && shm_my_region) {
+        // 交還區塊: collector 寫完剩下的紀錄後就會回收
+        atomic_store(&shm_my_region->owner, -getpid());
+    }
+}
+
+// ==========================================
+// 函數: init_logger_shm
+// 功能: 建立共享 ring 並 fork 出 collector process
+// ==========================================
+int init_logger_shm(const char *filename, int num_regions, size_t region_bytes) {
+    static int atfork_registered = 0;
+
+    if (shm_enabled) return 0;
+    if (num_regions <= 0) num_regions = SHM_DEFAULT_REGIONS;
+    if (region_bytes == 0) region_bytes = SHM_DEFAULT_REGION_BYTES;
+    region_bytes = (region_bytes + 63) & ~(size_t)63;
+
+    // 同步路徑仍保留，給沒有分到區塊的 process 使用
+    init_logger(filename);
+
+    shm_log_bytes = sizeof(ShmLogHeader) + num_regions * (sizeof(ShmLogRegion) + region_bytes);
+    void *mem = mmap(NULL, shm_log_bytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (mem == MAP_FAILED) {
+        perror("mmap failed, using synchronous logger");
+        return -1;
+    }
+    memset(mem, 0, sizeof(ShmLogHeader) + num_regions * sizeof(ShmLogRegion));
+    shm_log = (ShmLogHeader *)mem;
+    shm_log->num_regions = num_regions;
+    shm_log->region_bytes = region_bytes;
+
+    // stdio buffer 不能被 collector 複製一份
+    fflush(NULL);
+    pid_t pid = fork();
+    if (pid < 0) {
+        perror("fork failed, using synchronous logger");
+        munmap(mem, shm_log_bytes);
+        shm_log = NULL;
+        return -1;
+    }
+    if (pid == 0) {
+        shm_collector_main(filename);
+    }
+
+    shm_collector_pid = pid;
+    shm_creator_pid = getpid();
+    shm_my_region = NULL;
+    shm_no_region = 0;
+    if (!atfork_registered) {
+        pthread_atfork(NULL, NULL, shm_atfork_child);
+        atexit(shm_atexit);
+        atfork_registered = 1;
+    }
+    shm_enabled = 1;
+    return 0;
+}
+
+// ==========================================
+// 函數: shutdown_logger_shm
+// 功能: 通知 collector 寫完剩下的紀錄並等待它結束
+// ==========================================
+void shutdown_logger_shm(void) {
+    if (!shm_enabled || getpid() != shm_creator_pid) return;
+    atomic_store(&shm_log->stopping, 1);
+    waitpid(shm_collector_pid, NULL, 0);
+    shm_enabled = 0;
+    munmap(shm_log, shm_log_bytes);
+    shm_log = NULL;
+}
+
+// ==========================================
+// 二進位結構化 Log (Binary Log)
+// ==========================================
+// 每個 process 先把紀錄累積在自己的 buffer，滿了、距上次寫出超過
+// BINLOG_FLUSH_NS、或程式結束時才一次 write() (O_APPEND)。
+// 每一批的開頭是一筆 BinaryLogSync，記錄 pid 與 monotonic/realtime 的對應。
+
+#define BINLOG_BUFFER_BYTES (64 * 1024)
+#define BINLOG_FLUSH_NS     100000000L  // 100 ms
+#define BINLOG_MAX_ARGS     8
+
+#define LOG_TEMPLATE_ENTRY(id, level, format) { level, format },
+const LogTemplate log_templates[LT_COUNT] = {
+    LOG_TEMPLATES(LOG_TEMPLATE_ENTRY)
+};
+
+static char *binlog_buffer = NULL;
+static size_t binlog_len = 0;
+static uint64_t binlog_last_flush_ns = 0;
+static pthread_mutex_t binlog_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static uint64_t monotonic_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000UL + ts.tv_nsec;
+}
+
+// 在空的 buffer 開頭放一筆時間同步紀錄
+static void binlog_start_batch(uint64_t now_ns) {
+    BinaryLogSync sync;
+    sync.base.template_id = BINLOG_SYNC_ID;
+    sync.base.nargs = 0;
+    sync.base.reserved = 0;
+    sync.base.ts_ns = now_ns;
+    sync.realtime_ns = (uint64_t)realtime_ns();
+    sync.pid = (uint32_t)getpid();
+    memcpy(binlog_buffer, &sync, sizeof(sync));
+    binlog_len = sizeof(sync);
+}
+
+// 呼叫前必須持有 binlog_mutex
+static void binlog_flush_locked(uint64_t now_ns) {
+    if (binlog_len > sizeof(BinaryLogSync)) {
+        write_all(binlog_fd, binlog_buffer, binlog_len);
+    }
+    binlog_len = 0;
+    binlog_last_flush_ns = now_ns;
+}
+
+static void binlog_atfork_prepare(void) {
+    pthread_mutex_lock(&binlog_mutex);
+    if (binlog_fd >= 0) binlog_flush_locked(monotonic_ns());
+}
+
+static void binlog_atfork_parent(void) {
+    pthread_mutex_unlock(&binlog_mutex);
+}
+
+static void binlog_atfork_child(void) {
+    binlog_len = 0; // fork 前已寫出，child 從新的一批開始 (pid 不同)
+    pthread_mutex_init(&binlog_mutex, NULL);
+}
+
+static void binlog_atexit(void) {
+    pthread_mutex_lock(&binlog_mutex);
+    if (binlog_fd >= 0) binlog_flush_locked(monotonic_ns());
+    pthread_mutex_unlock(&binlog_mutex);
+}
+
+// ==========================================
+// 函數: init_binary_log
+// 功能: 開啟 (或建立) 二進位 log 檔
+// ==========================================
+int init_binary_log(const char *filename) {
+    if (binlog_fd >= 0) return 0;
+
+    int fd = open(filename, O_WRONLY | O_CREAT | O_APPEND, 0644);
+    if (fd < 0) {
+        perror("Failed to open binary log, using text log");
+        return -1;
+    }
+    binlog_buffer = malloc(BINLOG_BUFFER_BYTES);
+    if (!binlog_buffer) {
+        close(fd);
+        return -1;
+    }
+
+    // 新檔案: 先寫 magic
+    if (lseek(fd, 0, SEEK_END) == 0) {
+        write_all(fd, BINLOG_MAGIC, 8);
+    }
+
+    binlog_fd = fd;
+    binlog_len = 0;
+    binlog_last_flush_ns = monotonic_ns();
+    pthread_atfork(binlog_atfork_prepare, binlog_atfork_parent, binlog_atfork_child);
+    atexit(binlog_atexit);
+    return 0;
+}
+
+// ==========================================
+// 函數: log_event
+// 功能: 記錄一筆固定格式的事件
+// 說明: 二進位模式只 memcpy 12 bytes + 參數；否則格式化後交給 log_message
+// ==========================================
+void log_event(LogTemplateId id, const uint32_t *args, int nargs) {
+    if (id >= LT_COUNT) return;
+    if (nargs > BINLOG_MAX_ARGS) nargs = BINLOG_MAX_ARGS;
+
+    if (binlog_fd < 0) {
+        char text[800];
+        format_log_template(text, sizeof(text), log_templates[id].format, args, nargs);
+        log_message(log_templates[id].level, "%s", text);
+        return;
+    }
+
+    uint64_t now = monotonic_ns();
+    size_t need = sizeof(BinaryLogRecord) + nargs * sizeof(uint32_t);
+
+    pthread_mutex_lock(&binlog_mutex);
+    if (binlog_len + need > BINLOG_BUFFER_BYTES) {
+        binlog_flush_locked(now);
+    }
+    if (binlog_len == 0) {
+        binlog_start_batch(now);
+    }
+
+    BinaryLogRecord rec;
+    rec.template_id = (uint16_t)id;
+    rec.nargs = (uint8_t)nargs;
+    rec.reserved = 0;
+    rec.ts_ns = now;
+    memcpy(binlog_buffer + binlog_len, &rec, sizeof(rec));
+    memcpy(binlog_buffer + binlog_len + sizeof(rec), args, nargs * sizeof(uint32_t));
+    binlog_len += need;
+
+    if (now - binlog_last_flush_ns >= BINLOG_FLUSH_NS) {
+        binlog_flush_locked(now);
+    }
+    pthread_mutex_unlock(&binlog_mutex);
+}
+
+// ==========================================
+// 函數: format_log_template
+// 功能: 用整數參數陣列套用 printf 風格的 template
+// 說明: 逐一取出每個 %... 轉換規格交給 snprintf，
+//       %d/%i 視為有號，%u/%x/%X/%o/%c 視為無號
+// ==========================================
+int format_log_template(char *out, size_t out_size, const char *format, const uint32_t *args, int nargs) {
+    size_t len = 0;
+    int arg = 0;
+
+    if (out_size == 0) return 0;
+
+    for (const char *p = format; *p && len + 1 < out_size; p++) {
+        if (*p != '%') {
+            out[len++] = *p;
+            continue;
+        }
+        if (p[1] == '%') {
+            out[len++] = '%';
+            p++;
+            continue;
+        }
+
+        // 複製一個轉換規格: % [flags] [width] [.precision] conversion
+        char spec[16];
+        size_t spec_len = 0;
+        spec[spec_len++] = *p++;
+        while (*p && strchr("-+ #0123456789.", *p) && spec_len < sizeof(spec) - 2) {
+            spec[spec_len++] = *p++;
+        }
+        if (!*p) break;
+        char conv = *p;
+        spec[spec_len++] = conv;
+        spec[spec_len] = '\0';
+
+        uint32_t value = (arg < nargs) ? args[arg] : 0;
+        arg++;
+
+        int n;
+        if (conv == 'd' || conv == 'i') {
+            n = snprintf(out + len, out_size - len, spec, (int)value);
+        } else if (strchr("uxXoc", conv)) {
+            n = snprintf(out + len, out_size - len, spec, (unsigned int)value);
+        } else {
+            n = snprintf(out + len, out_size - len, "<?>");
+        }
+        if (n < 0) break;
+        len += ((size_t)n < out_size - len) ? (size_t)n : out_size - len - 1;
+    }
+
+    out[len] = '\0';
+    return (int)len;
+}
@@ -0,0 +1,299 @@
+// src_lib/metrics.c
+
+#include "common.h"
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sys/ipc.h>
+#include <sys/shm.h>
+
+static MetricsBlock *metrics_block = NULL;
+static WorkerMetrics *metrics_process = NULL;        // 沒有指定過的 thread 記錄在這一格 (第 0 格)
+static __thread WorkerMetrics *metrics_self = NULL;  // 這個 thread 記錄的那一格
+
+#define METRICS_ADD(field, n) atomic_fetch_add_explicit(&(field), (n), memory_order_relaxed)
+
+// threads 模式下每個 thread 各自指定一格，互不共用 cache line
+static WorkerMetrics *metrics_slot(void) {
+    return metrics_self ? metrics_self : metrics_process;
+}
+
+static int64_t metrics_realtime_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (int64_t)ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
+
+// LOGIN / QUERY / BOOK / BATCH_BOOK 各一格，其他 opcode 共用最後一格
+static int metrics_opcode_index(uint16_t opcode) {
+    return opcode < STATS_OPCODES - 1 ? opcode : STATS_OPCODES - 1;
+}
+
+// 小於 4 的值各一桶；之後每個 2 的次方依接下來的 2 個 bits 再分 4 桶
+static int metrics_latency_bucket(uint64_t ns) {
+    if (ns < 4) return (int)ns;
+    int msb = 63 - __builtin_clzll(ns);
+    return (msb - 1) * 4 + (int)((ns >> (msb - 2)) & 3);
+}
+
+static uint64_t metrics_bucket_upper(int bucket) {
+    if (bucket < 4) return bucket;
+    int msb = bucket / 4 + 1;
+    uint64_t width = 1ULL << (msb - 2);
+    return (uint64_t)(4 + bucket % 4) * width + width - 1;
+}
+
+// ==========================================
+// 函數: metrics_create
+// 功能: 建立統計用的 shared memory 並清空 (在 fork 任何 worker 之前呼叫)
+// ==========================================
+MetricsBlock *metrics_create(void) {
+    int shm_id = shmget(METRICS_SHM_KEY, sizeof(MetricsBlock), IPC_CREAT | 0666);
+    if (shm_id < 0 && errno == EINVAL) {
+        // 舊版本留下的區塊大小不同: 換掉它
+        int stale_id = shmget(METRICS_SHM_KEY, 0, 0);
+        if (stale_id >= 0) shmctl(stale_id, IPC_RMID, NULL);
+        shm_id = shmget(METRICS_SHM_KEY, sizeof(MetricsBlock), IPC_CREAT | 0666);
+    }
+    if (shm_id < 0) {
+        perror("metrics: shmget failed");
+        return NULL;
+    }
+    MetricsBlock *block = shmat(shm_id, NULL, 0);
+    if (block == (void *)-1) {
+        perror("metrics: shmat failed");
+        return NULL;
+    }
+
+    memset(block, 0, sizeof(MetricsBlock));
+    block->version = METRICS_VERSION;
+    block->max_workers = METRICS_MAX_WORKERS;
+    block->start_ns = metrics_realtime_ns();
+    block->server_pid = getpid();
+    memcpy(block->magic, METRICS_MAGIC, sizeof(block->magic));   // 最後寫: bin/stats 看到 magic 才讀
+
+    metrics_block = block;
+    metrics_set_worker(0);
+    metrics_process = metrics_self;
+    return block;
+}
+
+// ==========================================
+// 函數: metrics_attach
+// 功能: 唯讀 attach 到現有的統計區塊 (bin/stats 使用)
+// ==========================================
+const MetricsBlock *metrics_attach(void) {
+    int shm_id = shmget(METRICS_SHM_KEY, 0, 0);
+    if (shm_id < 0) return NULL;
+    const MetricsBlock *block = shmat(shm_id, NULL, SHM_RDONLY);
+    if (block == (void *)-1) return NULL;
+
+    struct shmid_ds ds;
+    if (shmctl(shm_id, IPC_STAT, &ds) < 0 || ds.shm_segsz < sizeof(MetricsBlock) ||
+        memcmp(block->magic, METRICS_MAGIC, sizeof(block->magic)) != 0 ||
+        block->version != METRICS_VERSION) {
+        shmdt(block);
+        return NULL;
+    }
+    return block;
+}
+
+// ==========================================
+// 函數: metrics_set_worker
+// 功能: 指定呼叫的 thread 之後寫入的那一格
+// 說明: 只影響呼叫的 thread；fork 出來的 child 繼承呼叫 fork 的 thread 的設定
+// ==========================================
+void metrics_set_worker(int worker) {
+    if (!metrics_block) return;
+    if (worker < 0) worker = -worker;
+    metrics_self = &metrics_block->workers[worker % METRICS_MAX_WORKERS];
+    atomic_store_explicit(&metrics_self->pid, getpid(), memory_order_relaxed);
+}
+
+// ==========================================
+// 函數: metrics_claim_worker
+// 功能: 認領一格空的 slot (fork 模式每個連線一個 child，數量不固定)
+// 說明: 從 next_worker 輪流往後找，pid 為 0 或該 process 已不存在的 slot 可以認領，
+//       以 CAS 寫入自己的 pid，兩個 child 不會搶到同一格。
+//       fork 模式的 server 忽略 SIGCHLD，結束的 child 不會留下 zombie，kill(pid, 0) 查得出來。
+//       原本累計的數字留著 (加總才是整個 server 的統計)。
+// ==========================================
+int metrics_claim_worker(void) {
+    if (!metrics_block) return -1;
+
+    int self = getpid();
+    unsigned start = atomic_fetch_add_explicit(&metrics_block->next_worker, 1, memory_order_relaxed);
+    for (int i = 0; i < METRICS_MAX_WORKERS; i++) {
+        int idx = (start + i) % METRICS_MAX_WORKERS;
+        WorkerMetrics *m = &metrics_block->workers[idx];
+        int owner = atomic_load_explicit(&m->pid, memory_order_relaxed);
+        if (owner != 0 && (kill(owner, 0) == 0 || errno != ESRCH)) continue;
+        if (atomic_compare_exchange_strong(&m->pid, &owner, self)) {
+            metrics_self = m;
+            return idx;
+        }
+    }
+
+    // 同時存在的 process 超過 METRICS_MAX_WORKERS: 只好共用 (加法都是 atomic，數字仍然正確)
+    int idx = start % METRICS_MAX_WORKERS;
+    metrics_self = &metrics_block->workers[idx];
+    atomic_store_explicit(&metrics_self->pid, self, memory_order_relaxed);
+    return idx;
+}
+
+// ==========================================
+// 函數: metrics_request
+// 功能: 記錄一個處理完的 request
+// ==========================================
+void metrics_request(uint16_t opcode, int success, uint64_t latency_ns, uint32_t bytes_in, uint32_t bytes_out) {
+    WorkerMetrics *m = metrics_slot();
+    if (!m) return;
+    METRICS_ADD(m->requests[metrics_opcode_index(opcode)], 1);
+    if (success) {
+        METRICS_ADD(m->successes, 1);
+    } else {
+        METRICS_ADD(m->failures, 1);
+    }
+    METRICS_ADD(m->bytes_in, bytes_in);
+    METRICS_ADD(m->bytes_out, bytes_out);
+    METRICS_ADD(m->latency[metrics_latency_bucket(latency_ns)], 1);
+}
+
+// ==========================================
+// 函數: metrics_checksum_error
+// 功能: 記錄一個 checksum 錯誤的封包 (連線會被關閉，沒有回覆)
+// ==========================================
+void metrics_checksum_error(uint32_t bytes_in) {
+    WorkerMetrics *m = metrics_slot();
+    if (!m) return;
+    METRICS_ADD(m->checksum_errors, 1);
+    METRICS_ADD(m->bytes_in, bytes_in);
+}
+
+// ==========================================
+// 函數: metrics_invalid_session
+// 功能: 記錄一個 session 無效的 request
+// ==========================================
+void metrics_invalid_session(void) {
+    WorkerMetrics *m = metrics_slot();
+    if (!m) return;
+    METRICS_ADD(m->invalid_sessions, 1);
+}
+
+// ==========================================
+// 函數: metrics_wait
+// 功能: 累計一次等待 (訂票日誌) 的時間
+// ==========================================
+void metrics_wait(MetricsWait kind, uint64_t ns) {
+    WorkerMetrics *m = metrics_slot();
+    if (!m) return;
+    METRICS_ADD(m->wait_ns[kind], ns);
+    METRICS_ADD(m->waits[kind], 1);
+}
+
+// ==========================================
+// 函數: metrics_cas_retry
+// 功能: 累計 CAS 失敗後重試的次數 (只在真的有競爭時呼叫)
+// 說明: 由 libcommon 的 inventory / session_table 呼叫；沒有統計區塊的程式 (例如 bench) 不記錄。
+// ==========================================
+void metrics_cas_retry(MetricsCas kind, uint32_t retries) {
+    WorkerMetrics *m = metrics_slot();
+    if (!m) return;
+    METRICS_ADD(m->cas_retries[kind], retries);
+}
+
+// ==========================================
+// 函數: metrics_shed
+// 功能: 記錄一個被 admission control 拒絕的 request (只回了 OP_RESPONSE_BUSY)
+// ==========================================
+void metrics_shed(BusyReason reason, uint32_t bytes_in, uint32_t bytes_out) {
+    WorkerMetrics *m = metrics_slot();
+    if (!m) return;
+    METRICS_ADD(m->shed[reason], 1);
+    METRICS_ADD(m->bytes_in, bytes_in);
+    METRICS_ADD(m->bytes_out, bytes_out);
+}
+
+// ==========================================
+// 函數: metrics_sum
+// 功能: 把所有 worker 的計數加總 (每個欄位各自 atomic 讀取，不需要暫停 worker)
+// ==========================================
+void metrics_sum(const MetricsBlock *block, WorkerMetrics *total) {
+    memset(total, 0, sizeof(*total));
+    for (int w = 0; w < METRICS_MAX_WORKERS; w++) {
+        const WorkerMetrics *m = &block->workers[w];
+#define METRICS_SUM(field) total->field += atomic_load_explicit(&m->field, memory_order_relaxed)
+        for (int i = 0; i < STATS_OPCODES; i++) METRICS_SUM(requests[i]);
+        METRICS_SUM(successes);
+        METRICS_SUM(failures);
+        METRICS_SUM(checksum_errors);
+        METRICS_SUM(invalid_sessions);
+        METRICS_SUM(bytes_in);
+        METRICS_SUM(bytes_out);
+        for (int i = 0; i < METRICS_WAIT_KINDS; i++) {
+            METRICS_SUM(wait_ns[i]);
+            METRICS_SUM(waits[i]);
+        }
+        for (int i = 0; i < METRICS_CAS_KINDS; i++) METRICS_SUM(cas_retries[i]);
+        for (int i = 0; i < BUSY_REASONS; i++) METRICS_SUM(shed[i]);
+        for (int i = 0; i < METRICS_LATENCY_BUCKETS; i++) METRICS_SUM(latency[i]);
+#undef METRICS_SUM
+    }
+}
+
+// ==========================================
+// 函數: metrics_latency_percentile
+// 功能: 由直方圖求百分位數 (回傳該桶的上界)
+// ==========================================
+uint64_t metrics_latency_percentile(const _Atomic uint64_t *latency, double percentile) {
+    uint64_t total = 0;
+    for (int i = 0; i < METRICS_LATENCY_BUCKETS; i++) total += latency[i];
+    if (total == 0) return 0;
+
+    uint64_t rank = (uint64_t)(percentile / 100.0 * total + 0.5);
+    if (rank == 0) rank = 1;
+    uint64_t seen = 0;
+    for (int i = 0; i < METRICS_LATENCY_BUCKETS; i++) {
+        seen += latency[i];
+        if (seen >= rank) return metrics_bucket_upper(i);
+    }
+    return metrics_bucket_upper(METRICS_LATENCY_BUCKETS - 1);
+}
+
+// ==========================================
+// 函數: metrics_fill_stats
+// 功能: 把加總後的數據轉成 OP_STATS 的回應
+// ==========================================
+void metrics_fill_stats(const MetricsBlock *block, StatsResponse *out) {
+    memset(out, 0, sizeof(*out));
+    if (!block) return;
+
+    WorkerMetrics total;
+    metrics_sum(block, &total);
+    out->uptime_ms = (metrics_realtime_ns() - block->start_ns) / 1000000;
+    for (int w = 0; w < METRICS_MAX_WORKERS; w++) {
+        const WorkerMetrics *m = &block->workers[w];
+        if (atomic_load_explicit(&m->successes, memory_order_relaxed) +
+            atomic_load_explicit(&m->failures, memory_order_relaxed) > 0) {
+            out->workers++;
+        }
+    }
+    for (int i = 0; i < STATS_OPCODES; i++) out->requests[i] = total.requests[i];
+    out->successes = total.successes;
+    out->failures = total.failures;
+    out->checksum_errors = total.checksum_errors;
+    out->invalid_sessions = total.invalid_sessions;
+    out->bytes_in = total.bytes_in;
+    out->bytes_out = total.bytes_out;
+    out->inventory_cas_retries = total.cas_retries[METRICS_CAS_INVENTORY];
+    out->session_cas_retries = total.cas_retries[METRICS_CAS_SESSION];
+    out->journal_wait_ns = total.wait_ns[METRICS_WAIT_JOURNAL];
+    out->latency_p50_ns = metrics_latency_percentile(total.latency, 50);
+    out->latency_p99_ns = metrics_latency_percentile(total.latency, 99);
+    out->latency_p999_ns = metrics_latency_percentile(total.latency, 99.9);
+    out->latency_max_ns = metrics_latency_percentile(total.latency, 100);
+    for (int i = 0; i < BUSY_REASONS; i++) out->shed[i] = total.shed[i];
+}
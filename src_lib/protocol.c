@@ -1,100 +1,352 @@
-// src_lib/protocol.c
-
-#include "common.h"  // 引入我們定義的結構
-#include <unistd.h>  // 用於 read, write
-#include <stdio.h>   // 用於 perror
-#include <errno.h>   // 用於 errno
-
-// ==========================================
-// 函數: calculate_checksum
-// 功能: 計算資料的簡易 Checksum (加總)
-// ==========================================
-uint32_t calculate_checksum(const void *data, size_t len) {
-    const uint8_t *ptr = (const uint8_t *)data;
-    uint32_t sum = 0;
-    for (size_t i = 0; i < len; i++) {
-        sum += ptr[i];
-    }
-    return sum;
-}
-
-// ==========================================
-// 函數: xor_cipher
-// 功能: 對資料進行 XOR 加密/解密
-// ==========================================
-void xor_cipher(void *data, size_t len) {
-    uint8_t *ptr = (uint8_t *)data;
-    for (size_t i = 0; i < len; i++) {
-        ptr[i] ^= XOR_KEY;
-    }
-}
-
-// ==========================================
-// 函數: read_n_bytes
-// 功能: 從 socket 讀取 "確切" n 個 bytes
-// 原因: read() 可能只讀到一半資料就返回，必須用迴圈讀滿 n bytes
-// ==========================================
-int read_n_bytes(int sockfd, void *buffer, int n) {
-    int total_read = 0;              // 目前已經讀到的 bytes 數
-    int bytes_left = n;              // 還剩下多少 bytes 沒讀
-    char *ptr = (char *)buffer;      // 指標用來移動寫入位置
-    int ret;                         // 每次 read 的回傳值
-
-    while (total_read < n) {
-        // 嘗試讀取剩下的 bytes
-        ret = read(sockfd, ptr + total_read, bytes_left);
-
-        if (ret < 0) {
-            if (errno == EINTR) {    // 訊號中斷
-                continue;
-            }
-            if (errno == EAGAIN || errno == EWOULDBLOCK) {
-                fprintf(stderr, "Request Timed Out (read)\n");
-                return -1;
-            }
-            perror("read_n_bytes error");
-            return -1;
-        } else if (ret == 0) {       // 關閉連線
-            return 0;
-        }
-
-        total_read += ret;
-        bytes_left -= ret;
-    }
-
-    return total_read;
-}
-
-// ==========================================
-// 函數: write_n_bytes
-// 功能: 寫入 "確切" n 個 bytes 到 socket
-// 原因: write() 也可能只寫入一部分，必須用迴圈確保全部寫出
-// ==========================================
-int write_n_bytes(int sockfd, void *buffer, int n) {
-    int total_written = 0;           // 目前已經寫入的 bytes 數
-    int bytes_left = n;              // 還剩下多少 bytes 沒寫
-    const char *ptr = (const char *)buffer; // 指標用來移動讀取位置
-    int ret;                         // 每次 write 的回傳值
-
-    while (total_written < n) {
-        // 嘗試寫入剩下的 bytes
-        ret = write(sockfd, ptr + total_written, bytes_left);
-
-        if (ret <= 0) {
-            if (ret < 0 && errno == EINTR) { // 訊號中斷
-                continue;
-            }
-            if (ret < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
-                fprintf(stderr, "Request Timed Out (write)\n");
-                return -1;
-            }
-            perror("write_n_bytes error");
-            return -1;
-        }
-
-        total_written += ret;
-        bytes_left -= ret;
-    }
-
-    return total_written;
-}
\ No newline at end of file
+// src_lib/protocol.c
+
+#include "common.h"  // 引入我們定義的結構
+#include <unistd.h>  // 用於 read, write
+#include <stdio.h>   // 用於 perror
+#include <errno.h>   // 用於 errno
+#include <string.h>  // 用於 memcpy
+#include <limits.h>  // 用於 IOV_MAX
+
+#ifndef IOV_MAX
+#define IOV_MAX 1024     // Linux 的上限 (沒有 _GNU_SOURCE 時 limits.h 不會定義)
+#endif
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define PROTOCOL_X86 1
+#endif
+
+// ==========================================
+// 函數: xor_cipher
+// 功能: 對資料進行 XOR 加密/解密
+// ==========================================
+void xor_cipher(void *data, size_t len) {
+    uint8_t *ptr = (uint8_t *)data;
+    for (size_t i = 0; i < len; i++) {
+        ptr[i] ^= XOR_KEY;
+    }
+}
+
+// ==========================================
+// 融合 (fused) 加解密 + Checksum
+// 原本收/送各要走兩遍資料 (xor_cipher 一遍、calculate_checksum 一遍)，
+// 這裡在同一個迴圈內完成: 每個 byte 只從記憶體讀一次、寫一次。
+// checksum 一律是對 "明文" 計算:
+//   收 (decrypt_*): 先 XOR 再算
+//   送 (*_encrypt): 先算再 XOR
+// ==========================================
+
+#define XOR_KEY64 (0x0101010101010101ULL * XOR_KEY)
+
+// 純 C 版本，也負責 SIMD 版本剩下的尾巴 (always_inline: 用呼叫端的指令集編譯)
+static inline __attribute__((always_inline))
+uint32_t xor_sum_scalar(uint8_t *ptr, size_t len, int decrypt) {
+    uint32_t sum = 0;
+    if (decrypt) {
+        for (size_t i = 0; i < len; i++) {
+            ptr[i] ^= XOR_KEY;
+            sum += ptr[i];
+        }
+    } else {
+        for (size_t i = 0; i < len; i++) {
+            sum += ptr[i];
+            ptr[i] ^= XOR_KEY;
+        }
+    }
+    return sum;
+}
+
+static uint32_t xor_sum_portable(void *data, size_t len, int decrypt) {
+    return xor_sum_scalar((uint8_t *)data, len, decrypt);
+}
+
+// CRC 沒有 SIMD 版本時: 以 256 bytes 為一段，XOR 完立刻在 L1 cache 內算 CRC
+static uint32_t xor_crc_portable(uint32_t crc, void *data, size_t len, int decrypt) {
+    uint8_t *ptr = (uint8_t *)data;
+    while (len > 0) {
+        size_t chunk = len < 256 ? len : 256;
+        if (!decrypt) crc = crc32c_update_portable(crc, ptr, chunk);
+        xor_cipher(ptr, chunk);
+        if (decrypt) crc = crc32c_update_portable(crc, ptr, chunk);
+        ptr += chunk;
+        len -= chunk;
+    }
+    return crc;
+}
+
+#ifdef PROTOCOL_X86
+
+__attribute__((target("sse2")))
+static uint32_t xor_sum_sse2(void *data, size_t len, int decrypt) {
+    uint8_t *ptr = (uint8_t *)data;
+    const __m128i key = _mm_set1_epi8((char)XOR_KEY);
+    const __m128i zero = _mm_setzero_si128();
+    __m128i acc = _mm_setzero_si128();
+    size_t i = 0;
+
+    for (; i + 16 <= len; i += 16) {
+        __m128i in = _mm_loadu_si128((const __m128i *)(ptr + i));
+        __m128i out = _mm_xor_si128(in, key);
+        acc = _mm_add_epi64(acc, _mm_sad_epu8(decrypt ? out : in, zero));
+        _mm_storeu_si128((__m128i *)(ptr + i), out);
+    }
+    acc = _mm_add_epi64(acc, _mm_unpackhi_epi64(acc, acc));
+    uint32_t sum = (uint32_t)_mm_cvtsi128_si32(acc);
+
+    return sum + xor_sum_scalar(ptr + i, len - i, decrypt);
+}
+
+__attribute__((target("avx2")))
+static uint32_t xor_sum_avx2(void *data, size_t len, int decrypt) {
+    uint8_t *ptr = (uint8_t *)data;
+    const __m256i key = _mm256_set1_epi8((char)XOR_KEY);
+    const __m256i zero = _mm256_setzero_si256();
+    __m256i acc = _mm256_setzero_si256();
+    size_t i = 0;
+
+    for (; i + 32 <= len; i += 32) {
+        __m256i in = _mm256_loadu_si256((const __m256i *)(ptr + i));
+        __m256i out = _mm256_xor_si256(in, key);
+        acc = _mm256_add_epi64(acc, _mm256_sad_epu8(decrypt ? out : in, zero));
+        _mm256_storeu_si256((__m256i *)(ptr + i), out);
+    }
+    __m128i lo = _mm_add_epi64(_mm256_castsi256_si128(acc), _mm256_extracti128_si256(acc, 1));
+
+    // 剩下 16 ~ 31 bytes 時再做一次 128-bit
+    if (i + 16 <= len) {
+        __m128i in = _mm_loadu_si128((const __m128i *)(ptr + i));
+        __m128i out = _mm_xor_si128(in, _mm256_castsi256_si128(key));
+        lo = _mm_add_epi64(lo, _mm_sad_epu8(decrypt ? out : in, _mm_setzero_si128()));
+        _mm_storeu_si128((__m128i *)(ptr + i), out);
+        i += 16;
+    }
+    lo = _mm_add_epi64(lo, _mm_unpackhi_epi64(lo, lo));
+    uint32_t sum = (uint32_t)_mm_cvtsi128_si32(lo);
+
+    return sum + xor_sum_scalar(ptr + i, len - i, decrypt);
+}
+
+// 每次處理 8 bytes: 一個 64-bit XOR + 一個 crc32 指令
+__attribute__((target("sse4.2")))
+static uint32_t xor_crc_sse42(uint32_t crc, void *data, size_t len, int decrypt) {
+    uint8_t *ptr = (uint8_t *)data;
+    crc = ~crc;
+#ifdef __x86_64__
+    uint64_t crc64 = crc;
+    for (; len >= 8; ptr += 8, len -= 8) {
+        uint64_t in, out;
+        memcpy(&in, ptr, 8);
+        out = in ^ XOR_KEY64;
+        crc64 = _mm_crc32_u64(crc64, decrypt ? out : in);
+        memcpy(ptr, &out, 8);
+    }
+    crc = (uint32_t)crc64;
+#endif
+    for (; len > 0; ptr++, len--) {
+        uint8_t in = *ptr, out = in ^ XOR_KEY;
+        crc = _mm_crc32_u8(crc, decrypt ? out : in);
+        *ptr = out;
+    }
+    return ~crc;
+}
+
+#endif // PROTOCOL_X86
+
+typedef uint32_t (*xor_sum_fn)(void *, size_t, int);
+typedef uint32_t (*xor_crc_fn)(uint32_t, void *, size_t, int);
+
+static xor_sum_fn xor_sum_impl = xor_sum_portable;
+static xor_crc_fn xor_crc_impl = xor_crc_portable;
+
+// 與 checksum.c 相同: 函式庫載入時選一次實作
+__attribute__((constructor))
+static void protocol_dispatch_init(void) {
+#ifdef PROTOCOL_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        xor_sum_impl = xor_sum_avx2;
+    } else if (__builtin_cpu_supports("sse2")) {
+        xor_sum_impl = xor_sum_sse2;
+    }
+    if (__builtin_cpu_supports("sse4.2")) {
+        xor_crc_impl = xor_crc_sse42;
+    }
+#endif
+}
+
+uint32_t decrypt_and_checksum(void *data, size_t len) {
+    return xor_sum_impl(data, len, 1);
+}
+
+uint32_t checksum_and_encrypt(void *data, size_t len) {
+    return xor_sum_impl(data, len, 0);
+}
+
+uint32_t decrypt_and_crc32c(uint32_t crc, void *data, size_t len) {
+    return xor_crc_impl(crc, data, len, 1);
+}
+
+uint32_t crc32c_and_encrypt(uint32_t crc, void *data, size_t len) {
+    return xor_crc_impl(crc, data, len, 0);
+}
+
+// header 部分的 checksum (checksum 欄位視為 0)。只有 16 bytes，在暫存的副本上計算
+static uint32_t header_checksum(const ProtocolHeader *header) {
+    ProtocolHeader tmp = *header;
+    tmp.checksum = 0;
+    if (tmp.opcode & OP_FLAG_CRC32C) {
+        return crc32c_update(0, &tmp, sizeof(tmp));
+    }
+    return calculate_checksum(&tmp, sizeof(tmp));
+}
+
+// ==========================================
+// 函數: packet_open_body
+// 功能: 就地解密 body 並驗證整個封包的 checksum (一次走完 body)
+// 參數: header 必須已經解密；body 可為 NULL (body_len 為 0)
+// 回傳: 0 = 正確, -1 = checksum 不符
+// ==========================================
+int packet_open_body(const ProtocolHeader *header, void *body, size_t body_len) {
+    uint32_t calc = header_checksum(header);
+    if (body && body_len > 0) {
+        if (header->opcode & OP_FLAG_CRC32C) {
+            calc = decrypt_and_crc32c(calc, body, body_len);
+        } else {
+            calc += decrypt_and_checksum(body, body_len);
+        }
+    }
+    return calc == header->checksum ? 0 : -1;
+}
+
+// ==========================================
+// 函數: packet_seal
+// 功能: 填入 checksum 並就地加密 header + body (body 只走一次)
+// ==========================================
+void packet_seal(ProtocolHeader *header, void *body, size_t body_len) {
+    uint32_t calc = header_checksum(header);
+    if (body && body_len > 0) {
+        if (header->opcode & OP_FLAG_CRC32C) {
+            calc = crc32c_and_encrypt(calc, body, body_len);
+        } else {
+            calc += checksum_and_encrypt(body, body_len);
+        }
+    }
+    header->checksum = calc;
+    xor_cipher(header, sizeof(ProtocolHeader));
+}
+
+// ==========================================
+// 函數: read_n_bytes
+// 功能: 從 socket 讀取 "確切" n 個 bytes
+// 原因: read() 可能只讀到一半資料就返回，必須用迴圈讀滿 n bytes
+// ==========================================
+int read_n_bytes(int sockfd, void *buffer, int n) {
+    int total_read = 0;              // 目前已經讀到的 bytes 數
+    int bytes_left = n;              // 還剩下多少 bytes 沒讀
+    char *ptr = (char *)buffer;      // 指標用來移動寫入位置
+    int ret;                         // 每次 read 的回傳值
+
+    while (total_read < n) {
+        // 嘗試讀取剩下的 bytes
+        ret = read(sockfd, ptr + total_read, bytes_left);
+
+        if (ret < 0) {
+            if (errno == EINTR) {    // 訊號中斷
+                continue;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                fprintf(stderr, "Request Timed Out (read)\n");
+                return -1;
+            }
+            perror("read_n_bytes error");
+            return -1;
+        } else if (ret == 0) {       // 關閉連線
+            return 0;
+        }
+
+        total_read += ret;
+        bytes_left -= ret;
+    }
+
+    return total_read;
+}
+
+// ==========================================
+// 函數: write_iov_n
+// 功能: 用 writev() 一次送出多段資料，並保證 "全部" 寫出
+// 原因: 分開 write header 和 body 會多一次系統呼叫，也可能被拆成兩個 TCP 封包；
+//       writev() 和 write() 一樣可能只寫出一部分，要跳過已寫完的段落再繼續
+// 注意: iov 陣列會被修改 (已寫出的部分會被消耗掉)
+// ==========================================
+int write_iov_n(int sockfd, struct iovec *iov, int iovcnt) {
+    int total_written = 0;           // 目前已經寫入的 bytes 數
+    ssize_t ret;                     // 每次 writev 的回傳值
+
+    // 跳過長度為 0 的段落
+    while (iovcnt > 0 && iov->iov_len == 0) {
+        iov++;
+        iovcnt--;
+    }
+
+    while (iovcnt > 0) {
+        // 一次最多 IOV_MAX 段
+        ret = writev(sockfd, iov, iovcnt < IOV_MAX ? iovcnt : IOV_MAX);
+
+        if (ret <= 0) {
+            if (ret < 0 && errno == EINTR) { // 訊號中斷
+                continue;
+            }
+            if (ret < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                fprintf(stderr, "Request Timed Out (write)\n");
+                return -1;
+            }
+            perror("write_iov_n error");
+            return -1;
+        }
+
+        total_written += ret;
+
+        // 消耗掉已寫出的段落，最後一段可能只寫了一部分
+        while (iovcnt > 0 && (size_t)ret >= iov->iov_len) {
+            ret -= iov->iov_len;
+            iov++;
+            iovcnt--;
+        }
+        if (iovcnt > 0) {
+            iov->iov_base = (char *)iov->iov_base + ret;
+            iov->iov_len -= ret;
+        }
+    }
+
+    return total_written;
+}
+
+// ==========================================
+// 函數: write_n_bytes
+// 功能: 寫入 "確切" n 個 bytes 到 socket
+// 說明: 單一段落的 write_iov_n
+// ==========================================
+int write_n_bytes(int sockfd, void *buffer, int n) {
+    struct iovec iov = { .iov_base = buffer, .iov_len = (size_t)n };
+    TRACE_START(trace_t);
+    int ret = write_iov_n(sockfd, &iov, 1);
+    TRACE_PHASE(trace_t, TRACE_WRITE, 0);
+    return ret;
+}
+
+// ==========================================
+// 函數: resp_status_name
+// 功能: v2 狀態碼 (RespStatus) 的文字說明
+// ==========================================
+const char *resp_status_name(uint8_t status) {
+    switch (status) {
+        case RESP_OK:              return "ok";
+        case RESP_INVALID_SESSION: return "invalid session";
+        case RESP_SOLD_OUT:        return "sold out";
+        case RESP_BAD_REQUEST:     return "bad request";
+        case RESP_UNKNOWN_OPCODE:  return "unknown opcode";
+        case RESP_SERVER_BUSY:     return "server busy";
+        case RESP_UNKNOWN_EVENT:   return "unknown event";
+        default:                   return "unknown status";
+    }
+}
@@ -0,0 +1,208 @@
+// src_lib/session_table.c
+
+#include "common.h"
+#include <string.h>
+
+#define SLOT_ID(word)        ((uint32_t)(word))
+#define SLOT_LAST_SEEN(word) ((uint32_t)((word) >> 32))
+#define SLOT_MAKE(id, ts)    (((uint64_t)(ts) << 32) | (uint32_t)(id))
+
+// tombstone 至少要存在這麼久 (秒) 才能清回 EMPTY:
+// 讓在它變成 tombstone 之前就開始探測的 insert 有時間完成
+#define TOMBSTONE_GRACE_SEC  2
+
+// 打散 session_id 的 bits (murmur3 finalizer)，避免連續的 id 擠在同一區
+static uint32_t hash_session_id(uint32_t id) {
+    id ^= id >> 16;
+    id *= 0x85ebca6bu;
+    id ^= id >> 13;
+    id *= 0xc2b2ae35u;
+    id ^= id >> 16;
+    return id;
+}
+
+static int is_expired(const SessionTable *table, uint64_t word, uint32_t now) {
+    return now - SLOT_LAST_SEEN(word) > table->ttl_sec;
+}
+
+// ==========================================
+// 函數: session_table_bytes
+// 功能: 計算需要的 shared memory 大小
+// ==========================================
+size_t session_table_bytes(uint32_t capacity) {
+    return sizeof(SessionTable) + (size_t)capacity * sizeof(uint64_t);
+}
+
+// ==========================================
+// 函數: session_table_init
+// 功能: 清空整張表 (只在 server 啟動、尚未 fork 前呼叫)
+// ==========================================
+void session_table_init(SessionTable *table, uint32_t capacity, uint32_t ttl_sec) {
+    table->capacity = capacity;
+    table->ttl_sec = ttl_sec;
+    atomic_init(&table->count, 0);
+    atomic_init(&table->expired_total, 0);
+    memset((void *)table->slots, 0, (size_t)capacity * sizeof(uint64_t));
+}
+
+// ==========================================
+// 函數: session_table_insert
+// 功能: 以 CAS 搶下一個空的或 tombstone slot
+// 說明: 先沿著探測鏈確認 id 不存在，再把 id 和 last_seen 一次寫進去，
+//       因此其他 process 不會看到 "有 id 但時間還沒寫" 的半成品。
+//       CAS 被搶先而重新探測的次數記進統計數據。
+// ==========================================
+int session_table_insert(SessionTable *table, uint32_t session_id, uint32_t now) {
+    if (session_id == SESSION_EMPTY || session_id == SESSION_TOMBSTONE) return 0;
+
+    uint32_t mask = table->capacity - 1;
+
+retry:;
+    uint32_t idx = hash_session_id(session_id) & mask;
+    int64_t reusable = -1;     // 第一個可以重複使用的 slot
+    uint64_t reusable_word = 0;
+
+    for (uint32_t probe = 0; probe < table->capacity; probe++, idx = (idx + 1) & mask) {
+        uint64_t word = atomic_load_explicit(&table->slots[idx], memory_order_acquire);
+        uint32_t id = SLOT_ID(word);
+
+        if (id == session_id) {
+            if (!is_expired(table, word, now)) return 0;
+            // 同一個 id 已過期但 sweeper 還沒清到: 直接續用
+            if (reusable < 0) {
+                reusable = idx;
+                reusable_word = word;
+            }
+            break;
+        }
+        if (id == SESSION_TOMBSTONE) {
+            if (reusable < 0) {
+                reusable = idx;
+                reusable_word = word;
+            }
+            continue;
+        }
+        if (id == SESSION_EMPTY) {
+            if (reusable < 0) {
+                reusable = idx;
+                reusable_word = word;
+            }
+            break;
+        }
+    }
+
+    if (reusable < 0) return -1; // 整張表都被有效 session 佔滿
+
+    if (!atomic_compare_exchange_strong_explicit(&table->slots[reusable], &reusable_word,
+                                                 SLOT_MAKE(session_id, now),
+                                                 memory_order_acq_rel, memory_order_relaxed)) {
+        // 被其他 process 搶先: 重新探測
+        metrics_cas_retry(METRICS_CAS_SESSION, 1);
+        goto retry;
+    }
+
+    if (SLOT_ID(reusable_word) != session_id) {
+        atomic_fetch_add_explicit(&table->count, 1, memory_order_relaxed);
+    }
+    return 1;
+}
+
+// ==========================================
+// 函數: session_table_touch
+// 功能: 驗證 session 並更新 last_seen
+// 說明: last_seen 以秒為單位，同一秒內重複的請求不會再寫入，
+//       大部分的驗證只有一次 atomic load。
+// ==========================================
+int session_table_touch(SessionTable *table, uint32_t session_id, uint32_t now) {
+    if (session_id == SESSION_EMPTY || session_id == SESSION_TOMBSTONE) return 0;
+
+    uint32_t mask = table->capacity - 1;
+    uint32_t idx = hash_session_id(session_id) & mask;
+
+    for (uint32_t probe = 0; probe < table->capacity; probe++, idx = (idx + 1) & mask) {
+        uint64_t word = atomic_load_explicit(&table->slots[idx], memory_order_acquire);
+        uint32_t id = SLOT_ID(word);
+
+        if (id == SESSION_EMPTY) return 0;
+        if (id != session_id) continue;
+
+        while (1) {
+            if (is_expired(table, word, now)) return 0;
+            if (SLOT_LAST_SEEN(word) == now) return 1;
+            // 更新失敗代表另一個請求剛更新過，或 sweeper 剛把它過期: 重新檢查
+            if (atomic_compare_exchange_weak_explicit(&table->slots[idx], &word,
+                                                      SLOT_MAKE(session_id, now),
+                                                      memory_order_acq_rel, memory_order_acquire)) {
+                return 1;
+            }
+            if (SLOT_ID(word) != session_id) return 0;
+        }
+    }
+    return 0;
+}
+
+// ==========================================
+// 函數: clear_tombstone_run
+// 功能: 把以 idx 結尾、後面緊接 EMPTY 的一串 tombstone 清回 EMPTY
+// 說明: 後一格是 EMPTY 時，沒有任何 key 的探測鏈會經過 idx，
+//       因此可以往回一路清到第一個不是 tombstone 的 slot。
+//       只清超過寬限期的 tombstone；CAS 失敗代表 insert 剛重複使用它，就停下來。
+// 回傳: 清掉的 slot 數
+// ==========================================
+static uint32_t clear_tombstone_run(SessionTable *table, uint32_t idx, uint32_t now) {
+    uint32_t mask = table->capacity - 1;
+    uint32_t cleared = 0;
+
+    while (cleared < table->capacity) {
+        uint64_t word = atomic_load_explicit(&table->slots[idx], memory_order_relaxed);
+        if (SLOT_ID(word) != SESSION_TOMBSTONE) break;
+        if (now - SLOT_LAST_SEEN(word) < TOMBSTONE_GRACE_SEC) break;
+        if (!atomic_compare_exchange_strong_explicit(&table->slots[idx], &word,
+                                                     SLOT_MAKE(SESSION_EMPTY, 0),
+                                                     memory_order_acq_rel, memory_order_relaxed)) {
+            break;
+        }
+        cleared++;
+        idx = (idx - 1) & mask;
+    }
+    return cleared;
+}
+
+// ==========================================
+// 函數: session_table_sweep
+// 功能: 背景清除閒置的 session
+// 說明: 用 CAS 把過期的 slot 換成 tombstone (記下變成 tombstone 的時間)；
+//       若同時有請求更新了 last_seen，CAS 會失敗，該 session 就保留下來。
+//       後面接著 EMPTY 的舊 tombstone 會被清回 EMPTY，否則登入一直換手後
+//       整張表都會是 tombstone，查不到的 ID 要探測整張表。不會阻塞任何請求。
+// ==========================================
+uint32_t session_table_sweep(SessionTable *table, uint32_t start, uint32_t n, uint32_t now) {
+    uint32_t mask = table->capacity - 1;
+    uint32_t expired = 0;
+
+    for (uint32_t i = 0; i < n && i < table->capacity; i++) {
+        uint32_t idx = (start + i) & mask;
+        uint64_t word = atomic_load_explicit(&table->slots[idx], memory_order_relaxed);
+        uint32_t id = SLOT_ID(word);
+
+        if (id == SESSION_EMPTY) continue;
+        if (id == SESSION_TOMBSTONE) {
+            uint64_t next = atomic_load_explicit(&table->slots[(idx + 1) & mask], memory_order_acquire);
+            if (SLOT_ID(next) == SESSION_EMPTY) clear_tombstone_run(table, idx, now);
+            continue;
+        }
+        if (!is_expired(table, word, now)) continue;
+
+        if (atomic_compare_exchange_strong_explicit(&table->slots[idx], &word,
+                                                    SLOT_MAKE(SESSION_TOMBSTONE, now),
+                                                    memory_order_acq_rel, memory_order_relaxed)) {
+            expired++;
+        }
+    }
+
+    if (expired) {
+        atomic_fetch_sub_explicit(&table->count, expired, memory_order_relaxed);
+        atomic_fetch_add_explicit(&table->expired_total, expired, memory_order_relaxed);
+    }
+    return expired;
+}
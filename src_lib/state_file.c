@@ -0,0 +1,136 @@
+// src_lib/state_file.c
+
+#include "common.h"
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// 讀取這次開機的 ID；讀不到時為空字串 (永遠不會被當成同一次開機)
+static void read_boot_id(char *out, size_t size) {
+    memset(out, 0, size);
+    int fd = open("/proc/sys/kernel/random/boot_id", O_RDONLY);
+    if (fd < 0) return;
+    ssize_t n = read(fd, out, size - 1);
+    close(fd);
+    if (n <= 0) {
+        out[0] = '\0';
+        return;
+    }
+    out[strcspn(out, "\n")] = '\0';
+}
+
+// ==========================================
+// 函數: state_file_open
+// 功能: 映射狀態檔；檔頭不符 (或新檔案) 時清空資料區並寫入新的檔頭
+// 說明: 只有檔頭一頁會被讀寫，資料區的頁面在第一次存取時才載入，
+//       所以不論檔案多大，重啟都只需要幾毫秒。
+// ==========================================
+int state_file_open(StateFile *sf, const char *path, uint32_t layout_version, size_t data_bytes) {
+    memset(sf, 0, sizeof(*sf));
+    size_t total = STATE_FILE_HEADER_BYTES + data_bytes;
+
+    int fd = open(path, O_RDWR | O_CREAT, 0644);
+    if (fd < 0) {
+        perror("state file: open failed");
+        return -1;
+    }
+    struct stat st;
+    if (fstat(fd, &st) < 0) {
+        perror("state file: fstat failed");
+        close(fd);
+        return -1;
+    }
+
+    StateFileHeader old;
+    int valid = st.st_size == (off_t)total &&
+                pread(fd, &old, sizeof(old), 0) == sizeof(old) &&
+                memcmp(old.magic, STATE_FILE_MAGIC, sizeof(old.magic)) == 0 &&
+                old.format_version == STATE_FILE_FORMAT_VERSION &&
+                old.layout_version == layout_version &&
+                old.data_bytes == data_bytes;
+    if (!valid) {
+        if (st.st_size > 0) {
+            fprintf(stderr, "state file: %s has a different layout, starting from a fresh state\n", path);
+        }
+        // 截成 0 再擴大: 整個檔案變成稀疏的 0，不用真的寫入
+        if (ftruncate(fd, 0) < 0 || ftruncate(fd, total) < 0) {
+            perror("state file: ftruncate failed");
+            close(fd);
+            return -1;
+        }
+    }
+
+    void *mem = mmap(NULL, total, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);   // 映射會保留檔案的參照
+    if (mem == MAP_FAILED) {
+        perror("state file: mmap failed");
+        return -1;
+    }
+
+    StateFileHeader *header = mem;
+    char boot_id[sizeof(header->boot_id)];
+    read_boot_id(boot_id, sizeof(boot_id));
+
+    sf->header = header;
+    sf->data = (char *)mem + STATE_FILE_HEADER_BYTES;
+    sf->data_bytes = data_bytes;
+    sf->owner_pid = getpid();
+    sf->created = !valid;
+    if (valid) {
+        sf->clean = header->clean != 0;
+        sf->same_boot = boot_id[0] != '\0' && strcmp(header->boot_id, boot_id) == 0;
+    } else {
+        memcpy(header->magic, STATE_FILE_MAGIC, sizeof(header->magic));
+        header->format_version = STATE_FILE_FORMAT_VERSION;
+        header->layout_version = layout_version;
+        header->data_bytes = data_bytes;
+    }
+
+    // 開始使用後就不再是 "正常關閉" 的狀態，直到 state_file_close
+    memcpy(header->boot_id, boot_id, sizeof(header->boot_id));
+    header->clean = 0;
+    if (msync(header, STATE_FILE_HEADER_BYTES, MS_SYNC) < 0) {
+        perror("state file: msync failed");
+    }
+    return 0;
+}
+
+// ==========================================
+// 函數: state_file_snapshot
+// 功能: 把資料區的髒頁寫回磁碟，完成後才更新檔頭的快照編號
+// 說明: 每個欄位都是對齊的 atomic word，寫回時不會被切成兩半；
+//       快照期間 server 照常處理 request，不需要暫停。
+// ==========================================
+int state_file_snapshot(StateFile *sf) {
+    if (!sf->header) return -1;
+    if (msync(sf->data, sf->data_bytes, MS_SYNC) < 0) {
+        perror("state file: msync failed");
+        return -1;
+    }
+    sf->header->snapshot_gen++;
+    sf->header->snapshot_time = time(NULL);
+    if (msync(sf->header, STATE_FILE_HEADER_BYTES, MS_SYNC) < 0) {
+        perror("state file: msync failed");
+        return -1;
+    }
+    return 0;
+}
+
+// ==========================================
+// 函數: state_file_close
+// 功能: 最後一次快照並標記為正常關閉，然後解除映射
+// ==========================================
+void state_file_close(StateFile *sf) {
+    if (!sf->header) return;
+    if (getpid() == sf->owner_pid && state_file_snapshot(sf) == 0) {
+        sf->header->clean = 1;
+        msync(sf->header, STATE_FILE_HEADER_BYTES, MS_SYNC);
+    }
+    munmap(sf->header, STATE_FILE_HEADER_BYTES + sf->data_bytes);
+    sf->header = NULL;
+    sf->data = NULL;
+}
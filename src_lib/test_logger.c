@@ -1,45 +1,130 @@
-// test_logger.c
-#include "common.h"
-#include <stdio.h>
-#include <stdlib.h>
-#include <unistd.h>
-#include <sys/wait.h>
-#include <time.h>
-
-#define PROCESS_COUNT 5    // 模擬 5 個 Process
-#define LOGS_PER_PROC 100  // 每個 Process 寫 100 行
-
-void worker_task(int id) {
-    for (int i = 0; i < LOGS_PER_PROC; i++) {
-        log_message(LOG_INFO, "Process %d is writing log line %d", id, i);
-        // 隨機延遲，增加競爭機會
-        usleep(rand() % 1000);
-    }
-    printf("Process %d finished.\n", id);
-    exit(0);
-}
-
-int main() {
-    // 移除舊的 log 以便觀察
-    remove("test_run.log");
-    
-    // 初始化寫入 test_run.log
-    init_logger("test_run.log");
-
-    printf("Starting Isolated Logger Test...\n");
-
-    for (int i = 0; i < PROCESS_COUNT; i++) {
-        pid_t pid = fork();
-        if (pid == 0) {
-            srand(getpid()); 
-            worker_task(i);
-        }
-    }
-
-    for (int i = 0; i < PROCESS_COUNT; i++) {
-        wait(NULL);
-    }
-
-    printf("Done. Check 'test_run.log'.\n");
-    return 0;
+// test_logger.c
+#include "common.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <time.h>
+
+#define PROCESS_COUNT 5    // 模擬 5 個 Process
+#define LOGS_PER_PROC 100  // 每個 Process 寫 100 行
+
+// 效能比較: 檔案鎖 logger vs 共享記憶體 log 通道
+#define BENCH_LINES_PER_PROC 2000
+static const int bench_process_counts[] = {5, 16, 32, 64};
+
+void worker_task(int id) {
+    for (int i = 0; i < LOGS_PER_PROC; i++) {
+        log_message(LOG_INFO, "Process %d is writing log line %d", id, i);
+        // 隨機延遲，增加競爭機會
+        usleep(rand() % 1000);
+    }
+    printf("Process %d finished.\n", id);
+    exit(0);
+}
+
+static double now_sec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static long count_lines(const char *filename) {
+    FILE *fp = fopen(filename, "r");
+    if (!fp) return -1;
+    long lines = 0;
+    int c;
+    while ((c = fgetc(fp)) != EOF) {
+        if (c == '\n') lines++;
+    }
+    fclose(fp);
+    return lines;
+}
+
+// 在獨立的 runner process 中初始化 logger 並 fork 出 num_procs 個 worker，
+// 回傳所有 log 都寫入檔案所花的秒數 (行數不符時回傳 -1)
+static double run_logger_bench(int use_shm, int num_procs, const char *filename) {
+    remove(filename);
+    fflush(stdout);
+
+    double start = now_sec();
+    pid_t runner = fork();
+    if (runner == 0) {
+        if (use_shm) {
+            init_logger_shm(filename, num_procs, 0);
+        } else {
+            init_logger(filename);
+        }
+
+        for (int i = 0; i < num_procs; i++) {
+            if (fork() == 0) {
+                for (int j = 0; j < BENCH_LINES_PER_PROC; j++) {
+                    log_message(LOG_INFO, "Process %d is writing log line %d", i, j);
+                }
+                exit(0);
+            }
+        }
+        for (int i = 0; i < num_procs; i++) {
+            wait(NULL);
+        }
+
+        if (use_shm) {
+            shutdown_logger_shm(); // 等 collector 寫完
+        }
+        exit(0);
+    }
+    waitpid(runner, NULL, 0);
+    double elapsed = now_sec() - start;
+
+    long lines = count_lines(filename);
+    remove(filename);
+    if (lines != (long)num_procs * BENCH_LINES_PER_PROC) {
+        fprintf(stderr, "%s logger wrote %ld lines, expected %ld\n",
+                use_shm ? "shm" : "locking", lines, (long)num_procs * BENCH_LINES_PER_PROC);
+        return -1;
+    }
+    return elapsed;
+}
+
+static void run_benchmarks(void) {
+    printf("\nLogger benchmark (%d lines per process)\n", BENCH_LINES_PER_PROC);
+    printf("%10s %14s %14s %10s\n", "processes", "locking (s)", "shm (s)", "speedup");
+
+    for (size_t i = 0; i < sizeof(bench_process_counts) / sizeof(bench_process_counts[0]); i++) {
+        int n = bench_process_counts[i];
+        double locking = run_logger_bench(0, n, "bench_locking.log");
+        double shm = run_logger_bench(1, n, "bench_shm.log");
+        if (locking < 0 || shm < 0) {
+            printf("%10d %14s %14s %10s\n", n, "-", "-", "FAILED");
+            continue;
+        }
+        printf("%10d %14.3f %14.3f %9.1fx\n", n, locking, shm, locking / shm);
+    }
+}
+
+int main() {
+    // 移除舊的 log 以便觀察
+    remove("test_run.log");
+    
+    // 初始化寫入 test_run.log
+    init_logger("test_run.log");
+
+    printf("Starting Isolated Logger Test...\n");
+
+    for (int i = 0; i < PROCESS_COUNT; i++) {
+        pid_t pid = fork();
+        if (pid == 0) {
+            srand(getpid()); 
+            worker_task(i);
+        }
+    }
+
+    for (int i = 0; i < PROCESS_COUNT; i++) {
+        wait(NULL);
+    }
+
+    printf("Done. Check 'test_run.log'.\n");
+
+    run_benchmarks();
+    return 0;
 }
\ No newline at end of file
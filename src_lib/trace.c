@@ -0,0 +1,169 @@
+// src_lib/trace.c
+
+#include "common.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+
+static TraceSpan *trace_spans = NULL;   // ring buffer，NULL = 沒有在收集
+static uint64_t trace_count = 0;        // 累計記錄的 span 數 (超過容量後覆蓋最舊的)
+static char trace_prefix[256];
+static atomic_int trace_threads = 0;             // 已編號的 thread 數
+static __thread int trace_thread_id = -1;
+
+// 每個階段在 folded stacks 中的位置 (flamegraph 會把 request 底下的階段疊在一起)
+// 以及在 Chrome trace 中的分類 (io = 整批 request 共用的 syscall / 等待)
+static const struct {
+    const char *name;
+    const char *category;
+    const char *stack;
+} trace_phases[TRACE_PHASES] = {
+    [TRACE_READ]             = { "read",             "io",      "server;read" },
+    [TRACE_LOG]              = { "log",              "request", "server;request;log" },
+    [TRACE_DECRYPT_CHECKSUM] = { "decrypt_checksum", "request", "server;request;decrypt_checksum" },
+    [TRACE_SESSION]          = { "session",          "request", "server;request;session" },
+    [TRACE_HANDLE]           = { "handle",           "request", "server;request;handle" },
+    [TRACE_SEAL]             = { "seal",             "request", "server;request;seal" },
+    [TRACE_JOURNAL_WAIT]     = { "journal_wait",     "io",      "server;journal_wait" },
+    [TRACE_WRITE]            = { "write",            "io",      "server;write" },
+};
+
+static uint64_t trace_clock_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000UL + ts.tv_nsec;
+}
+
+// fork 出來的 child 不輸出 parent 的 span
+static void trace_atfork_child(void) {
+    trace_count = 0;
+    trace_threads = 0;
+    trace_thread_id = -1;
+}
+
+static void trace_atexit(void) {
+    if (!trace_spans || trace_count == 0) return;
+    char path[sizeof(trace_prefix) + 32];
+    snprintf(path, sizeof(path), "%s.%d.json", trace_prefix, (int)getpid());
+    long n = trace_export_chrome(path);
+    snprintf(path, sizeof(path), "%s.%d.folded", trace_prefix, (int)getpid());
+    trace_export_folded(path);
+    if (n > 0) fprintf(stderr, "trace: wrote %ld spans to %s.%d.{json,folded}\n", n, trace_prefix, (int)getpid());
+}
+
+// ==========================================
+// 函數: trace_init
+// 功能: 配置這個 process 的 span buffer，並在結束時輸出追蹤檔
+// ==========================================
+int trace_init(const char *prefix) {
+    static int atfork_registered = 0;
+    if (!trace_spans) {
+        // 頁面在第一次寫入時才配置，收集很少 span 時不會真的用掉 16 MB
+        trace_spans = malloc(TRACE_BUFFER_SPANS * sizeof(TraceSpan));
+        if (!trace_spans) {
+            perror("trace: malloc failed");
+            return -1;
+        }
+    }
+    snprintf(trace_prefix, sizeof(trace_prefix), "%s", prefix);
+    trace_count = 0;
+    if (!atfork_registered) {
+        pthread_atfork(NULL, NULL, trace_atfork_child);
+        atexit(trace_atexit);
+        atfork_registered = 1;
+    }
+    return 0;
+}
+
+// ==========================================
+// 函數: trace_record
+// 功能: 寫入一個 span，回傳結束時間讓下一個階段接著計時
+// 說明: 同一個 process 的多個 thread 可以同時呼叫 (各自用 atomic 取得位置)
+// ==========================================
+uint64_t trace_record(TracePhase phase, uint64_t start_ns, uint16_t req_id) {
+    uint64_t now = trace_clock_ns();
+    if (!trace_spans) return now;
+    if (trace_thread_id < 0) trace_thread_id = atomic_fetch_add(&trace_threads, 1);
+    uint64_t slot = __atomic_fetch_add(&trace_count, 1, __ATOMIC_RELAXED);
+    TraceSpan *span = &trace_spans[slot % TRACE_BUFFER_SPANS];
+    span->start_ns = start_ns;
+    span->duration_ns = (uint32_t)(now - start_ns);
+    span->req_id = req_id;
+    span->phase = (uint8_t)phase;
+    span->thread = (uint8_t)trace_thread_id;
+    return now;
+}
+
+const char *trace_phase_name(TracePhase phase) {
+    return (unsigned)phase < TRACE_PHASES ? trace_phases[phase].name : "unknown";
+}
+
+// buffer 中目前保留的 span: 從最舊的開始
+static uint64_t trace_first(uint64_t *kept) {
+    *kept = trace_count < TRACE_BUFFER_SPANS ? trace_count : TRACE_BUFFER_SPANS;
+    return trace_count - *kept;
+}
+
+// ==========================================
+// 函數: trace_export_chrome
+// 功能: 輸出 Chrome trace 格式 (complete events, 時間單位 us)
+// 說明: 每個 process 一個 pid 列，其中每個 thread 一行；同一個 request 的階段帶有相同的 req_id
+// ==========================================
+long trace_export_chrome(const char *path) {
+    if (!trace_spans) return 0;
+    FILE *fp = fopen(path, "w");
+    if (!fp) {
+        perror("trace: fopen failed");
+        return -1;
+    }
+    int pid = (int)getpid();
+    uint64_t kept;
+    uint64_t first = trace_first(&kept);
+    fprintf(fp, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+    for (uint64_t i = 0; i < kept; i++) {
+        const TraceSpan *span = &trace_spans[(first + i) % TRACE_BUFFER_SPANS];
+        fprintf(fp, "%s{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,"
+                    "\"pid\":%d,\"tid\":%d,\"args\":{\"req_id\":%u}}\n",
+                i ? "," : "", trace_phase_name(span->phase),
+                span->phase < TRACE_PHASES ? trace_phases[span->phase].category : "unknown",
+                span->start_ns / 1e3, span->duration_ns / 1e3, pid, pid + span->thread, span->req_id);
+    }
+    fprintf(fp, "]}\n");
+    if (fclose(fp) != 0) {
+        perror("trace: fclose failed");
+        return -1;
+    }
+    return (long)kept;
+}
+
+// ==========================================
+// 函數: trace_export_folded
+// 功能: 輸出 folded stacks (每行 "stack 總奈秒數")，可直接交給 flamegraph.pl
+// ==========================================
+long trace_export_folded(const char *path) {
+    if (!trace_spans) return 0;
+    uint64_t total_ns[TRACE_PHASES] = {0};
+    uint64_t kept;
+    uint64_t first = trace_first(&kept);
+    for (uint64_t i = 0; i < kept; i++) {
+        const TraceSpan *span = &trace_spans[(first + i) % TRACE_BUFFER_SPANS];
+        if (span->phase < TRACE_PHASES) total_ns[span->phase] += span->duration_ns;
+    }
+
+    FILE *fp = fopen(path, "w");
+    if (!fp) {
+        perror("trace: fopen failed");
+        return -1;
+    }
+    for (int p = 0; p < TRACE_PHASES; p++) {
+        if (total_ns[p] > 0) fprintf(fp, "%s %lu\n", trace_phases[p].stack, (unsigned long)total_ns[p]);
+    }
+    if (fclose(fp) != 0) {
+        perror("trace: fclose failed");
+        return -1;
+    }
+    return (long)kept;
+}
@@ -0,0 +1,297 @@
+// src_lib/uring.c
+
+#include "common.h"
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+// 直接用 syscall，不依賴 liburing
+static int sys_io_uring_setup(unsigned entries, struct io_uring_params *p) {
+    return (int)syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int sys_io_uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags) {
+    return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+static int sys_io_uring_register(int fd, unsigned opcode, void *arg, unsigned nr_args) {
+    return (int)syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+// ==========================================
+// 函數: uring_init
+// 功能: 建立 io_uring 並映射 SQ / CQ ring
+// 說明: CQ 是 SQ 的 4 倍大 (multishot 的一個 SQE 會產生很多 CQE)。
+//       核心不支援 (ENOSYS) 或被停用 (EPERM) 時回傳 -1，errno 保留，呼叫端改用 epoll。
+// ==========================================
+int uring_init(Uring *ring, unsigned entries) {
+    memset(ring, 0, sizeof(*ring));
+    ring->fd = -1;
+
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    p.flags = IORING_SETUP_CQSIZE;
+    p.cq_entries = entries * 4;
+    int fd = sys_io_uring_setup(entries, &p);
+    if (fd < 0) return -1;
+
+    ring->fd = fd;
+    ring->sq_ring_bytes = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    ring->cq_ring_bytes = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if ((p.features & IORING_FEAT_SINGLE_MMAP) && ring->cq_ring_bytes > ring->sq_ring_bytes) {
+        ring->sq_ring_bytes = ring->cq_ring_bytes;
+    }
+
+    ring->sq_ring = mmap(NULL, ring->sq_ring_bytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                         fd, IORING_OFF_SQ_RING);
+    if (ring->sq_ring == MAP_FAILED) {
+        ring->sq_ring = NULL;
+        uring_close(ring);
+        return -1;
+    }
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        ring->cq_ring = ring->sq_ring;
+    } else {
+        ring->cq_ring = mmap(NULL, ring->cq_ring_bytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                             fd, IORING_OFF_CQ_RING);
+        if (ring->cq_ring == MAP_FAILED) {
+            ring->cq_ring = NULL;
+            uring_close(ring);
+            return -1;
+        }
+    }
+    ring->sqes_bytes = p.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = mmap(NULL, ring->sqes_bytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                      fd, IORING_OFF_SQES);
+    if (ring->sqes == MAP_FAILED) {
+        ring->sqes = NULL;
+        uring_close(ring);
+        return -1;
+    }
+
+    char *sq = ring->sq_ring, *cq = ring->cq_ring;
+    ring->sq_entries = p.sq_entries;
+    ring->sq_mask = *(unsigned *)(sq + p.sq_off.ring_mask);
+    ring->sq_head = (unsigned *)(sq + p.sq_off.head);
+    ring->sq_tail = (unsigned *)(sq + p.sq_off.tail);
+    ring->sq_array = (unsigned *)(sq + p.sq_off.array);
+    ring->cq_mask = *(unsigned *)(cq + p.cq_off.ring_mask);
+    ring->cq_head = (unsigned *)(cq + p.cq_off.head);
+    ring->cq_tail = (unsigned *)(cq + p.cq_off.tail);
+    ring->cqes = cq + p.cq_off.cqes;
+
+    // SQ array 固定成一對一，之後只需要移動 tail
+    for (unsigned i = 0; i < p.sq_entries; i++) ring->sq_array[i] = i;
+    return 0;
+}
+
+// ==========================================
+// 函數: uring_setup_buffers
+// 功能: 註冊一組 provided buffer ring (count 必須是 2 的次方)
+// 說明: recv 完成時由 kernel 從這裡挑一塊，CQE 告訴我們是哪一塊；
+//       用完以 uring_recycle_buffer 放回，不需要任何 syscall。
+// ==========================================
+int uring_setup_buffers(Uring *ring, uint16_t group, unsigned count, unsigned size) {
+    size_t ring_bytes = count * sizeof(struct io_uring_buf);
+    ring_bytes = (ring_bytes + 4095) & ~(size_t)4095;
+    void *br = mmap(NULL, ring_bytes + (size_t)count * size, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (br == MAP_FAILED) return -1;
+
+    struct io_uring_buf_reg reg;
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = (uint64_t)(uintptr_t)br;
+    reg.ring_entries = count;
+    reg.bgid = group;
+    if (sys_io_uring_register(ring->fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+        int saved = errno;
+        munmap(br, ring_bytes + (size_t)count * size);
+        errno = saved;
+        return -1;
+    }
+
+    ring->buf_ring = br;
+    ring->buf_ring_bytes = ring_bytes;
+    ring->buf_base = (char *)br + ring_bytes;
+    ring->buf_count = count;
+    ring->buf_size = size;
+    ring->buf_group = group;
+    ring->buf_tail = 0;
+    for (unsigned i = 0; i < count; i++) uring_recycle_buffer(ring, (int)i);
+    return 0;
+}
+
+void *uring_buffer(Uring *ring, int buffer_id) {
+    return ring->buf_base + (size_t)buffer_id * ring->buf_size;
+}
+
+// ==========================================
+// 函數: uring_recycle_buffer
+// 功能: 把用完的 provided buffer 放回 ring 尾端
+// ==========================================
+void uring_recycle_buffer(Uring *ring, int buffer_id) {
+    struct io_uring_buf_ring *br = ring->buf_ring;
+    struct io_uring_buf *buf = &br->bufs[ring->buf_tail & (ring->buf_count - 1)];
+    buf->addr = (uint64_t)(uintptr_t)uring_buffer(ring, buffer_id);
+    buf->len = ring->buf_size;
+    buf->bid = (uint16_t)buffer_id;
+    ring->buf_tail++;
+    __atomic_store_n(&br->tail, ring->buf_tail, __ATOMIC_RELEASE);
+}
+
+// 取一個空的 SQE；SQ 滿了就先交出去
+static struct io_uring_sqe *uring_get_sqe(Uring *ring) {
+    unsigned head = __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+    unsigned tail = *ring->sq_tail + ring->sq_pending;
+    if (tail - head >= ring->sq_entries) {
+        if (uring_submit_and_wait(ring, 0) < 0) return NULL;
+        head = __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+        tail = *ring->sq_tail + ring->sq_pending;
+        if (tail - head >= ring->sq_entries) return NULL;
+    }
+    struct io_uring_sqe *sqe = &((struct io_uring_sqe *)ring->sqes)[tail & ring->sq_mask];
+    memset(sqe, 0, sizeof(*sqe));
+    ring->sq_pending++;
+    return sqe;
+}
+
+// ==========================================
+// 函數: uring_accept
+// 功能: 在 listener 上等待連線 (multishot: 一個 SQE 接受之後所有的連線)
+// ==========================================
+int uring_accept(Uring *ring, int fd, uint64_t user_data, int multishot) {
+    struct io_uring_sqe *sqe = uring_get_sqe(ring);
+    if (!sqe) return -1;
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = fd;
+    if (multishot) sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    sqe->user_data = user_data;
+    return 0;
+}
+
+// ==========================================
+// 函數: uring_recv
+// 功能: 從 provided buffer ring 收資料 (multishot: 一直收到連線關閉或 buffer 用完)
+// ==========================================
+int uring_recv(Uring *ring, int fd, uint64_t user_data, int multishot) {
+    struct io_uring_sqe *sqe = uring_get_sqe(ring);
+    if (!sqe) return -1;
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = fd;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = ring->buf_group;
+    if (multishot) sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->user_data = user_data;
+    return 0;
+}
+
+// ==========================================
+// 函數: uring_send
+// 功能: 送出 buf 的 len bytes (buf 在完成前不能更動)
+// ==========================================
+int uring_send(Uring *ring, int fd, const void *buf, size_t len, uint64_t user_data) {
+    struct io_uring_sqe *sqe = uring_get_sqe(ring);
+    if (!sqe) return -1;
+    sqe->opcode = IORING_OP_SEND;
+    sqe->fd = fd;
+    sqe->addr = (uint64_t)(uintptr_t)buf;
+    sqe->len = (uint32_t)len;
+    sqe->msg_flags = MSG_NOSIGNAL;
+    sqe->user_data = user_data;
+    return 0;
+}
+
+// ==========================================
+// 函數: uring_timeout
+// 功能: msec 毫秒後產生一個完成事件 (res = -ETIME)
+// ==========================================
+int uring_timeout(Uring *ring, unsigned msec, uint64_t user_data) {
+    // kernel 在送出時就複製了時間，靜態變數不會被下一次呼叫影響
+    static struct __kernel_timespec ts;
+    struct io_uring_sqe *sqe = uring_get_sqe(ring);
+    if (!sqe) return -1;
+    ts.tv_sec = msec / 1000;
+    ts.tv_nsec = (long long)(msec % 1000) * 1000000;
+    sqe->opcode = IORING_OP_TIMEOUT;
+    sqe->fd = -1;
+    sqe->addr = (uint64_t)(uintptr_t)&ts;
+    sqe->len = 1;
+    sqe->user_data = user_data;
+    // 必須在這裡交出去: ts 是共用的
+    return uring_submit_and_wait(ring, 0);
+}
+
+// ==========================================
+// 函數: uring_cancel
+// 功能: 取消 user_data 為 target 的請求 (例如停止某個連線的 multishot recv)
+// ==========================================
+int uring_cancel(Uring *ring, uint64_t target, uint64_t user_data) {
+    struct io_uring_sqe *sqe = uring_get_sqe(ring);
+    if (!sqe) return -1;
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->fd = -1;
+    sqe->addr = target;
+    sqe->user_data = user_data;
+    return 0;
+}
+
+// ==========================================
+// 函數: uring_submit_and_wait
+// 功能: 一次 io_uring_enter 交出所有累積的 SQE，並等到至少 wait_nr 個完成事件
+// 說明: 沒有要交的 SQE、也不需要等待時不做 syscall。
+// 回傳: 0 成功；-1 失敗 (errno，EINTR = 被 signal 打斷)
+// ==========================================
+int uring_submit_and_wait(Uring *ring, unsigned wait_nr) {
+    if (ring->sq_pending > 0) {
+        __atomic_store_n(ring->sq_tail, *ring->sq_tail + ring->sq_pending, __ATOMIC_RELEASE);
+        ring->sq_pending = 0;
+    }
+    // 包含之前被打斷、kernel 還沒收走的 SQE
+    unsigned to_submit = *ring->sq_tail - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+    if (to_submit == 0 && wait_nr == 0) return 0;
+
+    ring->enter_calls++;
+    int ret = sys_io_uring_enter(ring->fd, to_submit, wait_nr, wait_nr > 0 ? IORING_ENTER_GETEVENTS : 0);
+    // CQ 滿了 (EBUSY) 或暫時沒有資源: 呼叫端先處理完成事件，剩下的 SQE 下次再交
+    if (ret < 0 && (errno == EBUSY || errno == EAGAIN)) return 0;
+    return ret < 0 ? -1 : 0;
+}
+
+// ==========================================
+// 函數: uring_next_completion
+// 功能: 取出下一個完成事件 (不做 syscall)
+// 回傳: 1 = 取得；0 = CQ 已空
+// ==========================================
+int uring_next_completion(Uring *ring, UringCompletion *out) {
+    unsigned head = *ring->cq_head;
+    if (head == __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE)) return 0;
+    const struct io_uring_cqe *cqe = &((struct io_uring_cqe *)ring->cqes)[head & ring->cq_mask];
+    out->user_data = cqe->user_data;
+    out->res = cqe->res;
+    out->more = (cqe->flags & IORING_CQE_F_MORE) != 0;
+    out->buffer_id = (cqe->flags & IORING_CQE_F_BUFFER) ? (int)(cqe->flags >> IORING_CQE_BUFFER_SHIFT) : -1;
+    __atomic_store_n(ring->cq_head, head + 1, __ATOMIC_RELEASE);
+    return 1;
+}
+
+// ==========================================
+// 函數: uring_close
+// 功能: 解除映射並關閉 ring (尚未完成的請求由 kernel 取消)
+// ==========================================
+void uring_close(Uring *ring) {
+    if (ring->buf_ring) {
+        munmap(ring->buf_ring, ring->buf_ring_bytes + (size_t)ring->buf_count * ring->buf_size);
+    }
+    if (ring->sqes) munmap(ring->sqes, ring->sqes_bytes);
+    if (ring->cq_ring && ring->cq_ring != ring->sq_ring) munmap(ring->cq_ring, ring->cq_ring_bytes);
+    if (ring->sq_ring) munmap(ring->sq_ring, ring->sq_ring_bytes);
+    if (ring->fd >= 0) close(ring->fd);
+    memset(ring, 0, sizeof(*ring));
+    ring->fd = -1;
+}
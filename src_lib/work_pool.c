@@ -0,0 +1,190 @@
+// src_lib/work_pool.c
+
+#include "common.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+// 每個 worker 一個佇列，各自一把鎖: 平常只有 submit 的 thread 與擁有者會碰到，
+// 閒著的 worker 才去鎖別人的佇列
+typedef struct {
+    pthread_mutex_t lock;
+    WorkItem *head;
+    WorkItem *tail;
+} __attribute__((aligned(64))) WorkQueue;
+
+struct WorkPool {
+    WorkQueue *queues;
+    pthread_t *threads;
+    int num_threads;
+    int started;                    // 成功建立的 thread 數
+    void (*thread_init)(int id);    // 每個 worker 開始前在自己的 thread 上呼叫 (可為 NULL)
+    atomic_uint next_queue;         // submit 輪流放進各個佇列
+    atomic_int pending;             // 已放進佇列、還沒被取走的工作數
+    atomic_int idle;                // 正在 idle_cond 上等待的 worker 數
+    atomic_int stopping;
+    atomic_ulong executed;
+    atomic_ulong stolen;
+    pthread_mutex_t idle_lock;
+    pthread_cond_t idle_cond;
+};
+
+typedef struct {
+    WorkPool *pool;
+    int id;
+} WorkerArg;
+
+static WorkItem *queue_pop(WorkQueue *q) {
+    pthread_mutex_lock(&q->lock);
+    WorkItem *item = q->head;
+    if (item) {
+        q->head = item->next;
+        if (!q->head) q->tail = NULL;
+    }
+    pthread_mutex_unlock(&q->lock);
+    return item;
+}
+
+// 先看自己的佇列，空了再從下一個 worker 開始輪流偷
+static WorkItem *work_pool_take(WorkPool *pool, int id) {
+    if (atomic_load(&pool->pending) == 0) return NULL;
+    for (int i = 0; i < pool->num_threads; i++) {
+        WorkItem *item = queue_pop(&pool->queues[(id + i) % pool->num_threads]);
+        if (item) {
+            atomic_fetch_sub(&pool->pending, 1);
+            if (i > 0) atomic_fetch_add_explicit(&pool->stolen, 1, memory_order_relaxed);
+            return item;
+        }
+    }
+    return NULL;
+}
+
+static void *work_pool_worker(void *arg) {
+    WorkPool *pool = ((WorkerArg *)arg)->pool;
+    int id = ((WorkerArg *)arg)->id;
+    free(arg);
+
+    if (pool->thread_init) pool->thread_init(id);
+
+    while (1) {
+        WorkItem *item = work_pool_take(pool, id);
+        if (item) {
+            item->run(item);
+            atomic_fetch_add_explicit(&pool->executed, 1, memory_order_relaxed);
+            continue;
+        }
+        if (atomic_load(&pool->stopping)) break;
+
+        // idle 先加一再檢查 pending: submit 是先加 pending 再看 idle，兩邊至少一方會看到對方
+        pthread_mutex_lock(&pool->idle_lock);
+        atomic_fetch_add(&pool->idle, 1);
+        while (atomic_load(&pool->pending) == 0 && !atomic_load(&pool->stopping)) {
+            pthread_cond_wait(&pool->idle_cond, &pool->idle_lock);
+        }
+        atomic_fetch_sub(&pool->idle, 1);
+        pthread_mutex_unlock(&pool->idle_lock);
+    }
+    return NULL;
+}
+
+// ==========================================
+// 函數: work_pool_create
+// 功能: 建立 num_threads 個 worker thread
+// 說明: 呼叫端若要讓 signal 只送到主 thread，應在呼叫前先用 pthread_sigmask 擋掉
+//       (新 thread 繼承建立者的 signal mask)。thread_init 用來設定各 thread 自己的狀態
+//       (例如統計數據寫到哪一格)。
+// ==========================================
+WorkPool *work_pool_create(int num_threads, void (*thread_init)(int id)) {
+    if (num_threads <= 0) return NULL;
+    WorkPool *pool = calloc(1, sizeof(WorkPool));
+    if (!pool) return NULL;
+    pool->num_threads = num_threads;
+    pool->thread_init = thread_init;
+    pool->queues = aligned_alloc(64, num_threads * sizeof(WorkQueue));
+    pool->threads = calloc(num_threads, sizeof(pthread_t));
+    if (!pool->queues || !pool->threads) {
+        free(pool->queues);
+        free(pool->threads);
+        free(pool);
+        return NULL;
+    }
+    memset(pool->queues, 0, num_threads * sizeof(WorkQueue));
+    for (int i = 0; i < num_threads; i++) {
+        pthread_mutex_init(&pool->queues[i].lock, NULL);
+    }
+    pthread_mutex_init(&pool->idle_lock, NULL);
+    pthread_cond_init(&pool->idle_cond, NULL);
+
+    for (int i = 0; i < num_threads; i++) {
+        WorkerArg *arg = malloc(sizeof(WorkerArg));
+        if (!arg) break;
+        arg->pool = pool;
+        arg->id = i;
+        if (pthread_create(&pool->threads[i], NULL, work_pool_worker, arg) != 0) {
+            perror("pthread_create failed (work pool)");
+            free(arg);
+            break;
+        }
+        pool->started++;
+    }
+    if (pool->started == 0) {
+        work_pool_destroy(pool);
+        return NULL;
+    }
+    // 少了幾個 thread 也能運作: 沒人負責的佇列會被其他 worker 偷光
+    return pool;
+}
+
+// ==========================================
+// 函數: work_pool_submit
+// 功能: 放入一個工作 (不配置記憶體，item 由呼叫端持有直到 run 被呼叫)
+// ==========================================
+void work_pool_submit(WorkPool *pool, WorkItem *item) {
+    WorkQueue *q = &pool->queues[atomic_fetch_add_explicit(&pool->next_queue, 1, memory_order_relaxed) %
+                                 pool->num_threads];
+    item->next = NULL;
+    pthread_mutex_lock(&q->lock);
+    if (q->tail) {
+        q->tail->next = item;
+    } else {
+        q->head = item;
+    }
+    q->tail = item;
+    pthread_mutex_unlock(&q->lock);
+
+    atomic_fetch_add(&pool->pending, 1);
+    if (atomic_load(&pool->idle) > 0) {
+        pthread_mutex_lock(&pool->idle_lock);
+        pthread_cond_signal(&pool->idle_cond);
+        pthread_mutex_unlock(&pool->idle_lock);
+    }
+}
+
+// ==========================================
+// 函數: work_pool_destroy
+// 功能: 執行完佇列中剩下的工作，結束並回收所有 thread
+// ==========================================
+void work_pool_destroy(WorkPool *pool) {
+    if (!pool) return;
+    pthread_mutex_lock(&pool->idle_lock);
+    atomic_store(&pool->stopping, 1);
+    pthread_cond_broadcast(&pool->idle_cond);
+    pthread_mutex_unlock(&pool->idle_lock);
+    for (int i = 0; i < pool->started; i++) {
+        pthread_join(pool->threads[i], NULL);
+    }
+    for (int i = 0; i < pool->num_threads; i++) {
+        pthread_mutex_destroy(&pool->queues[i].lock);
+    }
+    pthread_mutex_destroy(&pool->idle_lock);
+    pthread_cond_destroy(&pool->idle_cond);
+    free(pool->queues);
+    free(pool->threads);
+    free(pool);
+}
+
+void work_pool_stats(const WorkPool *pool, uint64_t *executed, uint64_t *stolen) {
+    *executed = atomic_load_explicit(&pool->executed, memory_order_relaxed);
+    *stolen = atomic_load_explicit(&pool->stolen, memory_order_relaxed);
+}
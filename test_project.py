@@ -2,12 +2,16 @@ import subprocess
 import time
 import os
 import socket
+import re
+import shutil
+import tempfile
 
 # Configuration
 SERVER_BIN = os.path.join("bin", "server")
 CLIENT_BIN = os.path.join("bin", "client")
 SERVER_PORT = 8080
 LOG_FILE = "test_run.log"
+SERVER_MODES = ["epoll", "fork", "prefork", "uring", "threads"]
 
 def log(message):
     print(f"[TEST RUNNER] {message}")
@@ -26,18 +30,23 @@ def get_client_path():
         return CLIENT_BIN + ".exe"
     return None
 
-def start_server(env=None):
+def start_server(env=None, mode=None, args=None):
     server_path = get_server_path()
     if not server_path:
         log(f"Error: Server binary not found at {SERVER_BIN}")
         return None
 
-    log(f"Starting Server (Env: {env})...")
+    cmd = [server_path]
+    if mode:
+        cmd += ["-m", mode]
+    if args:
+        cmd += args
+    log(f"Starting Server (Env: {env}, Mode: {mode or 'default'}, Args: {args or []})...")
     
     server_out = open("server_output.log", "a") 
     
     server_process = subprocess.Popen(
-        [server_path],
+        cmd,
         stdout=server_out,
         stderr=subprocess.STDOUT,
         env=env
@@ -60,7 +69,8 @@ def stop_server(server_process):
             server_process.kill()
         log("Server stopped.")
 
-def run_client(num_threads, action, *args, expect_fail=False):
+# Returns the CompletedProcess (stdout is checked by some tests), or None if the client could not run
+def run_client(num_threads, action, *args, expect_fail=False, env=None):
     client_path = get_client_path()
     cmd = [client_path, str(num_threads), action] + list(args)
     
@@ -70,7 +80,8 @@ def run_client(num_threads, action, *args, expect_fail=False):
             cmd,
             capture_output=True,
             text=True,
-            timeout=15 
+            timeout=15,
+            env=dict(os.environ, **env) if env else None
         )
         duration = time.time() - start_time
         
@@ -95,16 +106,32 @@ def run_client(num_threads, action, *args, expect_fail=False):
                 log("Client finished successfully.")
             else:
                 log(f"FAILURE: Client failed with return code {result.returncode}")
+        return result
 
     except subprocess.TimeoutExpired:
         log("Client Execution Timed Out (Process killed by test runner)!")
     except Exception as e:
         log(f"Client execution error: {e}")
+    return None
+
+# The last "Remaining Tickets: N" a query/book client printed, or None
+def remaining_tickets(result):
+    if result is None:
+        return None
+    counts = re.findall(r"Remaining Tickets: (\d+)", result.stdout)
+    return int(counts[-1]) if counts else None
 
-def run_functional_tests():
-    log("=== Running Functional Tests ===")
+def expect_remaining(result, expected, what):
+    got = remaining_tickets(result)
+    if got == expected:
+        log(f"SUCCESS: {what}: {got} tickets remaining.")
+    else:
+        log(f"FAILURE: {what}: expected {expected} tickets remaining, got {got}.")
+
+def run_functional_tests(mode=None):
+    log(f"=== Running Functional Tests ({mode or 'default'} mode) ===")
     
-    server_proc = start_server()
+    server_proc = start_server(mode=mode)
     if not server_proc: return
 
     try:
@@ -123,6 +150,140 @@ def run_functional_tests():
     finally:
         stop_server(server_proc)
 
+def expect_output(result, pattern, what):
+    match = re.search(pattern, result.stdout) if result else None
+    if match:
+        log(f"SUCCESS: {what}: {match.group(0).strip()}")
+    else:
+        log(f"FAILURE: {what}: no line matching '{pattern}' in the client output.")
+    return match
+
+def run_client_action_tests():
+    log("\n=== Running Client Action Tests ===")
+    log("Objective: Exercise batch booking, protocol v1, CRC32C checksums, pool re-login and OP_STATS.")
+
+    server_proc = start_server()
+    if not server_proc: return
+    try:
+        log("Batch booking (5 one-ticket orders in one packet)...")
+        expect_output(run_client(1, "batch", "5"), r"Orders Booked: 5 of 5", "Batch booking")
+
+        log("Query with protocol v1 (CLIENT_PROTOCOL=1)...")
+        expect_output(run_client(1, "query", env={"CLIENT_PROTOCOL": "1"}),
+                      r"OpCode: 0x1001", "Protocol v1 query")
+
+        log("Book with CRC32C checksums (CLIENT_CHECKSUM=crc32c)...")
+        expect_output(run_client(1, "book", "1", env={"CLIENT_CHECKSUM": "crc32c"}),
+                      r"Status: SUCCESS", "CRC32C booking")
+
+        # The pool demo swaps the stale session into its connections before each phase:
+        # every request in the window is rejected and must be resent after one re-login
+        log("Pool with a stale session (CLIENT_SESSION=1), 64 in flight per connection...")
+        expect_output(run_client(2, "pool", "2000", "64", env={"CLIENT_SESSION": "1"}),
+                      r"\(2000 completed, 0 failed\)", "Pool re-login after Invalid Session")
+
+        log("Server stats (OP_STATS)...")
+        stats = run_client(1, "stats")
+        expect_output(stats, r"book\s+[1-9]\d*", "Stats count the bookings")
+        match = expect_output(stats, r"Invalid sessions\s+(\d+)", "Stats count the stale session")
+        if match and int(match.group(1)) == 0:
+            log("FAILURE: The stale session was never rejected.")
+    finally:
+        stop_server(server_proc)
+
+def run_admission_tests():
+    log("\n=== Running Admission Control Tests ===")
+    log("Objective: Verify a rate-limited server sheds with OP_RESPONSE_BUSY and the client pool retries.")
+
+    # 50 requests/s per session with bursts of 5: the pool outruns it and must wait out BUSY replies
+    server_proc = start_server(args=["-R", "50,5"])
+    if not server_proc: return
+    try:
+        log("Pool of 1 connection, 30 requests, 1 in flight...")
+        run_client(1, "pool", "30", "1")
+        match = expect_output(run_client(1, "stats"), r"rate limit (\d+)", "Shed by the rate limit")
+        if match and int(match.group(1)) == 0:
+            log("FAILURE: The rate limit never shed a request.")
+    finally:
+        stop_server(server_proc)
+
+def run_journal_tests():
+    log("\n=== Running Booking Journal Tests ===")
+    log("Objective: Verify a restart with -j replays the bookings, and drops a torn final record.")
+
+    workdir = tempfile.mkdtemp(prefix="ticket_journal_")
+    journal = os.path.join(workdir, "bookings.wal")
+    args = ["-j", journal, "-e", "4", "-t", "10"]
+    try:
+        server_proc = start_server(args=args)
+        if not server_proc: return
+        try:
+            log("Booking 3 tickets, a batch of 2 one-ticket orders, then 1 more...")
+            run_client(1, "book", "3")
+            expect_output(run_client(1, "batch", "2"), r"Orders Booked: 2 of 2", "Journaled batch")
+            expect_remaining(run_client(1, "book", "1"), 4, "Before restart")
+        finally:
+            stop_server(server_proc)
+
+        log("Restarting with the same journal...")
+        server_proc = start_server(args=args)
+        if not server_proc: return
+        try:
+            expect_remaining(run_client(1, "query"), 4, "Journal replay after restart")
+        finally:
+            stop_server(server_proc)
+
+        # A crash in the middle of a write leaves a partial record: the 1-ticket booking is lost
+        size = os.path.getsize(journal)
+        log(f"Truncating the journal tail ({size} -> {size - 10} bytes)...")
+        with open(journal, "r+b") as f:
+            f.truncate(size - 10)
+        server_proc = start_server(args=args)
+        if not server_proc: return
+        try:
+            expect_remaining(run_client(1, "query"), 5, "Journal replay with a torn tail")
+        finally:
+            stop_server(server_proc)
+    finally:
+        shutil.rmtree(workdir, ignore_errors=True)
+
+def run_state_file_tests():
+    log("\n=== Running State File Tests ===")
+    log("Objective: Verify tickets and sessions survive a SIGKILL and a restart with the same -s file.")
+
+    workdir = tempfile.mkdtemp(prefix="ticket_state_")
+    args = ["-s", os.path.join(workdir, "state.bin"), "-e", "4", "-t", "10"]
+    try:
+        server_proc = start_server(args=args)
+        if not server_proc: return
+        log("Booking 2 tickets...")
+        result = run_client(1, "book", "2")
+        expect_remaining(result, 8, "Before the crash")
+        sessions = re.findall(r"Session ID: (\d+)", result.stdout) if result else []
+
+        # No shutdown handler runs: only what is already in the shared mapping survives
+        log("Killing the Server (SIGKILL)...")
+        server_proc.kill()
+        server_proc.wait()
+        time.sleep(1)  # Let the helper processes follow their parent
+
+        server_proc = start_server(args=args)
+        if not server_proc: return
+        try:
+            expect_remaining(run_client(1, "query"), 8, "State file after SIGKILL")
+            if not sessions:
+                log("FAILURE: The booking client printed no session ID.")
+            else:
+                result = run_client(1, "query", env={"CLIENT_SESSION": sessions[0]})
+                if result and "OpCode: 0x1001" in result.stdout:
+                    log(f"SUCCESS: Session {sessions[0]} is still valid after the restart.")
+                else:
+                    log(f"FAILURE: Session {sessions[0]} was not accepted after the restart.")
+        finally:
+            stop_server(server_proc)
+    finally:
+        shutil.rmtree(workdir, ignore_errors=True)
+
 def run_client_timeout_test():
     log("\n=== Running Client Timeout Test (Mock Server) ===")
     log("Objective: Verify Client times out when Server is slow (7s delay).")
@@ -197,12 +358,12 @@ def run_client_timeout_test():
         log("FAILURE: Client hung indefinitely (should have timed out internally).")
 
 
-def run_server_timeout_test():
-    log("\n=== Running Server Timeout Test (Mock Client) ===")
+def run_server_timeout_test(mode=None):
+    log(f"\n=== Running Server Timeout Test (Mock Client, {mode or 'default'} mode) ===")
     log("Objective: Verify Server disconnects idle Client after 10s.")
     
     # 1. Start Real Server
-    server_proc = start_server()
+    server_proc = start_server(mode=mode)
     if not server_proc: return
 
     try:
@@ -240,6 +401,12 @@ def run_server_timeout_test():
 if __name__ == "__main__":
     if os.path.exists("server_output.log"): os.remove("server_output.log")
     
-    run_functional_tests()
+    for mode in SERVER_MODES:
+        run_functional_tests(mode)
+    run_client_action_tests()
+    run_admission_tests()
+    run_journal_tests()
+    run_state_file_tests()
     run_client_timeout_test()
-    run_server_timeout_test()
+    for mode in SERVER_MODES:
+        run_server_timeout_test(mode)
@@ -0,0 +1,183 @@
+// tools/logdecode.c
+// 把二進位 log (init_binary_log 產生的檔案) 還原成與 server.log 相同格式的文字
+//
+// 用法: logdecode [-s] [-p] <file>...
+//   -s  依時間排序 (預設依檔案中的順序，每個 process 的批次各自有序)
+//   -p  每行加上寫入的 pid
+
+#include "common.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+typedef struct {
+    uint64_t wall_ns;
+    uint32_t pid;
+    size_t seq;            // 原始順序，排序時保持穩定
+    uint16_t template_id;
+    uint8_t nargs;
+    uint32_t args[8];
+} DecodedEvent;
+
+static DecodedEvent *events = NULL;
+static size_t num_events = 0;
+static size_t cap_events = 0;
+
+static int compare_events(const void *a, const void *b) {
+    const DecodedEvent *x = a, *y = b;
+    if (x->wall_ns != y->wall_ns) return x->wall_ns < y->wall_ns ? -1 : 1;
+    return x->seq < y->seq ? -1 : (x->seq > y->seq);
+}
+
+static void print_event(const DecodedEvent *ev, int show_pid) {
+    char time_str[20];
+    char text[800];
+    time_t sec = ev->wall_ns / 1000000000UL;
+    struct tm local;
+    localtime_r(&sec, &local);
+    strftime(time_str, sizeof(time_str), "%Y-%m-%d %H:%M:%S", &local);
+
+    const char *level_str = "INFO";
+    if (ev->template_id < LT_COUNT) {
+        const LogTemplate *t = &log_templates[ev->template_id];
+        if (t->level == LOG_ERROR) level_str = "ERROR";
+        else if (t->level == LOG_DEBUG) level_str = "DEBUG";
+        format_log_template(text, sizeof(text), t->format, ev->args, ev->nargs);
+    } else {
+        int len = snprintf(text, sizeof(text), "<unknown template %u>", ev->template_id);
+        for (int i = 0; i < ev->nargs && len < (int)sizeof(text); i++) {
+            len += snprintf(text + len, sizeof(text) - len, " %u", ev->args[i]);
+        }
+    }
+
+    if (show_pid) {
+        printf("[%s] [%s] [%u] %s\n", time_str, level_str, ev->pid, text);
+    } else {
+        printf("[%s] [%s] %s\n", time_str, level_str, text);
+    }
+}
+
+static unsigned char *read_file(const char *path, size_t *size) {
+    FILE *fp = fopen(path, "rb");
+    if (!fp) {
+        perror(path);
+        return NULL;
+    }
+    fseek(fp, 0, SEEK_END);
+    long len = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+    unsigned char *data = malloc(len > 0 ? len : 1);
+    if (!data || fread(data, 1, len, fp) != (size_t)len) {
+        perror(path);
+        free(data);
+        fclose(fp);
+        return NULL;
+    }
+    fclose(fp);
+    *size = len;
+    return data;
+}
+
+// 解析一個檔案；sort_mode 時先收集，否則直接印出
+static int decode_file(const char *path, int sort_mode, int show_pid) {
+    size_t size;
+    unsigned char *data = read_file(path, &size);
+    if (!data) return -1;
+
+    if (size < 8 || memcmp(data, BINLOG_MAGIC, 8) != 0) {
+        fprintf(stderr, "%s: not a binary log file\n", path);
+        free(data);
+        return -1;
+    }
+
+    size_t pos = 8;
+    uint64_t base_mono = 0, base_real = 0;
+    uint32_t pid = 0;
+    int synced = 0;
+
+    while (pos + sizeof(BinaryLogRecord) <= size) {
+        BinaryLogRecord rec;
+        memcpy(&rec, data + pos, sizeof(rec));
+
+        if (rec.template_id == BINLOG_SYNC_ID) {
+            if (pos + sizeof(BinaryLogSync) > size) break;
+            BinaryLogSync sync;
+            memcpy(&sync, data + pos, sizeof(sync));
+            base_mono = sync.base.ts_ns;
+            base_real = sync.realtime_ns;
+            pid = sync.pid;
+            synced = 1;
+            pos += sizeof(sync);
+            continue;
+        }
+
+        size_t rec_size = sizeof(rec) + rec.nargs * sizeof(uint32_t);
+        if (pos + rec_size > size || rec.nargs > 8) break;
+
+        DecodedEvent ev;
+        ev.wall_ns = synced ? base_real + (rec.ts_ns - base_mono) : 0;
+        ev.pid = pid;
+        ev.seq = num_events;
+        ev.template_id = rec.template_id;
+        ev.nargs = rec.nargs;
+        memcpy(ev.args, data + pos + sizeof(rec), rec.nargs * sizeof(uint32_t));
+        pos += rec_size;
+
+        if (!sort_mode) {
+            print_event(&ev, show_pid);
+            num_events++;
+            continue;
+        }
+        if (num_events == cap_events) {
+            cap_events = cap_events ? cap_events * 2 : 4096;
+            events = realloc(events, cap_events * sizeof(DecodedEvent));
+            if (!events) {
+                perror("realloc");
+                exit(EXIT_FAILURE);
+            }
+        }
+        events[num_events++] = ev;
+    }
+
+    if (pos != size) {
+        fprintf(stderr, "%s: ignoring %zu trailing bytes (truncated record)\n", path, size - pos);
+    }
+    free(data);
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    int sort_mode = 0;
+    int show_pid = 0;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "sp")) != -1) {
+        switch (opt) {
+            case 's': sort_mode = 1; break;
+            case 'p': show_pid = 1; break;
+            default:
+                fprintf(stderr, "Usage: %s [-s] [-p] <file>...\n", argv[0]);
+                return EXIT_FAILURE;
+        }
+    }
+    if (optind >= argc) {
+        fprintf(stderr, "Usage: %s [-s] [-p] <file>...\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    int status = EXIT_SUCCESS;
+    for (int i = optind; i < argc; i++) {
+        if (decode_file(argv[i], sort_mode, show_pid) < 0) status = EXIT_FAILURE;
+    }
+
+    if (sort_mode) {
+        qsort(events, num_events, sizeof(DecodedEvent), compare_events);
+        for (size_t i = 0; i < num_events; i++) {
+            print_event(&events[i], show_pid);
+        }
+    }
+    free(events);
+    return status;
+}
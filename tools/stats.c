@@ -0,0 +1,121 @@
+// tools/stats.c
+// 讀取 server 的統計區塊 (shared memory，唯讀 attach)，完全不經過 request 的處理路徑
+//
+// 用法: stats                    印出啟動以來的累計值
+//       stats <秒數> [次數]       每隔 <秒數> 印一行這段期間的速率 (類似 vmstat)
+
+#include "common.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+
+static const char *opcode_names[STATS_OPCODES] = { "login", "query", "book", "batch", "other" };
+
+static int server_alive(const MetricsBlock *block) {
+    return block->server_pid > 0 && (kill(block->server_pid, 0) == 0 || errno == EPERM);
+}
+
+static void print_totals(const MetricsBlock *block) {
+    StatsResponse st;
+    metrics_fill_stats(block, &st);
+    uint64_t total = 0;
+    for (int i = 0; i < STATS_OPCODES; i++) total += st.requests[i];
+
+    printf("Server pid %d (%s), up %.1f s, %u workers\n", block->server_pid,
+           server_alive(block) ? "running" : "not running", st.uptime_ms / 1e3, st.workers);
+    printf("  requests          %lu\n", (unsigned long)total);
+    for (int i = 0; i < STATS_OPCODES; i++) {
+        printf("    %-15s %lu\n", opcode_names[i], (unsigned long)st.requests[i]);
+    }
+    printf("  successes         %lu\n", (unsigned long)st.successes);
+    printf("  failures          %lu\n", (unsigned long)st.failures);
+    printf("  checksum errors   %lu\n", (unsigned long)st.checksum_errors);
+    printf("  invalid sessions  %lu\n", (unsigned long)st.invalid_sessions);
+    printf("  shed (busy)       in-flight %lu  queue delay %lu  rate limit %lu\n",
+           (unsigned long)st.shed[BUSY_IN_FLIGHT], (unsigned long)st.shed[BUSY_QUEUE_DELAY],
+           (unsigned long)st.shed[BUSY_RATE_LIMIT]);
+    printf("  bytes in / out    %lu / %lu\n", (unsigned long)st.bytes_in, (unsigned long)st.bytes_out);
+    printf("  cas retries       inventory %lu  sessions %lu\n", (unsigned long)st.inventory_cas_retries,
+           (unsigned long)st.session_cas_retries);
+    printf("  journal wait      %.3f ms\n", st.journal_wait_ns / 1e6);
+    printf("  latency us        p50 %.1f  p99 %.1f  p99.9 %.1f  max %.1f\n",
+           st.latency_p50_ns / 1e3, st.latency_p99_ns / 1e3, st.latency_p999_ns / 1e3, st.latency_max_ns / 1e3);
+}
+
+static void print_header(void) {
+    printf("%8s", "req/s");
+    for (int i = 0; i < STATS_OPCODES; i++) printf(" %7s", opcode_names[i]);
+    printf(" %8s %7s %7s %5s %6s %9s %9s %7s %7s %8s %8s\n", "ok/s", "fail/s", "shed/s", "csum", "inval",
+           "KB/s in", "KB/s out", "p50 us", "p99 us", "p999 us", "jwait us");
+}
+
+// 兩次加總相減，印出這段期間的速率與延遲分布
+static void print_interval(const WorkerMetrics *now, const WorkerMetrics *prev, double sec) {
+    static _Atomic uint64_t latency[METRICS_LATENCY_BUCKETS];
+    uint64_t total = 0;
+    for (int i = 0; i < STATS_OPCODES; i++) total += now->requests[i] - prev->requests[i];
+    for (int i = 0; i < METRICS_LATENCY_BUCKETS; i++) latency[i] = now->latency[i] - prev->latency[i];
+    uint64_t jwaits = now->waits[METRICS_WAIT_JOURNAL] - prev->waits[METRICS_WAIT_JOURNAL];
+    uint64_t jwait_ns = now->wait_ns[METRICS_WAIT_JOURNAL] - prev->wait_ns[METRICS_WAIT_JOURNAL];
+    uint64_t shed = 0;
+    for (int i = 0; i < BUSY_REASONS; i++) shed += now->shed[i] - prev->shed[i];
+
+    printf("%8.0f", total / sec);
+    for (int i = 0; i < STATS_OPCODES; i++) printf(" %7.0f", (now->requests[i] - prev->requests[i]) / sec);
+    printf(" %8.0f %7.0f %7.0f %5lu %6lu %9.1f %9.1f %7.1f %7.1f %8.1f %8.1f\n",
+           (now->successes - prev->successes) / sec, (now->failures - prev->failures) / sec, shed / sec,
+           (unsigned long)(now->checksum_errors - prev->checksum_errors),
+           (unsigned long)(now->invalid_sessions - prev->invalid_sessions),
+           (now->bytes_in - prev->bytes_in) / sec / 1024, (now->bytes_out - prev->bytes_out) / sec / 1024,
+           metrics_latency_percentile(latency, 50) / 1e3, metrics_latency_percentile(latency, 99) / 1e3,
+           metrics_latency_percentile(latency, 99.9) / 1e3, jwaits ? jwait_ns / 1e3 / jwaits : 0.0);
+    fflush(stdout);
+}
+
+static double now_sec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char *argv[]) {
+    double interval = argc >= 2 ? atof(argv[1]) : 0;
+    long count = argc >= 3 ? atol(argv[2]) : 0;
+    if (argc > 3 || (argc >= 2 && interval <= 0) || count < 0) {
+        fprintf(stderr, "Usage: %s [interval_sec [count]]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    const MetricsBlock *block = metrics_attach();
+    if (!block) {
+        fprintf(stderr, "No server metrics found (shared memory key %d); is the server running?\n", METRICS_SHM_KEY);
+        return EXIT_FAILURE;
+    }
+    if (interval == 0) {
+        print_totals(block);
+        return 0;
+    }
+
+    static WorkerMetrics snapshots[2];
+    int cur = 0;
+    metrics_sum(block, &snapshots[cur]);
+    double last = now_sec();
+    for (long row = 0; count == 0 || row < count; row++) {
+        if (row % 20 == 0) print_header();
+        usleep((useconds_t)(interval * 1e6));
+        double t = now_sec();
+        metrics_sum(block, &snapshots[!cur]);
+        print_interval(&snapshots[!cur], &snapshots[cur], t - last);
+        cur = !cur;
+        last = t;
+        if (!server_alive(block)) {
+            printf("Server pid %d has exited\n", block->server_pid);
+            break;
+        }
+    }
+    return 0;
+}